@@ -1,9 +1,14 @@
 #include <chrono>
 
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <ctime>
+#include <vector>
 
 #include "mos6502.hpp"
+#include "arena.hpp"
+#include "batch.hpp"
 #include "models.hpp"
 
 using namespace mos6502;
@@ -21,11 +26,67 @@ void setupCPU(CPU& cpu) {
     cpu[RESET_START + 9] = 1;
     cpu[RESET_START + 10] = JMP_ABS;
     cpu[RESET_START + 11] = lowByte(RESET_START);
-    cpu[RESET_START + 12] = lowByte(RESET_START);
+    cpu[RESET_START + 12] = highByte(RESET_START);
 }
 
-int main() {
+// Many CPUs running the program in lockstep, speed is of all lanes together
+int benchBatch(u32 numLanes, bool useArena) {
+    printf("Batch: %u lanes%s\n", numLanes, useArena ? " in huge page arena" : "");
+    // Lanes on the heap or all in the arena
+    InstanceArena arena;
+    std::vector<CPU> heapLanes(useArena ? 0 : numLanes);
+    std::vector<CPU*> lanes;
+    for (u32 i = 0; i < numLanes; ++i) {
+        lanes.push_back(useArena ? arena.create() : &heapLanes[i]);
+        if (lanes.back() == nullptr) {
+            printf("Could not map an arena region\n");
+            return 1;
+        }
+    }
+    long maxCycles[] = {10, 100, 1000, 10000, 100000, 1000000, 10000000};
+
+    printf("%16s %16s %16s\n", "Cycles", "Time(s)", "Speed(Mcylces/s)");
+
+    for (long max_c : maxCycles) {
+        Batch batch;
+        for (CPU* cpu : lanes) {
+            cpu->reset();
+            setupCPU(*cpu);
+            batch.add(*cpu);
+        }
+
+        auto start = std::chrono::system_clock::now();
+        batch.execute(max_c);
+        auto end = std::chrono::system_clock::now();
+
+        std::chrono::duration<double> elapsed_seconds = end - start;
+        printf("%16ld %16f %16f\n", max_c, elapsed_seconds.count(), (max_c * numLanes / elapsed_seconds.count()) / 1000000);
+    }
+    if (useArena) {
+        printf("Arena: %u regions, %u from reserved huge pages\n", arena.num_regions(), arena.num_huge_tlb_regions());
+        for (CPU* cpu : lanes) {
+            arena.destroy(cpu);
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1 && strcmp(argv[1], "--batch") == 0) {
+        bool useArena = (argc > 3 && strcmp(argv[3], "--arena") == 0);
+        return benchBatch((argc > 2) ? (u32) atoi(argv[2]) : 256, useArena);
+    }
     CPU cpu;
+    if (argc > 1 && !engine_from_name(argv[1], cpu.engine)) {
+        printf("Unknown engine: %s\n", argv[1]);
+        return 1;
+    }
+    printf("Engine: %s\n", engine_name(cpu.engine));
+    // Executed sequences worth fusing, block engines only
+    FusionProfile profile;
+    if (argc > 2 && strcmp(argv[2], "--profile") == 0) {
+        cpu.profile = &profile;
+    }
     long maxCycles[] = {10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000, 10000000000, 100000000000};
 
     printf("%16s %16s %16s\n", "Cycles", "Time(s)", "Speed(Mcylces/s)");
@@ -41,5 +102,8 @@ int main() {
         std::chrono::duration<double> elapsed_seconds = end - start;
         printf("%16ld %16f %16f\n", max_c, elapsed_seconds.count(), (max_c / elapsed_seconds.count()) / 1000000);
     }
+    if (cpu.profile != nullptr) {
+        profile.print(stdout, 10);
+    }
     return 0;
 }
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+
+#include "types.hpp"
+#include "ring.hpp"
+#include "clocked_device.hpp"
+
+namespace mos6502 {
+    // Registers, repeated every 4 bytes of the page
+    enum AciaRegister : u8 {
+        ACIA_DATA = 0x0, ACIA_STATUS = 0x1, ACIA_COMMAND = 0x2, ACIA_CONTROL = 0x3,
+    };
+
+    // Status bits
+    constexpr u8 ACIA_RDRF = 0x08;      // Received byte in the data register
+    constexpr u8 ACIA_TDRE = 0x10;      // Room to transmit
+    constexpr u8 ACIA_IRQ  = 0x80;
+
+    /*
+     * 6551-like serial console. Bytes written to the data register go into a ring drained by a host
+     * thread, which writes whatever has gathered with one write() per batch, and bytes read come
+     * from a ring a host thread fills, so the guest never waits on a syscall. There is no baud rate:
+     * TDRE is set while the TX ring has room and RDRF while input is waiting.
+     * Command bit 0 (DTR) enables interrupts: on input unless bit 1 is set, and while TDRE is set when
+     * bits 2-3 are 01. Input and a full TX ring are polled for those interrupts every pollCycles
+     * cycles, an event that is only scheduled while one could come and the line is low. Bit 4 echoes
+     * input.
+     * Without attached files the host side is take_output() and give_input().
+     */
+    class Acia6551 : public ClockedDevice {
+     public:
+        // Raises the IRQ line of cpu as source (one bit)
+        explicit Acia6551(CPU& cpu, u32 irqSource = 1, u32 ringSize = 1 << 16);
+        ~Acia6551() override;
+
+        // Registers from page on
+        void map(u8 page);
+
+        // Host threads writing TX to outFd and reading RX from inFd (-1 for none), false if already
+        // attached or not supported. The descriptors are not closed.
+        bool attach(int inFd, int outFd);
+        // Same on files, "-" for stdin / stdout, nullptr for none, closed by detach()
+        bool open(const char* inPath, const char* outPath);
+        // Waits until every byte transmitted so far is written out
+        void flush();
+        // Stops the threads once TX is written out
+        void detach();
+        bool attached() const { return writer.joinable() || reader.joinable(); }
+
+        // Without an output attached, bytes transmitted
+        u32 take_output(u8* data, u32 max) { return tx.pop(data, max); }
+        // Without an input attached, bytes to receive, returns how many fit
+        u32 give_input(const u8* data, u32 size) { return rx.push(data, size); }
+
+        u32 pollCycles = 1000;
+        // Transmitted while the TX ring was full and nothing drained it
+        u64 dropped = 0;
+
+     protected:
+        void advance(u64 cycle) override { (void) cycle; }
+        u8 read_register(u16 addr) override;
+        void write_register(u16 addr, u8 val) override;
+        void event(u64 cycle) override;
+
+     private:
+        bool rx_ready();
+        void transmit(u8 byte);
+        void update();
+        void write_out();
+        void read_in();
+
+        u32 irqSource;
+        u8 command = 0, control = 0;
+        u8 rxData = 0;
+        bool rxFull = false;            // rxData not read yet
+        bool irq = false;
+
+        ByteRing tx, rx;
+        u64 txBytes = 0;                // Pushed to tx
+        std::atomic<u64> txWritten{0};  // Written out by the writer thread
+        std::atomic<bool> stopping{false};
+        int inFd = -1, outFd = -1;
+        bool ownsFds = false;
+        std::thread writer, reader;
+    };
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <string>
+
+#include "types.hpp"
+#include "memory.hpp"
+#include "block_cache.hpp"
+
+namespace mos6502 {
+    // Bumped whenever generated modules would no longer match this library
+    constexpr u32 AOT_VERSION = 1;
+
+    // One translated block, same boundaries as CPU::decode_block
+    struct AotBlock {
+        u16 start;
+        u16 next;
+        NativeBlock code;
+    };
+
+    // Exported by generated modules as mos6502_aot_module
+    struct AotModuleInfo {
+        u32 version;                // AOT_VERSION the module was generated for
+        u32 cpuSize;                // sizeof(CPU) the module was compiled with
+        u32 numBlocks;
+        const AotBlock* blocks;     // Sorted by start
+        const u8* image;            // 64 KiB image the blocks were translated from
+    };
+
+    /*
+     * Shared object generated by aot-6502 from a ROM image (see tools/aot.cpp), loaded with dlopen.
+     * Blocks are handed to the block cache when decoded, only if the bytes in memory still match the
+     * image. Code not found statically or modified since runs on the interpreter.
+     */
+    class AotModule {
+     public:
+        AotModule() {}
+        AotModule(const AotModule&) = delete;
+        AotModule& operator=(const AotModule&) = delete;
+        ~AotModule();
+
+        // False if the module cannot be loaded or was built for another version, see error()
+        bool load(const char* path);
+        const std::string& error() const { return err; }
+        u32 num_blocks() const { return (info != nullptr) ? info->numBlocks : 0; }
+
+        // Translation of a freshly decoded block, nullptr if none or memory differs from the image
+        NativeBlock find(const Memory& memory, const Block& block) const;
+
+     private:
+        void* handle = nullptr;
+        const AotModuleInfo* info = nullptr;
+        std::string err;
+    };
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <vector>
+
+#include "types.hpp"
+
+namespace mos6502 {
+    class CPU;
+
+    /*
+     * CPUs placed in 2 MiB regions backed by huge pages, each with its flat memory right after it in
+     * the same slot, so switching between instances touches few TLB entries.
+     * Regions are MAP_HUGETLB pages when the system has some reserved, otherwise aligned anonymous
+     * memory advised for transparent huge pages. Destroyed slots are reused before another region
+     * is mapped, so creating and destroying instances does not call malloc.
+     */
+    class InstanceArena {
+     public:
+        static constexpr u32 REGION_SIZE = 2 << 20;
+
+        InstanceArena();
+        InstanceArena(const InstanceArena&) = delete;
+        InstanceArena& operator=(const InstanceArena&) = delete;
+        // Unmaps every region, CPUs still in it must not be used anymore
+        ~InstanceArena();
+
+        // Constructed CPU with flat memory, nullptr when no region could be mapped
+        CPU* create();
+        void destroy(CPU* cpu);
+        // cpu is in one of the regions
+        bool owns(const CPU* cpu) const;
+
+        u32 num_instances() const { return numInstances; }
+        u32 num_regions() const { return (u32) regions.size(); }
+        u32 slots_per_region() const;
+        // Regions mapped from reserved huge pages, the others rely on transparent ones
+        u32 num_huge_tlb_regions() const { return numHugeTlb; }
+
+     private:
+        bool map_region();
+
+        struct FreeSlot {
+            FreeSlot* next;
+        };
+        FreeSlot* freeSlots = nullptr;
+        std::vector<void*> regions;
+        u32 numInstances = 0;
+        u32 numHugeTlb = 0;
+        bool tryHugeTlb = true;     // Cleared once MAP_HUGETLB fails, no pages are reserved then
+    };
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <vector>
+
+#include "types.hpp"
+
+namespace mos6502 {
+    class CPU;
+    class Memory;
+
+    /*
+     * Lockstep execution of many CPUs running the same program on different data.
+     * Registers are kept as structure of arrays, one lane per CPU, memory stays in each CPU.
+     * Every step runs the instruction at the lowest PC for all lanes at that PC whose code bytes
+     * match, the other lanes are masked off and catch up when the scheduler reaches their PC.
+     * Common instructions are run with loops over all lanes the compiler can vectorize (cloned for
+     * AVX-512 and AVX2, picked on the host at load time), the rest (stack, interrupts, indirect
+     * modes, decimal arithmetic) one lane at a time by the switch engine.
+     * Each CPU's cycles advance with its lane, and a lane with events due or an interrupt to take is
+     * stepped by CPU::execute(), which runs them between instructions as it does on its own.
+     */
+    class Batch {
+     public:
+        void add(CPU& cpu);
+        void clear();
+        u32 size() const { return (u32) cpus.size(); }
+
+        // Runs every CPU like CPU::execute(numCycles) with the switch engine, returns each result by lane
+        const std::vector<s32>& execute(s32 numCycles);
+
+        u64 vectorSteps = 0;    // Steps run by the lane loops
+        u64 scalarSteps = 0;    // Lane instructions run by the switch engine
+
+     private:
+        void gather(s32 numCycles);
+        void scatter();
+        // Runs the instruction at pc for the lanes in mask, false if it has no lane loop
+        bool step_vector(u16 pc, u8 opcode, u16 operand);
+        void step_scalar(u32 lane);
+        // Events due or an interrupt to take, at the lane's cycle
+        bool needs_cpu(u32 lane) const;
+        // Operand of every lane in mask into val, false for modes without a lane loop
+        bool read_operands(u8 opcode, u16 operand);
+        bool write_operands(u8 opcode, u16 operand, const u8* reg);
+
+        std::vector<CPU*> cpus;
+        std::vector<const Memory*> memory;
+        std::vector<s32> results;
+        // Registers by lane
+        std::vector<u16> PC;
+        std::vector<u8> A, X, Y, S, SR;
+        std::vector<s32> cycles;
+        std::vector<u64> end;       // CPU::cycles when the lane's budget is used up exactly
+        std::vector<u8> running;    // Cycles left and no invalid opcode
+        std::vector<u8> mask;       // 0xFF for lanes in the current step
+        std::vector<u8> val;        // Operand of the current step by lane
+    };
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <bitset>
+#include <vector>
+
+#include "types.hpp"
+
+namespace mos6502 {
+    class CPU;
+
+    // Executes one instruction with its operand already decoded
+    typedef void (*DecodedHandler)(CPU& cpu, u32 operand);
+
+    struct Block;
+
+    // Translated block (jit or aot), returns 0 when it ran, 1 when it declined and must be interpreted
+    typedef u32 (*NativeBlock)(CPU* cpu, const Block* block);
+
+    struct DecodedInstr {
+        DecodedHandler handler;
+        u32 operand;            // Bytes following the opcode (packed operands when fused)
+        u8  opcode;             // First opcode when fused
+    };
+
+    // Straight-line run of instructions ending at the first control transfer
+    struct Block {
+        u16 start;              // PC of the first instruction
+        u16 next;               // Fall-through PC, one past the last byte
+        u32 cycles;             // Summed base cycles of all instructions
+        u1  valid;              // Cleared when the code is written to
+        std::vector<DecodedInstr> instrs;   // Empty when the first opcode is invalid
+        std::vector<DecodedInstr> fused;    // instrs with common sequences fused, run when the whole block fits
+        u32 hits;               // Times executed while not translated
+        u8  idleChecks;         // Runs left to prove it an idle loop, 0 if it can not be one
+        NativeBlock native;         // Translated code (jit or aot), nullptr if none
+        NativeBlock nativeBounded;  // Translated code stopping when the cycle budget runs out
+    };
+
+    /*
+     * Decoded blocks keyed by PC (direct mapped, a new block evicts the one in its slot).
+     * Bytes covered by cached blocks are tracked so writes to them invalidate the blocks, which are
+     * found through the slots listed for the written page.
+     */
+    class BlockCache {
+     public:
+        static constexpr u32 NUM_SLOTS = 1024;
+        static constexpr u32 MAX_INSTRS = 32;  // Per block
+        static constexpr u8 IDLE_CHECKS = 4;   // Runs of a possible idle loop compared before giving up
+
+        BlockCache() { clear(); }
+        // Decoded code belongs to the memory it came from, copies start empty
+        BlockCache(const BlockCache&) : BlockCache() {}
+        BlockCache& operator=(const BlockCache&) { clear(); return *this; }
+
+        inline Block* lookup(u16 pc) {
+            if (slots.empty()) { return nullptr; }
+            Block& block = slots[pc % NUM_SLOTS];
+            return (block.valid && block.start == pc) ? &block : nullptr;
+        }
+
+        // Empty block for pc, fill then commit()
+        Block& insert(u16 pc);
+        void commit(Block& block);
+
+        // Address is part of a cached block
+        inline u1 is_code(u16 addr) {
+            return pageBlocks[addr >> 8] != 0 && ((codeBytes[addr >> 3] >> (addr & 0x07)) & 0x01);
+        }
+        // Drop every block containing addr
+        void invalidate(u16 addr);
+        // Drop every block touching one of pages, their storage stays valid for a block being run
+        void invalidate_pages(const std::bitset<256>& pages);
+        // Drop every block, the storage stays allocated
+        void clear();
+
+        const u16* page_blocks() const { return pageBlocks; }
+
+     private:
+        void evict(Block& block);
+        void unlist(u8 page, u16 slot);
+
+        std::vector<Block> slots;       // Allocated on first insert
+        u16 pageBlocks[256];            // Valid blocks touching each page
+        std::vector<u16> pageSlots[256];    // Their slots
+        std::vector<u8> codeBytes;      // Bitmap of bytes covered by blocks (may have stale bits)
+    };
+}
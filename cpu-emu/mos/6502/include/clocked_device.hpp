@@ -0,0 +1,56 @@
+#pragma once
+
+#include "types.hpp"
+#include "memory.hpp"
+#include "mos6502.hpp"
+
+namespace mos6502 {
+    /*
+     * Peripheral brought up to date lazily instead of ticking every cycle: the state is advanced to
+     * the CPU's cycle only when the CPU reads or writes one of its pages, when its own event fires or
+     * when the host calls sync(). Between those it costs nothing, however many devices are mapped.
+     * Derived devices implement advance() from the cycle their state is at to a later one (in closed
+     * form, not cycle by cycle), the registers, and event() for what happens at the cycle they asked
+     * for with schedule(), timer underflows for instance.
+     * The device times itself with the CPU it was made for and stays with it: copies of that CPU
+     * (fork(), snapshot()) get neither its events nor its IRQ line, so running one never advances the
+     * device. A reset or restore of the CPU restarts its clock from there and drops the event.
+     */
+    class ClockedDevice : public Device {
+     public:
+        explicit ClockedDevice(CPU& cpu);
+        ~ClockedDevice() override;
+
+        // Register access from the page table, syncs first
+        u8 read(u16 addr) final;
+        void write(u16 addr, u8 val) final;
+
+        // State up to the CPU's current cycle
+        void sync() { catch_up(cpu.now()); }
+        // Cycle the state is at
+        u64 synced() const { return syncedCycle; }
+
+     protected:
+        // State from synced() to cycle, which is later
+        virtual void advance(u64 cycle) = 0;
+        virtual u8 read_register(u16 addr) = 0;
+        virtual void write_register(u16 addr, u8 val) = 0;
+        // At the cycle given to schedule(), the state is synced to it
+        virtual void event(u64 cycle) { (void) cycle; }
+
+        // event() at cycle, replaces the one scheduled before. Scheduled from a register access, the
+        // running engine stops at cycle instead of running on to the end of its slice
+        void schedule(u64 cycle);
+        void cancel();
+        bool scheduled() const { return eventId != 0 && clears == cpu.events.clears(); }
+
+        CPU& cpu;
+
+     private:
+        void catch_up(u64 cycle);
+
+        u64 syncedCycle;
+        u32 eventId = 0;    // 0 without event
+        u32 clears;         // Of cpu.events when eventId was taken
+    };
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdio>
+#include <unordered_map>
+#include <vector>
+
+#include "types.hpp"
+#include "block_cache.hpp"
+
+namespace mos6502 {
+    // Instruction sequence run by one fused handler
+    struct Fusion {
+        static constexpr u32 MAX_LENGTH = 3;
+
+        u8 length;
+        u8 opcodes[MAX_LENGTH];
+        DecodedHandler handler;
+    };
+
+    // Longest fusion matching the start of instrs (count available), nullptr if none
+    const Fusion* find_fusion(const DecodedInstr* instrs, u32 count);
+    // Operands of a fused sequence packed for its handler
+    u32 pack_operands(const DecodedInstr* instrs, u32 length);
+
+    /*
+     * N-gram profile of executed instructions (pairs and triples inside blocks), the sequences
+     * worth fusing for a workload. Recorded by the block engines while CPU::profile is set.
+     */
+    class FusionProfile {
+     public:
+        struct Entry {
+            u8 length;
+            u8 opcodes[Fusion::MAX_LENGTH];
+            u64 count;
+            bool fused;     // Already has a fused handler
+        };
+
+        void record(const Block& block);
+        void clear() { counts.clear(); }
+        // Most executed sequences first
+        std::vector<Entry> top(u32 limit) const;
+        void print(FILE* out, u32 limit) const;
+
+     private:
+        // Key is length << 24 | opcodes, first opcode in the highest byte
+        std::unordered_map<u32, u64> counts;
+    };
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "types.hpp"
+#include "block_cache.hpp"
+
+namespace mos6502 {
+    class CPU;
+
+    /*
+     * Dynamic binary translator of basic blocks to x86-64.
+     * A, X, Y and the cycle counter live in host registers for the whole block, flags stay in the
+     * lazy flag sources. Instructions without a native translation call their compile-time handler,
+     * as do accesses to pages not mapped to the CPU's own RAM.
+     * Code is appended to one executable buffer per CPU, the buffer is only recycled as a whole.
+     * The buffer is mapped RWX: blocks are compiled one at a time between runs of blocks already
+     * in it, and flipping the mapping between RW and RX for each one would cost two mprotect calls
+     * per compiled block. It only ever holds code the translator emitted.
+     */
+    class Jit {
+     public:
+        static constexpr u32 BUFFER_SIZE = 1 << 20;
+        static constexpr u32 MAX_BLOCK_CODE = 16 * 1024;   // Upper bound of one translated block
+
+        Jit() {}
+        // Translated code belongs to the CPU it was made for, copies start empty
+        Jit(const Jit&) : Jit() {}
+        Jit& operator=(const Jit&) { reset(); return *this; }
+        ~Jit();
+
+        // Translate block, false if the host is not supported or the buffer is unusable.
+        // Bounded code checks the cycle budget before every instruction like the interpreter.
+        bool compile(CPU& cpu, Block& block, bool bounded = false);
+        // Not enough room for another block, blocks must be dropped then reset()
+        bool full() const { return used + MAX_BLOCK_CODE > BUFFER_SIZE; }
+        void reset() { used = 0; }
+
+     private:
+        class Translator;
+
+        static void code_written(CPU* cpu, u32 addr);
+
+        u8* buffer = nullptr;
+        u32 used = 0;
+        bool unusable = false;
+    };
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <string>
+
+#include "types.hpp"
+
+namespace mos6502 {
+    class CPU;
+
+    enum ImageFormat {
+        IMAGE_AUTO,     // From the extension: .hex / .ihex Intel HEX, .prg PRG, anything else raw
+        IMAGE_RAW,      // Bytes as they are, at ImageLoader::address
+        IMAGE_PRG,      // Two byte little-endian load address, then the bytes (also ld65 with a LOADADDR segment)
+        IMAGE_HEX,      // Intel HEX, data records up to 0xFFFF, start address records give the entry
+    };
+
+    /*
+     * Loads program images into the memory of a CPU and points its reset vector and PC at the entry.
+     * Malformed images leave memory as it was.
+     * Raw ROM images are mapped read-only page by page straight from the file (mmap), so loading one
+     * costs the same whatever its size and the pages are shared with every copy of the CPU. Everything
+     * else is copied to RAM with Memory::load. ld65 output is raw (give the address of the linker
+     * config) or PRG when the config starts with a LOADADDR segment.
+     * The entry is the reset vector of the image when it covers it, else the HEX start address or the
+     * first address loaded, written to the vector (dropped if that page is ROM).
+     */
+    class ImageLoader {
+     public:
+        ImageFormat format = IMAGE_AUTO;
+        s32 address = -1;   // Raw images: load address, -1 places them so they end at 0xFFFF
+        bool rom = false;   // Raw images: map read-only, the address must be a page boundary
+
+        // False if the file cannot be read, is malformed or does not fit, see error()
+        bool load(CPU& cpu, const char* path);
+        const std::string& error() const { return err; }
+
+        // Of the last image loaded
+        u16 start() const { return first; }     // Lowest address loaded
+        u32 size() const { return numBytes; }   // Bytes from start() to the last address loaded
+        u16 entry() const { return entryPC; }
+        bool mapped() const { return wasMapped; }
+
+     private:
+        bool load_raw(CPU& cpu, const char* path);
+        bool load_prg(CPU& cpu, const char* path);
+        bool load_hex(CPU& cpu, const char* path);
+        bool fail(const char* path, const char* what);
+
+        std::string err;
+        u16 first = 0;
+        u32 numBytes = 0;
+        u16 entryPC = 0;
+        bool wasMapped = false;
+        s32 startRecord = -1;   // Entry given by a HEX start address record
+        bool hasVector = false; // Image wrote both bytes of the reset vector
+    };
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <vector>
+
+#include "types.hpp"
+#include "memory.hpp"
+
+namespace mos6502 {
+    /*
+     * Bank switching: a backing store larger than the address space, whose banks are shown in windows
+     * of the page table. Selecting a bank points the window's pages at it with Memory::remap(), so a
+     * switch costs one table entry per page and never copies, and only code decoded from the window
+     * is dropped.
+     * Writable windows map their bank as RAM, read-only ones as ROM whose writes come to write(), so
+     * mappers decoding writes to ROM (most cartridges) derive from this and override it. By default
+     * a write to offset i of the register page selects bank val for window i.
+     * A mapper remaps the memory it was made for only. Copies of that memory (fork(), snapshot()) keep
+     * the banks shown when they were made, writable windows as pages of their own, copy-on-write.
+     */
+    class Mapper : public Device {
+     public:
+        // numBanks banks of bankSize bytes, a multiple of PAGE_SIZE, zeroed
+        Mapper(Memory& memory, u32 bankSize, u32 numBanks, bool writable);
+
+        // Window of one bank from page on, showing bank, returns its index
+        u32 add_window(u8 page, u32 bank = 0);
+        // Registers selecting the banks of the windows, mapped as device page
+        void map_registers(u8 page);
+        // Shows bank in window, banks past the last wrap around
+        void select(u32 window, u32 bank);
+        u32 selected(u32 window) const { return windows[window].bank; }
+
+        u8* bank(u32 index) { return store.data() + (index % numBanks) * bankSize; }
+        u32 num_banks() const { return numBanks; }
+        u32 bank_size() const { return bankSize; }
+
+        // Registers read back the selected banks, read-only windows never call this
+        u8 read(u16 addr) override;
+        void write(u16 addr, u8 val) override;
+
+     protected:
+        Memory& memory;
+
+     private:
+        struct Window {
+            u8 page;
+            u32 bank;
+        };
+
+        std::vector<u8> store;
+        u32 bankSize;
+        u32 numBanks;
+        bool writable;
+        std::vector<Window> windows;
+        s32 registerPage = -1;      // -1 without register page
+    };
+}
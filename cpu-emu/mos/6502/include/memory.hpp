@@ -0,0 +1,198 @@
+#pragma once
+
+#include <bitset>
+#include <memory>
+#include <vector>
+
+#include "types.hpp"
+
+// Memory accesses are inlined even into the engines' huge dispatch functions, where the compiler gives up
+#if defined(__has_attribute)
+#if __has_attribute(always_inline)
+#define MEMORY_INLINE inline __attribute__((always_inline))
+#endif
+#endif
+#ifndef MEMORY_INLINE
+#define MEMORY_INLINE inline
+#endif
+// Plain RAM is laid out as the straight path
+#if defined(__GNUC__)
+#define PLAIN_RAM(x) __builtin_expect((x), 1)
+#else
+#define PLAIN_RAM(x) (x)
+#endif
+
+namespace mos6502 {
+    constexpr u32 PAGE_SIZE = 0x100;    // Bytes per page, addresses with the same high byte
+    constexpr u32 NUM_PAGES = 0x100;
+
+    // Read-only image shared by every Memory it is mapped in, kept alive by them
+    typedef std::shared_ptr<const std::vector<u8>> RomImage;
+    // Image of size bytes of data, padded with 0xFF to whole pages
+    RomImage make_rom(const u8* data, u32 size);
+
+    // Storage of the pages a Memory maps as its own RAM, picked at construction
+    enum MemoryBackend {
+        MEMORY_FLAT,    // 64 KiB allocated up front, accesses skip the page table while nothing is mapped
+        MEMORY_SPARSE,  // Pages allocated on their first write, untouched ones read a shared zero page
+    };
+
+    // Pages of a sparse memory, handed out in order and all freed at once
+    class PageArena {
+     public:
+        u8* alloc();
+        // Every page is free again, the chunks are kept for the next ones
+        void clear() { used = 0; }
+        bool owns(const u8* p) const;
+
+     private:
+        static constexpr u32 CHUNK_PAGES = 16;
+        std::vector<std::unique_ptr<u8[]>> chunks;
+        u32 used = 0;
+    };
+
+    // Memory mapped device, gets every access to the pages it is mapped to
+    class Device {
+     public:
+        virtual ~Device() {}
+        virtual u8 read(u16 addr) = 0;
+        virtual void write(u16 addr, u8 val) = 0;
+    };
+
+    /*
+     * Address space of a CPU as a page table, one entry per 256 byte page.
+     * A page is host memory, read / write or read-only, or a device. Accesses to host memory are
+     * one indexed load through the entry, only device pages call out. Every page starts as RAM in
+     * ram, private memory allocated with this object, and as long as none is mapped elsewhere
+     * accesses skip the table and index ram directly.
+     * Only the table lives in the object, so CPUs embedding it stay small, and ROM images and
+     * devices are shared by every address space they are mapped in.
+     * freeze() turns the pages of ram into read-only pages shared with every copy made afterwards,
+     * the first write to one of them copies it back to ram. Writes take the out of line path then.
+     * Pages written or mapped are marked dirty, so clear_ram() and restore() only redo those as long
+     * as the memory still derives from the state they go back to.
+     * Sparse memory has no ram: its pages start shared with a zero page and the first write to one
+     * takes a page from its arena, so instances cost only the pages they write.
+     */
+    class Memory {
+     public:
+        u8* ram;    // Private host memory of pages mapped as RAM by default, MEM_MAX bytes, replaced by freeze()
+                    // nullptr for sparse memory
+
+        explicit Memory(MemoryBackend backend = MEMORY_FLAT);
+        // Flat memory in storage, MEM_MAX bytes not owned, zeroed
+        explicit Memory(u8* storage);
+        // Copies the other's ram only where it is mapped, ROM, devices and shared pages are shared.
+        // Writable pages from remap() are copied too, as shared pages of this one.
+        Memory(const Memory& other);
+        Memory& operator=(const Memory& other);
+        ~Memory();
+
+        MEMORY_INLINE u8 read(u16 addr) const {
+            const u8* flat = flatRam;
+            if (PLAIN_RAM(flat != nullptr)) {
+                return flat[addr];
+            }
+            const u8* page = readPages[addr >> 8];
+            if (page != nullptr) {
+                return page[addr & 0xFF];
+            }
+            return read_device(addr);
+        }
+        // Writes to read-only pages are dropped, true if the write went to a device that remapped pages
+        MEMORY_INLINE bool write(u16 addr, u8 val) {
+            u8* flat = flatRam;
+            if (PLAIN_RAM(flat != nullptr)) {
+                flat[addr] = val;
+                dirtyPages[addr >> 8] = 1;
+                return false;
+            }
+            u8* page = writePages[addr >> 8];
+            if (page != nullptr) {
+                page[addr & 0xFF] = val;
+                dirtyPages[addr >> 8] = 1;
+                return false;
+            }
+            return write_slow(addr, val);
+        }
+
+        // Host copy of size bytes to addr on, same as writing them one by one, stops at the end of memory
+        void load(u16 addr, const u8* data, u32 size);
+
+        // Map numPages pages from page on, host memory holds numPages * PAGE_SIZE bytes and is not owned
+        void map_ram(u8 page, u32 numPages, u8* host);
+        void map_rom(u8 page, u32 numPages, const u8* host);
+        // Whole image from page on, the image stays alive as long as this maps it
+        void map_rom(u8 page, const RomImage& image);
+        // Read-only until the first write to a page, which copies it to own memory
+        void map_shared(u8 page, u32 numPages, const u8* host);
+        // Host memory mapped with the calls above stays alive as long as this or a copy of it
+        void keep_alive(const std::shared_ptr<const void>& host);
+        void map_device(u8 page, u32 numPages, Device* device);
+        // Pages read from read and write to write, or to device where write is nullptr, all host memory not owned.
+        // Decoded code is only dropped for these pages unless one was RAM or the first device is mapped.
+        // Unlike map_ram(), copies of this memory do not share write, they get its pages as they are.
+        void remap(u8 page, u32 numPages, const u8* read, u8* write, Device* device);
+        // Back to RAM in ram, zeroed
+        void unmap(u8 page, u32 numPages);
+        // Zero the pages mapped to their own part of ram or shared
+        void clear_ram();
+        // Share the pages mapped to ram copy-on-write, the old ram stays alive as long as a page maps it
+        void freeze();
+        // Map of frozen memory, pages mapped to ram become the frozen pages
+        void restore(const Memory& frozen);
+
+        // Host memory of a page, nullptr for device pages
+        const u8* page_memory(u8 page) const { return readPages[page]; }
+        bool is_device(u8 page) const { return readPages[page] == nullptr; }
+        bool is_rom(u8 page) const { return readPages[page] != nullptr && writePages[page] == nullptr && !sharedPages[page]; }
+        // Page is frozen memory, copied to ram by the first write
+        bool is_shared(u8 page) const { return sharedPages[page]; }
+        // Page is writable and backed by its own part of ram
+        bool is_ram(u8 page) const { return ram != nullptr && writePages[page] == ram + page * PAGE_SIZE; }
+        bool has_devices() const { return numDevicePages != 0; }
+        MemoryBackend backend() const { return (ram != nullptr) ? MEMORY_FLAT : MEMORY_SPARSE; }
+        // Non-zero for pages written or mapped since the last clear_ram(), freeze() or restore()
+        const u8* dirty_pages() const { return dirtyPages; }
+        // Pages clear_ram(), or restore(*frozen), would rewrite: the dirty ones, all when it starts over
+        std::bitset<NUM_PAGES> pages_to_redo(const Memory* frozen = nullptr) const;
+        // Changes whenever a page is mapped, decoded code must be dropped then
+        u32 generation() const { return mapGeneration; }
+        // Changes whenever remap() leaves the generation, code decoded from the remapped pages must be dropped then
+        u32 remap_count() const { return numRemaps; }
+        // Pages remapped since the last call
+        std::bitset<NUM_PAGES> take_remapped_pages();
+
+     private:
+        u8* flatRam = nullptr;                  // ram while no page is mapped elsewhere, one load on the fast path
+        bool ownsRam = true;
+
+        // Out of line so the engines only inline the host memory path
+        u8 read_device(u16 addr) const;
+        // Device, read-only or shared page
+        bool write_slow(u16 addr, u8 val);
+        void init_pages();
+        // Storage for a page of own memory, in ram or taken from the arena
+        u8* own_page(u8 page);
+        bool is_own(const u8* p) const;
+        u8* unshare(u8 page);
+        void share_zero(u8 page);
+        void set_page(u8 page, const u8* read, u8* write, Device* device);
+        void copy_map(const Memory& other);
+
+        const u8* readPages[NUM_PAGES] = {};    // nullptr for device pages
+        u8* writePages[NUM_PAGES] = {};         // nullptr for read-only and device pages
+        Device* devices[NUM_PAGES] = {};
+        u32 numDevicePages = 0;
+        u32 numMappedPages = NUM_PAGES;         // Pages not mapped to their own part of ram
+        u8 dirtyPages[NUM_PAGES] = {};
+        u64 baseline = 0;                       // State the clean pages are in, 0 unknown
+        u32 mapGeneration = 0;
+        u32 numRemaps = 0;
+        std::bitset<NUM_PAGES> sharedPages;
+        std::bitset<NUM_PAGES> remappedPages;
+        std::bitset<NUM_PAGES> bankPages;       // Writable pages from remap()
+        std::vector<std::shared_ptr<const void>> keepAlive; // ROM images and frozen ram mapped at some time
+        std::shared_ptr<PageArena> arena;       // Own pages of sparse memory, allocated on the first one
+    };
+}
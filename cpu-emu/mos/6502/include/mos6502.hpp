@@ -1,31 +1,18 @@
 #pragma once
 
-#include <cstdint>
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <utility>
 
 #include "models.hpp"
-
-// typedefs
-typedef bool            u1;
-typedef std::uint8_t    u8;
-typedef std::uint16_t   u16;
-typedef std::uint32_t   u32;
-
-typedef std::int8_t     s8;
-typedef std::int32_t    s32;
-
-// Bytes to Wyde
-inline u16 B2W(u8 low, u8 high) { return (high << 8) + low; }
-
-inline u8 lowByte(u16 x)  { return x & 0x000F; }
-inline u8 highByte(u16 x) { return x >> 8; }
-inline u1 signBit(u8 x)   { return x >> 7; }
-inline u1 lowBit(u8 x)    { return x & 0x01;}
-// Binary number (in 4-bit packed BCD) to decimal value
-// Note invalid BCD numbers are undocumented and undefined behavior
-inline u8 bin_2_dec(u8 x) { return (((x & 0xF0) >> 4) * 10) + (x & 0x0F); }
-inline u8 dec_2_bin(u8 x) { return ((x / 10) << 4) | (x % 10); }
-
-inline u1 onDifferentPages(u16 x, u16 y) { return highByte(x) != highByte(y); }
+#include "types.hpp"
+#include "memory.hpp"
+#include "block_cache.hpp"
+#include "jit.hpp"
+#include "aot.hpp"
+#include "fusion.hpp"
+#include "scheduler.hpp"
 
 namespace mos6502 {
     // Constants
@@ -67,10 +54,264 @@ namespace mos6502 {
         NUL = 13,   // placeholder for lookup table no instruction
     };
 
+    // Execution engines, selected per CPU with CPU::engine
+    enum Engine {
+        ENGINE_SWITCH   = 0,    // Reference interpreter, decode and switch on every instruction
+        ENGINE_THREADED = 1,    // Direct-threaded (computed goto) dispatch, one handler per opcode
+        ENGINE_TABLE    = 2,    // Call through the compile-time generated HANDLERS table
+        ENGINE_BLOCKS   = 3,    // Execute pre-decoded basic blocks from the block cache
+        ENGINE_JIT      = 4,    // Blocks engine, hot blocks translated to host code (x86-64 only)
+        ENGINE_AOT      = 5,    // Blocks engine running code translated ahead of time (CPU::aot)
+        NUM_ENGINES,
+    };
+
+    // Engine by name ("switch", "threaded", ...), false if no engine has that name
+    bool engine_from_name(const char* name, Engine& engine);
+    const char* engine_name(Engine engine);
+
+    enum Instructions : u8 {
+        LDA_IMM = 0xA9, LDA_ZPG = 0xA5, LDA_ZPX = 0xB5, LDA_ABS = 0xAD, LDA_ABX = 0xBD, LDA_ABY = 0xB9, LDA_IDX = 0xA1, LDA_IDY = 0xB1,
+        LDX_IMM = 0xA2, LDX_ZPG = 0xA6, LDX_ZPY = 0xB6, LDX_ABS = 0xAE, LDX_ABY = 0xBE,
+        LDY_IMM = 0xA0, LDY_ZPG = 0xA4, LDY_ZPX = 0xB4, LDY_ABS = 0xAC, LDY_ABX = 0xBC,
+        STA_ZPG = 0x85, STA_ZPX = 0x95, STA_ABS = 0x8D, STA_ABX = 0x9D, STA_ABY = 0x99, STA_IDX = 0x81, STA_IDY = 0x91,
+        STX_ZPG = 0x86, STX_ZPY = 0x96, STX_ABS = 0x8E,
+        STY_ZPG = 0x84, STY_ZPX = 0x94, STY_ABS = 0x8C,
+        TAX_IMP = 0xAA, TAY_IMP = 0xA8, TSX_IMP = 0xBA, TXA_IMP = 0x8A, TXS_IMP = 0x9A, TYA_IMP = 0x98,
+        CLC_IMP = 0x18, CLD_IMP = 0xD8, CLI_IMP = 0x58, CLV_IMP = 0xB8,
+        SEC_IMP = 0x38, SED_IMP = 0xF8, SEI_IMP = 0x78,
+        INC_ZPG = 0xE6, INC_ZPX = 0xF6, INC_ABS = 0xEE, INC_ABX = 0xFE, INX_IMP = 0xE8, INY_IMP = 0xC8,
+        DEC_ZPG = 0xC6, DEC_ZPX = 0xD6, DEC_ABS = 0xCE, DEC_ABX = 0xDE, DEX_IMP = 0xCA, DEY_IMP = 0x88,
+        AND_IMM = 0x29, AND_ZPG = 0x25, AND_ZPX = 0x35, AND_ABS = 0x2D, AND_ABX = 0x3D, AND_ABY = 0x39, AND_IDX = 0x21, AND_IDY = 0x31,
+        EOR_IMM = 0x49, EOR_ZPG = 0x45, EOR_ZPX = 0x55, EOR_ABS = 0x4D, EOR_ABX = 0x5D, EOR_ABY = 0x59, EOR_IDX = 0x41, EOR_IDY = 0x51,
+        ORA_IMM = 0x09, ORA_ZPG = 0x05, ORA_ZPX = 0x15, ORA_ABS = 0x0D, ORA_ABX = 0x1D, ORA_ABY = 0x19, ORA_IDX = 0x01, ORA_IDY = 0x11,
+        ASL_ACC = 0x0A, ASL_ZPG = 0x06, ASL_ZPX = 0x16, ASL_ABS = 0x0E, ASL_ABX = 0x1E,
+        LSR_ACC = 0x4A, LSR_ZPG = 0x46, LSR_ZPX = 0x56, LSR_ABS = 0x4E, LSR_ABX = 0x5E,
+        ROL_ACC = 0x2A, ROL_ZPG = 0x26, ROL_ZPX = 0x36, ROL_ABS = 0x2E, ROL_ABX = 0x3E,
+        ROR_ACC = 0x6A, ROR_ZPG = 0x66, ROR_ZPX = 0x76, ROR_ABS = 0x6E, ROR_ABX = 0x7E,
+        ADC_IMM = 0x69, ADC_ZPG = 0x65, ADC_ZPX = 0x75, ADC_ABS = 0x6D, ADC_ABX = 0x7D, ADC_ABY = 0x79, ADC_IDX = 0x61, ADC_IDY = 0x71,
+        SBC_IMM = 0xE9, SBC_ZPG = 0xE5, SBC_ZPX = 0xF5, SBC_ABS = 0xED, SBC_ABX = 0xFD, SBC_ABY = 0xF9, SBC_IDX = 0xE1, SBC_IDY = 0xF1,
+        BIT_ZPG = 0x24, BIT_ABS = 0x2C,
+        CMP_IMM = 0xC9, CMP_ZPG = 0xC5, CMP_ZPX = 0xD5, CMP_ABS = 0xCD, CMP_ABX = 0xDD, CMP_ABY = 0xD9, CMP_IDX = 0xC1, CMP_IDY = 0xD1,
+        CPX_IMM = 0xE0, CPX_ZPG = 0xE4, CPX_ABS = 0xEC,
+        CPY_IMM = 0xC0, CPY_ZPG = 0xC4, CPY_ABS = 0xCC,
+        PHA_IMP = 0x48, PHP_IMP = 0x08,
+        PLA_IMP = 0x68, PLP_IMP = 0x28,
+        BCC_REL = 0x90, BCS_REL = 0xB0, BEQ_REL = 0xF0, BMI_REL = 0x30, BNE_REL = 0xD0, BPL_REL = 0x10, BVC_REL = 0x50, BVS_REL = 0x70,
+        JMP_ABS = 0x4C, JMP_IND = 0x6C,
+        JSR_ABS = 0x20, RTS_IMP = 0x60,
+        BRK_IMP = 0x00, RTI_IMP = 0x40,
+        NOP_IMP = 0xEA,
+        INVALID_INSTRUCTION = 0xFF,
+    };
+
+    constexpr AddrMode INSTR_GET_ADDR_MODE [256] = {
+    // -0                                       -8
+        IMP, IDX, NUL, NUL, NUL, ZPG, ZPG, NUL, IMP, IMM, ACC, NUL, NUL, ABS, ABS, NUL,     // 0-
+        REL, IDY, NUL, NUL, NUL, ZPX, ZPX, NUL, IMP, ABY, NUL, NUL, NUL, ABX, ABX, NUL,     // 1-
+        ABS, IDX, NUL, NUL, ZPG, ZPG, ZPG, NUL, IMP, IMM, ACC, NUL, ABS, ABS, ABS, NUL,     // 2-
+        REL, IDY, NUL, NUL, NUL, ZPX, ZPX, NUL, IMP, ABY, NUL, NUL, NUL, ABX, ABX, NUL,     // 3-
+        IMP, IDX, NUL, NUL, NUL, ZPG, ZPG, NUL, IMP, IMM, ACC, NUL, ABS, ABS, ABS, NUL,     // 4-
+        REL, IDY, NUL, NUL, NUL, ZPX, ZPX, NUL, IMP, ABY, NUL, NUL, NUL, ABX, ABX, NUL,     // 5-
+        IMP, IDX, NUL, NUL, NUL, ZPG, ZPG, NUL, IMP, IMM, ACC, NUL, IND, ABS, ABS, NUL,     // 6-
+        REL, IDY, NUL, NUL, NUL, ZPX, ZPX, NUL, IMP, ABY, NUL, NUL, NUL, ABX, ABX, NUL,     // 7-
+        NUL, IDX, NUL, NUL, ZPG, ZPG, ZPG, NUL, IMP, NUL, IMP, NUL, ABS, ABS, ABS, NUL,     // 8-
+        REL, IDY, NUL, NUL, ZPX, ZPX, ZPY, NUL, IMP, ABY, IMP, NUL, NUL, ABX, NUL, NUL,     // 9-
+        IMM, IDX, IMM, NUL, ZPG, ZPG, ZPG, NUL, IMP, IMM, IMP, NUL, ABS, ABS, ABS, NUL,     // A-
+        REL, IDY, NUL, NUL, ZPX, ZPX, ZPY, NUL, IMP, ABY, IMP, NUL, ABX, ABX, ABY, NUL,     // B-
+        IMM, IDX, NUL, NUL, ZPG, ZPG, ZPG, NUL, IMP, IMM, IMP, NUL, ABS, ABS, ABS, NUL,     // C-
+        REL, IDY, NUL, NUL, NUL, ZPX, ZPX, NUL, IMP, ABY, NUL, NUL, NUL, ABX, ABX, NUL,     // D-
+        IMM, IDX, NUL, NUL, ZPG, ZPG, ZPG, NUL, IMP, IMM, IMP, NUL, ABS, ABS, ABS, NUL,     // E-
+        REL, IDY, NUL, NUL, NUL, ZPX, ZPX, NUL, IMP, ABY, NUL, NUL, NUL, ABX, ABX, NUL,     // F-
+    };
+
+    // Base number of cycles used per instruction, actual may be more on certain circumstances
+    constexpr u8 NUM_CYCLES_BASE [256] = {
+    // -0                      -8
+        7, 6, 0, 0, 0, 3, 5, 0, 3, 2, 2, 0, 0, 4, 6, 0,     // 0-
+        2, 5, 0, 0, 0, 4, 6, 0, 2, 4, 0, 0, 0, 4, 7, 0,     // 1-
+        6, 6, 0, 0, 3, 3, 5, 0, 4, 2, 2, 0, 4, 4, 6, 0,     // 2-
+        2, 5, 0, 0, 0, 4, 6, 0, 2, 4, 0, 0, 0, 4, 7, 0,     // 3-
+        6, 6, 0, 0, 0, 3, 5, 0, 3, 2, 2, 0, 3, 4, 6, 0,     // 4-
+        2, 5, 0, 0, 0, 4, 6, 0, 2, 4, 0, 0, 0, 4, 7, 0,     // 5-
+        6, 6, 0, 0, 0, 3, 5, 0, 4, 2, 2, 0, 5, 4, 6, 0,     // 6-
+        2, 5, 0, 0, 0, 4, 6, 0, 2, 4, 0, 0, 0, 4, 7, 0,     // 7-
+        0, 6, 0, 0, 3, 3, 3, 0, 2, 0, 2, 0, 4, 4, 4, 0,     // 8-
+        2, 6, 0, 0, 4, 4, 4, 0, 2, 5, 2, 0, 0, 5, 0, 0,     // 9-
+        2, 6, 2, 0, 3, 3, 3, 0, 2, 2, 2, 0, 4, 4, 4, 0,     // A-
+        2, 5, 0, 0, 4, 4, 4, 0, 2, 4, 2, 0, 4, 4, 4, 0,     // B-
+        2, 6, 0, 0, 3, 3, 5, 0, 2, 2, 2, 0, 4, 4, 6, 0,     // C-
+        2, 5, 0, 0, 0, 4, 6, 0, 2, 4, 0, 0, 0, 4, 7, 0,     // D-
+        2, 6, 0, 0, 3, 3, 5, 0, 2, 2, 2, 0, 4, 4, 6, 0,     // E-
+        2, 5, 0, 0, 0, 4, 6, 0, 2, 4, 0, 0, 0, 4, 7, 0,     // F-
+    };
+
+    /*
+     * Number of bytes for each instruction, used to update PC
+     * JMP, BRANCH, SUBROUTINE, BRK, RTI instructions set to 0 bytes, to change PC manually
+     */
+    constexpr u8 INSTR_BYTES [256] = {
+    // -0                      -8
+        0, 2, 0, 0, 0, 2, 2, 0, 1, 2, 1, 0, 0, 3, 3, 0,    // 0-
+        0, 2, 0, 0, 0, 2, 2, 0, 1, 3, 0, 0, 0, 3, 3, 0,    // 1-
+        0, 2, 0, 0, 2, 2, 2, 0, 1, 2, 1, 0, 3, 3, 3, 0,    // 2-
+        0, 2, 0, 0, 0, 2, 2, 0, 1, 3, 0, 0, 0, 3, 3, 0,    // 3-
+        0, 2, 0, 0, 0, 2, 2, 0, 1, 2, 1, 0, 0, 3, 3, 0,    // 4-
+        0, 2, 0, 0, 0, 2, 2, 0, 1, 3, 0, 0, 0, 3, 3, 0,    // 5-
+        0, 2, 0, 0, 0, 2, 2, 0, 1, 2, 1, 0, 0, 3, 3, 0,    // 6-
+        0, 2, 0, 0, 0, 2, 2, 0, 1, 3, 0, 0, 0, 3, 3, 0,    // 7-
+        0, 2, 0, 0, 2, 2, 2, 0, 1, 0, 1, 0, 3, 3, 3, 0,    // 8-
+        0, 2, 0, 0, 2, 2, 2, 0, 1, 3, 1, 0, 0, 3, 0, 0,    // 9-
+        2, 2, 2, 0, 2, 2, 2, 0, 1, 2, 1, 0, 3, 3, 3, 0,    // A-
+        0, 2, 0, 0, 2, 2, 2, 0, 1, 3, 1, 0, 3, 3, 3, 0,    // B-
+        2, 2, 0, 0, 2, 2, 2, 0, 1, 2, 1, 0, 3, 3, 3, 0,    // C-
+        0, 2, 0, 0, 0, 2, 2, 0, 1, 3, 0, 0, 0, 3, 3, 0,    // D-
+        2, 2, 0, 0, 2, 2, 2, 0, 1, 2, 1, 0, 3, 3, 3, 0,    // E-
+        0, 2, 0, 0, 0, 2, 2, 0, 1, 3, 0, 0, 0, 3, 3, 0,    // F-
+    };
+
+    // Operation of an instruction, independent of its addressing mode
+    enum Operation {
+        OP_LDA, OP_LDX, OP_LDY, OP_STA, OP_STX, OP_STY,
+        OP_TAX, OP_TAY, OP_TSX, OP_TXA, OP_TXS, OP_TYA,
+        OP_CLC, OP_CLD, OP_CLI, OP_CLV, OP_SEC, OP_SED, OP_SEI,
+        OP_INC, OP_INX, OP_INY, OP_DEC, OP_DEX, OP_DEY,
+        OP_AND, OP_EOR, OP_ORA, OP_ASL, OP_LSR, OP_ROL, OP_ROR, OP_ADC, OP_SBC,
+        OP_BIT, OP_CMP, OP_CPX, OP_CPY,
+        OP_PHA, OP_PHP, OP_PLA, OP_PLP,
+        OP_BCC, OP_BCS, OP_BEQ, OP_BMI, OP_BNE, OP_BPL, OP_BVC, OP_BVS,
+        OP_JMP, OP_JSR, OP_RTS, OP_BRK, OP_RTI, OP_NOP,
+        OP_NUL,     // no instruction
+    };
+
+    constexpr Operation instr_operation(u8 opcode) {
+        switch (opcode) {
+            case LDA_IMM: case LDA_ZPG: case LDA_ZPX: case LDA_ABS: case LDA_ABX: case LDA_ABY: case LDA_IDX: case LDA_IDY:
+                return OP_LDA;
+            case LDX_IMM: case LDX_ZPG: case LDX_ZPY: case LDX_ABS: case LDX_ABY:                   return OP_LDX;
+            case LDY_IMM: case LDY_ZPG: case LDY_ZPX: case LDY_ABS: case LDY_ABX:                   return OP_LDY;
+            case STA_ZPG: case STA_ZPX: case STA_ABS: case STA_ABX: case STA_ABY: case STA_IDX: case STA_IDY:
+                return OP_STA;
+            case STX_ZPG: case STX_ZPY: case STX_ABS:                                               return OP_STX;
+            case STY_ZPG: case STY_ZPX: case STY_ABS:                                               return OP_STY;
+            case TAX_IMP: return OP_TAX;
+            case TAY_IMP: return OP_TAY;
+            case TSX_IMP: return OP_TSX;
+            case TXA_IMP: return OP_TXA;
+            case TXS_IMP: return OP_TXS;
+            case TYA_IMP: return OP_TYA;
+            case CLC_IMP: return OP_CLC;
+            case CLD_IMP: return OP_CLD;
+            case CLI_IMP: return OP_CLI;
+            case CLV_IMP: return OP_CLV;
+            case SEC_IMP: return OP_SEC;
+            case SED_IMP: return OP_SED;
+            case SEI_IMP: return OP_SEI;
+            case INC_ZPG: case INC_ZPX: case INC_ABS: case INC_ABX:                                 return OP_INC;
+            case INX_IMP: return OP_INX;
+            case INY_IMP: return OP_INY;
+            case DEC_ZPG: case DEC_ZPX: case DEC_ABS: case DEC_ABX:                                 return OP_DEC;
+            case DEX_IMP: return OP_DEX;
+            case DEY_IMP: return OP_DEY;
+            case AND_IMM: case AND_ZPG: case AND_ZPX: case AND_ABS: case AND_ABX: case AND_ABY: case AND_IDX: case AND_IDY:
+                return OP_AND;
+            case EOR_IMM: case EOR_ZPG: case EOR_ZPX: case EOR_ABS: case EOR_ABX: case EOR_ABY: case EOR_IDX: case EOR_IDY:
+                return OP_EOR;
+            case ORA_IMM: case ORA_ZPG: case ORA_ZPX: case ORA_ABS: case ORA_ABX: case ORA_ABY: case ORA_IDX: case ORA_IDY:
+                return OP_ORA;
+            case ASL_ACC: case ASL_ZPG: case ASL_ZPX: case ASL_ABS: case ASL_ABX:                   return OP_ASL;
+            case LSR_ACC: case LSR_ZPG: case LSR_ZPX: case LSR_ABS: case LSR_ABX:                   return OP_LSR;
+            case ROL_ACC: case ROL_ZPG: case ROL_ZPX: case ROL_ABS: case ROL_ABX:                   return OP_ROL;
+            case ROR_ACC: case ROR_ZPG: case ROR_ZPX: case ROR_ABS: case ROR_ABX:                   return OP_ROR;
+            case ADC_IMM: case ADC_ZPG: case ADC_ZPX: case ADC_ABS: case ADC_ABX: case ADC_ABY: case ADC_IDX: case ADC_IDY:
+                return OP_ADC;
+            case SBC_IMM: case SBC_ZPG: case SBC_ZPX: case SBC_ABS: case SBC_ABX: case SBC_ABY: case SBC_IDX: case SBC_IDY:
+                return OP_SBC;
+            case BIT_ZPG: case BIT_ABS:                                                             return OP_BIT;
+            case CMP_IMM: case CMP_ZPG: case CMP_ZPX: case CMP_ABS: case CMP_ABX: case CMP_ABY: case CMP_IDX: case CMP_IDY:
+                return OP_CMP;
+            case CPX_IMM: case CPX_ZPG: case CPX_ABS:                                               return OP_CPX;
+            case CPY_IMM: case CPY_ZPG: case CPY_ABS:                                               return OP_CPY;
+            case PHA_IMP: return OP_PHA;
+            case PHP_IMP: return OP_PHP;
+            case PLA_IMP: return OP_PLA;
+            case PLP_IMP: return OP_PLP;
+            case BCC_REL: return OP_BCC;
+            case BCS_REL: return OP_BCS;
+            case BEQ_REL: return OP_BEQ;
+            case BMI_REL: return OP_BMI;
+            case BNE_REL: return OP_BNE;
+            case BPL_REL: return OP_BPL;
+            case BVC_REL: return OP_BVC;
+            case BVS_REL: return OP_BVS;
+            case JMP_ABS: case JMP_IND:                                                             return OP_JMP;
+            case JSR_ABS: return OP_JSR;
+            case RTS_IMP: return OP_RTS;
+            case BRK_IMP: return OP_BRK;
+            case RTI_IMP: return OP_RTI;
+            case NOP_IMP: return OP_NOP;
+            default:      return OP_NUL;
+        }
+    }
+
+    // Operations whose indexed reads (ABX, ABY, IDY) take a cycle more when the index crosses a page,
+    // every engine and Batch charge it from here
+    constexpr bool pays_page_cross(Operation op) {
+        switch (op) {
+            case OP_LDA: case OP_LDX: case OP_LDY: case OP_AND: case OP_EOR: case OP_ORA: case OP_ADC: case OP_SBC:
+            case OP_CMP:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    // Number of operand bytes following the opcode
+    constexpr u8 operand_bytes(AddrMode am) {
+        switch (am) {
+            case IMM: case ZPG: case ZPX: case ZPY: case IDX: case IDY: case REL:   return 1;
+            case ABS: case ABX: case ABY: case IND:                                 return 2;
+            default:                                                                return 0;
+        }
+    }
+
+    class CPU;
+    // State frozen by CPU::snapshot(), copies of it share its memory copy-on-write
+    typedef std::shared_ptr<const CPU> Snapshot;
+
     // Cpu and memory
     class CPU {
+        friend class Jit;   // Translated code accesses registers and lazy flags directly
+        friend class SaveState;
+
      private:
-        inline u8 getCurrentInstr() { return this->ram[this->PC]; }
+        MEMORY_INLINE u8 getCurrentInstr() { return read(PC); }
+
+        MEMORY_INLINE u8 read(u16 addr) { return memory.read(addr); }
+        // Every write to memory goes through here so decoded code can be invalidated
+        MEMORY_INLINE void write(u16 addr, u8 val) {
+            if (memory.write(addr, val)) {
+                remapped();
+            }
+            written(addr);
+        }
+        MEMORY_INLINE void written(u16 addr) {
+            if (blockCache.is_code(addr)) { blockCache.invalidate(addr); }
+        }
+        // Decoded and translated code assumes the memory map it was made with
+        inline void check_memory_map() {
+            if (memory.generation() != codeGeneration) {
+                blockCache.clear();
+                jit.reset();
+                memory.take_remapped_pages();
+                codeGeneration = memory.generation();
+                codeRemaps = memory.remap_count();
+            } else if (memory.remap_count() != codeRemaps) {
+                remapped();
+            }
+        }
+        // Drops the code of remapped pages right away, so the block running stops after the instruction
+        // that switched banks. Everything is dropped once the block loop checks the map again.
+        void remapped();
 
         inline void set_ZN_flags(u8 val) {
             set_flag_z(val == 0);
@@ -147,36 +388,36 @@ namespace mos6502 {
             return { 0xFFFF, 0xFF, 0 };    // Implied register
         }
         avo addr_mode_get_imm() {
-            return { 0xFFFF, ram[PC+1], 0 };
+            return { 0xFFFF, read(PC+1), 0 };
         }
         avo addr_mode_get_zp() {
-            u8 addr = (u8) ram[PC+1];
-            return { addr, ram[addr], 0 };
+            u8 addr = (u8) read(PC+1);
+            return { addr, 0, 0 };
         }
         avo addr_mode_get_zpx() {
-            u8 addr = (u8) (ram[PC+1] + X);
-            return { addr, ram[addr], X };
+            u8 addr = (u8) (read(PC+1) + X);
+            return { addr, 0, X };
         }
         avo addr_mode_get_zpy() {
-            u8 addr = (u8) (ram[PC+1] + Y);
-            return { addr, ram[addr], Y };
+            u8 addr = (u8) (read(PC+1) + Y);
+            return { addr, 0, Y };
         }
         avo addr_mode_get_abs() {
-            u16 addr = B2W(ram[PC+1], ram[PC+2]);
-            return { addr, ram[addr], 0 };
+            u16 addr = B2W(read(PC+1), read(PC+2));
+            return { addr, 0, 0 };
         }
         avo addr_mode_get_abx() {
-            u16 addr = B2W(ram[PC+1], ram[PC+2]) + X;
-            return { addr, ram[addr], X };
+            u16 addr = B2W(read(PC+1), read(PC+2)) + X;
+            return { addr, 0, X };
         }
         avo addr_mode_get_aby() {
-            u16 addr = B2W(ram[PC+1], ram[PC+2]) + Y;
-            return { addr, ram[addr], Y };
+            u16 addr = B2W(read(PC+1), read(PC+2)) + Y;
+            return { addr, 0, Y };
         }
         avo addr_mode_get_indirect() {
-            u8 low = ram[PC+1];
-            u8 high = ram[PC+2];
-            u16 deref_low = ram[B2W(low, high)];
+            u8 low = read(PC+1);
+            u8 high = read(PC+2);
+            u16 deref_low = read(B2W(low, high));
 #if CPU_MODEL==MODEL_6502
             /* Original 6502 handled xxFF boundary incorrectly (wraps without updating high byte) */
 #else
@@ -184,16 +425,16 @@ namespace mos6502 {
             high += (low == 0xFF);
 #endif
             low = (u8) (low + 1);
-            u16 deref_high = ram[B2W(low, high)];
+            u16 deref_high = read(B2W(low, high));
             return { B2W(deref_low, deref_high), 0, 0 };  // Don't need to read addr in memory, just need addr
         }
         avo addr_mode_get_indexed_indirect() {
-            u16 addr = B2W(ram[(u8) (ram[PC+1] + X)], ram[(u8) (ram[PC+1] + X + 1)]);
-            return { addr, ram[addr], X };
+            u16 addr = B2W(read((u8) (read(PC+1) + X)), read((u8) (read(PC+1) + X + 1)));
+            return { addr, 0, X };
         }
         avo addr_mode_get_indirect_indexed() {
-            u16 addr = Y + B2W(ram[ram[PC+1]], ram[(u8) (ram[PC+1] + 1)]);
-            return { addr, ram[addr], Y };
+            u16 addr = Y + B2W(read(read(PC+1)), read((u8) (read(PC+1) + 1)));
+            return { addr, 0, Y };
         }
         avo addr_mode_get_null() {
             return { 0x0, 0x0, 0x0 };
@@ -219,17 +460,29 @@ namespace mos6502 {
 
         inline avo addr_mode_get(AddrMode am) { return (this->*addr_mode_funcs[am])(); }
 
+        /*
+         * Instructions of the switch engine, given the address mode and the operand decoded with it
+         */
+
+        // Value operand, memory is only read by the instructions using it so devices see no reads for stores
+        inline u8 operand_val(AddrMode am, const avo& op) { return (am == IMM) ? op.val : read(op.addr); }
 
-        inline void load(u8& reg) {
-            reg = avo_ret.val;
-            if (am == ABX || am == ABY || am == IDY) {
-                numCycles -= onDifferentPages(avo_ret.addr, avo_ret.addr - avo_ret.offset);
+        // Page crossing cycle of an indexed read by operation
+        inline void page_cross(Operation operation, AddrMode am, const avo& op) {
+            if (pays_page_cross(operation) && (am == ABX || am == ABY || am == IDY)) {
+                numCycles -= onDifferentPages(op.addr, op.addr - op.offset);
             }
+        }
+
+
+        inline void load(AddrMode am, const avo& op, u8& reg) {
+            reg = operand_val(am, op);
+            page_cross(OP_LDA, am, op);
             set_ZN_flags(reg);
         }
 
-        inline void store(u8& reg) {
-            ram[avo_ret.addr] = reg;
+        inline void store(const avo& op, u8 reg) {
+            write(op.addr, reg);
         }
 
         inline void transfer(u8& from, u8& to, bool updateFlags) {
@@ -237,78 +490,85 @@ namespace mos6502 {
             if (updateFlags) { set_ZN_flags(to); }
         }
 
-        inline void inc_dec(s8 val, u8* impReg = nullptr) {
+        inline void inc_dec(AddrMode am, const avo& op, s8 val, u8* impReg = nullptr) {
             if (am == IMP) {
                 *impReg += val;
                 set_ZN_flags(*impReg);
             } else {
-                ram[avo_ret.addr] += val;
-                set_ZN_flags(ram[avo_ret.addr]);
+                u8 res = read(op.addr) + val;
+                write(op.addr, res);
+                set_ZN_flags(res);
             }
         }
 
         // AND, EOR, ORA, ADC, SBC
-        inline void arith(u8 (CPU::*mathOpFunc)(u8, u8)) {
-            A = (this->*mathOpFunc)(A, avo_ret.val);
-            if (am == ABX || am == ABY || am == IDY) {
-                numCycles -= onDifferentPages(avo_ret.addr, avo_ret.addr - avo_ret.offset);
-            }
+        inline void arith(AddrMode am, const avo& op, u8 (CPU::*mathOpFunc)(u8, u8)) {
+            A = (this->*mathOpFunc)(A, operand_val(am, op));
+            page_cross(OP_AND, am, op);
             set_ZN_flags(A);
         }
 
         // ASL, LSR, ROL, ROR
-        inline void shift_rot(void (CPU::*mathShiftFunc)(u8&)) {
-            u8& toShift = (am == ACC) ? A : ram[avo_ret.addr];
-            (this->*mathShiftFunc)(toShift);
-            set_ZN_flags(toShift);
+        inline void shift_rot(AddrMode am, const avo& op, void (CPU::*mathShiftFunc)(u8&)) {
+            if (am == ACC) {
+                (this->*mathShiftFunc)(A);
+                set_ZN_flags(A);
+                return;
+            }
+            u8 val = read(op.addr);
+            (this->*mathShiftFunc)(val);
+            write(op.addr, val);
+            set_ZN_flags(val);
         }
 
-        inline void bit() {
-            u8 and_res = avo_ret.val & A;
+        inline void bit(AddrMode am, const avo& op) {
+            u8 and_res = operand_val(am, op) & A;
             set_flag_z(and_res == 0);
             set_flag_v((and_res & 0b01000000) != 0);
             set_flag_n((and_res & 0b10000000) != 0);
         }
 
         // CMP, CPX, CPY
-        inline void cmp(u8& reg) {
-            set_flag_c(reg >= avo_ret.val);
-            set_flag_z(reg == avo_ret.val);
-            set_flag_n(signBit(reg - avo_ret.val));
+        inline void cmp(AddrMode am, const avo& op, u8 reg) {
+            u8 val = operand_val(am, op);
+            page_cross(OP_CMP, am, op);
+            set_flag_c(reg >= val);
+            set_flag_z(reg == val);
+            set_flag_n(signBit(reg - val));
         }
 
-        inline void jmp() {
-            PC = avo_ret.addr;
+        inline void jmp(const avo& op) {
+            PC = op.addr;
         }
 
         // Push onto stack
         inline void push(u8 val) {
-            ram[S + 0x0100] = val;
+            write(S + 0x0100, val);
             S -= 1;
         }
 
         // Pull from stack
         inline u8 pull() {
             S += 1;
-            return ram[S + 0x0100];
+            return read(S + 0x0100);
             // Need to clear stuff in stack?
         }
 
-        inline void branch(u1 branchCondResult) {
+        inline void branch(const avo& op, u1 branchCondResult) {
             if (!branchCondResult) {
                 PC += 2;
                 return;
             }
-            u16 newPC = PC + ((s8) avo_ret.val);    // address is signed
+            u16 newPC = PC + ((s8) op.val);     // address is signed
             numCycles -= 1 + (2 * (u32) onDifferentPages(PC, newPC));
             PC = newPC;
         }
 
-        inline void jump_sub_routine() {
+        inline void jump_sub_routine(const avo& op) {
             u16 addrOnStack = PC + 2;
             push(highByte(addrOnStack));
             push(lowByte(addrOnStack));
-            PC = avo_ret.addr;
+            PC = op.addr;
         }
 
         inline void return_sub_routine() {
@@ -324,12 +584,26 @@ namespace mos6502 {
             push(SR);
 
             // Jump to interrupt vector location
-            PC = B2W(ram[INT_VEC_LOC], ram[INT_VEC_LOC + 1]);
+            PC = B2W(read(INT_VEC_LOC), read(INT_VEC_LOC + 1));
 
             // break flag high
             set_flag_b(1);
         }
 
+        // IRQ or NMI through the vector at vec, pushes SR with B clear, returns the 7 cycles taken
+        s32 hardware_interrupt(u16 vec);
+        // Lines raised while an engine runs stop it at the next instruction, or the next block
+        inline void stop_engine() {
+            if (running && numCycles > 0) {
+                cyclesCut += numCycles;
+                numCycles = 0;
+            }
+        }
+        // Engine selected, or run_masked(), counting cycles
+        s32 run_engine(s32 numCycles, bool masked);
+        // One instruction at a time while an IRQ waits for I to clear
+        s32 run_masked(s32 numCycles);
+
         inline void return_from_interrupt() {
             // Load flags and PC from stack
             SR = pull();
@@ -338,14 +612,291 @@ namespace mos6502 {
             PC = B2W(pcLow, pcHigh);
         }
 
-        // For execute() function, so we don't need to pass it around so much
-        s32 numCycles;  // Number of cycles left to execute
-        AddrMode am;    // Address mode of current instruction
-        avo avo_ret;    // address, val of addr, offset from current address mode
+        /*
+         * Compile-time specialized instructions, one instantiation per opcode (operation, address mode pair).
+         * Address mode, page crossing penalty, cycle count and PC increment are constants in each.
+         *
+         * Flags N, Z, C, V are evaluated lazily: instructions only store the result they were computed
+         * from, and SR is rebuilt by sync_flags() when it is needed (PHP, BRK, leaving the engine).
+         */
+
+        // Lazy flags from / to SR
+        inline void load_lazy_flags() {
+            n_src = SR & FLAG_MASK_N;
+            z_src = (SR & FLAG_MASK_Z) == 0;
+            c_src = (SR & FLAG_MASK_C) << 8;
+            v_src = (SR & FLAG_MASK_V) << 1;
+        }
+        inline void sync_flags() {
+            SR = (SR & ~(FLAG_MASK_N | FLAG_MASK_Z | FLAG_MASK_C | FLAG_MASK_V))
+                | (n_src & FLAG_MASK_N)
+                | ((z_src == 0) ? FLAG_MASK_Z : 0)
+                | ((c_src >> 8) & FLAG_MASK_C)
+                | ((v_src & 0x80) >> 1);
+        }
+
+        inline u1 lazy_flag_n() { return (n_src & 0x80) != 0; }
+        inline u1 lazy_flag_z() { return z_src == 0; }
+        inline u1 lazy_flag_c() { return (c_src >> 8) & 0x01; }
+        inline u1 lazy_flag_v() { return (v_src & 0x80) != 0; }
+
+        inline void lazy_ZN(u8 val) {
+            n_src = val;
+            z_src = val;
+        }
+
+        // Operand bytes following the opcode at PC
+        template <AddrMode AM>
+        MEMORY_INLINE u16 fetch_operand() {
+            if constexpr (operand_bytes(AM) == 2) {
+                return B2W(read((u16) (PC + 1)), read((u16) (PC + 2)));
+            } else if constexpr (operand_bytes(AM) == 1) {
+                return read((u16) (PC + 1));
+            } else {
+                return 0;
+            }
+        }
+
+        template <AddrMode AM>
+        inline u16 effective_addr(u16 operand) {
+            if constexpr (AM == ZPG) {
+                return (u8) operand;
+            } else if constexpr (AM == ZPX) {
+                return (u8) (operand + X);
+            } else if constexpr (AM == ZPY) {
+                return (u8) (operand + Y);
+            } else if constexpr (AM == ABS) {
+                return operand;
+            } else if constexpr (AM == ABX) {
+                return (u16) (operand + X);
+            } else if constexpr (AM == ABY) {
+                return (u16) (operand + Y);
+            } else if constexpr (AM == IND) {
+                u8 low = (u8) operand;
+                u8 high = highByte(operand);
+                u8 deref_low = read(operand);
+#if CPU_MODEL==MODEL_6502
+                /* Original 6502 handled xxFF boundary incorrectly (wraps without updating high byte) */
+#else
+                /* Later models like 65SC02 fixed this */
+                high += (low == 0xFF);
+#endif
+                low = (u8) (low + 1);
+                return B2W(deref_low, read(B2W(low, high)));
+            } else if constexpr (AM == IDX) {
+                u8 zp = (u8) (operand + X);
+                return B2W(read(zp), read((u8) (zp + 1)));
+            } else if constexpr (AM == IDY) {
+                return (u16) (B2W(read((u8) operand), read((u8) (operand + 1))) + Y);
+            } else {
+                static_assert(AM == ZPG, "Address mode has no effective address");
+                return 0;
+            }
+        }
+
+        // Value operand, indexed modes pay one cycle when crossing a page for the operations that do
+        template <Operation OP, AddrMode AM>
+        MEMORY_INLINE u8 read_operand(u16 operand) {
+            if constexpr (AM == IMM || AM == REL) {
+                return (u8) operand;
+            } else if constexpr ((AM == ABX || AM == ABY || AM == IDY) && pays_page_cross(OP)) {
+                u16 addr = effective_addr<AM>(operand);
+                numCycles -= onDifferentPages(addr, addr - (AM == ABX ? X : Y));
+                return read(addr);
+            } else {
+                return read(effective_addr<AM>(operand));
+            }
+        }
+
+        template <Operation OP>
+        inline u8 alu(u8 op1, u8 op2) {
+            if constexpr (OP == OP_AND)      { return op1 & op2; }
+            else if constexpr (OP == OP_EOR) { return op1 ^ op2; }
+            else if constexpr (OP == OP_ORA) { return op1 | op2; }
+            else {
+                if (get_flag_d() == 0) {    // Binary, subtraction adds the complement
+                    u16 val = op1 + ((OP == OP_ADC) ? op2 : (u8) ~op2) + lazy_flag_c();
+                    c_src = val;
+                    v_src = op1 ^ (u8) val;
+                    return (u8) val;
+                }
+                // BCD, V flag undocumented undefined behavior
+                u8 val;
+                if constexpr (OP == OP_ADC) {
+                    val = bin_2_dec(op1) + bin_2_dec(op2) + lazy_flag_c();
+                    c_src = (val >= 100) << 8;
+                } else {
+                    val = bin_2_dec(op1) - bin_2_dec(op2) - lazy_flag_c();
+                    c_src = (val < 100) << 8;
+                }
+                return dec_2_bin(val % 100);
+            }
+        }
+
+        template <Operation OP>
+        inline void shift(u8& op) {
+            if constexpr (OP == OP_ASL) {
+                c_src = op << 1;
+                op = (u8) c_src;
+            } else if constexpr (OP == OP_LSR) {
+                c_src = (op & 0x01) << 8;
+                op = op >> 1;
+            } else if constexpr (OP == OP_ROL) {
+                c_src = (op << 1) + lazy_flag_c();
+                op = (u8) c_src;
+            } else {
+                u8 origOp = op;
+                op = (op >> 1) + (lazy_flag_c() << 7);
+                c_src = (origOp & 0x01) << 8;
+            }
+        }
+
+        inline void compare(u8 reg, u8 val) {
+            c_src = reg + (u8) ~val + 1;    // Bit 8 set when reg >= val
+            lazy_ZN((u8) c_src);
+        }
+
+        inline void branch_rel(u1 branchCondResult, u8 offset) {
+            if (!branchCondResult) {
+                PC += 2;
+                return;
+            }
+            u16 newPC = PC + ((s8) offset);     // address is signed
+            numCycles -= 1 + (2 * (u32) onDifferentPages(PC, newPC));
+            PC = newPC;
+        }
+
+        template <u8 OPCODE>
+        inline void exec(u16 operand) {
+            constexpr Operation OP = instr_operation(OPCODE);
+            constexpr AddrMode AM = INSTR_GET_ADDR_MODE[OPCODE];
+            static_assert(OP != OP_NUL, "No instruction for opcode");
+
+            if constexpr (OP == OP_LDA)      { A = read_operand<OP, AM>(operand); lazy_ZN(A); }
+            else if constexpr (OP == OP_LDX) { X = read_operand<OP, AM>(operand); lazy_ZN(X); }
+            else if constexpr (OP == OP_LDY) { Y = read_operand<OP, AM>(operand); lazy_ZN(Y); }
+            else if constexpr (OP == OP_STA) { write(effective_addr<AM>(operand), A); }
+            else if constexpr (OP == OP_STX) { write(effective_addr<AM>(operand), X); }
+            else if constexpr (OP == OP_STY) { write(effective_addr<AM>(operand), Y); }
+            else if constexpr (OP == OP_TAX) { X = A; lazy_ZN(X); }
+            else if constexpr (OP == OP_TAY) { Y = A; lazy_ZN(Y); }
+            else if constexpr (OP == OP_TSX) { X = S; lazy_ZN(X); }
+            else if constexpr (OP == OP_TXA) { A = X; lazy_ZN(A); }
+            else if constexpr (OP == OP_TXS) { S = X; }
+            else if constexpr (OP == OP_TYA) { A = Y; lazy_ZN(A); }
+            else if constexpr (OP == OP_CLC) { c_src = 0; }
+            else if constexpr (OP == OP_CLD) { set_flag_d(0); }
+            else if constexpr (OP == OP_CLI) { set_flag_i(0); }
+            else if constexpr (OP == OP_CLV) { v_src = 0; }
+            else if constexpr (OP == OP_SEC) { c_src = 0x100; }
+            else if constexpr (OP == OP_SED) { set_flag_d(1); }
+            else if constexpr (OP == OP_SEI) { set_flag_i(1); }
+            else if constexpr (OP == OP_INC || OP == OP_DEC) {
+                u16 addr = effective_addr<AM>(operand);
+                u8 val = read(addr) + ((OP == OP_INC) ? 1 : -1);
+                write(addr, val);
+                lazy_ZN(val);
+            }
+            else if constexpr (OP == OP_INX) { X += 1; lazy_ZN(X); }
+            else if constexpr (OP == OP_INY) { Y += 1; lazy_ZN(Y); }
+            else if constexpr (OP == OP_DEX) { X -= 1; lazy_ZN(X); }
+            else if constexpr (OP == OP_DEY) { Y -= 1; lazy_ZN(Y); }
+            else if constexpr (OP == OP_AND || OP == OP_EOR || OP == OP_ORA || OP == OP_ADC || OP == OP_SBC) {
+                A = alu<OP>(A, read_operand<OP, AM>(operand));
+                lazy_ZN(A);
+            }
+            else if constexpr (OP == OP_ASL || OP == OP_LSR || OP == OP_ROL || OP == OP_ROR) {
+                if constexpr (AM == ACC) {
+                    shift<OP>(A);
+                    lazy_ZN(A);
+                } else {
+                    u16 addr = effective_addr<AM>(operand);
+                    u8 val = read(addr);
+                    shift<OP>(val);
+                    write(addr, val);
+                    lazy_ZN(val);
+                }
+            }
+            else if constexpr (OP == OP_BIT) {
+                u8 and_res = read_operand<OP, AM>(operand) & A;
+                lazy_ZN(and_res);
+                v_src = (and_res & 0b01000000) << 1;
+            }
+            else if constexpr (OP == OP_CMP) { compare(A, read_operand<OP, AM>(operand)); }
+            else if constexpr (OP == OP_CPX) { compare(X, read_operand<OP, AM>(operand)); }
+            else if constexpr (OP == OP_CPY) { compare(Y, read_operand<OP, AM>(operand)); }
+            else if constexpr (OP == OP_PHA) { push(A); }
+            else if constexpr (OP == OP_PHP) { sync_flags(); push(SR); }
+            else if constexpr (OP == OP_PLA) { A = pull(); lazy_ZN(A); }
+            else if constexpr (OP == OP_PLP) { SR = pull(); load_lazy_flags(); }
+            else if constexpr (OP == OP_BCC) { branch_rel(lazy_flag_c() == 0, operand); }
+            else if constexpr (OP == OP_BCS) { branch_rel(lazy_flag_c() == 1, operand); }
+            else if constexpr (OP == OP_BEQ) { branch_rel(lazy_flag_z() == 1, operand); }
+            else if constexpr (OP == OP_BMI) { branch_rel(lazy_flag_n() == 1, operand); }
+            else if constexpr (OP == OP_BNE) { branch_rel(lazy_flag_z() == 0, operand); }
+            else if constexpr (OP == OP_BPL) { branch_rel(lazy_flag_n() == 0, operand); }
+            else if constexpr (OP == OP_BVC) { branch_rel(lazy_flag_v() == 0, operand); }
+            else if constexpr (OP == OP_BVS) { branch_rel(lazy_flag_v() == 1, operand); }
+            else if constexpr (OP == OP_JMP) { PC = effective_addr<AM>(operand); }
+            else if constexpr (OP == OP_JSR) {
+                u16 addrOnStack = PC + 2;
+                push(highByte(addrOnStack));
+                push(lowByte(addrOnStack));
+                PC = operand;
+            }
+            else if constexpr (OP == OP_RTS) { return_sub_routine(); }
+            else if constexpr (OP == OP_BRK) { sync_flags(); generate_interrupt(); }
+            else if constexpr (OP == OP_RTI) { return_from_interrupt(); load_lazy_flags(); }
+            else if constexpr (OP == OP_NOP) { /* do nothing */ }
+
+            numCycles -= NUM_CYCLES_BASE[OPCODE];
+            PC += INSTR_BYTES[OPCODE];
+        }
+
+        template <u8 OPCODE, u8... REST>
+        inline void exec_fused(u32 operands) {
+            exec<OPCODE>((u16) operands);
+            if constexpr (sizeof...(REST) > 0) {
+                exec_fused<REST...>((operand_bytes(INSTR_GET_ADDR_MODE[OPCODE]) > 0) ? operands >> 16 : operands);
+            }
+        }
+
+        // Fetch operand and execute instruction at PC
+        template <u8 OPCODE>
+        inline void step() {
+            exec<OPCODE>(fetch_operand<INSTR_GET_ADDR_MODE[OPCODE]>());
+        }
+
+        // Decode the block starting at pc into the block cache
+        Block& decode_block(u16 pc);
+        void fuse_block(Block& block);
+
+        // State an idle loop must leave as it found it (it writes no memory)
+        struct IdleState {
+            u8 A, X, Y, S, SR;
+            bool operator==(const IdleState& other) const {
+                return A == other.A && X == other.X && Y == other.Y && S == other.S && SR == other.SR;
+            }
+        };
+        inline IdleState idle_state() { sync_flags(); return { A, X, Y, S, SR }; }
+        // Block ran once from before, skip its identical iterations if it was an idle loop
+        void fast_forward_idle(Block& block, const IdleState& before, s32 cycles);
+        // Blocks loop running translated code where there is some (jit and aot engines)
+        template <bool TRANSLATE>
+        s32 execute_native(s32 numCycles, bool forever);
+
+        // Budget of the engine running, instruction handlers take their cycles from it. Only valid
+        // inside an engine, CPU::cycles counts what ran. Lazy flags and registers are kept next to it,
+        // one cache line in arena slots.
+        s32 numCycles = 0;
+
+        // Lazy flag sources, valid while a specialized engine is executing
+        u8  n_src;      // N is bit 7
+        u8  z_src;      // Z is set when 0
+        u16 c_src;      // C is bit 8
+        u8  v_src;      // V is bit 7
 
      public:
-        // Internal state
-        u8 ram[MEM_MAX];    // 64 KiB random access memory (max addressable memory)
         // All registers
         u16 PC;         // program counter
         u8  A;          // accumulator register (aka 'A')
@@ -362,10 +913,109 @@ namespace mos6502 {
                         //  bit 6: V: overflow
                         //  bit 7: N: negative
 
+     private:
+        BlockCache blockCache;  // Decoded blocks of the block engine
+        Jit jit;                // Translated blocks of the jit engine
+        u32 codeGeneration = 0; // Memory map generation the cached code was made with
+        u32 codeRemaps = 0;     // Remaps of pages the cached code was checked against
+        u32 irqSources = 0;     // Sources holding the IRQ line, one bit each
+        bool nmiPending = false;
+        bool running = false;   // An engine is running under execute()
+        s32 cyclesCut = 0;      // Budget stop_engine() took from the running engine
+        s32 sliceCycles = 0;    // Budget the running engine started with
+
+     public:
+        // Internal state
+        Memory memory;      // 64 KiB address space, RAM unless pages are mapped elsewhere
+
+        Engine engine = ENGINE_SWITCH;  // Engine used by execute(), not changed by reset()
+        u32 jitThreshold = 2;           // Interpreted runs of a block before the jit engine translates it
+        const AotModule* aot = nullptr; // Code translated ahead of time for the jit and aot engines, not owned
+        FusionProfile* profile = nullptr;   // Counts executed sequences in the block engines when set, not owned
+        u64 idleCyclesSkipped = 0;          // Cycles the block engines fast-forwarded through idle loops
+        Snapshot baseline;                  // Memory reset() goes back to, zeroed RAM when not set
+        u64 cycles = 0;                     // Cycles run by execute(), run_until() and run_to(), the time base of events
+        Scheduler events;                   // Run by execute() when cycles reaches them
+
+        // Instruction handler, executes the instruction at PC (nullptr for invalid opcodes)
+        typedef void (*Handler)(CPU& cpu);
+
+        template <u8 OPCODE>
+        static void handler(CPU& cpu) { cpu.step<OPCODE>(); }
+
+        template <u8 OPCODE>
+        static void decoded_handler(CPU& cpu, u32 operand) { cpu.exec<OPCODE>((u16) operand); }
+
+        // Runs a fused sequence, operands of the instructions having one packed 16 bits each from bit 0
+        template <u8... OPCODES>
+        static void fused_handler(CPU& cpu, u32 operands) { cpu.exec_fused<OPCODES...>(operands); }
+
+        // Host access to memory, writes invalidate decoded code like guest writes
+        class MemRef {
+         public:
+            MemRef(CPU& cpu, u16 addr) : cpu(cpu), addr(addr) {}
+            operator u8() const { return cpu.read(addr); }
+            MemRef& operator=(u8 val) { cpu.write(addr, val); return *this; }
+            MemRef& operator=(const MemRef& other) { return *this = (u8) other; }
+         private:
+            CPU& cpu;
+            u16 addr;
+        };
+
+        explicit CPU(MemoryBackend backend = MEMORY_FLAT) : memory(backend) {}
+        // Flat memory in ram, MEM_MAX bytes owned by the caller
+        explicit CPU(u8* ram) : memory(ram) {}
+
         // Methods
+        // Only rewrites the pages dirtied since the last reset, restore or snapshot. Also drops the
+        // scheduled events and IRQ lines and restarts cycles from 0.
         void reset();
+        // Frozen copy of this, the pages of memory.ram become shared copy-on-write by both. Like every
+        // copy it has no scheduled events, and no IRQ line held by this one's devices.
+        Snapshot snapshot();
+        // Registers and memory of the snapshot, only redoes dirty pages when this derives from it. Drops
+        // the scheduled events and IRQ lines like reset(), cycles go back to the snapshot's.
+        void restore(const Snapshot& snapshot);
+        // Copy sharing memory with this copy-on-write, each page is copied on its first write by either,
+        // without events or IRQ lines like snapshot()
+        CPU fork();
+        // Runs the engine to the next event or the end of the budget, runs the events due and takes
+        // pending interrupts in between, returns the cycles run (interrupts included)
         s32 execute(s32 numCycles, bool forever = false);
-        u8& operator[] (u16 i) { return this->ram[i]; }
+        s32 execute_switch(s32 numCycles, bool forever = false);
+        s32 execute_threaded(s32 numCycles, bool forever = false);
+        s32 execute_table(s32 numCycles, bool forever = false);
+        s32 execute_blocks(s32 numCycles, bool forever = false);
+        s32 execute_jit(s32 numCycles, bool forever = false);
+        s32 execute_aot(s32 numCycles, bool forever = false);
+        // Runs one instruction at a time until PC is stopPC or maxCycles ran, returns the cycles run
+        // (may pass maxCycles by the last instruction), -1 on illegal instruction
+        s64 run_to(u16 stopPC, s64 maxCycles);
+        // Runs until cycles reaches cycle, returns by how much the last instruction passed it, -1 on
+        // illegal instruction. Calls with increasing cycles run on from where the last one stopped, so
+        // slices stay aligned to the cycles asked for however much each one overshoots.
+        s64 run_until(u64 cycle);
+        // Interrupt inputs, taken between instructions by execute(). IRQ is level triggered, held while
+        // any source (one bit each) asserts it and taken while I is clear, NMI is taken once per call.
+        void set_irq(bool asserted, u32 source = 1);
+        void nmi();
+        bool irq_asserted() const { return irqSources != 0; }
+        bool nmi_pending() const { return nmiPending; }
+        // Cycle of the instruction running (when it started, plus a page crossing cycle of its operand),
+        // cycles between instructions. For devices accessed while an engine runs.
+        u64 now() const { return running ? cycles + (sliceCycles - numCycles - cyclesCut) : cycles; }
+        // For events scheduled while an engine runs, stops it at the first instruction boundary at or
+        // after cycle if its slice went past
+        inline void wake_at(u64 cycle) {
+            u64 end = cycles + (sliceCycles - cyclesCut);
+            if (running && numCycles > 0 && cycle < end) {
+                s32 cut = (s32) std::min<u64>(end - cycle, (u64) numCycles);
+                cyclesCut += cut;
+                numCycles -= cut;
+            }
+        }
+        MemRef operator[] (u16 i) { return MemRef(*this, i); }
+        u8 operator[] (u16 i) const { return memory.read(i); }
 
         // Helper method for accessing flags
         inline u1 get_flag_c()   { return (this->SR & FLAG_MASK_C) != 0; }
@@ -385,103 +1035,39 @@ namespace mos6502 {
         inline void set_flag_n(u1 val)  { this->SR = (this->SR & ~FLAG_MASK_N) + (val * FLAG_MASK_N); }
     };
 
-    enum Instructions : u8 {
-        LDA_IMM = 0xA9, LDA_ZPG = 0xA5, LDA_ZPX = 0xB5, LDA_ABS = 0xAD, LDA_ABX = 0xBD, LDA_ABY = 0xB9, LDA_IDX = 0xA1, LDA_IDY = 0xB1,
-        LDX_IMM = 0xA2, LDX_ZPG = 0xA6, LDX_ZPY = 0xB6, LDX_ABS = 0xAE, LDX_ABY = 0xBE,
-        LDY_IMM = 0xA0, LDY_ZPG = 0xA4, LDY_ZPX = 0xB4, LDY_ABS = 0xAC, LDY_ABX = 0xBC,
-        STA_ZPG = 0x85, STA_ZPX = 0x95, STA_ABS = 0x8D, STA_ABX = 0x9D, STA_ABY = 0x99, STA_IDX = 0x81, STA_IDY = 0x91,
-        STX_ZPG = 0x86, STX_ZPY = 0x96, STX_ABS = 0x8E,
-        STY_ZPG = 0x84, STY_ZPX = 0x94, STY_ABS = 0x8C,
-        TAX_IMP = 0xAA, TAY_IMP = 0xA8, TSX_IMP = 0xBA, TXA_IMP = 0x8A, TXS_IMP = 0x9A, TYA_IMP = 0x98,
-        CLC_IMP = 0x18, CLD_IMP = 0xD8, CLI_IMP = 0x58, CLV_IMP = 0xB8,
-        SEC_IMP = 0x38, SED_IMP = 0xF8, SEI_IMP = 0x78,
-        INC_ZPG = 0xE6, INC_ZPX = 0xF6, INC_ABS = 0xEE, INC_ABX = 0xFE, INX_IMP = 0xE8, INY_IMP = 0xC8,
-        DEC_ZPG = 0xC6, DEC_ZPX = 0xD6, DEC_ABS = 0xCE, DEC_ABX = 0xDE, DEX_IMP = 0xCA, DEY_IMP = 0x88,
-        AND_IMM = 0x29, AND_ZPG = 0x25, AND_ZPX = 0x35, AND_ABS = 0x2D, AND_ABX = 0x3D, AND_ABY = 0x39, AND_IDX = 0x21, AND_IDY = 0x31,
-        EOR_IMM = 0x49, EOR_ZPG = 0x45, EOR_ZPX = 0x55, EOR_ABS = 0x4D, EOR_ABX = 0x5D, EOR_ABY = 0x59, EOR_IDX = 0x41, EOR_IDY = 0x51,
-        ORA_IMM = 0x09, ORA_ZPG = 0x05, ORA_ZPX = 0x15, ORA_ABS = 0x0D, ORA_ABX = 0x1D, ORA_ABY = 0x19, ORA_IDX = 0x01, ORA_IDY = 0x11,
-        ASL_ACC = 0x0A, ASL_ZPG = 0x06, ASL_ZPX = 0x16, ASL_ABS = 0x0E, ASL_ABX = 0x1E,
-        LSR_ACC = 0x4A, LSR_ZPG = 0x46, LSR_ZPX = 0x56, LSR_ABS = 0x4E, LSR_ABX = 0x5E,
-        ROL_ACC = 0x2A, ROL_ZPG = 0x26, ROL_ZPX = 0x36, ROL_ABS = 0x2E, ROL_ABX = 0x3E,
-        ROR_ACC = 0x6A, ROR_ZPG = 0x66, ROR_ZPX = 0x76, ROR_ABS = 0x6E, ROR_ABX = 0x7E,
-        ADC_IMM = 0x69, ADC_ZPG = 0x65, ADC_ZPX = 0x75, ADC_ABS = 0x6D, ADC_ABX = 0x7D, ADC_ABY = 0x79, ADC_IDX = 0x61, ADC_IDY = 0x71,
-        SBC_IMM = 0xE9, SBC_ZPG = 0xE5, SBC_ZPX = 0xF5, SBC_ABS = 0xED, SBC_ABX = 0xFD, SBC_ABY = 0xF9, SBC_IDX = 0xE1, SBC_IDY = 0xF1,
-        BIT_ZPG = 0x24, BIT_ABS = 0x2C,
-        CMP_IMM = 0xC9, CMP_ZPG = 0xC5, CMP_ZPX = 0xD5, CMP_ABS = 0xCD, CMP_ABX = 0xDD, CMP_ABY = 0xD9, CMP_IDX = 0xC1, CMP_IDY = 0xD1,
-        CPX_IMM = 0xE0, CPX_ZPG = 0xE4, CPX_ABS = 0xEC,
-        CPY_IMM = 0xC0, CPY_ZPG = 0xC4, CPY_ABS = 0xCC,
-        PHA_IMP = 0x48, PHP_IMP = 0x08,
-        PLA_IMP = 0x68, PLP_IMP = 0x28,
-        BCC_REL = 0x90, BCS_REL = 0xB0, BEQ_REL = 0xF0, BMI_REL = 0x30, BNE_REL = 0xD0, BPL_REL = 0x10, BVC_REL = 0x50, BVS_REL = 0x70,
-        JMP_ABS = 0x4C, JMP_IND = 0x6C,
-        JSR_ABS = 0x20, RTS_IMP = 0x60,
-        BRK_IMP = 0x00, RTI_IMP = 0x40,
-        NOP_IMP = 0xEA,
-        INVALID_INSTRUCTION = 0xFF,
-    };
 
-    const AddrMode INSTR_GET_ADDR_MODE [256] = {
-    // -0                                       -8
-        IMP, IDX, NUL, NUL, NUL, ZPG, ZPG, NUL, IMP, IMM, ACC, NUL, NUL, ABS, ABS, NUL,     // 0-
-        REL, IDY, NUL, NUL, NUL, ZPX, ZPX, NUL, IMP, ABY, NUL, NUL, NUL, ABX, ABX, NUL,     // 1-
-        ABS, IDX, NUL, NUL, ZPG, ZPG, ZPG, NUL, IMP, IMM, ACC, NUL, ABS, ABS, ABS, NUL,     // 2-
-        REL, IDY, NUL, NUL, NUL, ZPX, ZPX, NUL, IMP, ABY, NUL, NUL, NUL, ABX, ABX, NUL,     // 3-
-        IMP, IDX, NUL, NUL, NUL, ZPG, ZPG, NUL, IMP, IMM, ACC, NUL, ABS, ABS, ABS, NUL,     // 4-
-        REL, IDY, NUL, NUL, NUL, ZPX, ZPX, NUL, IMP, ABY, NUL, NUL, NUL, ABX, ABX, NUL,     // 5-
-        IMP, IDX, NUL, NUL, NUL, ZPG, ZPG, NUL, IMP, IMM, ACC, NUL, IND, ABS, ABS, NUL,     // 6-
-        REL, IDY, NUL, NUL, NUL, ZPX, ZPX, NUL, IMP, ABY, NUL, NUL, NUL, ABX, ABX, NUL,     // 7-
-        NUL, IDX, NUL, NUL, ZPG, ZPG, ZPG, NUL, IMP, NUL, IMP, NUL, ABS, ABS, ABS, NUL,     // 8-
-        REL, IDY, NUL, NUL, ZPX, ZPX, ZPY, NUL, IMP, ABY, IMP, NUL, NUL, ABX, NUL, NUL,     // 9-
-        IMM, IDX, IMM, NUL, ZPG, ZPG, ZPG, NUL, IMP, IMM, IMP, NUL, ABS, ABS, ABS, NUL,     // A-
-        REL, IDY, NUL, NUL, ZPX, ZPX, ZPY, NUL, IMP, ABY, IMP, NUL, ABX, ABX, ABY, NUL,     // B-
-        IMM, IDX, NUL, NUL, ZPG, ZPG, ZPG, NUL, IMP, IMM, IMP, NUL, ABS, ABS, ABS, NUL,     // C-
-        REL, IDY, NUL, NUL, NUL, ZPX, ZPX, NUL, IMP, ABY, NUL, NUL, NUL, ABX, ABX, NUL,     // D-
-        IMM, IDX, NUL, NUL, ZPG, ZPG, ZPG, NUL, IMP, IMM, IMP, NUL, ABS, ABS, ABS, NUL,     // E-
-        REL, IDY, NUL, NUL, NUL, ZPX, ZPX, NUL, IMP, ABY, NUL, NUL, NUL, ABX, ABX, NUL,     // F-
-    };
+    // Handler table, one specialized handler per valid opcode
+    template <std::size_t OPCODE>
+    constexpr CPU::Handler handler_for() {
+        if constexpr (instr_operation(OPCODE) == OP_NUL) {
+            return nullptr;
+        } else {
+            return &CPU::handler<OPCODE>;
+        }
+    }
 
-    // Base number of cycles used per instruction, actual may be more on certain circumstances
-    const u8 NUM_CYCLES_BASE [256] = {
-    // -0                      -8
-        7, 6, 0, 0, 0, 3, 5, 0, 3, 2, 2, 0, 0, 4, 6, 0,     // 0-
-        2, 5, 0, 0, 0, 4, 6, 0, 2, 4, 0, 0, 0, 4, 7, 0,     // 1-
-        6, 6, 0, 0, 3, 3, 5, 0, 4, 2, 2, 0, 4, 4, 6, 0,     // 2-
-        2, 5, 0, 0, 0, 4, 6, 0, 2, 4, 0, 0, 0, 4, 7, 0,     // 3-
-        6, 6, 0, 0, 0, 3, 5, 0, 3, 2, 2, 0, 3, 4, 6, 0,     // 4-
-        2, 5, 0, 0, 0, 4, 6, 0, 2, 4, 0, 0, 0, 4, 7, 0,     // 5-
-        6, 6, 0, 0, 0, 3, 5, 0, 4, 2, 2, 0, 5, 4, 6, 0,     // 6-
-        2, 5, 0, 0, 0, 4, 6, 0, 2, 4, 0, 0, 0, 4, 7, 0,     // 7-
-        0, 6, 0, 0, 3, 3, 3, 0, 2, 0, 2, 0, 4, 4, 4, 0,     // 8-
-        2, 6, 0, 0, 4, 4, 4, 0, 2, 5, 2, 0, 0, 5, 0, 0,     // 9-
-        2, 6, 2, 0, 3, 3, 3, 0, 2, 2, 2, 0, 4, 4, 4, 0,     // A-
-        2, 5, 0, 0, 4, 4, 4, 0, 2, 4, 2, 0, 4, 4, 4, 0,     // B-
-        2, 6, 0, 0, 3, 3, 5, 0, 2, 2, 2, 0, 4, 4, 6, 0,     // C-
-        2, 5, 0, 0, 0, 4, 6, 0, 2, 4, 0, 0, 0, 4, 7, 0,     // D-
-        2, 6, 0, 0, 3, 3, 5, 0, 2, 2, 2, 0, 4, 4, 6, 0,     // E-
-        2, 5, 0, 0, 0, 4, 6, 0, 2, 4, 0, 0, 0, 4, 7, 0,     // F-
-    };
+    template <std::size_t... OPCODES>
+    constexpr std::array<CPU::Handler, 256> make_handler_table(std::index_sequence<OPCODES...>) {
+        return {{ handler_for<OPCODES>()... }};
+    }
 
-    /*
-     * Number of bytes for each instruction, used to update PC
-     * JMP, BRANCH, SUBROUTINE, BRK, RTI instructions set to 0 bytes, to change PC manually
-     */
-    const u8 INSTR_BYTES [256] = {
-    // -0                      -8
-        0, 2, 0, 0, 0, 2, 2, 0, 1, 2, 1, 0, 0, 3, 3, 0,    // 0-
-        0, 2, 0, 0, 0, 2, 2, 0, 1, 3, 0, 0, 0, 3, 3, 0,    // 1-
-        0, 2, 0, 0, 2, 2, 2, 0, 1, 2, 1, 0, 3, 3, 3, 0,    // 2-
-        0, 2, 0, 0, 0, 2, 2, 0, 1, 3, 0, 0, 0, 3, 3, 0,    // 3-
-        0, 2, 0, 0, 0, 2, 2, 0, 1, 2, 1, 0, 0, 3, 3, 0,    // 4-
-        0, 2, 0, 0, 0, 2, 2, 0, 1, 3, 0, 0, 0, 3, 3, 0,    // 5-
-        0, 2, 0, 0, 0, 2, 2, 0, 1, 2, 1, 0, 0, 3, 3, 0,    // 6-
-        0, 2, 0, 0, 0, 2, 2, 0, 1, 3, 0, 0, 0, 3, 3, 0,    // 7-
-        0, 2, 0, 0, 2, 2, 2, 0, 1, 0, 1, 0, 3, 3, 3, 0,    // 8-
-        0, 2, 0, 0, 2, 2, 2, 0, 1, 3, 1, 0, 0, 3, 0, 0,    // 9-
-        2, 2, 2, 0, 2, 2, 2, 0, 1, 2, 1, 0, 3, 3, 3, 0,    // A-
-        0, 2, 0, 0, 2, 2, 2, 0, 1, 3, 1, 0, 3, 3, 3, 0,    // B-
-        2, 2, 0, 0, 2, 2, 2, 0, 1, 2, 1, 0, 3, 3, 3, 0,    // C-
-        0, 2, 0, 0, 0, 2, 2, 0, 1, 3, 0, 0, 0, 3, 3, 0,    // D-
-        2, 2, 0, 0, 2, 2, 2, 0, 1, 2, 1, 0, 3, 3, 3, 0,    // E-
-        0, 2, 0, 0, 0, 2, 2, 0, 1, 3, 0, 0, 0, 3, 3, 0,    // F-
-    };
+    inline constexpr std::array<CPU::Handler, 256> HANDLERS = make_handler_table(std::make_index_sequence<256>());
+
+    // Same for instructions with a decoded operand
+    template <std::size_t OPCODE>
+    constexpr DecodedHandler decoded_handler_for() {
+        if constexpr (instr_operation(OPCODE) == OP_NUL) {
+            return nullptr;
+        } else {
+            return &CPU::decoded_handler<OPCODE>;
+        }
+    }
+
+    template <std::size_t... OPCODES>
+    constexpr std::array<DecodedHandler, 256> make_decoded_handler_table(std::index_sequence<OPCODES...>) {
+        return {{ decoded_handler_for<OPCODES>()... }};
+    }
+
+    inline constexpr std::array<DecodedHandler, 256> DECODED_HANDLERS =
+        make_decoded_handler_table(std::make_index_sequence<256>());
 }
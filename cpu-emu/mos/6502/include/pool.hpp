@@ -0,0 +1,88 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "types.hpp"
+#include "mos6502.hpp"
+#include "arena.hpp"
+
+namespace mos6502 {
+    // Register file of a job, defaults are those of CPU::reset()
+    struct Registers {
+        u16 PC = RESET_START;
+        u8  A  = 0;
+        u8  X  = 0;
+        u8  Y  = 0;
+        u8  S  = 0xFF;
+        u8  SR = FLAG_INIT;
+    };
+
+    // One program run: memory image, initial registers and cycle budget
+    struct Job {
+        // State the job starts from instead of reset(), its registers replace regs, shared by jobs
+        Snapshot start;
+        const u8* image = nullptr;  // Copied to memory at origin, not owned, may be shared by jobs
+        u32 imageSize = 0;
+        u16 origin = 0;
+        Registers regs;
+        s32 numCycles = 0;
+        // Called on the worker's CPU before it runs, to schedule events or assert interrupts. They are
+        // dropped before the next job.
+        std::function<void(CPU&)> setup;
+        // Stops the job early when it returns true, checked every checkCycles cycles
+        std::function<bool(const CPU&)> done;
+        s32 checkCycles = 10000;
+        bool keepMemory = false;    // Copy the final memory to the result
+    };
+
+    struct JobResult {
+        Registers regs;
+        s32 cycles = 0;             // Cycles executed, -1 after an invalid opcode
+        bool done = false;          // Job::done returned true
+        u32 worker = 0;             // Worker that ran the job
+        std::vector<u8> ram;        // Final memory if Job::keepMemory
+    };
+
+    struct PoolStats {
+        u64 jobs = 0;
+        u64 cycles = 0;             // Cycles executed by all jobs
+        u64 steals = 0;             // Jobs taken from another worker's deque
+        double seconds = 0;         // Wall time of the last run()
+        std::vector<u64> jobsByWorker;
+    };
+
+    class WorkDeque;
+
+    /*
+     * Runs jobs on all cores. Jobs are dealt to one deque per worker in contiguous chunks, a worker
+     * takes its own jobs from the back and, once out of work, steals from the front of the others.
+     * Each worker has one CPU allocated with the pool and reset for every job, taken from arena when
+     * one is given.
+     */
+    class InstancePool {
+     public:
+        // numWorkers 0 uses one worker per hardware thread, arena is not owned and must outlive the pool
+        explicit InstancePool(u32 numWorkers = 0, Engine engine = ENGINE_SWITCH, InstanceArena* arena = nullptr);
+        InstancePool(const InstancePool&) = delete;
+        InstancePool& operator=(const InstancePool&) = delete;
+        ~InstancePool();
+
+        // Runs every job and waits for all of them, results in job order
+        std::vector<JobResult> run(const std::vector<Job>& jobs);
+        const PoolStats& stats() const { return poolStats; }
+        u32 num_workers() const { return (u32) cpus.size(); }
+
+     private:
+        void work(u32 worker, const std::vector<Job>& jobs, std::vector<JobResult>& results);
+        bool next_job(u32 worker, u32& job);
+        void run_job(CPU& cpu, const Job& job, JobResult& result);
+
+        Engine engine;
+        InstanceArena* arena;
+        std::vector<CPU*> cpus;
+        std::vector<std::unique_ptr<WorkDeque>> deques;
+        PoolStats poolStats;
+    };
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <vector>
+
+#include "types.hpp"
+
+namespace mos6502 {
+    /*
+     * Lock-free ring of bytes between one producer thread and one consumer thread. Indices run freely
+     * and each is stored only by its own side (release) and loaded by the other (acquire). Each side
+     * caches the other's index and reloads it only when the ring looks full or empty to it, so a push
+     * or pop mostly touches its own cache line.
+     */
+    class ByteRing {
+     public:
+        // Capacity rounded up to a power of two
+        explicit ByteRing(u32 capacity = 1 << 16) {
+            u32 size = 1;
+            while (size < capacity) {
+                size <<= 1;
+            }
+            buffer.resize(size);
+            mask = size - 1;
+        }
+        ByteRing(const ByteRing&) = delete;
+        ByteRing& operator=(const ByteRing&) = delete;
+
+        // Producer, false when full
+        inline bool push(u8 byte) {
+            u32 h = head.load(std::memory_order_relaxed);
+            if (h - tailCache == capacity()) {
+                tailCache = tail.load(std::memory_order_acquire);
+                if (h - tailCache == capacity()) {
+                    return false;
+                }
+            }
+            buffer[h & mask] = byte;
+            head.store(h + 1, std::memory_order_release);
+            return true;
+        }
+
+        // Producer, returns how many bytes fit
+        u32 push(const u8* data, u32 size) {
+            u32 h = head.load(std::memory_order_relaxed);
+            if (capacity() - (h - tailCache) < size) {
+                tailCache = tail.load(std::memory_order_acquire);
+            }
+            size = std::min(size, capacity() - (h - tailCache));
+            u32 first = std::min(size, capacity() - (h & mask));
+            memcpy(&buffer[h & mask], data, first);
+            memcpy(&buffer[0], data + first, size - first);
+            head.store(h + size, std::memory_order_release);
+            return size;
+        }
+
+        // Consumer, returns how many bytes were taken
+        u32 pop(u8* data, u32 max) {
+            u32 t = tail.load(std::memory_order_relaxed);
+            if (headCache - t < max) {
+                headCache = head.load(std::memory_order_acquire);
+            }
+            u32 size = std::min(max, headCache - t);
+            u32 first = std::min(size, capacity() - (t & mask));
+            memcpy(data, &buffer[t & mask], first);
+            memcpy(data + first, &buffer[0], size - first);
+            tail.store(t + size, std::memory_order_release);
+            return size;
+        }
+
+        // Either side, may be out of date by the time it returns
+        u32 size() const { return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire); }
+        bool empty() const { return size() == 0; }
+        bool full() const { return size() == capacity(); }
+        u32 capacity() const { return mask + 1; }
+
+     private:
+        std::vector<u8> buffer;
+        u32 mask;
+        // Producer's line
+        alignas(64) std::atomic<u32> head{0};
+        u32 tailCache = 0;
+        // Consumer's line
+        alignas(64) std::atomic<u32> tail{0};
+        u32 headCache = 0;
+    };
+}
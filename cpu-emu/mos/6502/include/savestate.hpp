@@ -0,0 +1,60 @@
+#pragma once
+
+#include "types.hpp"
+#include "memory.hpp"
+#include "mos6502.hpp"
+
+namespace mos6502 {
+    // Bumped whenever saved states would no longer load the same
+    constexpr u32 SAVE_STATE_VERSION = 2;
+    // Page data starts here, the header is padded to a host page so it can be mapped in place
+    constexpr u32 SAVE_STATE_DATA = 0x1000;
+
+    enum SaveFormat {
+        SAVE_RAW,           // Pages as they are, loaded by mapping the file
+        SAVE_COMPRESSED,    // Pages run-length encoded one after the other, loaded by decoding them
+    };
+
+    // What a page of the saved address space was
+    enum SavedPage : u8 {
+        SAVED_ZERO,     // RAM reading zero, no data
+        SAVED_RAM,
+        SAVED_ROM,      // Read-only, stays so when loaded
+        SAVED_DEVICE,   // No data, loaded as zero RAM
+    };
+
+    // Start of a save state file, in host byte order
+    struct SaveStateHeader {
+        char magic[8];              // "6502SAVE"
+        u32 version;                // SAVE_STATE_VERSION
+        u32 format;                 // SaveFormat
+        u32 dataOffset;             // SAVE_STATE_DATA
+        u32 pageSize;               // PAGE_SIZE
+        u32 numDataPages;           // Pages with data, one after the other from dataOffset on
+        u32 nmiPending;             // NMI latched and not taken yet
+        u64 cycles;                 // CPU::cycles
+        u16 PC;
+        u8  A, X, Y, S, SR;
+        u8  reserved;
+        u8  kinds[NUM_PAGES];       // SavedPage of each page
+        u32 data[NUM_PAGES];        // Index of each page's data among the data pages
+    };
+    static_assert(sizeof(SaveStateHeader) <= SAVE_STATE_DATA, "Header fits before the page data");
+
+    /*
+     * Registers and memory pages of a CPU in a file.
+     * Raw states keep every page with data at a page aligned offset, so loading one maps the file
+     * read-only and points the pages of a sparse memory at it copy-on-write: nothing is read or copied
+     * until it is accessed, and a page is copied only by the first write to it. Pages reading zero are
+     * left out. Compressed states run-length encode the pages for archiving, they are decoded into
+     * memory when loaded. Devices are not saved, their pages load as RAM.
+     */
+    class SaveState {
+     public:
+        // False if the file cannot be written
+        static bool save(const CPU& cpu, const char* path, SaveFormat format = SAVE_RAW);
+        // State with sparse memory, copy it or CPU::restore() it to run it, nullptr for a missing,
+        // damaged or other version file
+        static Snapshot load(const char* path);
+    };
+}
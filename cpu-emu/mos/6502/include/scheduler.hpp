@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "types.hpp"
+
+namespace mos6502 {
+    constexpr u64 NO_EVENT = UINT64_MAX;
+
+    /*
+     * Events at absolute cycles of CPU::cycles, kept in a min-heap. CPU::execute() runs the engine
+     * straight to the earliest deadline, runs the events due and continues, so nothing is polled per
+     * instruction. Events run at the first instruction boundary at or after their cycle, in cycle
+     * order, those at the same cycle in the order they were scheduled.
+     */
+    class Scheduler {
+     public:
+        // Gets the cycle it was scheduled for, may schedule further events
+        typedef std::function<void(u64 cycle)> Callback;
+
+        Scheduler() = default;
+        // Copies start empty, callbacks belong to what scheduled them. Assigning drops this one's.
+        Scheduler(const Scheduler&) {}
+        Scheduler& operator=(const Scheduler&) { clear(); return *this; }
+
+        // Returns an id for cancel()
+        u32 schedule(u64 cycle, Callback callback);
+        // False if the event already ran or was cancelled
+        bool cancel(u32 id);
+        // Runs the events due at now, returns how many ran
+        u32 run_due(u64 now);
+
+        // Cycle of the earliest event, NO_EVENT without any
+        u64 next() const { return heap.empty() ? NO_EVENT : heap.front().cycle; }
+        bool empty() const { return heap.empty(); }
+        u32 size() const { return heap.size(); }
+        void clear() { heap.clear(); numClears += 1; }
+        // Times clear() was called, for holders of ids to tell theirs are gone
+        u32 clears() const { return numClears; }
+
+     private:
+        struct Event {
+            u64 cycle;
+            u64 order;      // Scheduling order among events of the same cycle
+            u32 id;
+            Callback callback;
+            // Heap keeps the largest on top, so the earliest event is the "largest"
+            bool operator<(const Event& other) const {
+                return cycle != other.cycle ? cycle > other.cycle : order > other.order;
+            }
+        };
+
+        std::vector<Event> heap;
+        u64 numScheduled = 0;
+        u32 nextId = 1;
+        u32 numClears = 0;
+    };
+}
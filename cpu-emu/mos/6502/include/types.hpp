@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+
+// typedefs
+typedef bool            u1;
+typedef std::uint8_t    u8;
+typedef std::uint16_t   u16;
+typedef std::uint32_t   u32;
+typedef std::uint64_t   u64;
+
+typedef std::int8_t     s8;
+typedef std::int32_t    s32;
+typedef std::int64_t    s64;
+
+// Bytes to Wyde
+inline u16 B2W(u8 low, u8 high) { return (high << 8) + low; }
+
+inline u8 lowByte(u16 x)  { return x & 0x000F; }
+inline u8 highByte(u16 x) { return x >> 8; }
+inline u1 signBit(u8 x)   { return x >> 7; }
+inline u1 lowBit(u8 x)    { return x & 0x01;}
+// Binary number (in 4-bit packed BCD) to decimal value
+// Note invalid BCD numbers are undocumented and undefined behavior
+inline u8 bin_2_dec(u8 x) { return (((x & 0xF0) >> 4) * 10) + (x & 0x0F); }
+inline u8 dec_2_bin(u8 x) { return ((x / 10) << 4) | (x % 10); }
+
+inline u1 onDifferentPages(u16 x, u16 y) { return highByte(x) != highByte(y); }
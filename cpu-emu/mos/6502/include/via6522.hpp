@@ -0,0 +1,110 @@
+#pragma once
+
+#include <functional>
+
+#include "types.hpp"
+#include "clocked_device.hpp"
+
+namespace mos6502 {
+    // Registers, repeated every 16 bytes of the page
+    enum ViaRegister : u8 {
+        VIA_ORB = 0x0, VIA_ORA = 0x1, VIA_DDRB = 0x2, VIA_DDRA = 0x3,
+        VIA_T1CL = 0x4, VIA_T1CH = 0x5, VIA_T1LL = 0x6, VIA_T1LH = 0x7,
+        VIA_T2CL = 0x8, VIA_T2CH = 0x9, VIA_SR = 0xA, VIA_ACR = 0xB,
+        VIA_PCR = 0xC, VIA_IFR = 0xD, VIA_IER = 0xE, VIA_ORA_NH = 0xF,
+    };
+
+    // IFR / IER bits
+    constexpr u8 VIA_IRQ_CA2 = 0x01;
+    constexpr u8 VIA_IRQ_CA1 = 0x02;
+    constexpr u8 VIA_IRQ_SR  = 0x04;
+    constexpr u8 VIA_IRQ_CB2 = 0x08;
+    constexpr u8 VIA_IRQ_CB1 = 0x10;
+    constexpr u8 VIA_IRQ_T2  = 0x20;
+    constexpr u8 VIA_IRQ_T1  = 0x40;
+    constexpr u8 VIA_IRQ_ANY = 0x80;
+
+    /*
+     * MOS 6522 VIA: ports A and B, timers 1 and 2, shift register, CA1/CA2/CB1/CB2 interrupt inputs.
+     * Timers are a start cycle and the value loaded then, counters are computed when read and
+     * underflows are events at their cycle, so a running timer costs nothing between them.
+     * Times count from the cycle of the accessing instruction (CPU::now()). Writing T1C-H loads N from
+     * the latch: the counter reads N down to 0, 0xFFFF one cycle later with the interrupt flag set
+     * (N + 1 cycles after the write), then free-running T1 reloads the latch, every N + 2 cycles.
+     * T2 counts the same once per write of T2C-H, or PB6 pulses. The shift register moves a bit every
+     * 2 cycles under phi2, every 2 * (T2 low latch + 2) under T2, or per CB1 rising edge.
+     * Handshake output modes of CA2/CB2 are not modeled, they are manual outputs.
+     */
+    class Via6522 : public ClockedDevice {
+     public:
+        // Raises the IRQ line of cpu as source (one bit)
+        explicit Via6522(CPU& cpu, u32 irqSource = 1);
+        ~Via6522() override;
+
+        // Registers from page on, repeated every 16 bytes
+        void map(u8 page);
+
+        // Pins driven by the outside, bits not set as outputs by DDRA / DDRB read these
+        void set_port_a(u8 pins);
+        void set_port_b(u8 pins);
+        // Pins as driven by the VIA and the outside (PB7 by T1 when ACR bit 7 is set)
+        u8 port_a();
+        u8 port_b();
+        // Control lines in, an edge sets its interrupt flag as PCR selects, CB1 also clocks the shift
+        // register when it is external
+        void set_ca1(bool level);
+        void set_ca2(bool level);
+        void set_cb1(bool level);
+        void set_cb2(bool level);
+        // Negative edge on PB6, counted by T2 in pulse counting mode
+        void pulse_pb6();
+
+        // Every byte shifted out, when the shift register finished it
+        std::function<void(u8)> onShiftOut;
+
+     protected:
+        void advance(u64 cycle) override;
+        u8 read_register(u16 addr) override;
+        void write_register(u16 addr, u8 val) override;
+        void event(u64 cycle) override;
+
+     private:
+        bool t1_free_run() const { return (acr & 0x40) != 0; }
+        bool t2_counts_pulses() const { return (acr & 0x20) != 0; }
+        u8 sr_mode() const { return (acr >> 2) & 0x07; }
+        u16 t1_counter(u64 cycle) const;
+        u16 t2_counter(u64 cycle) const;
+        u32 sr_bit_cycles() const;
+        void start_shift(u64 cycle);
+        void shift_bits(u32 numBits);
+        void control_edge(bool old, bool level, u8 flag, bool positive);
+        void update();
+
+        u32 irqSource;
+        u8 ora = 0, orb = 0, ddra = 0, ddrb = 0;
+        u8 pinsA = 0xFF, pinsB = 0xFF;
+        u8 ira = 0, irb = 0;            // Latched inputs (ACR bits 0, 1)
+        u8 acr = 0, pcr = 0, ifr = 0, ier = 0;
+        bool ca1 = true, ca2 = true, cb1 = true, cb2 = true;
+        bool irq = false;
+
+        u16 t1Latch = 0;
+        u64 t1Base = 0;                 // Cycle T1 was loaded
+        u16 t1Value = 0;                // Value loaded then
+        bool t1Underflowed = true;      // Since it was loaded
+        bool t1Armed = false;           // Underflow sets the flag
+        bool pb7 = true;
+
+        u8 t2LatchLow = 0;
+        u64 t2Base = 0;
+        u16 t2Value = 0;                // Value loaded at t2Base, or the count in pulse counting mode
+        bool t2Armed = false;
+
+        u8 sr = 0;
+        u64 srBase = 0;                 // Cycle shifting started or last bit
+        u32 srBits = 0;                 // Bits left to shift, 0 when stopped
+        u8 srOut = 0;                   // Byte being shifted out
+
+        u64 eventCycle = NO_EVENT;      // Of the scheduled event
+    };
+}
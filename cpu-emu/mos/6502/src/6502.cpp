@@ -2,29 +2,191 @@
 Emulate the MOS 6502 cpu
 */
 
+#include <algorithm>
 #include <cstdio>
+#include <cstring>
 
 #include "mos6502.hpp"
 
 
+// Must follow order in Engine enum
+static const char* ENGINE_NAMES[mos6502::NUM_ENGINES] = {
+    "switch",
+    "threaded",
+    "table",
+    "blocks",
+    "jit",
+    "aot",
+};
+
+bool mos6502::engine_from_name(const char* name, Engine& engine) {
+    for (u32 i = 0; i < NUM_ENGINES; ++i) {
+        if (strcmp(name, ENGINE_NAMES[i]) == 0) {
+            engine = (Engine) i;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* mos6502::engine_name(Engine engine) {
+    return (engine < NUM_ENGINES) ? ENGINE_NAMES[engine] : "unknown";
+}
+
 void mos6502::CPU::reset() {
-    // Clear RAM
-    for (u32 i = 0; i < MEM_MAX; ++i)
-        ram[i] = 0;
-    // Initial memory loaded?
-    ram[RESET_VEC_LOC] = lowByte(RESET_START);
-    ram[RESET_VEC_LOC + 1] = highByte(RESET_START);
+    // Code decoded from pages left as they are stays, with its translation
+    std::bitset<NUM_PAGES> pages = memory.pages_to_redo(baseline ? &baseline->memory : nullptr);
+    if (baseline) {
+        // The baseline brings its own vector
+        memory.restore(baseline->memory);
+    } else {
+        // Clear RAM, mapped pages are left alone
+        memory.clear_ram();
+        // Initial memory loaded? A ROM keeps its own vector
+        memory.write(RESET_VEC_LOC, lowByte(RESET_START));
+        memory.write(RESET_VEC_LOC + 1, highByte(RESET_START));
+        pages[RESET_VEC_LOC >> 8] = true;
+    }
+    blockCache.invalidate_pages(pages);
     // Reset registers
-    PC = B2W(ram[RESET_VEC_LOC], ram[RESET_VEC_LOC + 1]);
+    PC = B2W(read(RESET_VEC_LOC), read(RESET_VEC_LOC + 1));
     A = 0;
     X = 0;
     Y = 0;
     SR = FLAG_INIT;
     S = 0xff;   // Stack start at top
+    nmiPending = false;
+    irqSources = 0;
+    cycles = 0;
+    events.clear();
+}
+
+// Copies get no events, those belong to devices of this CPU, nor the IRQ lines they hold
+mos6502::Snapshot mos6502::CPU::snapshot() {
+    memory.freeze();
+    std::shared_ptr<CPU> copy = std::make_shared<CPU>(*this);
+    copy->irqSources = 0;
+    return copy;
+}
+
+void mos6502::CPU::restore(const Snapshot& snapshot) {
+    std::bitset<NUM_PAGES> pages = memory.pages_to_redo(&snapshot->memory);
+    memory.restore(snapshot->memory);
+    blockCache.invalidate_pages(pages);
+    PC = snapshot->PC;
+    A = snapshot->A;
+    X = snapshot->X;
+    Y = snapshot->Y;
+    S = snapshot->S;
+    SR = snapshot->SR;
+    cycles = snapshot->cycles;
+    nmiPending = snapshot->nmiPending;
+    // Events and IRQ lines of the timeline left behind, as in reset()
+    irqSources = 0;
+    events.clear();
+}
+
+mos6502::CPU mos6502::CPU::fork() {
+    memory.freeze();
+    CPU copy = *this;
+    copy.irqSources = 0;
+    return copy;
 }
 
 // Returns -1 on illegal instruction
 s32 mos6502::CPU::execute(s32 p_numCycles, bool forever) {
+    s32 executed = 0;
+    while (executed < p_numCycles || forever) {
+        events.run_due(cycles);
+        if (nmiPending) {
+            nmiPending = false;
+            executed += hardware_interrupt(NON_MASK_INT_VEC_LOC);
+            continue;
+        }
+        if (irqSources != 0 && !get_flag_i()) {
+            executed += hardware_interrupt(INT_VEC_LOC);
+            continue;
+        }
+        // Straight to the next event, which bounds idle loop skipping as well
+        s64 slice = forever ? (1 << 30) : p_numCycles - executed;
+        slice = (s64) std::min<u64>((u64) slice, events.next() - cycles);
+        s32 ran = run_engine((s32) slice, irqSources != 0);
+        if (ran < 0) {
+            return -1;
+        }
+        executed += ran;
+    }
+    return executed;
+}
+
+s32 mos6502::CPU::run_engine(s32 p_numCycles, bool masked) {
+    running = true;
+    sliceCycles = p_numCycles;
+    s32 ran;
+    if (masked) {
+        ran = run_masked(p_numCycles);
+    } else {
+        switch (engine) {
+            case ENGINE_THREADED:   ran = execute_threaded(p_numCycles); break;
+            case ENGINE_TABLE:      ran = execute_table(p_numCycles); break;
+            case ENGINE_BLOCKS:     ran = execute_blocks(p_numCycles); break;
+            case ENGINE_JIT:        ran = execute_jit(p_numCycles); break;
+            case ENGINE_AOT:        ran = execute_aot(p_numCycles); break;
+            case ENGINE_SWITCH:
+            default:                ran = execute_switch(p_numCycles); break;
+        }
+    }
+    running = false;
+    // Engines leave the budget they did not use, illegal instructions included
+    cycles += p_numCycles - numCycles - cyclesCut;
+    if (ran >= 0) {
+        ran -= cyclesCut;
+    }
+    cyclesCut = 0;
+    return ran;
+}
+
+// Same handlers as the table engine, checking I after each instruction
+s32 mos6502::CPU::run_masked(s32 p_numCycles) {
+    numCycles = p_numCycles;
+    load_lazy_flags();
+    while (numCycles > 0 && irqSources != 0 && get_flag_i()) {
+        Handler handler = HANDLERS[getCurrentInstr()];
+        if (handler == nullptr) {
+            sync_flags();
+            return -1;
+        }
+        handler(*this);
+    }
+    sync_flags();
+    return p_numCycles - numCycles;
+}
+
+s32 mos6502::CPU::hardware_interrupt(u16 vec) {
+    push(highByte(PC));
+    push((u8) PC);
+    push((SR | FLAG_MASK_NOT_USED) & ~FLAG_MASK_B);
+    set_flag_i(1);
+    PC = B2W(read(vec), read(vec + 1));
+    cycles += 7;
+    return 7;
+}
+
+void mos6502::CPU::set_irq(bool asserted, u32 source) {
+    if (asserted) {
+        irqSources |= source;
+        stop_engine();
+    } else {
+        irqSources &= ~source;
+    }
+}
+
+void mos6502::CPU::nmi() {
+    nmiPending = true;
+    stop_engine();
+}
+
+s32 mos6502::CPU::execute_switch(s32 p_numCycles, bool forever) {
     s32 numCyclesSave = p_numCycles;  // Original number of cycles to execute
     numCycles = p_numCycles;
     u8 currentInstr;
@@ -32,23 +194,23 @@ s32 mos6502::CPU::execute(s32 p_numCycles, bool forever) {
     while (numCycles > 0 || forever) {
         // Get instruction and some common information needed when executing instruction
         currentInstr = getCurrentInstr();
-        am = INSTR_GET_ADDR_MODE[currentInstr];
-        avo_ret = addr_mode_get(am);
+        AddrMode am = INSTR_GET_ADDR_MODE[currentInstr];
+        avo op = addr_mode_get(am);
 
         // Execute instruction
         switch (currentInstr) {
             case LDA_IMM: case LDA_ZPG: case LDA_ZPX: case LDA_ABS: case LDA_ABX: case LDA_ABY: case LDA_IDX: case LDA_IDY :
-                load(A);                                                        break;
+                load(am, op, A);                                                break;
             case LDX_IMM: case LDX_ZPG: case LDX_ZPY: case LDX_ABS: case LDX_ABY:
-                load(X);                                                        break;
+                load(am, op, X);                                                break;
             case LDY_IMM: case LDY_ZPG: case LDY_ZPX: case LDY_ABS: case LDY_ABX:
-                load(Y);                                                        break;
+                load(am, op, Y);                                                break;
             case STA_ZPG: case STA_ZPX: case STA_ABS: case STA_ABX: case STA_ABY: case STA_IDX: case STA_IDY:
-                store(A);                                                       break;
+                store(op, A);                                                   break;
             case STX_ZPG: case STX_ZPY: case STX_ABS:
-                store(X);                                                       break;
+                store(op, X);                                                   break;
             case STY_ZPG: case STY_ZPX: case STY_ABS:
-                store(Y);                                                       break;
+                store(op, Y);                                                   break;
             case TAX_IMP: transfer(A, X, true);                                 break;
             case TAY_IMP: transfer(A, Y, true);                                 break;
             case TSX_IMP: transfer(S, X, true);                                 break;
@@ -64,54 +226,54 @@ s32 mos6502::CPU::execute(s32 p_numCycles, bool forever) {
             case SED_IMP: set_flag_d(1);                                        break;
             case SEI_IMP: set_flag_i(1);                                        break;
             case INC_ZPG: case INC_ZPX: case INC_ABS: case INC_ABX:
-                inc_dec(1);                                                     break;
-            case INX_IMP: inc_dec(1, &X);                                       break;
-            case INY_IMP: inc_dec(1, &Y);                                       break;
+                inc_dec(am, op, 1);                                             break;
+            case INX_IMP: inc_dec(am, op, 1, &X);                               break;
+            case INY_IMP: inc_dec(am, op, 1, &Y);                               break;
             case DEC_ZPG: case DEC_ZPX: case DEC_ABS: case DEC_ABX:
-                inc_dec(-1);                                                    break;
-            case DEX_IMP: inc_dec(-1, &X);                                      break;
-            case DEY_IMP: inc_dec(-1, &Y);                                      break;
+                inc_dec(am, op, -1);                                            break;
+            case DEX_IMP: inc_dec(am, op, -1, &X);                              break;
+            case DEY_IMP: inc_dec(am, op, -1, &Y);                              break;
             case AND_ZPG: case AND_IMM: case AND_ZPX: case AND_ABS: case AND_ABX: case AND_ABY: case AND_IDX: case AND_IDY:
-                arith(&CPU::bitwise_and);                                       break;
+                arith(am, op, &CPU::bitwise_and);                               break;
             case EOR_IMM: case EOR_ZPG: case EOR_ZPX: case EOR_ABS: case EOR_ABX: case EOR_ABY: case EOR_IDX: case EOR_IDY:
-                arith(&CPU::bitwise_eor);                                       break;
+                arith(am, op, &CPU::bitwise_eor);                               break;
             case ORA_IMM: case ORA_ZPG: case ORA_ZPX: case ORA_ABS: case ORA_ABX: case ORA_ABY: case ORA_IDX: case ORA_IDY:
-                arith(&CPU::bitwise_or);                                        break;
+                arith(am, op, &CPU::bitwise_or);                                break;
             case ASL_ACC: case ASL_ZPG: case ASL_ZPX: case ASL_ABS: case ASL_ABX:
-                shift_rot(&CPU::shift_left);                                    break;
+                shift_rot(am, op, &CPU::shift_left);                            break;
             case LSR_ACC: case LSR_ZPG: case LSR_ZPX: case LSR_ABS: case LSR_ABX:
-                shift_rot(&CPU::shift_right);                                   break;
+                shift_rot(am, op, &CPU::shift_right);                           break;
             case ROL_ACC: case ROL_ZPG: case ROL_ZPX: case ROL_ABS: case ROL_ABX:
-                shift_rot(&CPU::rotate_left);                                   break;
+                shift_rot(am, op, &CPU::rotate_left);                           break;
             case ROR_ACC: case ROR_ZPG: case ROR_ZPX: case ROR_ABS: case ROR_ABX:
-                shift_rot(&CPU::rotate_right);                                  break;
+                shift_rot(am, op, &CPU::rotate_right);                          break;
             case ADC_IMM: case ADC_ZPG: case ADC_ZPX: case ADC_ABS: case ADC_ABX: case ADC_ABY: case ADC_IDX: case ADC_IDY:
-                arith(&CPU::add);                                               break;
+                arith(am, op, &CPU::add);                                       break;
             case SBC_IMM: case SBC_ZPG: case SBC_ZPX: case SBC_ABS: case SBC_ABX: case SBC_ABY: case SBC_IDX: case SBC_IDY:
-                arith(&CPU::sub);                                               break;
+                arith(am, op, &CPU::sub);                                       break;
             case BIT_ZPG: case BIT_ABS:
-                bit();                                                          break;
+                bit(am, op);                                                    break;
             case CMP_IMM: case CMP_ZPG: case CMP_ZPX: case CMP_ABS: case CMP_ABX: case CMP_ABY: case CMP_IDX: case CMP_IDY:
-                cmp(A);                                                         break;
+                cmp(am, op, A);                                                 break;
             case CPX_IMM: case CPX_ZPG: case CPX_ABS:
-                cmp(X);                                                         break;
+                cmp(am, op, X);                                                 break;
             case CPY_IMM: case CPY_ZPG: case CPY_ABS:
-                cmp(Y);                                                         break;
+                cmp(am, op, Y);                                                 break;
             case JMP_ABS: case JMP_IND:
-                jmp();                                                          break;
+                jmp(op);                                                        break;
             case PHA_IMP: push(A);                                              break;
             case PHP_IMP: push(SR);                                             break;
             case PLA_IMP: A = pull(); set_ZN_flags(A);                          break;
             case PLP_IMP: SR = pull();                                          break;
-            case BCC_REL: branch(get_flag_c() == 0);                            break;
-            case BCS_REL: branch(get_flag_c() == 1);                            break;
-            case BEQ_REL: branch(get_flag_z() == 1);                            break;
-            case BMI_REL: branch(get_flag_n() == 1);                            break;
-            case BNE_REL: branch(get_flag_z() == 0);                            break;
-            case BPL_REL: branch(get_flag_n() == 0);                            break;
-            case BVC_REL: branch(get_flag_v() == 0);                            break;
-            case BVS_REL: branch(get_flag_v() == 1);                            break;
-            case JSR_ABS: jump_sub_routine();                                   break;
+            case BCC_REL: branch(op, get_flag_c() == 0);                        break;
+            case BCS_REL: branch(op, get_flag_c() == 1);                        break;
+            case BEQ_REL: branch(op, get_flag_z() == 1);                        break;
+            case BMI_REL: branch(op, get_flag_n() == 1);                        break;
+            case BNE_REL: branch(op, get_flag_z() == 0);                        break;
+            case BPL_REL: branch(op, get_flag_n() == 0);                        break;
+            case BVC_REL: branch(op, get_flag_v() == 0);                        break;
+            case BVS_REL: branch(op, get_flag_v() == 1);                        break;
+            case JSR_ABS: jump_sub_routine(op);                                 break;
             case RTS_IMP: return_sub_routine();                                 break;
             case BRK_IMP: generate_interrupt();                                 break;
             case RTI_IMP: return_from_interrupt();                              break;
@@ -130,3 +292,50 @@ s32 mos6502::CPU::execute(s32 p_numCycles, bool forever) {
     }
     return numCyclesSave - numCycles;
 }
+
+
+// Same handlers as the table engine, checking PC before each instruction
+s64 mos6502::CPU::run_to(u16 stopPC, s64 maxCycles) {
+    s64 executed = 0;
+    load_lazy_flags();
+    while (PC != stopPC && executed < maxCycles) {
+        Handler handler = HANDLERS[getCurrentInstr()];
+        if (handler == nullptr) {
+            sync_flags();
+            return -1;
+        }
+        numCycles = 0;
+        handler(*this);
+        executed -= numCycles;
+        cycles -= numCycles;
+    }
+    sync_flags();
+    return executed;
+}
+
+s64 mos6502::CPU::run_until(u64 cycle) {
+    while (cycles < cycle) {
+        if (execute((s32) std::min<u64>(cycle - cycles, 1 << 30)) < 0) {
+            return -1;
+        }
+    }
+    return (s64) (cycles - cycle);
+}
+
+// Returns -1 on illegal instruction
+s32 mos6502::CPU::execute_table(s32 p_numCycles, bool forever) {
+    s32 numCyclesSave = p_numCycles;  // Original number of cycles to execute
+    numCycles = p_numCycles;
+    load_lazy_flags();
+
+    while (numCycles > 0 || forever) {
+        Handler handler = HANDLERS[getCurrentInstr()];
+        if (handler == nullptr) {
+            sync_flags();
+            return -1;
+        }
+        handler(*this);
+    }
+    sync_flags();
+    return numCyclesSave - numCycles;
+}
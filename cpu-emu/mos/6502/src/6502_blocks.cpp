@@ -0,0 +1,243 @@
+/*
+Basic block execution engine for the MOS 6502 cpu
+
+Instructions are decoded once per block (handler and operand), blocks are looked up by PC
+in the block cache. Writes to cached code invalidate the blocks containing it.
+Common sequences are fused into one handler (fusion.cpp) for runs where the whole block fits the
+cycle budget, otherwise the block runs one instruction at a time.
+The jit engine runs the same blocks, translating those executed more than jitThreshold times.
+Both jit and aot engines run blocks translated ahead of time when CPU::aot has them.
+
+Idle loops (JMP *, polls branching back to themselves) are found in two steps: decoding marks blocks
+that loop to their own start without writing memory, then a run that leaves registers and flags as
+it found them proves every following run identical, and those are skipped in one step.
+*/
+
+#include "mos6502.hpp"
+
+
+// Loops to its own start and writes no memory, may be an idle loop
+static bool idle_candidate(const mos6502::Block& block) {
+    using namespace mos6502;
+    u16 pc = block.start;
+    for (const DecodedInstr& instr : block.instrs) {
+        switch (instr_operation(instr.opcode)) {
+            case OP_STA: case OP_STX: case OP_STY: case OP_INC: case OP_DEC: case OP_PHA: case OP_PHP:
+            case OP_JSR: case OP_BRK:
+                return false;
+            case OP_ASL: case OP_LSR: case OP_ROL: case OP_ROR:
+                if (INSTR_GET_ADDR_MODE[instr.opcode] != ACC) { return false; }
+                break;
+            default:
+                break;
+        }
+        if (&instr != &block.instrs.back()) {
+            pc += 1 + operand_bytes(INSTR_GET_ADDR_MODE[instr.opcode]);
+        }
+    }
+    const DecodedInstr& last = block.instrs.back();
+    if (last.opcode == JMP_ABS) {
+        return last.operand == block.start;
+    }
+    return INSTR_GET_ADDR_MODE[last.opcode] == REL && (u16) (pc + (s8) last.operand) == block.start;
+}
+
+mos6502::Block& mos6502::CPU::decode_block(u16 pc) {
+    Block& block = blockCache.insert(pc);
+    while (block.instrs.size() < BlockCache::MAX_INSTRS) {
+        u8 opcode = read(pc);
+        if (DECODED_HANDLERS[opcode] == nullptr) {
+            if (block.instrs.empty()) {
+                block.next = pc + 1;    // Cover the opcode so writing a valid one invalidates
+            }
+            break;
+        }
+        u8 numBytes = operand_bytes(INSTR_GET_ADDR_MODE[opcode]);
+        u16 operand = 0;
+        if (numBytes >= 1) { operand = read(pc + 1); }
+        if (numBytes == 2) { operand = B2W((u8) operand, read(pc + 2)); }
+
+        block.instrs.push_back({ DECODED_HANDLERS[opcode], operand, opcode });
+        block.cycles += NUM_CYCLES_BASE[opcode];
+        pc += 1 + numBytes;
+        block.next = pc;
+
+        // PC is set by the instruction, end of block
+        if (INSTR_BYTES[opcode] == 0) {
+            break;
+        }
+    }
+    fuse_block(block);
+    // Devices can change what a loop reads without the CPU writing, so their loops never idle
+    if (!block.instrs.empty() && !memory.has_devices() && idle_candidate(block)) {
+        block.idleChecks = BlockCache::IDLE_CHECKS;
+    }
+    blockCache.commit(block);
+    if (aot != nullptr) {
+        block.native = aot->find(memory, block);
+    }
+    return block;
+}
+
+void mos6502::CPU::fuse_block(Block& block) {
+    const DecodedInstr* instrs = block.instrs.data();
+    u32 numInstrs = block.instrs.size();
+    for (u32 i = 0; i < numInstrs;) {
+        const Fusion* fusion = find_fusion(instrs + i, numInstrs - i);
+        // Branch would run after the block was invalidated by writing to itself
+        if (fusion != nullptr && instrs[i].opcode == INC_ZPG
+                && (u16) (instrs[i].operand - block.start) < (u16) (block.next - block.start)) {
+            fusion = nullptr;
+        }
+        if (fusion == nullptr) {
+            block.fused.push_back(instrs[i]);
+            i += 1;
+            continue;
+        }
+        block.fused.push_back({ fusion->handler, pack_operands(instrs + i, fusion->length), instrs[i].opcode });
+        i += fusion->length;
+    }
+}
+
+void mos6502::CPU::remapped() {
+    std::bitset<256> pages = memory.take_remapped_pages();
+    if (memory.generation() != codeGeneration) {
+        pages.set();
+    }
+    blockCache.invalidate_pages(pages);
+    codeRemaps = memory.remap_count();
+}
+
+void mos6502::CPU::fast_forward_idle(Block& block, const IdleState& before, s32 cycles) {
+    if (PC != block.start || !block.valid || cycles <= 0 || !(idle_state() == before)) {
+        block.idleChecks -= 1;
+        return;
+    }
+    // Every further run repeats this one, leave the last ones fitting the budget to the normal loop
+    s32 margin = block.cycles + block.instrs.size();
+    if (numCycles > margin) {
+        s32 iterations = (numCycles - margin - 1) / cycles;
+        numCycles -= iterations * cycles;
+        idleCyclesSkipped += (u64) iterations * cycles;
+    }
+}
+
+// Returns -1 on illegal instruction
+s32 mos6502::CPU::execute_blocks(s32 p_numCycles, bool forever) {
+    s32 numCyclesSave = p_numCycles;  // Original number of cycles to execute
+    numCycles = p_numCycles;
+    load_lazy_flags();
+
+    while (numCycles > 0 || forever) {
+        check_memory_map();
+        Block* block = blockCache.lookup(PC);
+        if (block == nullptr) {
+            block = &decode_block(PC);
+        }
+        const DecodedInstr* instrs = block->instrs.data();
+        u32 numInstrs = block->instrs.size();
+        if (numInstrs == 0) {
+            sync_flags();
+            return -1;
+        }
+
+        if (profile != nullptr) {
+            profile->record(*block);
+        }
+
+        // Each instruction before the last can add at most one page crossing cycle
+        if (forever || numCycles > (s32) (block->cycles + numInstrs)) {
+            bool watchIdle = !forever && block->idleChecks != 0;
+            IdleState idleBefore = watchIdle ? idle_state() : IdleState();
+            s32 cyclesBefore = numCycles;
+            // Whole block fits in the budget, stop early only if it wrote to itself
+            const DecodedInstr* fused = block->fused.data();
+            u32 numFused = block->fused.size();
+            for (u32 i = 0; i < numFused && block->valid; ++i) {
+                fused[i].handler(*this, fused[i].operand);
+            }
+            if (watchIdle) {
+                fast_forward_idle(*block, idleBefore, cyclesBefore - numCycles);
+            }
+        } else {
+            for (u32 i = 0; i < numInstrs && block->valid && numCycles > 0; ++i) {
+                instrs[i].handler(*this, instrs[i].operand);
+            }
+        }
+    }
+    sync_flags();
+    return numCyclesSave - numCycles;
+}
+
+// Returns -1 on illegal instruction
+template <bool TRANSLATE>
+s32 mos6502::CPU::execute_native(s32 p_numCycles, bool forever) {
+    s32 numCyclesSave = p_numCycles;  // Original number of cycles to execute
+    numCycles = p_numCycles;
+    load_lazy_flags();
+
+    while (numCycles > 0 || forever) {
+        check_memory_map();
+        if (TRANSLATE && jit.full()) {  // Drop all blocks with their code
+            blockCache.clear();
+            jit.reset();
+        }
+        Block* block = blockCache.lookup(PC);
+        if (block == nullptr) {
+            block = &decode_block(PC);
+        }
+        const DecodedInstr* instrs = block->instrs.data();
+        u32 numInstrs = block->instrs.size();
+        if (numInstrs == 0) {
+            sync_flags();
+            return -1;
+        }
+        if (TRANSLATE && block->native == nullptr && block->hits++ >= jitThreshold) {
+            jit.compile(*this, *block);
+        }
+
+        if (profile != nullptr) {
+            profile->record(*block);
+        }
+
+        // Each instruction before the last can add at most one page crossing cycle
+        bool fits = forever || numCycles > (s32) (block->cycles + numInstrs);
+        bool watchIdle = fits && !forever && block->idleChecks != 0;
+        IdleState idleBefore = watchIdle ? idle_state() : IdleState();
+        s32 cyclesBefore = numCycles;
+        bool ran = false;
+        if (block->native != nullptr) {
+            if (TRANSLATE && !fits && block->nativeBounded == nullptr) {
+                jit.compile(*this, *block, true);
+            }
+            NativeBlock code = fits ? block->native : block->nativeBounded;
+            ran = code != nullptr && code(this, block) == 0;
+        }
+        if (ran) {
+            // Done natively
+        } else if (fits) {
+            const DecodedInstr* fused = block->fused.data();
+            u32 numFused = block->fused.size();
+            for (u32 i = 0; i < numFused && block->valid; ++i) {
+                fused[i].handler(*this, fused[i].operand);
+            }
+        } else {
+            for (u32 i = 0; i < numInstrs && block->valid && numCycles > 0; ++i) {
+                instrs[i].handler(*this, instrs[i].operand);
+            }
+        }
+        if (watchIdle) {
+            fast_forward_idle(*block, idleBefore, cyclesBefore - numCycles);
+        }
+    }
+    sync_flags();
+    return numCyclesSave - numCycles;
+}
+
+s32 mos6502::CPU::execute_jit(s32 p_numCycles, bool forever) {
+    return execute_native<true>(p_numCycles, forever);
+}
+
+s32 mos6502::CPU::execute_aot(s32 p_numCycles, bool forever) {
+    return execute_native<false>(p_numCycles, forever);
+}
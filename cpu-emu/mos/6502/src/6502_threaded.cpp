@@ -0,0 +1,229 @@
+/*
+Direct-threaded execution engine for the MOS 6502 cpu
+
+Every opcode gets its own handler label running the specialized CPU::step<opcode>(),
+and ends with its own copy of the dispatch code, so the host branch predictor sees one
+indirect jump per opcode instead of a single shared one. Uses the GNU labels-as-values
+extension, falls back to the switch engine on other compilers.
+*/
+
+#include "mos6502.hpp"
+
+
+#if defined(__GNUC__)
+
+// Replicated in every handler
+#define DISPATCH()                                  \
+    do {                                            \
+        if (numCycles <= 0 && !forever) goto done;  \
+        goto *dispatch[getCurrentInstr()];          \
+    } while (0)
+
+// Handler for one opcode, specialized at compile time
+#define HANDLER(opcode)                             \
+    opcode:                                         \
+        step<opcode>();                             \
+        DISPATCH();
+
+// Labels as values and computed goto in this function only
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+
+// Returns -1 on illegal instruction
+s32 mos6502::CPU::execute_threaded(s32 p_numCycles, bool forever) {
+    static void* const dispatch[256] = {
+    // -0
+        &&BRK_IMP, &&ORA_IDX, &&ILLEGAL, &&ILLEGAL, &&ILLEGAL, &&ORA_ZPG, &&ASL_ZPG, &&ILLEGAL, &&PHP_IMP, &&ORA_IMM, &&ASL_ACC, &&ILLEGAL, &&ILLEGAL, &&ORA_ABS, &&ASL_ABS, &&ILLEGAL,    // 0-
+        &&BPL_REL, &&ORA_IDY, &&ILLEGAL, &&ILLEGAL, &&ILLEGAL, &&ORA_ZPX, &&ASL_ZPX, &&ILLEGAL, &&CLC_IMP, &&ORA_ABY, &&ILLEGAL, &&ILLEGAL, &&ILLEGAL, &&ORA_ABX, &&ASL_ABX, &&ILLEGAL,    // 1-
+        &&JSR_ABS, &&AND_IDX, &&ILLEGAL, &&ILLEGAL, &&BIT_ZPG, &&AND_ZPG, &&ROL_ZPG, &&ILLEGAL, &&PLP_IMP, &&AND_IMM, &&ROL_ACC, &&ILLEGAL, &&BIT_ABS, &&AND_ABS, &&ROL_ABS, &&ILLEGAL,    // 2-
+        &&BMI_REL, &&AND_IDY, &&ILLEGAL, &&ILLEGAL, &&ILLEGAL, &&AND_ZPX, &&ROL_ZPX, &&ILLEGAL, &&SEC_IMP, &&AND_ABY, &&ILLEGAL, &&ILLEGAL, &&ILLEGAL, &&AND_ABX, &&ROL_ABX, &&ILLEGAL,    // 3-
+        &&RTI_IMP, &&EOR_IDX, &&ILLEGAL, &&ILLEGAL, &&ILLEGAL, &&EOR_ZPG, &&LSR_ZPG, &&ILLEGAL, &&PHA_IMP, &&EOR_IMM, &&LSR_ACC, &&ILLEGAL, &&JMP_ABS, &&EOR_ABS, &&LSR_ABS, &&ILLEGAL,    // 4-
+        &&BVC_REL, &&EOR_IDY, &&ILLEGAL, &&ILLEGAL, &&ILLEGAL, &&EOR_ZPX, &&LSR_ZPX, &&ILLEGAL, &&CLI_IMP, &&EOR_ABY, &&ILLEGAL, &&ILLEGAL, &&ILLEGAL, &&EOR_ABX, &&LSR_ABX, &&ILLEGAL,    // 5-
+        &&RTS_IMP, &&ADC_IDX, &&ILLEGAL, &&ILLEGAL, &&ILLEGAL, &&ADC_ZPG, &&ROR_ZPG, &&ILLEGAL, &&PLA_IMP, &&ADC_IMM, &&ROR_ACC, &&ILLEGAL, &&JMP_IND, &&ADC_ABS, &&ROR_ABS, &&ILLEGAL,    // 6-
+        &&BVS_REL, &&ADC_IDY, &&ILLEGAL, &&ILLEGAL, &&ILLEGAL, &&ADC_ZPX, &&ROR_ZPX, &&ILLEGAL, &&SEI_IMP, &&ADC_ABY, &&ILLEGAL, &&ILLEGAL, &&ILLEGAL, &&ADC_ABX, &&ROR_ABX, &&ILLEGAL,    // 7-
+        &&ILLEGAL, &&STA_IDX, &&ILLEGAL, &&ILLEGAL, &&STY_ZPG, &&STA_ZPG, &&STX_ZPG, &&ILLEGAL, &&DEY_IMP, &&ILLEGAL, &&TXA_IMP, &&ILLEGAL, &&STY_ABS, &&STA_ABS, &&STX_ABS, &&ILLEGAL,    // 8-
+        &&BCC_REL, &&STA_IDY, &&ILLEGAL, &&ILLEGAL, &&STY_ZPX, &&STA_ZPX, &&STX_ZPY, &&ILLEGAL, &&TYA_IMP, &&STA_ABY, &&TXS_IMP, &&ILLEGAL, &&ILLEGAL, &&STA_ABX, &&ILLEGAL, &&ILLEGAL,    // 9-
+        &&LDY_IMM, &&LDA_IDX, &&LDX_IMM, &&ILLEGAL, &&LDY_ZPG, &&LDA_ZPG, &&LDX_ZPG, &&ILLEGAL, &&TAY_IMP, &&LDA_IMM, &&TAX_IMP, &&ILLEGAL, &&LDY_ABS, &&LDA_ABS, &&LDX_ABS, &&ILLEGAL,    // A-
+        &&BCS_REL, &&LDA_IDY, &&ILLEGAL, &&ILLEGAL, &&LDY_ZPX, &&LDA_ZPX, &&LDX_ZPY, &&ILLEGAL, &&CLV_IMP, &&LDA_ABY, &&TSX_IMP, &&ILLEGAL, &&LDY_ABX, &&LDA_ABX, &&LDX_ABY, &&ILLEGAL,    // B-
+        &&CPY_IMM, &&CMP_IDX, &&ILLEGAL, &&ILLEGAL, &&CPY_ZPG, &&CMP_ZPG, &&DEC_ZPG, &&ILLEGAL, &&INY_IMP, &&CMP_IMM, &&DEX_IMP, &&ILLEGAL, &&CPY_ABS, &&CMP_ABS, &&DEC_ABS, &&ILLEGAL,    // C-
+        &&BNE_REL, &&CMP_IDY, &&ILLEGAL, &&ILLEGAL, &&ILLEGAL, &&CMP_ZPX, &&DEC_ZPX, &&ILLEGAL, &&CLD_IMP, &&CMP_ABY, &&ILLEGAL, &&ILLEGAL, &&ILLEGAL, &&CMP_ABX, &&DEC_ABX, &&ILLEGAL,    // D-
+        &&CPX_IMM, &&SBC_IDX, &&ILLEGAL, &&ILLEGAL, &&CPX_ZPG, &&SBC_ZPG, &&INC_ZPG, &&ILLEGAL, &&INX_IMP, &&SBC_IMM, &&NOP_IMP, &&ILLEGAL, &&CPX_ABS, &&SBC_ABS, &&INC_ABS, &&ILLEGAL,    // E-
+        &&BEQ_REL, &&SBC_IDY, &&ILLEGAL, &&ILLEGAL, &&ILLEGAL, &&SBC_ZPX, &&INC_ZPX, &&ILLEGAL, &&SED_IMP, &&SBC_ABY, &&ILLEGAL, &&ILLEGAL, &&ILLEGAL, &&SBC_ABX, &&INC_ABX, &&ILLEGAL,    // F-
+    };
+
+    s32 numCyclesSave = p_numCycles;  // Original number of cycles to execute
+    numCycles = p_numCycles;
+    load_lazy_flags();
+    DISPATCH();
+
+    HANDLER(LDA_IMM)
+    HANDLER(LDA_ZPG)
+    HANDLER(LDA_ZPX)
+    HANDLER(LDA_ABS)
+    HANDLER(LDA_ABX)
+    HANDLER(LDA_ABY)
+    HANDLER(LDA_IDX)
+    HANDLER(LDA_IDY)
+    HANDLER(LDX_IMM)
+    HANDLER(LDX_ZPG)
+    HANDLER(LDX_ZPY)
+    HANDLER(LDX_ABS)
+    HANDLER(LDX_ABY)
+    HANDLER(LDY_IMM)
+    HANDLER(LDY_ZPG)
+    HANDLER(LDY_ZPX)
+    HANDLER(LDY_ABS)
+    HANDLER(LDY_ABX)
+    HANDLER(STA_ZPG)
+    HANDLER(STA_ZPX)
+    HANDLER(STA_ABS)
+    HANDLER(STA_ABX)
+    HANDLER(STA_ABY)
+    HANDLER(STA_IDX)
+    HANDLER(STA_IDY)
+    HANDLER(STX_ZPG)
+    HANDLER(STX_ZPY)
+    HANDLER(STX_ABS)
+    HANDLER(STY_ZPG)
+    HANDLER(STY_ZPX)
+    HANDLER(STY_ABS)
+    HANDLER(TAX_IMP)
+    HANDLER(TAY_IMP)
+    HANDLER(TSX_IMP)
+    HANDLER(TXA_IMP)
+    HANDLER(TXS_IMP)
+    HANDLER(TYA_IMP)
+    HANDLER(NOP_IMP)
+    HANDLER(CLC_IMP)
+    HANDLER(CLD_IMP)
+    HANDLER(CLI_IMP)
+    HANDLER(CLV_IMP)
+    HANDLER(SEC_IMP)
+    HANDLER(SED_IMP)
+    HANDLER(SEI_IMP)
+    HANDLER(INC_ZPG)
+    HANDLER(INC_ZPX)
+    HANDLER(INC_ABS)
+    HANDLER(INC_ABX)
+    HANDLER(INX_IMP)
+    HANDLER(INY_IMP)
+    HANDLER(DEC_ZPG)
+    HANDLER(DEC_ZPX)
+    HANDLER(DEC_ABS)
+    HANDLER(DEC_ABX)
+    HANDLER(DEX_IMP)
+    HANDLER(DEY_IMP)
+    HANDLER(AND_IMM)
+    HANDLER(AND_ZPG)
+    HANDLER(AND_ZPX)
+    HANDLER(AND_ABS)
+    HANDLER(AND_ABX)
+    HANDLER(AND_ABY)
+    HANDLER(AND_IDX)
+    HANDLER(AND_IDY)
+    HANDLER(EOR_IMM)
+    HANDLER(EOR_ZPG)
+    HANDLER(EOR_ZPX)
+    HANDLER(EOR_ABS)
+    HANDLER(EOR_ABX)
+    HANDLER(EOR_ABY)
+    HANDLER(EOR_IDX)
+    HANDLER(EOR_IDY)
+    HANDLER(ORA_IMM)
+    HANDLER(ORA_ZPG)
+    HANDLER(ORA_ZPX)
+    HANDLER(ORA_ABS)
+    HANDLER(ORA_ABX)
+    HANDLER(ORA_ABY)
+    HANDLER(ORA_IDX)
+    HANDLER(ORA_IDY)
+    HANDLER(ASL_ACC)
+    HANDLER(ASL_ZPG)
+    HANDLER(ASL_ZPX)
+    HANDLER(ASL_ABS)
+    HANDLER(ASL_ABX)
+    HANDLER(LSR_ACC)
+    HANDLER(LSR_ZPG)
+    HANDLER(LSR_ZPX)
+    HANDLER(LSR_ABS)
+    HANDLER(LSR_ABX)
+    HANDLER(ROL_ACC)
+    HANDLER(ROL_ZPG)
+    HANDLER(ROL_ZPX)
+    HANDLER(ROL_ABS)
+    HANDLER(ROL_ABX)
+    HANDLER(ROR_ACC)
+    HANDLER(ROR_ZPG)
+    HANDLER(ROR_ZPX)
+    HANDLER(ROR_ABS)
+    HANDLER(ROR_ABX)
+    HANDLER(ADC_IMM)
+    HANDLER(ADC_ZPG)
+    HANDLER(ADC_ZPX)
+    HANDLER(ADC_ABS)
+    HANDLER(ADC_ABX)
+    HANDLER(ADC_ABY)
+    HANDLER(ADC_IDX)
+    HANDLER(ADC_IDY)
+    HANDLER(SBC_IMM)
+    HANDLER(SBC_ZPG)
+    HANDLER(SBC_ZPX)
+    HANDLER(SBC_ABS)
+    HANDLER(SBC_ABX)
+    HANDLER(SBC_ABY)
+    HANDLER(SBC_IDX)
+    HANDLER(SBC_IDY)
+    HANDLER(BIT_ZPG)
+    HANDLER(BIT_ABS)
+    HANDLER(CMP_IMM)
+    HANDLER(CMP_ZPG)
+    HANDLER(CMP_ZPX)
+    HANDLER(CMP_ABS)
+    HANDLER(CMP_ABX)
+    HANDLER(CMP_ABY)
+    HANDLER(CMP_IDX)
+    HANDLER(CMP_IDY)
+    HANDLER(CPX_IMM)
+    HANDLER(CPX_ZPG)
+    HANDLER(CPX_ABS)
+    HANDLER(CPY_IMM)
+    HANDLER(CPY_ZPG)
+    HANDLER(CPY_ABS)
+    HANDLER(JMP_ABS)
+    HANDLER(JMP_IND)
+    HANDLER(PHA_IMP)
+    HANDLER(PHP_IMP)
+    HANDLER(PLA_IMP)
+    HANDLER(PLP_IMP)
+    HANDLER(BCC_REL)
+    HANDLER(BCS_REL)
+    HANDLER(BEQ_REL)
+    HANDLER(BMI_REL)
+    HANDLER(BNE_REL)
+    HANDLER(BPL_REL)
+    HANDLER(BVC_REL)
+    HANDLER(BVS_REL)
+    HANDLER(JSR_ABS)
+    HANDLER(RTS_IMP)
+    HANDLER(BRK_IMP)
+    HANDLER(RTI_IMP)
+
+    // Invalid instruction
+    ILLEGAL:
+        sync_flags();
+        return -1;
+
+    done:
+        sync_flags();
+        return numCyclesSave - numCycles;
+}
+
+#pragma GCC diagnostic pop
+
+#else
+
+s32 mos6502::CPU::execute_threaded(s32 p_numCycles, bool forever) {
+    return execute_switch(p_numCycles, forever);
+}
+
+#endif
@@ -0,0 +1,261 @@
+/*
+6551-like serial console
+*/
+
+#include <chrono>
+#include <cstring>
+#include <vector>
+
+#include "acia6551.hpp"
+
+#if defined(__unix__)
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+
+mos6502::Acia6551::Acia6551(CPU& cpu, u32 irqSource, u32 ringSize)
+    : ClockedDevice(cpu), irqSource(irqSource), tx(ringSize), rx(ringSize) {}
+
+mos6502::Acia6551::~Acia6551() {
+    detach();
+    if (irq) {
+        cpu.set_irq(false, irqSource);
+    }
+}
+
+void mos6502::Acia6551::map(u8 page) {
+    cpu.memory.map_device(page, 1, this);
+}
+
+bool mos6502::Acia6551::rx_ready() {
+    if (!rxFull && rx.pop(&rxData, 1) == 1) {
+        rxFull = true;
+    }
+    return rxFull;
+}
+
+void mos6502::Acia6551::transmit(u8 byte) {
+    if (tx.push(byte)) {
+        txBytes += 1;
+        return;
+    }
+    // Full: wait for the writer rather than lose output, there is nothing to wait for without it
+    if (!writer.joinable()) {
+        dropped += 1;
+        return;
+    }
+    while (!tx.push(byte)) {
+        std::this_thread::yield();
+    }
+    txBytes += 1;
+}
+
+void mos6502::Acia6551::update() {
+    bool asserted = false;
+    if (command & 0x01) {
+        asserted = (!(command & 0x02) && rx_ready()) || ((command & 0x0C) == 0x04 && !tx.full());
+    }
+    if (asserted != irq) {
+        irq = asserted;
+        cpu.set_irq(irq, irqSource);
+    }
+    // Input arrives and TX drains on other threads, looked for while either would interrupt
+    bool rxPoll = !(command & 0x02);
+    bool txPoll = (command & 0x0C) == 0x04 && tx.full();
+    if (!(command & 0x01) || irq || !(rxPoll || txPoll)) {
+        cancel();
+    } else if (!scheduled()) {
+        schedule(synced() + pollCycles);
+    }
+}
+
+void mos6502::Acia6551::event(u64 cycle) {
+    (void) cycle;
+    update();
+}
+
+u8 mos6502::Acia6551::read_register(u16 addr) {
+    u8 val = 0;
+    switch (addr & 0x03) {
+        case ACIA_DATA:
+            rx_ready();
+            val = rxData;
+            if (rxFull) {
+                rxFull = false;
+                if (command & 0x10) {
+                    transmit(val);
+                }
+            }
+            break;
+        case ACIA_STATUS:
+            val = (rx_ready() ? ACIA_RDRF : 0) | (!tx.full() ? ACIA_TDRE : 0) | (irq ? ACIA_IRQ : 0);
+            break;
+        case ACIA_COMMAND: val = command; break;
+        case ACIA_CONTROL: val = control; break;
+    }
+    update();
+    return val;
+}
+
+void mos6502::Acia6551::write_register(u16 addr, u8 val) {
+    switch (addr & 0x03) {
+        case ACIA_DATA:
+            transmit(val);
+            // Only the transmit interrupt depends on it
+            if ((command & 0x0D) != 0x05) {
+                return;
+            }
+            break;
+        case ACIA_STATUS:
+            // Programmed reset
+            command &= 0xE0;
+            break;
+        case ACIA_COMMAND: command = val; break;
+        case ACIA_CONTROL: control = val; break;
+    }
+    update();
+}
+
+#if defined(__unix__)
+
+void mos6502::Acia6551::write_out() {
+    std::vector<u8> batch(tx.capacity());
+    for (;;) {
+        u32 size = tx.pop(batch.data(), (u32) batch.size());
+        if (size == 0) {
+            if (stopping.load(std::memory_order_acquire) && tx.empty()) {
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+        // Everything gathered in one call, a write error drops the batch
+        u32 done = 0;
+        while (done < size) {
+            ssize_t n = ::write(outFd, batch.data() + done, size - done);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                break;
+            }
+            done += (u32) n;
+        }
+        txWritten.fetch_add(size, std::memory_order_release);
+    }
+}
+
+void mos6502::Acia6551::read_in() {
+    std::vector<u8> chunk(4096);
+    while (!stopping.load(std::memory_order_acquire)) {
+        // Timeout to see detach()
+        pollfd fd = { inFd, POLLIN, 0 };
+        if (poll(&fd, 1, 10) <= 0) {
+            continue;
+        }
+        ssize_t n = ::read(inFd, chunk.data(), chunk.size());
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;      // End of input
+        }
+        u32 done = 0;
+        while (done < (u32) n && !stopping.load(std::memory_order_acquire)) {
+            done += rx.push(chunk.data() + done, (u32) n - done);
+            if (done < (u32) n) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+    }
+}
+
+bool mos6502::Acia6551::attach(int p_inFd, int p_outFd) {
+    if (attached()) {
+        return false;
+    }
+    stopping = false;
+    inFd = p_inFd;
+    outFd = p_outFd;
+    ownsFds = false;
+    if (outFd >= 0) {
+        writer = std::thread(&Acia6551::write_out, this);
+    }
+    if (inFd >= 0) {
+        reader = std::thread(&Acia6551::read_in, this);
+    }
+    return true;
+}
+
+bool mos6502::Acia6551::open(const char* inPath, const char* outPath) {
+    if (attached()) {
+        return false;
+    }
+    int in = -1;
+    int out = -1;
+    if (inPath != nullptr) {
+        in = strcmp(inPath, "-") == 0 ? STDIN_FILENO : ::open(inPath, O_RDONLY);
+    }
+    if (outPath != nullptr) {
+        out = strcmp(outPath, "-") == 0 ? STDOUT_FILENO : ::open(outPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+    if ((inPath != nullptr && in < 0) || (outPath != nullptr && out < 0)) {
+        if (in > STDERR_FILENO) {
+            ::close(in);
+        }
+        if (out > STDERR_FILENO) {
+            ::close(out);
+        }
+        return false;
+    }
+    attach(in, out);
+    ownsFds = true;
+    return true;
+}
+
+void mos6502::Acia6551::flush() {
+    if (!writer.joinable()) {
+        return;
+    }
+    while (txWritten.load(std::memory_order_acquire) < txBytes) {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+}
+
+void mos6502::Acia6551::detach() {
+    if (!attached()) {
+        return;
+    }
+    stopping = true;
+    if (writer.joinable()) {
+        writer.join();
+    }
+    if (reader.joinable()) {
+        reader.join();
+    }
+    if (ownsFds) {
+        if (inFd > STDERR_FILENO) {
+            ::close(inFd);
+        }
+        if (outFd > STDERR_FILENO) {
+            ::close(outFd);
+        }
+    }
+    inFd = outFd = -1;
+    ownsFds = false;
+    stopping = false;
+}
+
+#else
+
+void mos6502::Acia6551::write_out() {}
+void mos6502::Acia6551::read_in() {}
+bool mos6502::Acia6551::attach(int, int) { return false; }
+bool mos6502::Acia6551::open(const char*, const char*) { return false; }
+void mos6502::Acia6551::flush() {}
+void mos6502::Acia6551::detach() {}
+
+#endif
@@ -0,0 +1,57 @@
+/*
+Loader of ahead-of-time translated ROM modules
+*/
+
+#include <algorithm>
+
+#include <dlfcn.h>
+
+#include "mos6502.hpp"
+#include "aot.hpp"
+
+
+mos6502::AotModule::~AotModule() {
+    if (handle != nullptr) {
+        dlclose(handle);
+    }
+}
+
+bool mos6502::AotModule::load(const char* path) {
+    void* newHandle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (newHandle == nullptr) {
+        err = dlerror();
+        return false;
+    }
+    const AotModuleInfo* newInfo = (const AotModuleInfo*) dlsym(newHandle, "mos6502_aot_module");
+    if (newInfo == nullptr || newInfo->version != AOT_VERSION || newInfo->cpuSize != sizeof(CPU)) {
+        err = std::string(path) + ": not an aot module of this version";
+        dlclose(newHandle);
+        return false;
+    }
+    if (handle != nullptr) {
+        dlclose(handle);
+    }
+    handle = newHandle;
+    info = newInfo;
+    err.clear();
+    return true;
+}
+
+mos6502::NativeBlock mos6502::AotModule::find(const Memory& memory, const Block& block) const {
+    if (info == nullptr) {
+        return nullptr;
+    }
+    const AotBlock* end = info->blocks + info->numBlocks;
+    const AotBlock* found = std::lower_bound(info->blocks, end, block.start,
+        [](const AotBlock& b, u16 start) { return b.start < start; });
+    if (found == end || found->start != block.start || found->next != block.next || block.next <= block.start) {
+        return nullptr;
+    }
+    // Code written since the image was translated
+    for (u32 addr = block.start; addr < block.next; ++addr) {
+        if (memory.read(addr) != info->image[addr]) {
+            return nullptr;
+        }
+    }
+    return found->code;
+}
@@ -0,0 +1,109 @@
+/*
+Huge page backed arena of CPU instances
+*/
+
+#include <cstdint>
+#include <new>
+
+#include "arena.hpp"
+#include "mos6502.hpp"
+
+#if defined(__unix__)
+#include <sys/mman.h>
+#endif
+
+
+// CPU rounded up to whole cache lines, then its flat memory
+static constexpr u32 CPU_BYTES = (sizeof(mos6502::CPU) + 63) & ~63u;
+static constexpr u32 SLOT_SIZE = CPU_BYTES + mos6502::MEM_MAX;
+static_assert(alignof(mos6502::CPU) <= 64, "Slots are aligned to cache lines");
+
+mos6502::InstanceArena::InstanceArena() {}
+
+mos6502::InstanceArena::~InstanceArena() {
+    for (void* region : regions) {
+#if defined(__unix__)
+        munmap(region, REGION_SIZE);
+#else
+        ::operator delete(region, std::align_val_t(REGION_SIZE));
+#endif
+    }
+}
+
+u32 mos6502::InstanceArena::slots_per_region() const {
+    return REGION_SIZE / SLOT_SIZE;
+}
+
+bool mos6502::InstanceArena::map_region() {
+    void* region = nullptr;
+#if defined(__unix__)
+#ifdef MAP_HUGETLB
+    if (tryHugeTlb) {
+        region = mmap(nullptr, REGION_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (region == MAP_FAILED) {
+            region = nullptr;
+            tryHugeTlb = false;
+        } else {
+            numHugeTlb += 1;
+        }
+    }
+#endif
+    if (region == nullptr) {
+        // Twice the size so an aligned region fits, the rest is given back
+        void* p = mmap(nullptr, 2 * REGION_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            return false;
+        }
+        u8* raw = (u8*) p;
+        u8* aligned = (u8*) (((std::uintptr_t) raw + REGION_SIZE - 1) & ~(std::uintptr_t) (REGION_SIZE - 1));
+        if (aligned != raw) {
+            munmap(raw, aligned - raw);
+        }
+        munmap(aligned + REGION_SIZE, raw + REGION_SIZE - aligned);
+#ifdef MADV_HUGEPAGE
+        madvise(aligned, REGION_SIZE, MADV_HUGEPAGE);
+#endif
+        region = aligned;
+    }
+#else
+    region = ::operator new(REGION_SIZE, std::align_val_t(REGION_SIZE), std::nothrow);
+    if (region == nullptr) {
+        return false;
+    }
+#endif
+    regions.push_back(region);
+    // Free list in address order
+    for (u32 i = slots_per_region(); i-- > 0;) {
+        FreeSlot* slot = (FreeSlot*) ((u8*) region + i * SLOT_SIZE);
+        slot->next = freeSlots;
+        freeSlots = slot;
+    }
+    return true;
+}
+
+mos6502::CPU* mos6502::InstanceArena::create() {
+    if (freeSlots == nullptr && !map_region()) {
+        return nullptr;
+    }
+    u8* slot = (u8*) freeSlots;
+    freeSlots = freeSlots->next;
+    numInstances += 1;
+    return new (slot) CPU(slot + CPU_BYTES);
+}
+
+void mos6502::InstanceArena::destroy(CPU* cpu) {
+    cpu->~CPU();
+    FreeSlot* slot = (FreeSlot*) cpu;
+    slot->next = freeSlots;
+    freeSlots = slot;
+    numInstances -= 1;
+}
+
+bool mos6502::InstanceArena::owns(const CPU* cpu) const {
+    for (void* region : regions) {
+        if ((const u8*) cpu >= (const u8*) region && (const u8*) cpu < (const u8*) region + REGION_SIZE) {
+            return true;
+        }
+    }
+    return false;
+}
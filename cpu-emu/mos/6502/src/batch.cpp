@@ -0,0 +1,462 @@
+/*
+Lockstep execution of many CPUs, registers as structure of arrays
+
+Lane loops select the new value with the lane mask instead of branching on it, so they compile to
+SIMD blends. Memory operands are gathered lane by lane first since every lane has its own memory.
+Results equal running every CPU on its own with the switch engine, cycle counts included.
+*/
+
+#include <algorithm>
+
+#include "mos6502.hpp"
+#include "batch.hpp"
+
+// Lane loops are also built for AVX2 and AVX-512 when the compiler can dispatch on the host
+#if defined(__x86_64__) && defined(__has_attribute)
+#if __has_attribute(target_clones)
+#define LANE_LOOPS __attribute__((target_clones("avx512f", "avx2", "default")))
+#endif
+#endif
+#ifndef LANE_LOOPS
+#define LANE_LOOPS
+#endif
+
+
+namespace {
+    using namespace mos6502;
+
+    // Passed by value: stores through the u8 arrays could alias a referenced struct and keep the
+    // compiler from vectorizing
+    struct Lanes {
+        u32 n;
+        const u8* mask;
+        const u8* val;
+        u8* A;
+        u8* X;
+        u8* Y;
+        u8* S;
+        u8* SR;
+        u16* PC;
+        s32* cycles;
+    };
+
+    inline u8 select(u8 mask, u8 a, u8 b) { return (a & mask) | (b & ~mask); }
+
+    inline u8 with_nz(u8 sr, u8 val) {
+        return (sr & ~(FLAG_MASK_N | FLAG_MASK_Z)) | (val & FLAG_MASK_N) | ((val == 0) ? FLAG_MASK_Z : 0);
+    }
+
+    // Register selected by an operation
+    u8* reg_of(Lanes l, Operation op) {
+        switch (op) {
+            case OP_LDX: case OP_STX: case OP_CPX: case OP_INX: case OP_DEX: return l.X;
+            case OP_LDY: case OP_STY: case OP_CPY: case OP_INY: case OP_DEY: return l.Y;
+            default:                                                          return l.A;
+        }
+    }
+
+    // Opcode and operand bytes of the instruction at pc, first byte lowest
+    inline u32 code_at(const Memory* memory, u16 pc, u8 numBytes) {
+        u32 code = memory->read(pc);
+        if (numBytes >= 1) { code |= memory->read(pc + 1) << 8; }
+        if (numBytes == 2) { code |= memory->read(pc + 2) << 16; }
+        return code;
+    }
+
+    LANE_LOOPS
+    void load(Lanes l, u8* reg) {
+        for (u32 i = 0; i < l.n; ++i) {
+            u8 m = l.mask[i];
+            reg[i] = select(m, l.val[i], reg[i]);
+            l.SR[i] = select(m, with_nz(l.SR[i], l.val[i]), l.SR[i]);
+        }
+    }
+
+    LANE_LOOPS
+    void transfer(Lanes l, const u8* from, u8* to, bool updateFlags) {
+        for (u32 i = 0; i < l.n; ++i) {
+            u8 m = l.mask[i];
+            to[i] = select(m, from[i], to[i]);
+            if (updateFlags) { l.SR[i] = select(m, with_nz(l.SR[i], to[i]), l.SR[i]); }
+        }
+    }
+
+    LANE_LOOPS
+    void inc_dec(Lanes l, u8* reg, u8 delta) {
+        for (u32 i = 0; i < l.n; ++i) {
+            u8 m = l.mask[i];
+            u8 res = reg[i] + delta;
+            reg[i] = select(m, res, reg[i]);
+            l.SR[i] = select(m, with_nz(l.SR[i], res), l.SR[i]);
+        }
+    }
+
+    // AND, EOR, ORA
+    LANE_LOOPS
+    void logic(Lanes l, Operation op) {
+        for (u32 i = 0; i < l.n; ++i) {
+            u8 m = l.mask[i];
+            u8 res = (op == OP_AND) ? (l.A[i] & l.val[i]) : (op == OP_EOR) ? (l.A[i] ^ l.val[i]) : (l.A[i] | l.val[i]);
+            l.A[i] = select(m, res, l.A[i]);
+            l.SR[i] = select(m, with_nz(l.SR[i], res), l.SR[i]);
+        }
+    }
+
+    // Binary ADC, SBC adds the complement
+    LANE_LOOPS
+    void add_carry(Lanes l, bool subtract) {
+        for (u32 i = 0; i < l.n; ++i) {
+            u8 m = l.mask[i];
+            u16 sum = l.A[i] + (u8) (subtract ? ~l.val[i] : l.val[i]) + (l.SR[i] & FLAG_MASK_C);
+            u8 res = (u8) sum;
+            u8 sr = with_nz(l.SR[i], res) & ~(FLAG_MASK_C | FLAG_MASK_V);
+            sr |= (sum >> 8) | (((l.A[i] ^ res) & 0x80) >> 1);
+            l.A[i] = select(m, res, l.A[i]);
+            l.SR[i] = select(m, sr, l.SR[i]);
+        }
+    }
+
+    LANE_LOOPS
+    void compare(Lanes l, const u8* reg) {
+        for (u32 i = 0; i < l.n; ++i) {
+            u8 sr = with_nz(l.SR[i], reg[i] - l.val[i]) & ~FLAG_MASK_C;
+            sr |= (reg[i] >= l.val[i]) ? FLAG_MASK_C : 0;
+            l.SR[i] = select(l.mask[i], sr, l.SR[i]);
+        }
+    }
+
+    // N and V from the AND result like the other engines
+    LANE_LOOPS
+    void bit(Lanes l) {
+        for (u32 i = 0; i < l.n; ++i) {
+            u8 res = l.A[i] & l.val[i];
+            u8 sr = with_nz(l.SR[i], res) & ~FLAG_MASK_V;
+            l.SR[i] = select(l.mask[i], sr | (res & FLAG_MASK_V), l.SR[i]);
+        }
+    }
+
+    LANE_LOOPS
+    void shift_acc(Lanes l, Operation op) {
+        for (u32 i = 0; i < l.n; ++i) {
+            u8 m = l.mask[i];
+            u8 a = l.A[i];
+            u8 c = l.SR[i] & FLAG_MASK_C;
+            u8 res, carry;
+            if (op == OP_ASL)      { res = a << 1;             carry = a >> 7; }
+            else if (op == OP_LSR) { res = a >> 1;             carry = a & 1; }
+            else if (op == OP_ROL) { res = (a << 1) | c;       carry = a >> 7; }
+            else                   { res = (a >> 1) | (c << 7); carry = a & 1; }
+            l.A[i] = select(m, res, a);
+            l.SR[i] = select(m, (with_nz(l.SR[i], res) & ~FLAG_MASK_C) | carry, l.SR[i]);
+        }
+    }
+
+    LANE_LOOPS
+    void set_flags(Lanes l, u8 flags, u8 set) {
+        for (u32 i = 0; i < l.n; ++i) {
+            l.SR[i] = select(l.mask[i], (l.SR[i] & ~flags) | (set & flags), l.SR[i]);
+        }
+    }
+
+    // All lanes are at pc, taken lanes pay for the branch
+    LANE_LOOPS
+    void branch(Lanes l, u8 flag, bool whenSet, u16 pc, u8 offset) {
+        u16 target = pc + (s8) offset;
+        s32 penalty = 1 + 2 * (s32) onDifferentPages(pc, target);
+        for (u32 i = 0; i < l.n; ++i) {
+            u8 m = l.mask[i];
+            bool taken = ((l.SR[i] & flag) != 0) == whenSet;
+            u16 next = taken ? target : (u16) (pc + 2);
+            l.PC[i] = m ? next : l.PC[i];
+            l.cycles[i] -= (m && taken) ? penalty : 0;
+        }
+    }
+
+    // Stops lanes out of cycles, lowest PC of the lanes still running or 0x10000 when none is
+    LANE_LOOPS
+    u32 lowest_pc(Lanes l, u8* running) {
+        u32 lowest = 0x10000;
+        for (u32 i = 0; i < l.n; ++i) {
+            u8 run = running[i] & (l.cycles[i] > 0);
+            running[i] = run;
+            u32 pc = l.PC[i] | ((u32) (run ^ 1) << 16);
+            lowest = std::min(lowest, pc);
+        }
+        return lowest;
+    }
+
+    // Whether a lane in the step has any of flags set
+    LANE_LOOPS
+    bool any_flag(Lanes l, u8 flags) {
+        u8 found = 0;
+        for (u32 i = 0; i < l.n; ++i) {
+            found |= l.mask[i] & l.SR[i] & flags;
+        }
+        return found != 0;
+    }
+
+    LANE_LOOPS
+    void finish(Lanes l, u8 numCycles, u8 numBytes) {
+        for (u32 i = 0; i < l.n; ++i) {
+            bool m = l.mask[i] != 0;
+            l.cycles[i] -= m ? numCycles : 0;
+            l.PC[i] += m ? numBytes : 0;
+        }
+    }
+}
+
+void mos6502::Batch::add(CPU& cpu) {
+    cpus.push_back(&cpu);
+}
+
+void mos6502::Batch::clear() {
+    cpus.clear();
+}
+
+void mos6502::Batch::gather(s32 numCycles) {
+    u32 n = size();
+    memory.resize(n);
+    results.assign(n, 0);
+    PC.resize(n);
+    A.resize(n);
+    X.resize(n);
+    Y.resize(n);
+    S.resize(n);
+    SR.resize(n);
+    cycles.assign(n, numCycles);
+    end.resize(n);
+    running.assign(n, numCycles > 0);
+    mask.resize(n);
+    val.resize(n);
+    for (u32 i = 0; i < n; ++i) {
+        CPU& cpu = *cpus[i];
+        memory[i] = &cpu.memory;
+        PC[i] = cpu.PC;
+        A[i] = cpu.A;
+        X[i] = cpu.X;
+        Y[i] = cpu.Y;
+        S[i] = cpu.S;
+        SR[i] = cpu.SR;
+        end[i] = cpu.cycles + numCycles;
+    }
+}
+
+void mos6502::Batch::scatter() {
+    for (u32 i = 0; i < size(); ++i) {
+        CPU& cpu = *cpus[i];
+        cpu.PC = PC[i];
+        cpu.A = A[i];
+        cpu.X = X[i];
+        cpu.Y = Y[i];
+        cpu.S = S[i];
+        cpu.SR = SR[i];
+        cpu.cycles = end[i] - cycles[i];
+    }
+}
+
+bool mos6502::Batch::needs_cpu(u32 lane) const {
+    const CPU& cpu = *cpus[lane];
+    return cpu.events.next() <= cpu.cycles || cpu.nmi_pending()
+        || (cpu.irq_asserted() && !(SR[lane] & FLAG_MASK_I));
+}
+
+void mos6502::Batch::step_scalar(u32 lane) {
+    CPU& cpu = *cpus[lane];
+    cpu.PC = PC[lane];
+    cpu.A = A[lane];
+    cpu.X = X[lane];
+    cpu.Y = Y[lane];
+    cpu.S = S[lane];
+    cpu.SR = SR[lane];
+    cpu.cycles = end[lane] - cycles[lane];
+    // One instruction, or an interrupt, after the events due
+    Engine engine = cpu.engine;
+    cpu.engine = ENGINE_SWITCH;
+    if (cpu.execute(1) < 0) {
+        results[lane] = -1;
+        running[lane] = 0;
+    }
+    cpu.engine = engine;
+    cycles[lane] = (s32) (end[lane] - cpu.cycles);
+    PC[lane] = cpu.PC;
+    A[lane] = cpu.A;
+    X[lane] = cpu.X;
+    Y[lane] = cpu.Y;
+    S[lane] = cpu.S;
+    SR[lane] = cpu.SR;
+    scalarSteps += 1;
+}
+
+bool mos6502::Batch::read_operands(u8 opcode, u16 operand) {
+    AddrMode am = INSTR_GET_ADDR_MODE[opcode];
+    bool penalty = pays_page_cross(instr_operation(opcode));
+    u32 n = size();
+    switch (am) {
+        case IMM:
+            for (u32 i = 0; i < n; ++i) { val[i] = (u8) operand; }
+            return true;
+        case ZPG: case ABS:
+            for (u32 i = 0; i < n; ++i) {
+                if (mask[i]) { val[i] = memory[i]->read(operand); }
+            }
+            return true;
+        case ZPX: case ZPY: {
+            const u8* index = (am == ZPX) ? X.data() : Y.data();
+            for (u32 i = 0; i < n; ++i) {
+                if (mask[i]) { val[i] = memory[i]->read((u8) (operand + index[i])); }
+            }
+            return true;
+        }
+        case ABX: case ABY: {
+            const u8* index = (am == ABX) ? X.data() : Y.data();
+            for (u32 i = 0; i < n; ++i) {
+                if (mask[i]) {
+                    u16 addr = operand + index[i];
+                    val[i] = memory[i]->read(addr);
+                    cycles[i] -= penalty && onDifferentPages(addr, operand);
+                }
+            }
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+bool mos6502::Batch::write_operands(u8 opcode, u16 operand, const u8* reg) {
+    AddrMode am = INSTR_GET_ADDR_MODE[opcode];
+    u32 n = size();
+    const u8* index = (am == ZPX || am == ABX) ? X.data() : Y.data();
+    for (u32 i = 0; i < n; ++i) {
+        if (!mask[i]) {
+            continue;
+        }
+        u16 addr;
+        switch (am) {
+            case ZPG: case ABS: addr = operand;                     break;
+            case ZPX: case ZPY: addr = (u8) (operand + index[i]);   break;
+            case ABX: case ABY: addr = operand + index[i];          break;
+            default:            return false;
+        }
+        (*cpus[i])[addr] = reg[i];     // Invalidates code decoded by the CPU
+    }
+    return true;
+}
+
+bool mos6502::Batch::step_vector(u16 pc, u8 opcode, u16 operand) {
+    Operation op = instr_operation(opcode);
+    AddrMode am = INSTR_GET_ADDR_MODE[opcode];
+    u32 n = size();
+    Lanes l = { n, mask.data(), val.data(), A.data(), X.data(), Y.data(), S.data(), SR.data(), PC.data(), cycles.data() };
+    if ((op == OP_ADC || op == OP_SBC) && any_flag(l, FLAG_MASK_D)) {
+        // Decimal mode lanes by the switch engine
+        for (u32 i = 0; i < n; ++i) {
+            if (mask[i] && (SR[i] & FLAG_MASK_D)) {
+                mask[i] = 0;
+                step_scalar(i);
+            }
+        }
+    }
+
+    switch (op) {
+        case OP_LDA: case OP_LDX: case OP_LDY:
+            if (!read_operands(opcode, operand)) { return false; }
+            load(l, reg_of(l, op));
+            break;
+        case OP_STA: case OP_STX: case OP_STY:
+            if (!write_operands(opcode, operand, reg_of(l, op))) { return false; }
+            break;
+        case OP_TAX: transfer(l, l.A, l.X, true);   break;
+        case OP_TAY: transfer(l, l.A, l.Y, true);   break;
+        case OP_TSX: transfer(l, l.S, l.X, true);   break;
+        case OP_TXA: transfer(l, l.X, l.A, true);   break;
+        case OP_TXS: transfer(l, l.X, l.S, false);  break;
+        case OP_TYA: transfer(l, l.Y, l.A, true);   break;
+        case OP_INX: case OP_INY: inc_dec(l, reg_of(l, op), 1);     break;
+        case OP_DEX: case OP_DEY: inc_dec(l, reg_of(l, op), 0xFF);  break;
+        case OP_AND: case OP_EOR: case OP_ORA:
+            if (!read_operands(opcode, operand)) { return false; }
+            logic(l, op);
+            break;
+        case OP_ADC: case OP_SBC:
+            if (!read_operands(opcode, operand)) { return false; }
+            add_carry(l, op == OP_SBC);
+            break;
+        case OP_CMP: case OP_CPX: case OP_CPY:
+            if (!read_operands(opcode, operand)) { return false; }
+            compare(l, reg_of(l, op));
+            break;
+        case OP_BIT:
+            if (!read_operands(opcode, operand)) { return false; }
+            bit(l);
+            break;
+        case OP_ASL: case OP_LSR: case OP_ROL: case OP_ROR:
+            if (am != ACC) { return false; }
+            shift_acc(l, op);
+            break;
+        case OP_CLC: set_flags(l, FLAG_MASK_C, 0);      break;
+        case OP_SEC: set_flags(l, FLAG_MASK_C, 0xFF);   break;
+        case OP_CLD: set_flags(l, FLAG_MASK_D, 0);      break;
+        case OP_SED: set_flags(l, FLAG_MASK_D, 0xFF);   break;
+        case OP_CLI: set_flags(l, FLAG_MASK_I, 0);      break;
+        case OP_SEI: set_flags(l, FLAG_MASK_I, 0xFF);   break;
+        case OP_CLV: set_flags(l, FLAG_MASK_V, 0);      break;
+        case OP_BCC: branch(l, FLAG_MASK_C, false, pc, operand);  break;
+        case OP_BCS: branch(l, FLAG_MASK_C, true, pc, operand);   break;
+        case OP_BNE: branch(l, FLAG_MASK_Z, false, pc, operand);  break;
+        case OP_BEQ: branch(l, FLAG_MASK_Z, true, pc, operand);   break;
+        case OP_BPL: branch(l, FLAG_MASK_N, false, pc, operand);  break;
+        case OP_BMI: branch(l, FLAG_MASK_N, true, pc, operand);   break;
+        case OP_BVC: branch(l, FLAG_MASK_V, false, pc, operand);  break;
+        case OP_BVS: branch(l, FLAG_MASK_V, true, pc, operand);   break;
+        case OP_JMP:
+            if (am != ABS) { return false; }
+            for (u32 i = 0; i < n; ++i) { PC[i] = mask[i] ? operand : PC[i]; }
+            break;
+        case OP_NOP:
+            break;
+        default:
+            return false;
+    }
+    finish(l, NUM_CYCLES_BASE[opcode], INSTR_BYTES[opcode]);
+    vectorSteps += 1;
+    return true;
+}
+
+const std::vector<s32>& mos6502::Batch::execute(s32 numCycles) {
+    gather(numCycles);
+    u32 n = size();
+    Lanes l = { n, mask.data(), val.data(), A.data(), X.data(), Y.data(), S.data(), SR.data(), PC.data(), cycles.data() };
+    // Lowest PC goes first so lanes behind catch up with the others
+    for (u32 next = lowest_pc(l, running.data()); next <= 0xFFFF; next = lowest_pc(l, running.data())) {
+        u16 pc = next;
+        u32 leader = 0;
+        while (!running[leader] || PC[leader] != pc) {
+            leader += 1;
+        }
+        u8 opcode = memory[leader]->read(pc);
+        u8 numBytes = operand_bytes(INSTR_GET_ADDR_MODE[opcode]);
+        u32 code = code_at(memory[leader], pc, numBytes);
+        u16 operand = code >> 8;
+
+        // Lanes with other code at the same PC diverge, they are run on their own like those the CPU
+        // has to run events or take an interrupt for. The others' devices see the cycle of the step.
+        for (u32 i = 0; i < n; ++i) {
+            bool here = running[i] && PC[i] == pc;
+            if (here) { cpus[i]->cycles = end[i] - cycles[i]; }
+            bool same = here && !needs_cpu(i) && code_at(memory[i], pc, numBytes) == code;
+            mask[i] = same ? 0xFF : 0;
+            if (here && !same) { step_scalar(i); }
+        }
+        if (!step_vector(pc, opcode, operand)) {
+            for (u32 i = 0; i < n; ++i) {
+                if (mask[i]) { step_scalar(i); }
+            }
+        }
+    }
+    for (u32 i = 0; i < n; ++i) {
+        if (results[i] != -1) { results[i] = numCycles - cycles[i]; }
+    }
+    scatter();
+    return results;
+}
@@ -0,0 +1,103 @@
+/*
+Cache of decoded basic blocks
+*/
+
+#include <algorithm>
+#include <cstring>
+
+#include "block_cache.hpp"
+
+
+mos6502::Block& mos6502::BlockCache::insert(u16 pc) {
+    if (slots.empty()) {
+        slots.resize(NUM_SLOTS);
+        codeBytes.assign((1 << 16) / 8, 0);
+    }
+    Block& block = slots[pc % NUM_SLOTS];
+    evict(block);
+    block.start = pc;
+    block.next = pc;
+    block.cycles = 0;
+    block.instrs.clear();
+    block.fused.clear();
+    block.hits = 0;
+    block.idleChecks = 0;
+    block.native = nullptr;
+    block.nativeBounded = nullptr;
+    return block;
+}
+
+void mos6502::BlockCache::commit(Block& block) {
+    u16 last = block.next - 1;
+    u16 slot = (u16) (&block - slots.data());
+    pageBlocks[block.start >> 8] += 1;
+    pageSlots[block.start >> 8].push_back(slot);
+    if ((last >> 8) != (block.start >> 8)) {
+        pageBlocks[last >> 8] += 1;
+        pageSlots[last >> 8].push_back(slot);
+    }
+    for (u16 addr = block.start; addr != block.next; ++addr) {
+        codeBytes[addr >> 3] |= 1 << (addr & 0x07);
+    }
+    block.valid = true;
+}
+
+void mos6502::BlockCache::evict(Block& block) {
+    if (!block.valid) {
+        return;
+    }
+    block.valid = false;
+    u16 last = block.next - 1;
+    u8 pages[2] = { (u8) (block.start >> 8), (u8) (last >> 8) };
+    for (u32 i = 0; i < ((pages[0] == pages[1]) ? 1u : 2u); ++i) {
+        unlist(pages[i], (u16) (&block - slots.data()));
+        pageBlocks[pages[i]] -= 1;
+        if (pageBlocks[pages[i]] == 0) {    // No more code in page, drop stale bits
+            memset(&codeBytes[pages[i] * 256 / 8], 0, 256 / 8);
+        }
+    }
+}
+
+void mos6502::BlockCache::unlist(u8 page, u16 slot) {
+    std::vector<u16>& list = pageSlots[page];
+    for (u32 i = 0; i < list.size(); ++i) {
+        if (list[i] == slot) {
+            list[i] = list.back();
+            list.pop_back();
+            return;
+        }
+    }
+}
+
+void mos6502::BlockCache::invalidate(u16 addr) {
+    // Backwards, evicting moves the last entry into the one removed
+    std::vector<u16>& list = pageSlots[addr >> 8];
+    for (u32 i = (u32) list.size(); i-- > 0; ) {
+        Block& block = slots[list[i]];
+        // Unsigned distance handles blocks wrapping around 0xFFFF
+        if ((u16) (addr - block.start) < (u16) (block.next - block.start)) {
+            evict(block);
+        }
+    }
+}
+
+void mos6502::BlockCache::invalidate_pages(const std::bitset<256>& pages) {
+    for (u32 page = 0; page < 256; ++page) {
+        std::vector<u16>& list = pageSlots[page];
+        while (pages[page] && !list.empty()) {
+            evict(slots[list.back()]);
+        }
+    }
+}
+
+void mos6502::BlockCache::clear() {
+    // Storage stays allocated for the blocks decoded next
+    for (Block& block : slots) {
+        block.valid = false;
+    }
+    std::fill(codeBytes.begin(), codeBytes.end(), 0);
+    memset(pageBlocks, 0, sizeof(pageBlocks));
+    for (std::vector<u16>& list : pageSlots) {
+        list.clear();
+    }
+}
@@ -0,0 +1,54 @@
+/*
+Devices synced to the CPU cycle on access
+*/
+
+#include "clocked_device.hpp"
+
+
+mos6502::ClockedDevice::ClockedDevice(CPU& cpu) : cpu(cpu), syncedCycle(cpu.now()), clears(cpu.events.clears()) {}
+
+mos6502::ClockedDevice::~ClockedDevice() {
+    cancel();
+}
+
+u8 mos6502::ClockedDevice::read(u16 addr) {
+    sync();
+    return read_register(addr);
+}
+
+void mos6502::ClockedDevice::write(u16 addr, u8 val) {
+    sync();
+    write_register(addr, val);
+}
+
+void mos6502::ClockedDevice::catch_up(u64 cycle) {
+    // The scheduler was cleared by a reset or restore, the CPU's clock may have gone back
+    if (clears != cpu.events.clears()) {
+        clears = cpu.events.clears();
+        eventId = 0;
+        syncedCycle = cycle;
+        return;
+    }
+    // Never backwards, the host may have synced past the cycle of an event
+    if (cycle > syncedCycle) {
+        advance(cycle);
+        syncedCycle = cycle;
+    }
+}
+
+void mos6502::ClockedDevice::schedule(u64 cycle) {
+    cancel();
+    eventId = cpu.events.schedule(cycle, [this](u64 at) {
+        eventId = 0;
+        catch_up(at);
+        event(at);
+    });
+    cpu.wake_at(cycle);
+}
+
+void mos6502::ClockedDevice::cancel() {
+    if (scheduled()) {
+        cpu.events.cancel(eventId);
+        eventId = 0;
+    }
+}
@@ -0,0 +1,170 @@
+/*
+Superinstructions: common instruction sequences run by one handler
+
+Each fused handler runs exec<> of every instruction in order, so cycles and flags are those of
+running them one at a time. Only the dispatch between them is saved, and the compiler can keep
+registers and lazy flags in host registers across the sequence.
+*/
+
+#include <algorithm>
+#include <cstring>
+
+#include "mos6502.hpp"
+#include "fusion.hpp"
+
+
+namespace {
+    using namespace mos6502;
+
+    template <u8... OPCODES>
+    constexpr Fusion fusion() {
+        return { sizeof...(OPCODES), { OPCODES... }, &CPU::fused_handler<OPCODES...> };
+    }
+
+    template <u8 OP1, u8... BRANCHES>
+    constexpr std::array<Fusion, sizeof...(BRANCHES)> with_branches() {
+        return {{ fusion<OP1, BRANCHES>()... }};
+    }
+
+    // Triples first so they win over their leading pair
+    const Fusion TRIPLES[] = {
+        fusion<CLC_IMP, ADC_IMM, STA_ZPG>(),
+        fusion<SEC_IMP, SBC_IMM, STA_ZPG>(),
+        fusion<LDA_ZPG, CLC_IMP, ADC_IMM>(),
+        fusion<LDA_ZPG, SEC_IMP, SBC_IMM>(),
+    };
+
+    const Fusion PAIRS[] = {
+        // Loop tails
+        fusion<DEX_IMP, BNE_REL>(),
+        fusion<DEY_IMP, BNE_REL>(),
+        fusion<INX_IMP, BNE_REL>(),
+        fusion<INY_IMP, BNE_REL>(),
+        fusion<DEX_IMP, BPL_REL>(),
+        fusion<DEY_IMP, BPL_REL>(),
+        // 16 bit counters
+        fusion<INC_ZPG, BNE_REL>(),
+        // Multi byte arithmetic
+        fusion<CLC_IMP, ADC_IMM>(),
+        fusion<CLC_IMP, ADC_ZPG>(),
+        fusion<CLC_IMP, ADC_ABS>(),
+        fusion<SEC_IMP, SBC_IMM>(),
+        fusion<SEC_IMP, SBC_ZPG>(),
+        fusion<SEC_IMP, SBC_ABS>(),
+        // Copies
+        fusion<LDA_IMM, STA_ZPG>(),
+        fusion<LDA_IMM, STA_ABS>(),
+        fusion<LDA_IMM, STA_ABX>(),
+        fusion<LDA_ZPG, STA_ZPG>(),
+        fusion<LDA_ZPG, STA_ABS>(),
+        fusion<LDA_ABS, STA_ZPG>(),
+        fusion<LDA_ABS, STA_ABS>(),
+        fusion<LDA_ABX, STA_ABX>(),
+        fusion<LDA_ABY, STA_ABY>(),
+        fusion<LDA_IDY, STA_IDY>(),
+    };
+
+    // Compare and branch
+    const std::array<Fusion, 4> COMPARES[] = {
+        with_branches<CMP_IMM, BNE_REL, BEQ_REL, BCC_REL, BCS_REL>(),
+        with_branches<CMP_ZPG, BNE_REL, BEQ_REL, BCC_REL, BCS_REL>(),
+        with_branches<CMP_ABS, BNE_REL, BEQ_REL, BCC_REL, BCS_REL>(),
+        with_branches<CPX_IMM, BNE_REL, BEQ_REL, BCC_REL, BCS_REL>(),
+        with_branches<CPY_IMM, BNE_REL, BEQ_REL, BCC_REL, BCS_REL>(),
+        with_branches<CPX_ZPG, BNE_REL, BEQ_REL, BCC_REL, BCS_REL>(),
+        with_branches<CPY_ZPG, BNE_REL, BEQ_REL, BCC_REL, BCS_REL>(),
+    };
+
+    bool matches(const Fusion& fusion, const DecodedInstr* instrs, u32 count) {
+        if (fusion.length > count) {
+            return false;
+        }
+        for (u32 i = 0; i < fusion.length; ++i) {
+            if (instrs[i].opcode != fusion.opcodes[i]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool has_fusion(const u8* opcodes, u32 length) {
+        DecodedInstr instrs[Fusion::MAX_LENGTH];
+        for (u32 i = 0; i < length; ++i) {
+            instrs[i].opcode = opcodes[i];
+        }
+        const Fusion* found = find_fusion(instrs, length);
+        return found != nullptr && found->length == length;
+    }
+}
+
+const mos6502::Fusion* mos6502::find_fusion(const DecodedInstr* instrs, u32 count) {
+    for (const Fusion& fusion : TRIPLES) {
+        if (matches(fusion, instrs, count)) { return &fusion; }
+    }
+    for (const Fusion& fusion : PAIRS) {
+        if (matches(fusion, instrs, count)) { return &fusion; }
+    }
+    for (const auto& compares : COMPARES) {
+        for (const Fusion& fusion : compares) {
+            if (matches(fusion, instrs, count)) { return &fusion; }
+        }
+    }
+    return nullptr;
+}
+
+u32 mos6502::pack_operands(const DecodedInstr* instrs, u32 length) {
+    u32 operands = 0;
+    u32 shift = 0;
+    for (u32 i = 0; i < length; ++i) {
+        if (operand_bytes(INSTR_GET_ADDR_MODE[instrs[i].opcode]) > 0) {
+            operands |= instrs[i].operand << shift;
+            shift += 16;
+        }
+    }
+    return operands;
+}
+
+void mos6502::FusionProfile::record(const Block& block) {
+    const std::vector<DecodedInstr>& instrs = block.instrs;
+    for (u32 i = 0; i < instrs.size(); ++i) {
+        u32 key = instrs[i].opcode;
+        for (u32 length = 2; length <= Fusion::MAX_LENGTH && i + length <= instrs.size(); ++length) {
+            key = (key << 8) | instrs[i + length - 1].opcode;
+            counts[(length << 24) | (key & 0xFFFFFF)] += 1;
+        }
+    }
+}
+
+std::vector<mos6502::FusionProfile::Entry> mos6502::FusionProfile::top(u32 limit) const {
+    std::vector<Entry> entries;
+    for (const auto& count : counts) {
+        Entry entry = {};
+        entry.length = count.first >> 24;
+        for (u32 i = 0; i < entry.length; ++i) {
+            entry.opcodes[i] = count.first >> (8 * (entry.length - 1 - i));
+        }
+        entry.count = count.second;
+        entry.fused = has_fusion(entry.opcodes, entry.length);
+        entries.push_back(entry);
+    }
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+        if (a.count != b.count) { return a.count > b.count; }
+        if (a.length != b.length) { return a.length < b.length; }
+        return memcmp(a.opcodes, b.opcodes, sizeof(a.opcodes)) < 0;
+    });
+    if (entries.size() > limit) {
+        entries.resize(limit);
+    }
+    return entries;
+}
+
+void mos6502::FusionProfile::print(FILE* out, u32 limit) const {
+    fprintf(out, "%16s  %-12s %s\n", "Count", "Opcodes", "Fused");
+    for (const Entry& entry : top(limit)) {
+        char opcodes[16] = "";
+        for (u32 i = 0; i < entry.length; ++i) {
+            snprintf(opcodes + 3 * i, sizeof(opcodes) - 3 * i, "%02X ", entry.opcodes[i]);
+        }
+        fprintf(out, "%16llu  %-12s %s\n", (unsigned long long) entry.count, opcodes, entry.fused ? "yes" : "");
+    }
+}
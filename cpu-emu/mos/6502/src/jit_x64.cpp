@@ -0,0 +1,545 @@
+/*
+x86-64 translation of 6502 basic blocks
+
+Register use inside translated code (all callee saved, so handler calls keep them):
+    rbx     CPU*
+    rbp     memory.ram, only accessed for pages mapped to it
+    r12d    A
+    r13d    X
+    r14d    Y
+    r15d    cycles left (CPU::numCycles)
+Registers hold zero extended 8 bit values. eax, ecx are scratch.
+*/
+
+#include <cstring>
+#include <vector>
+
+#include "mos6502.hpp"
+#include "jit.hpp"
+
+#if defined(__x86_64__) && defined(__unix__)
+
+#include <sys/mman.h>
+
+namespace {
+    using namespace mos6502;
+
+    enum Reg { RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RBP = 5, RSI = 6, RDI = 7,
+               R12 = 12, R13 = 13, R14 = 14, R15 = 15 };
+    enum Cond { CC_E = 0x4, CC_NE = 0x5, CC_G = 0xF };
+    enum AluOp { ALU_ADD = 0, ALU_OR = 1, ALU_AND = 4, ALU_SUB = 5, ALU_XOR = 6, ALU_CMP = 7 };
+    enum ShiftOp { SHIFT_SHL = 4, SHIFT_SHR = 5 };
+
+    // [base + index * (1 << scale) + disp]
+    struct Mem {
+        int base;
+        int index;
+        int scale;
+        s32 disp;
+    };
+    Mem mem(int base, s32 disp)                     { return { base, -1, 0, disp }; }
+    Mem mem(int base, int index, int scale, s32 disp) { return { base, index, scale, disp }; }
+
+    // Just enough of an x86-64 assembler
+    class Emitter {
+     public:
+        std::vector<u8> code;
+
+        u32 pos() const { return code.size(); }
+
+        void emit8(u8 b) { code.push_back(b); }
+        void emit16(u16 v) { emit8(v); emit8(v >> 8); }
+        void emit32(u32 v) { emit16(v); emit16(v >> 16); }
+        void emit64(std::uint64_t v) { emit32(v); emit32(v >> 32); }
+
+        // Byte registers always get a REX prefix so 4-7 are spl..dil, not ah..bh
+        void rex(bool w, int reg, int index, int base, bool byteRegs) {
+            u8 r = 0x40 | (w ? 0x08 : 0) | (((reg >> 3) & 1) << 2) | (((index >> 3) & 1) << 1) | ((base >> 3) & 1);
+            if (r != 0x40 || byteRegs) { emit8(r); }
+        }
+        void rex_mem(bool w, int reg, const Mem& m, bool byteRegs) {
+            rex(w, reg, (m.index < 0) ? 0 : m.index, m.base, byteRegs);
+        }
+        void modrm_reg(int reg, int rm) { emit8(0xC0 | ((reg & 7) << 3) | (rm & 7)); }
+        void modrm_mem(int reg, const Mem& m) {
+            if (m.index < 0) {
+                emit8(0x80 | ((reg & 7) << 3) | (m.base & 7));
+                if ((m.base & 7) == RSP) { emit8(0x24); }
+            } else {
+                emit8(0x80 | ((reg & 7) << 3) | 0x04);
+                emit8((m.scale << 6) | ((m.index & 7) << 3) | (m.base & 7));
+            }
+            emit32(m.disp);
+        }
+
+        void push(int r)  { rex(false, 0, 0, r, false); emit8(0x50 + (r & 7)); }
+        void pop(int r)   { rex(false, 0, 0, r, false); emit8(0x58 + (r & 7)); }
+        void ret()        { emit8(0xC3); }
+        void call(int r)  { rex(false, 0, 0, r, false); emit8(0xFF); modrm_reg(2, r); }
+
+        void mov_r32_imm(int r, u32 imm)            { rex(false, 0, 0, r, false); emit8(0xB8 + (r & 7)); emit32(imm); }
+        void mov_r64_imm(int r, std::uint64_t imm)  { rex(true, 0, 0, r, false); emit8(0xB8 + (r & 7)); emit64(imm); }
+        void mov_r64_r64(int dst, int src)          { rex(true, src, 0, dst, false); emit8(0x89); modrm_reg(src, dst); }
+        void mov_r32_r32(int dst, int src)          { rex(false, src, 0, dst, false); emit8(0x89); modrm_reg(src, dst); }
+        void movzx_r32_r8(int dst, int src)         { rex(false, dst, 0, src, true); emit8(0x0F); emit8(0xB6); modrm_reg(dst, src); }
+        void movzx_r32_m8(int dst, const Mem& m)    { rex_mem(false, dst, m, false); emit8(0x0F); emit8(0xB6); modrm_mem(dst, m); }
+        void movzx_r32_m16(int dst, const Mem& m)   { rex_mem(false, dst, m, false); emit8(0x0F); emit8(0xB7); modrm_mem(dst, m); }
+        void mov_r32_m32(int dst, const Mem& m)     { rex_mem(false, dst, m, false); emit8(0x8B); modrm_mem(dst, m); }
+        void mov_m8_r8(const Mem& m, int src)       { rex_mem(false, src, m, true); emit8(0x88); modrm_mem(src, m); }
+        void mov_m16_r16(const Mem& m, int src)     { emit8(0x66); rex_mem(false, src, m, false); emit8(0x89); modrm_mem(src, m); }
+        void mov_m32_r32(const Mem& m, int src)     { rex_mem(false, src, m, false); emit8(0x89); modrm_mem(src, m); }
+        void mov_m8_imm(const Mem& m, u8 imm)       { rex_mem(false, 0, m, false); emit8(0xC6); modrm_mem(0, m); emit8(imm); }
+        void mov_m16_imm(const Mem& m, u16 imm)     { emit8(0x66); rex_mem(false, 0, m, false); emit8(0xC7); modrm_mem(0, m); emit16(imm); }
+
+        void alu_r32_r32(AluOp op, int dst, int src) {
+            static const u8 OPCODES[8] = { 0x01, 0x09, 0, 0, 0x21, 0x29, 0x31, 0x39 };
+            rex(false, src, 0, dst, false); emit8(OPCODES[op]); modrm_reg(src, dst);
+        }
+        void alu_r32_imm(AluOp op, int dst, u32 imm) { rex(false, 0, 0, dst, false); emit8(0x81); modrm_reg(op, dst); emit32(imm); }
+        void alu_r64_imm8(AluOp op, int dst, u8 imm) { rex(true, 0, 0, dst, false); emit8(0x83); modrm_reg(op, dst); emit8(imm); }
+        void alu_m8_imm(AluOp op, const Mem& m, u8 imm) { rex_mem(false, 0, m, false); emit8(0x80); modrm_mem(op, m); emit8(imm); }
+        void cmp_m16_imm8(const Mem& m, u8 imm)     { emit8(0x66); rex_mem(false, 0, m, false); emit8(0x83); modrm_mem(ALU_CMP, m); emit8(imm); }
+        void test_m8_imm(const Mem& m, u8 imm)      { rex_mem(false, 0, m, false); emit8(0xF6); modrm_mem(0, m); emit8(imm); }
+        void shift_r32(ShiftOp op, int r, u8 n)     { rex(false, 0, 0, r, false); emit8(0xC1); modrm_reg(op, r); emit8(n); }
+        void setcc_r8(Cond cc, int r)               { rex(false, 0, 0, r, true); emit8(0x0F); emit8(0x90 + cc); modrm_reg(0, r); }
+
+        // Jumps return the position of their rel32 for patch()
+        u32 jcc(Cond cc)  { emit8(0x0F); emit8(0x80 + cc); emit32(0); return pos() - 4; }
+        u32 jmp()         { emit8(0xE9); emit32(0); return pos() - 4; }
+        void patch(u32 at) { patch(at, pos()); }
+        void patch(u32 at, u32 target) {
+            u32 rel = target - (at + 4);
+            memcpy(&code[at], &rel, 4);
+        }
+    };
+}
+
+/*
+ * Translates one block. Cycles of native instructions are summed at compile time and only
+ * subtracted before handler calls and exits.
+ */
+class mos6502::Jit::Translator {
+ public:
+    Translator(CPU& cpu, Block& block, bool bounded) : cpu(cpu), block(block), bounded(bounded) {}
+
+    const std::vector<u8>& translate();
+
+ private:
+    // Displacement of a CPU field from rbx
+    s32 field(const void* p) const { return (s32) ((const u8*) p - (const u8*) &cpu); }
+    Mem cpu_field(const void* p) const { return mem(RBX, field(p)); }
+
+    void flush_cycles() {
+        if (pendingCycles != 0) {
+            e.alu_r32_imm(ALU_SUB, R15, pendingCycles);
+            pendingCycles = 0;
+        }
+    }
+    // Leave the block with PC = pc, cycles so far are paid but stay pending for code after the exit
+    void exit_at(u16 pc) {
+        if (pendingCycles != 0) { e.alu_r32_imm(ALU_SUB, R15, pendingCycles); }
+        e.mov_m16_imm(cpu_field(&cpu.PC), pc);
+        exits.push_back(e.jmp());
+    }
+    void exit_keep_pc() {
+        if (pendingCycles != 0) { e.alu_r32_imm(ALU_SUB, R15, pendingCycles); }
+        exits.push_back(e.jmp());
+    }
+    // A write invalidated this block, the rest of it may be stale
+    void exit_if_block_invalid(bool keepPC, u16 pc) {
+        e.mov_r64_imm(RAX, (std::uint64_t) &block.valid);
+        e.test_m8_imm(mem(RAX, 0), 0xFF);
+        u32 stillValid = e.jcc(CC_NE);
+        if (keepPC) { exit_keep_pc(); } else { exit_at(pc); }
+        e.patch(stillValid);
+    }
+
+    void set_nz(int r) {
+        e.mov_m8_r8(cpu_field(&cpu.n_src), r);
+        e.mov_m8_r8(cpu_field(&cpu.z_src), r);
+    }
+
+    // Code is dropped whenever the memory map changes, so pages can be checked at translation
+    bool native_operand(AddrMode am, u16 operand) const {
+        const Memory& memory = cpu.memory;
+        u8 page = highByte(operand);
+        switch (am) {
+            case IMM:           return true;
+            case ZPG: case ZPX: case ZPY: return memory.is_ram(0);
+            case ABS:           return memory.is_ram(page);
+            case ABX: case ABY: return memory.is_ram(page) && memory.is_ram((u8) (page + 1));
+            default:            return false;
+        }
+    }
+    // Effective address of a memory operand, in eax if it depends on X / Y (returns true), else in addr
+    bool address(AddrMode am, u16 operand, u16& addr) {
+        int index = (am == ZPX || am == ABX) ? R13 : R14;
+        switch (am) {
+            case ZPG: addr = (u8) operand; return false;
+            case ABS: addr = operand; return false;
+            case ZPX: case ZPY:
+                e.mov_r32_r32(RAX, index);
+                e.alu_r32_imm(ALU_ADD, RAX, operand);
+                e.movzx_r32_r8(RAX, RAX);
+                return true;
+            default:    // ABX, ABY
+                e.mov_r32_r32(RAX, index);
+                e.alu_r32_imm(ALU_ADD, RAX, operand);
+                e.alu_r32_imm(ALU_AND, RAX, 0xFFFF);
+                return true;
+        }
+    }
+    // Value operand of op into dst (eax or ecx), indexed absolute modes pay for page crossing when
+    // pays_page_cross(op)
+    void load_operand(Operation op, AddrMode am, u16 operand, int dst) {
+        if (am == IMM) {
+            e.mov_r32_imm(dst, (u8) operand);
+            return;
+        }
+        u16 addr;
+        if (!address(am, operand, addr)) {
+            e.movzx_r32_m8(dst, mem(RBP, addr));
+            return;
+        }
+        if ((am == ABX || am == ABY) && pays_page_cross(op)) {
+            e.mov_r32_r32(RCX, RAX);
+            e.shift_r32(SHIFT_SHR, RCX, 8);
+            e.alu_r32_imm(ALU_CMP, RCX, highByte(operand));
+            e.setcc_r8(CC_NE, RCX);
+            e.movzx_r32_r8(RCX, RCX);
+            e.alu_r32_r32(ALU_SUB, R15, RCX);
+        }
+        e.movzx_r32_m8(dst, mem(RBP, RAX, 0, 0));
+    }
+    void store(AddrMode am, u16 operand, int src, u16 nextPC) {
+        u16 addr;
+        u32 noCode;
+        if (address(am, operand, addr)) {
+            e.mov_m8_r8(mem(RBP, RAX, 0, 0), src);
+            e.mov_r32_r32(RCX, RAX);
+            e.shift_r32(SHIFT_SHR, RCX, 8);
+            e.mov_m8_imm(mem(RBX, RCX, 0, field(cpu.memory.dirty_pages())), 1);
+            e.cmp_m16_imm8(mem(RBX, RCX, 1, field(cpu.blockCache.page_blocks())), 0);
+            noCode = e.jcc(CC_E);
+            e.mov_r32_r32(RSI, RAX);
+        } else {
+            e.mov_m8_r8(mem(RBP, addr), src);
+            e.mov_m8_imm(cpu_field(&cpu.memory.dirty_pages()[addr >> 8]), 1);
+            e.cmp_m16_imm8(cpu_field(&cpu.blockCache.page_blocks()[addr >> 8]), 0);
+            noCode = e.jcc(CC_E);
+            e.mov_r32_imm(RSI, addr);
+        }
+        // Page has cached code, let the block cache decide
+        e.mov_r64_r64(RDI, RBX);
+        e.mov_r64_imm(RAX, (std::uint64_t) &Jit::code_written);
+        e.call(RAX);
+        exit_if_block_invalid(false, nextPC);
+        e.patch(noCode);
+    }
+
+    void spill() {
+        e.mov_m8_r8(cpu_field(&cpu.A), R12);
+        e.mov_m8_r8(cpu_field(&cpu.X), R13);
+        e.mov_m8_r8(cpu_field(&cpu.Y), R14);
+        e.mov_m32_r32(cpu_field(&cpu.numCycles), R15);
+    }
+    void reload() {
+        e.movzx_r32_m8(R12, cpu_field(&cpu.A));
+        e.movzx_r32_m8(R13, cpu_field(&cpu.X));
+        e.movzx_r32_m8(R14, cpu_field(&cpu.Y));
+        e.mov_r32_m32(R15, cpu_field(&cpu.numCycles));
+    }
+    // Instruction without native translation, the handler does everything including PC and cycles
+    void call_handler(const DecodedInstr& instr, u16 pc, bool last) {
+        flush_cycles();
+        spill();
+        e.mov_m16_imm(cpu_field(&cpu.PC), pc);
+        e.mov_r64_r64(RDI, RBX);
+        e.mov_r32_imm(RSI, instr.operand);
+        e.mov_r64_imm(RAX, (std::uint64_t) instr.handler);
+        e.call(RAX);
+        reload();
+        if (last) {
+            exit_keep_pc();
+        } else {
+            exit_if_block_invalid(true, 0);
+        }
+    }
+
+    // Conditional branch ending the block, flag tested with mask
+    void branch(Mem flag, u8 mask, bool zeroWhenSet, bool takenIfSet, u16 pc, u8 offset) {
+        flush_cycles();
+        e.test_m8_imm(flag, mask);
+        // test sets ZF when the masked bits are clear (or for Z: when z_src is non zero)
+        bool set_is_nz = !zeroWhenSet;
+        Cond notTaken = ((takenIfSet == set_is_nz) ? CC_E : CC_NE);
+        u32 skip = e.jcc(notTaken);
+        u16 newPC = pc + (s8) offset;
+        pendingCycles = 1 + 2 * onDifferentPages(pc, newPC);
+        exit_at(newPC);
+        pendingCycles = 0;
+        e.patch(skip);
+        exit_at(pc + 2);
+    }
+
+    bool translate_instr(const DecodedInstr& instr, u16 pc, bool last, bool decimalKnown);
+
+    CPU& cpu;
+    Block& block;
+    bool bounded;
+    Emitter e;
+    u32 pendingCycles = 0;
+    std::vector<u32> exits;     // Jumps to the epilogue
+    bool checkDecimal = false;  // Binary ADC / SBC translated, decline to run in decimal mode
+};
+
+// Returns false if the instruction has no native translation
+bool mos6502::Jit::Translator::translate_instr(const DecodedInstr& instr, u16 pc, bool last, bool decimalKnown) {
+    Operation op = instr_operation(instr.opcode);
+    AddrMode am = INSTR_GET_ADDR_MODE[instr.opcode];
+    u16 operand = instr.operand;
+    u16 nextPC = pc + 1 + operand_bytes(am);
+    int reg = R12;
+
+    switch (op) {
+        case OP_LDA: case OP_LDX: case OP_LDY:
+            if (!native_operand(am, operand)) { return false; }
+            reg = (op == OP_LDA) ? R12 : (op == OP_LDX) ? R13 : R14;
+            load_operand(op, am, operand, reg);
+            set_nz(reg);
+            break;
+        case OP_STA: case OP_STX: case OP_STY:
+            if (!native_operand(am, operand)) { return false; }
+            pendingCycles += NUM_CYCLES_BASE[instr.opcode];
+            store(am, operand, (op == OP_STA) ? R12 : (op == OP_STX) ? R13 : R14, nextPC);
+            if (last) {
+                exit_at(nextPC);
+            }
+            return true;
+        case OP_TAX: e.mov_r32_r32(R13, R12); set_nz(R13); break;
+        case OP_TAY: e.mov_r32_r32(R14, R12); set_nz(R14); break;
+        case OP_TXA: e.mov_r32_r32(R12, R13); set_nz(R12); break;
+        case OP_TYA: e.mov_r32_r32(R12, R14); set_nz(R12); break;
+        case OP_TSX: e.movzx_r32_m8(R13, cpu_field(&cpu.S)); set_nz(R13); break;
+        case OP_TXS: e.mov_m8_r8(cpu_field(&cpu.S), R13); break;
+        case OP_CLC: e.mov_m16_imm(cpu_field(&cpu.c_src), 0); break;
+        case OP_SEC: e.mov_m16_imm(cpu_field(&cpu.c_src), 0x100); break;
+        case OP_CLV: e.mov_m8_imm(cpu_field(&cpu.v_src), 0); break;
+        case OP_CLD: e.alu_m8_imm(ALU_AND, cpu_field(&cpu.SR), (u8) ~FLAG_MASK_D); break;
+        case OP_CLI: e.alu_m8_imm(ALU_AND, cpu_field(&cpu.SR), (u8) ~FLAG_MASK_I); break;
+        case OP_SED: e.alu_m8_imm(ALU_OR, cpu_field(&cpu.SR), FLAG_MASK_D); break;
+        case OP_SEI: e.alu_m8_imm(ALU_OR, cpu_field(&cpu.SR), FLAG_MASK_I); break;
+        case OP_INX: case OP_INY: case OP_DEX: case OP_DEY:
+            reg = (op == OP_INX || op == OP_DEX) ? R13 : R14;
+            e.alu_r32_imm(ALU_ADD, reg, (op == OP_INX || op == OP_INY) ? 0x01 : 0xFF);
+            e.movzx_r32_r8(reg, reg);
+            set_nz(reg);
+            break;
+        case OP_AND: case OP_ORA: case OP_EOR:
+            if (!native_operand(am, operand)) { return false; }
+            load_operand(op, am, operand, RAX);
+            e.alu_r32_r32((op == OP_AND) ? ALU_AND : (op == OP_ORA) ? ALU_OR : ALU_XOR, R12, RAX);
+            set_nz(R12);
+            break;
+        case OP_ADC: case OP_SBC:
+            // Binary mode only, decimal mode is unknown unless nothing before could have set it
+            if (!native_operand(am, operand) || !decimalKnown) { return false; }
+            checkDecimal = true;
+            load_operand(op, am, operand, RCX);
+            if (op == OP_SBC) { e.alu_r32_imm(ALU_XOR, RCX, 0xFF); }
+            e.movzx_r32_m16(RAX, cpu_field(&cpu.c_src));
+            e.shift_r32(SHIFT_SHR, RAX, 8);
+            e.alu_r32_r32(ALU_ADD, RAX, RCX);
+            e.alu_r32_r32(ALU_ADD, RAX, R12);
+            e.mov_m16_r16(cpu_field(&cpu.c_src), RAX);
+            e.mov_r32_r32(RCX, R12);
+            e.alu_r32_r32(ALU_XOR, RCX, RAX);
+            e.mov_m8_r8(cpu_field(&cpu.v_src), RCX);
+            e.movzx_r32_r8(R12, RAX);
+            set_nz(R12);
+            break;
+        case OP_CMP: case OP_CPX: case OP_CPY:
+            if (!native_operand(am, operand)) { return false; }
+            load_operand(op, am, operand, RCX);
+            e.mov_r32_r32(RAX, (op == OP_CMP) ? R12 : (op == OP_CPX) ? R13 : R14);
+            e.alu_r32_imm(ALU_XOR, RCX, 0xFF);
+            e.alu_r32_r32(ALU_ADD, RAX, RCX);
+            e.alu_r32_imm(ALU_ADD, RAX, 1);
+            e.mov_m16_r16(cpu_field(&cpu.c_src), RAX);
+            set_nz(RAX);
+            break;
+        case OP_BIT:
+            if (!native_operand(am, operand)) { return false; }
+            load_operand(op, am, operand, RAX);
+            e.alu_r32_r32(ALU_AND, RAX, R12);
+            set_nz(RAX);
+            e.alu_r32_imm(ALU_AND, RAX, 0x40);
+            e.shift_r32(SHIFT_SHL, RAX, 1);
+            e.mov_m8_r8(cpu_field(&cpu.v_src), RAX);
+            break;
+        case OP_ASL: case OP_LSR: case OP_ROL: case OP_ROR:
+            if (am != ACC) { return false; }
+            if (op == OP_ASL) {
+                e.mov_r32_r32(RAX, R12);
+                e.shift_r32(SHIFT_SHL, RAX, 1);
+                e.mov_m16_r16(cpu_field(&cpu.c_src), RAX);
+                e.movzx_r32_r8(R12, RAX);
+            } else if (op == OP_LSR) {
+                e.mov_r32_r32(RAX, R12);
+                e.alu_r32_imm(ALU_AND, RAX, 0x01);
+                e.shift_r32(SHIFT_SHL, RAX, 8);
+                e.mov_m16_r16(cpu_field(&cpu.c_src), RAX);
+                e.shift_r32(SHIFT_SHR, R12, 1);
+            } else if (op == OP_ROL) {
+                e.movzx_r32_m16(RAX, cpu_field(&cpu.c_src));
+                e.shift_r32(SHIFT_SHR, RAX, 8);
+                e.mov_r32_r32(RCX, R12);
+                e.shift_r32(SHIFT_SHL, RCX, 1);
+                e.alu_r32_r32(ALU_ADD, RAX, RCX);
+                e.mov_m16_r16(cpu_field(&cpu.c_src), RAX);
+                e.movzx_r32_r8(R12, RAX);
+            } else {
+                e.movzx_r32_m16(RAX, cpu_field(&cpu.c_src));
+                e.shift_r32(SHIFT_SHR, RAX, 8);
+                e.shift_r32(SHIFT_SHL, RAX, 7);
+                e.mov_r32_r32(RCX, R12);
+                e.alu_r32_imm(ALU_AND, RCX, 0x01);
+                e.shift_r32(SHIFT_SHL, RCX, 8);
+                e.mov_m16_r16(cpu_field(&cpu.c_src), RCX);
+                e.shift_r32(SHIFT_SHR, R12, 1);
+                e.alu_r32_r32(ALU_ADD, R12, RAX);
+            }
+            set_nz(R12);
+            break;
+        case OP_NOP:
+            break;
+        case OP_JMP:
+            if (am != ABS) { return false; }
+            pendingCycles += NUM_CYCLES_BASE[instr.opcode];
+            exit_at(operand);
+            return true;
+        case OP_BCC: case OP_BCS: case OP_BEQ: case OP_BNE: case OP_BMI: case OP_BPL: case OP_BVC: case OP_BVS: {
+            pendingCycles += NUM_CYCLES_BASE[instr.opcode];
+            bool takenIfSet = (op == OP_BCS || op == OP_BEQ || op == OP_BMI || op == OP_BVS);
+            if (op == OP_BCC || op == OP_BCS) {         // C is bit 8 of c_src
+                branch(mem(RBX, field(&cpu.c_src) + 1), 0x01, false, takenIfSet, pc, operand);
+            } else if (op == OP_BEQ || op == OP_BNE) {  // Z is set when z_src is 0
+                branch(cpu_field(&cpu.z_src), 0xFF, true, takenIfSet, pc, operand);
+            } else if (op == OP_BMI || op == OP_BPL) {
+                branch(cpu_field(&cpu.n_src), 0x80, false, takenIfSet, pc, operand);
+            } else {
+                branch(cpu_field(&cpu.v_src), 0x80, false, takenIfSet, pc, operand);
+            }
+            return true;
+        }
+        default:
+            return false;
+    }
+    pendingCycles += NUM_CYCLES_BASE[instr.opcode];
+    if (last) {
+        exit_at(nextPC);
+    }
+    return true;
+}
+
+const std::vector<u8>& mos6502::Jit::Translator::translate() {
+    // Prologue, keeps the stack 16 byte aligned for handler calls
+    e.push(RBX); e.push(RBP); e.push(R12); e.push(R13); e.push(R14); e.push(R15);
+    e.alu_r64_imm8(ALU_SUB, RSP, 8);
+    e.mov_r64_r64(RBX, RDI);
+    // Patched to test the decimal flag when needed
+    e.test_m8_imm(cpu_field(&cpu.SR), 0);
+    u32 decimalTest = e.pos() - 1;
+    u32 decimal = e.jcc(CC_NE);
+    e.mov_r64_imm(RBP, (std::uint64_t) cpu.memory.ram);
+    reload();
+
+    u16 pc = block.start;
+    bool decimalKnown = true;
+    for (u32 i = 0; i < block.instrs.size(); ++i) {
+        const DecodedInstr& instr = block.instrs[i];
+        bool last = (i + 1 == block.instrs.size());
+        if (bounded && i > 0) {     // Cycles left (r15d - pending) must be positive
+            e.alu_r32_imm(ALU_CMP, R15, pendingCycles);
+            u32 inBudget = e.jcc(CC_G);
+            exit_at(pc);
+            e.patch(inBudget);
+        }
+        if (!translate_instr(instr, pc, last, decimalKnown)) {
+            call_handler(instr, pc, last);
+        }
+        Operation op = instr_operation(instr.opcode);
+        if (op == OP_SED || op == OP_PLP || op == OP_RTI) {
+            decimalKnown = false;
+        }
+        pc += 1 + operand_bytes(INSTR_GET_ADDR_MODE[instr.opcode]);
+    }
+    // Block without control transfer at the end (too long) exited in translate_instr
+    // Epilogue
+    for (u32 exit : exits) {
+        e.patch(exit);
+    }
+    e.mov_m8_r8(cpu_field(&cpu.A), R12);
+    e.mov_m8_r8(cpu_field(&cpu.X), R13);
+    e.mov_m8_r8(cpu_field(&cpu.Y), R14);
+    e.mov_m32_r32(cpu_field(&cpu.numCycles), R15);
+    e.mov_r32_imm(RAX, 0);
+    u32 epilogue = e.pos();
+    e.alu_r64_imm8(ALU_ADD, RSP, 8);
+    e.pop(R15); e.pop(R14); e.pop(R13); e.pop(R12); e.pop(RBP); e.pop(RBX);
+    e.ret();
+    // Declined, nothing changed
+    e.patch(decimal);
+    e.mov_r32_imm(RAX, 1);
+    e.patch(e.jmp(), epilogue);
+    if (checkDecimal) {
+        e.code[decimalTest] = FLAG_MASK_D;
+    }
+    return e.code;
+}
+
+mos6502::Jit::~Jit() {
+    if (buffer != nullptr) {
+        munmap(buffer, BUFFER_SIZE);
+    }
+}
+
+bool mos6502::Jit::compile(CPU& cpu, Block& block, bool bounded) {
+    if (unusable || full()) {
+        return false;
+    }
+    if (buffer == nullptr) {
+        // Writable and executable at once, see jit.hpp
+        void* p = mmap(nullptr, BUFFER_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            unusable = true;
+            return false;
+        }
+        buffer = (u8*) p;
+    }
+    Translator translator(cpu, block, bounded);
+    const std::vector<u8>& code = translator.translate();
+    if (code.size() > MAX_BLOCK_CODE) {
+        return false;
+    }
+    memcpy(buffer + used, code.data(), code.size());
+    (bounded ? block.nativeBounded : block.native) = (NativeBlock) (buffer + used);
+    used += (code.size() + 15) & ~15u;
+    return true;
+}
+
+void mos6502::Jit::code_written(CPU* cpu, u32 addr) {
+    cpu->written(addr);
+}
+
+#else
+
+mos6502::Jit::~Jit() {}
+
+bool mos6502::Jit::compile(CPU&, Block&, bool) {
+    return false;
+}
+
+void mos6502::Jit::code_written(CPU*, u32) {}
+
+#endif
@@ -0,0 +1,298 @@
+/*
+Program image loaders
+*/
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "loader.hpp"
+#include "mos6502.hpp"
+
+#if defined(__unix__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+
+// Whole file, false if it cannot be read
+static bool read_file(const char* path, std::vector<u8>& out) {
+    FILE* in = fopen(path, "rb");
+    if (in == nullptr) {
+        return false;
+    }
+    out.clear();
+    u8 buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+        out.insert(out.end(), buf, buf + n);
+    }
+    bool ok = !ferror(in);
+    fclose(in);
+    return ok;
+}
+
+static bool ends_with(const char* s, const char* suffix) {
+    size_t n = strlen(s);
+    size_t m = strlen(suffix);
+    if (n < m) {
+        return false;
+    }
+    for (size_t i = 0; i < m; ++i) {
+        if (tolower((unsigned char) s[n - m + i]) != suffix[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static s32 hex_digit(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    c = (char) tolower((unsigned char) c);
+    return (c >= 'a' && c <= 'f') ? c - 'a' + 10 : -1;
+}
+
+// Whether size bytes from start include both bytes at addr
+static bool covers(u32 start, u32 size, u32 addr) {
+    return start <= addr && start + size >= addr + 2;
+}
+
+bool mos6502::ImageLoader::fail(const char* path, const char* what) {
+    err = std::string(path) + ": " + what;
+    return false;
+}
+
+bool mos6502::ImageLoader::load(CPU& cpu, const char* path) {
+    err.clear();
+    wasMapped = false;
+    startRecord = -1;
+    hasVector = false;
+    ImageFormat f = format;
+    if (f == IMAGE_AUTO) {
+        if (ends_with(path, ".hex") || ends_with(path, ".ihex")) {
+            f = IMAGE_HEX;
+        } else if (ends_with(path, ".prg")) {
+            f = IMAGE_PRG;
+        } else {
+            f = IMAGE_RAW;
+        }
+    }
+    bool ok = false;
+    switch (f) {
+        case IMAGE_PRG: ok = load_prg(cpu, path); break;
+        case IMAGE_HEX: ok = load_hex(cpu, path); break;
+        default:        ok = load_raw(cpu, path); break;
+    }
+    if (!ok) {
+        return false;
+    }
+
+    if (hasVector) {
+        entryPC = B2W(cpu[RESET_VEC_LOC], cpu[RESET_VEC_LOC + 1]);
+    } else {
+        entryPC = (startRecord >= 0) ? (u16) startRecord : first;
+        cpu[RESET_VEC_LOC] = (u8) (entryPC & 0xFF);
+        cpu[RESET_VEC_LOC + 1] = (u8) (entryPC >> 8);
+    }
+    cpu.PC = entryPC;
+    return true;
+}
+
+bool mos6502::ImageLoader::load_raw(CPU& cpu, const char* path) {
+    FILE* in = fopen(path, "rb");
+    if (in == nullptr) {
+        return fail(path, "cannot open");
+    }
+    long size = -1;
+    if (fseek(in, 0, SEEK_END) == 0) {
+        size = ftell(in);
+    }
+    if (size <= 0 || size > MEM_MAX) {
+        fclose(in);
+        return fail(path, "image must be 1 to 65536 bytes");
+    }
+    s32 addr = (address >= 0) ? address : MEM_MAX - (s32) size;
+    if (addr + size > MEM_MAX) {
+        fclose(in);
+        return fail(path, "image runs past 0xFFFF");
+    }
+    if (rom && (addr % PAGE_SIZE) != 0) {
+        fclose(in);
+        return fail(path, "ROM images must start on a page boundary");
+    }
+    first = (u16) addr;
+    numBytes = (u32) size;
+    hasVector = covers(first, numBytes, RESET_VEC_LOC);
+    Memory& memory = cpu.memory;
+    u8 page = (u8) (addr / PAGE_SIZE);
+    u32 wholePages = (u32) size / PAGE_SIZE;
+
+#if defined(__unix__)
+    // Whole pages straight from the file, the tail page is copied so it is padded like make_rom()
+    if (rom && wholePages != 0) {
+        void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fileno(in), 0);
+        if (mapped != MAP_FAILED) {
+            fclose(in);
+            std::shared_ptr<const void> storage(mapped, [size](const void* p) { munmap((void*) p, size); });
+            memory.keep_alive(storage);
+            memory.map_rom(page, wholePages, (const u8*) mapped);
+            u32 tail = (u32) size % PAGE_SIZE;
+            if (tail != 0) {
+                memory.map_rom(page + wholePages, make_rom((const u8*) mapped + wholePages * PAGE_SIZE, tail));
+            }
+            wasMapped = true;
+            return true;
+        }
+    }
+#endif
+    std::vector<u8> data((size_t) size);
+    bool ok = fseek(in, 0, SEEK_SET) == 0 && fread(data.data(), 1, data.size(), in) == data.size();
+    fclose(in);
+    if (!ok) {
+        return fail(path, "cannot read");
+    }
+    if (rom) {
+        memory.map_rom(page, make_rom(data.data(), (u32) size));
+    } else {
+        memory.load(first, data.data(), (u32) size);
+    }
+    return true;
+}
+
+bool mos6502::ImageLoader::load_prg(CPU& cpu, const char* path) {
+    std::vector<u8> data;
+    if (!read_file(path, data)) {
+        return fail(path, "cannot read");
+    }
+    if (data.size() < 3) {
+        return fail(path, "no load address or no data");
+    }
+    u32 addr = B2W(data[0], data[1]);
+    u32 size = (u32) data.size() - 2;
+    if (addr + size > MEM_MAX) {
+        return fail(path, "image runs past 0xFFFF");
+    }
+    first = (u16) addr;
+    numBytes = size;
+    hasVector = covers(first, numBytes, RESET_VEC_LOC);
+    cpu.memory.load(first, data.data() + 2, size);
+    return true;
+}
+
+bool mos6502::ImageLoader::load_hex(CPU& cpu, const char* path) {
+    std::vector<u8> text;
+    if (!read_file(path, text)) {
+        return fail(path, "cannot read");
+    }
+    // Parsed whole before memory is touched, records may leave gaps
+    std::vector<u8> image(MEM_MAX);
+    std::vector<bool> written(MEM_MAX);
+    u32 base = 0;
+    u32 lowest = MEM_MAX;
+    u32 highest = 0;
+    bool done = false;
+    size_t i = 0;
+    while (i < text.size() && !done) {
+        if (text[i] != ':') {
+            if (!isspace(text[i])) {
+                return fail(path, "expected ':' at the start of a record");
+            }
+            i += 1;
+            continue;
+        }
+        i += 1;
+        // Byte count, address, type, data and checksum
+        u8 record[4 + 255 + 1];
+        u32 length = 0;
+        u32 needed = 5;
+        u8 sum = 0;
+        while (length < needed) {
+            if (i + 1 >= text.size()) {
+                return fail(path, "truncated record");
+            }
+            s32 hi = hex_digit((char) text[i]);
+            s32 lo = hex_digit((char) text[i + 1]);
+            if (hi < 0 || lo < 0) {
+                return fail(path, "bad hex digit");
+            }
+            record[length] = (u8) (hi * 16 + lo);
+            sum += record[length];
+            if (length == 0) {
+                needed = 5 + record[0];
+            }
+            length += 1;
+            i += 2;
+        }
+        if (sum != 0) {
+            return fail(path, "bad checksum");
+        }
+        u32 count = record[0];
+        u32 addr = B2W(record[2], record[1]);
+        const u8* bytes = record + 4;
+        switch (record[3]) {
+            case 0x00:  // Data
+                if (count == 0) {
+                    break;
+                }
+                if (base + addr + count > MEM_MAX) {
+                    return fail(path, "data past 0xFFFF");
+                }
+                std::copy(bytes, bytes + count, image.begin() + base + addr);
+                std::fill(written.begin() + base + addr, written.begin() + base + addr + count, true);
+                lowest = std::min(lowest, base + addr);
+                highest = std::max(highest, base + addr + count);
+                break;
+            case 0x01:  // End of file
+                done = true;
+                break;
+            case 0x02:  // Extended segment address
+                if (count != 2) {
+                    return fail(path, "bad extended address");
+                }
+                base = B2W(bytes[1], bytes[0]) * 16;
+                break;
+            case 0x04:  // Extended linear address
+                if (count != 2) {
+                    return fail(path, "bad extended address");
+                }
+                base = (u32) B2W(bytes[1], bytes[0]) << 16;
+                break;
+            case 0x03:  // Start segment address, CS:IP
+                if (count != 4) {
+                    return fail(path, "bad start address");
+                }
+                startRecord = (s32) ((B2W(bytes[1], bytes[0]) * 16 + B2W(bytes[3], bytes[2])) & 0xFFFF);
+                break;
+            case 0x05:  // Start linear address
+                if (count != 4) {
+                    return fail(path, "bad start address");
+                }
+                startRecord = (s32) B2W(bytes[3], bytes[2]);
+                break;
+            default:
+                return fail(path, "unknown record type");
+        }
+    }
+    if (lowest > highest) {
+        return fail(path, "no data");
+    }
+    for (u32 addr = lowest; addr < highest;) {
+        u32 end = addr;
+        while (end < highest && written[end]) {
+            end += 1;
+        }
+        if (end > addr) {
+            cpu.memory.load((u16) addr, image.data() + addr, end - addr);
+        }
+        addr = end + 1;
+    }
+    first = (u16) lowest;
+    numBytes = highest - lowest;
+    hasVector = written[RESET_VEC_LOC] && written[RESET_VEC_LOC + 1];
+    return true;
+}
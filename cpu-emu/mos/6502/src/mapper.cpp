@@ -0,0 +1,44 @@
+/*
+Bank switching through the page table
+*/
+
+#include "mapper.hpp"
+
+
+mos6502::Mapper::Mapper(Memory& memory, u32 bankSize, u32 numBanks, bool writable) :
+        memory(memory), store((size_t) bankSize * numBanks, 0), bankSize(bankSize), numBanks(numBanks),
+        writable(writable) {}
+
+u32 mos6502::Mapper::add_window(u8 page, u32 bank) {
+    windows.push_back({ page, 0 });
+    select(windows.size() - 1, bank);
+    return windows.size() - 1;
+}
+
+void mos6502::Mapper::map_registers(u8 page) {
+    registerPage = page;
+    memory.map_device(page, 1, this);
+}
+
+void mos6502::Mapper::select(u32 window, u32 bank) {
+    Window& w = windows[window];
+    w.bank = bank % numBanks;
+    u8* data = store.data() + w.bank * bankSize;
+    if (writable) {
+        memory.remap(w.page, bankSize / PAGE_SIZE, data, data, nullptr);
+    } else {
+        memory.remap(w.page, bankSize / PAGE_SIZE, data, nullptr, this);
+    }
+}
+
+u8 mos6502::Mapper::read(u16 addr) {
+    u32 window = addr & 0xFF;
+    return (window < windows.size()) ? (u8) windows[window].bank : 0;
+}
+
+void mos6502::Mapper::write(u16 addr, u8 val) {
+    u32 window = addr & 0xFF;
+    if ((s32) (addr >> 8) == registerPage && window < windows.size()) {
+        select(window, val);
+    }
+}
@@ -0,0 +1,409 @@
+/*
+Page table of the 6502 address space
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+#include "memory.hpp"
+
+
+// Baselines of cleared ram and of each frozen state
+static constexpr u64 ZERO_BASELINE = 1;
+static std::atomic<u64> nextBaseline(ZERO_BASELINE + 1);
+
+// Untouched pages of sparse memories, never written as it is only mapped shared
+static const u8 ZERO_PAGE[mos6502::PAGE_SIZE] = {};
+
+mos6502::RomImage mos6502::make_rom(const u8* data, u32 size) {
+    auto image = std::make_shared<std::vector<u8>>((size + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE, 0xFF);
+    std::copy(data, data + size, image->begin());
+    return image;
+}
+
+u8* mos6502::PageArena::alloc() {
+    if (used == chunks.size() * CHUNK_PAGES) {
+        chunks.emplace_back(new u8[CHUNK_PAGES * PAGE_SIZE]);
+    }
+    u8* page = chunks[used / CHUNK_PAGES].get() + (used % CHUNK_PAGES) * PAGE_SIZE;
+    used += 1;
+    return page;
+}
+
+bool mos6502::PageArena::owns(const u8* p) const {
+    for (const auto& chunk : chunks) {
+        if (p >= chunk.get() && p < chunk.get() + CHUNK_PAGES * PAGE_SIZE) {
+            return true;
+        }
+    }
+    return false;
+}
+
+mos6502::Memory::Memory(MemoryBackend backend) :
+        ram((backend == MEMORY_FLAT) ? new u8[NUM_PAGES * PAGE_SIZE]() : nullptr) {
+    init_pages();
+}
+
+mos6502::Memory::Memory(u8* storage) : ram(storage), ownsRam(false) {
+    memset(ram, 0, NUM_PAGES * PAGE_SIZE);
+    init_pages();
+}
+
+// Only pages mapped to own memory are copied, the rest of ram is garbage until unmapped
+mos6502::Memory::Memory(const Memory& other) :
+        ram((other.ram != nullptr) ? new u8[NUM_PAGES * PAGE_SIZE] : nullptr) {
+    copy_map(other);
+}
+
+mos6502::Memory& mos6502::Memory::operator=(const Memory& other) {
+    if (this != &other) {
+        u32 generation = mapGeneration;
+        if (arena) {
+            arena->clear();
+        }
+        copy_map(other);
+        mapGeneration = generation + 1;
+    }
+    return *this;
+}
+
+mos6502::Memory::~Memory() {
+    if (ownsRam) {
+        delete[] ram;
+    }
+}
+
+void mos6502::Memory::init_pages() {
+    for (u32 page = 0; page < NUM_PAGES; ++page) {
+        if (ram != nullptr) {
+            set_page(page, ram + page * PAGE_SIZE, ram + page * PAGE_SIZE, nullptr);
+        } else {
+            share_zero(page);
+        }
+    }
+    memset(dirtyPages, 0, sizeof(dirtyPages));
+    baseline = ZERO_BASELINE;
+}
+
+u8 mos6502::Memory::read_device(u16 addr) const {
+    return devices[addr >> 8]->read(addr);
+}
+
+bool mos6502::Memory::write_slow(u16 addr, u8 val) {
+    u8 page = addr >> 8;
+    if (sharedPages[page]) {
+        unshare(page)[addr & 0xFF] = val;
+    } else if (devices[page] != nullptr) {
+        u32 before = mapGeneration + numRemaps;
+        devices[page]->write(addr, val);
+        return mapGeneration + numRemaps != before;
+    }
+    return false;
+}
+
+u8* mos6502::Memory::own_page(u8 page) {
+    if (ram != nullptr) {
+        return ram + page * PAGE_SIZE;
+    }
+    if (!arena) {
+        arena = std::make_shared<PageArena>();
+    }
+    return arena->alloc();
+}
+
+bool mos6502::Memory::is_own(const u8* p) const {
+    if (p == nullptr) {
+        return false;
+    }
+    if (ram != nullptr) {
+        return p >= ram && p < ram + NUM_PAGES * PAGE_SIZE;
+    }
+    return arena && arena->owns(p);
+}
+
+// Same memory, so decoded code stays valid
+u8* mos6502::Memory::unshare(u8 page) {
+    u8* own = own_page(page);
+    memcpy(own, readPages[page], PAGE_SIZE);
+    set_page(page, own, own, nullptr);
+    return own;
+}
+
+void mos6502::Memory::share_zero(u8 page) {
+    set_page(page, ZERO_PAGE, nullptr, nullptr);
+    sharedPages[page] = true;
+}
+
+// Pages mapped to the other's own memory get copies in this one's, writable banks frozen copies,
+// everything else is shared
+void mos6502::Memory::copy_map(const Memory& other) {
+    memcpy(dirtyPages, other.dirtyPages, sizeof(dirtyPages));
+    sharedPages = other.sharedPages;
+    u8* banks = nullptr;
+    if (other.bankPages.any()) {
+        banks = new u8[other.bankPages.count() * PAGE_SIZE];
+    }
+    u8* bank = banks;
+    for (u32 page = 0; page < NUM_PAGES; ++page) {
+        readPages[page] = other.readPages[page];
+        writePages[page] = other.writePages[page];
+        devices[page] = other.devices[page];
+        if (other.is_own(other.readPages[page])) {
+            u8* own = own_page(page);
+            memcpy(own, other.readPages[page], PAGE_SIZE);
+            readPages[page] = own;
+            writePages[page] = (writePages[page] != nullptr) ? own : nullptr;
+            // Clean pages of the other may be in a different baseline than this backend's
+            dirtyPages[page] = 1;
+        } else if (other.bankPages[page]) {
+            // Writes to the bank after this are the other's own, this one's copy them on its first
+            memcpy(bank, other.readPages[page], PAGE_SIZE);
+            readPages[page] = bank;
+            writePages[page] = nullptr;
+            sharedPages[page] = true;
+            dirtyPages[page] = 1;
+            bank += PAGE_SIZE;
+        }
+    }
+    bankPages.reset();
+    remappedPages = other.remappedPages;
+    numRemaps = other.numRemaps;
+    keepAlive = other.keepAlive;
+    baseline = other.baseline;
+    mapGeneration = other.mapGeneration;
+    if (banks != nullptr) {
+        keepAlive.push_back(std::shared_ptr<const u8>(banks, std::default_delete<const u8[]>()));
+        // Code translated from the banks would write to them
+        mapGeneration += 1;
+    }
+    numDevicePages = 0;
+    numMappedPages = NUM_PAGES;
+    for (u32 page = 0; page < NUM_PAGES; ++page) {
+        numDevicePages += (devices[page] != nullptr);
+        numMappedPages -= is_ram(page);
+    }
+    flatRam = (numMappedPages == 0) ? ram : nullptr;
+}
+
+void mos6502::Memory::set_page(u8 page, const u8* read, u8* write, Device* device) {
+    numDevicePages -= (devices[page] != nullptr);
+    numDevicePages += (device != nullptr);
+    // Sparse memory has no flat ram, every page counts as mapped
+    if (ram != nullptr) {
+        u8* own = ram + page * PAGE_SIZE;
+        numMappedPages -= (writePages[page] != own);
+        numMappedPages += (write != own);
+    }
+    readPages[page] = read;
+    writePages[page] = write;
+    devices[page] = device;
+    sharedPages[page] = false;
+    bankPages[page] = false;
+    dirtyPages[page] = 1;
+    flatRam = (numMappedPages == 0) ? ram : nullptr;
+}
+
+void mos6502::Memory::load(u16 addr, const u8* data, u32 size) {
+    u32 at = addr;
+    size = std::min(size, NUM_PAGES * PAGE_SIZE - at);
+    while (size > 0) {
+        u8 page = at >> 8;
+        u32 n = std::min(size, PAGE_SIZE - (at & 0xFF));
+        if (sharedPages[page]) {
+            unshare(page);
+        }
+        if (writePages[page] != nullptr) {
+            memcpy(writePages[page] + (at & 0xFF), data, n);
+            dirtyPages[page] = 1;
+        } else {
+            for (u32 i = 0; i < n; ++i) {
+                write_slow(at + i, data[i]);
+            }
+        }
+        at += n;
+        data += n;
+        size -= n;
+    }
+}
+
+void mos6502::Memory::map_ram(u8 page, u32 numPages, u8* host) {
+    for (u32 i = 0; i < numPages && page + i < NUM_PAGES; ++i) {
+        set_page(page + i, host + i * PAGE_SIZE, host + i * PAGE_SIZE, nullptr);
+    }
+    mapGeneration += 1;
+}
+
+void mos6502::Memory::map_rom(u8 page, u32 numPages, const u8* host) {
+    for (u32 i = 0; i < numPages && page + i < NUM_PAGES; ++i) {
+        set_page(page + i, host + i * PAGE_SIZE, nullptr, nullptr);
+    }
+    mapGeneration += 1;
+}
+
+void mos6502::Memory::map_rom(u8 page, const RomImage& image) {
+    keep_alive(image);
+    map_rom(page, image->size() / PAGE_SIZE, image->data());
+}
+
+void mos6502::Memory::map_shared(u8 page, u32 numPages, const u8* host) {
+    for (u32 i = 0; i < numPages && page + i < NUM_PAGES; ++i) {
+        set_page(page + i, host + i * PAGE_SIZE, nullptr, nullptr);
+        sharedPages[page + i] = true;
+    }
+    mapGeneration += 1;
+}
+
+void mos6502::Memory::keep_alive(const std::shared_ptr<const void>& host) {
+    if (std::find(keepAlive.begin(), keepAlive.end(), host) == keepAlive.end()) {
+        keepAlive.push_back(host);
+    }
+}
+
+void mos6502::Memory::map_device(u8 page, u32 numPages, Device* device) {
+    for (u32 i = 0; i < numPages && page + i < NUM_PAGES; ++i) {
+        set_page(page + i, nullptr, nullptr, device);
+    }
+    mapGeneration += 1;
+}
+
+// Translated code assumes RAM pages stay RAM and idle loops are only skipped without devices
+void mos6502::Memory::remap(u8 page, u32 numPages, const u8* read, u8* write, Device* device) {
+    numPages = std::min(numPages, NUM_PAGES - page);
+    bool wasRam = false;
+    for (u32 i = 0; i < numPages; ++i) {
+        wasRam |= is_ram(page + i) || is_own(writePages[page + i]);
+    }
+    bool firstDevice = (device != nullptr && numDevicePages == 0);
+    for (u32 i = 0; i < numPages; ++i) {
+        set_page(page + i, read + i * PAGE_SIZE, (write != nullptr) ? write + i * PAGE_SIZE : nullptr, device);
+        remappedPages[page + i] = true;
+        bankPages[page + i] = (write != nullptr);
+    }
+    if (wasRam || firstDevice) {
+        mapGeneration += 1;
+    } else {
+        numRemaps += 1;
+    }
+}
+
+std::bitset<mos6502::NUM_PAGES> mos6502::Memory::take_remapped_pages() {
+    std::bitset<NUM_PAGES> pages = remappedPages;
+    remappedPages.reset();
+    return pages;
+}
+
+void mos6502::Memory::unmap(u8 page, u32 numPages) {
+    numPages = std::min(numPages, NUM_PAGES - page);
+    if (ram != nullptr) {
+        memset(ram + page * PAGE_SIZE, 0, numPages * PAGE_SIZE);
+        map_ram(page, numPages, ram + page * PAGE_SIZE);
+        return;
+    }
+    for (u32 i = 0; i < numPages; ++i) {
+        share_zero(page + i);
+    }
+    mapGeneration += 1;
+}
+
+// Pages not dirty are already zero as long as nothing but clear_ram() set the baseline
+void mos6502::Memory::clear_ram() {
+    bool all = (baseline != ZERO_BASELINE);
+    for (u32 page = 0; page < NUM_PAGES; ++page) {
+        if (!all && !dirtyPages[page]) {
+            continue;
+        }
+        if (ram == nullptr) {
+            if (sharedPages[page] || is_own(writePages[page])) {
+                share_zero(page);
+            }
+            continue;
+        }
+        u8* own = ram + page * PAGE_SIZE;
+        if (sharedPages[page]) {
+            set_page(page, own, own, nullptr);
+        }
+        if (is_ram(page)) {
+            memset(own, 0, PAGE_SIZE);
+        }
+    }
+    // Every page taken from the arena was dirty, so none is mapped now
+    if (arena) {
+        arena->clear();
+    }
+    memset(dirtyPages, 0, sizeof(dirtyPages));
+    baseline = ZERO_BASELINE;
+}
+
+std::bitset<mos6502::NUM_PAGES> mos6502::Memory::pages_to_redo(const Memory* frozen) const {
+    bool all = (frozen != nullptr) ? (baseline != frozen->baseline || baseline == ZERO_BASELINE)
+                                   : (baseline != ZERO_BASELINE);
+    std::bitset<NUM_PAGES> pages;
+    for (u32 page = 0; page < NUM_PAGES; ++page) {
+        pages[page] = all || dirtyPages[page];
+    }
+    return pages;
+}
+
+void mos6502::Memory::freeze() {
+    u32 numFrozen = 0;
+    u8* copy = nullptr;     // Frozen pages of storage this does not own, which may go away before them
+    for (u32 page = 0; page < NUM_PAGES; ++page) {
+        // Own memory mapped anywhere with map_ram included
+        u8* write = writePages[page];
+        if (!is_own(write)) {
+            continue;
+        }
+        if (!ownsRam) {
+            if (copy == nullptr) {
+                copy = new u8[NUM_PAGES * PAGE_SIZE];
+            }
+            memcpy(copy + (write - ram), write, PAGE_SIZE);
+            write = copy + (write - ram);
+        }
+        set_page(page, write, nullptr, nullptr);
+        sharedPages[page] = true;
+        numFrozen += 1;
+    }
+    if (numFrozen != 0) {
+        // No page is mapped to own memory now, so the counters hold for the new one
+        if (copy != nullptr) {
+            keepAlive.push_back(std::shared_ptr<const u8>(copy, std::default_delete<const u8[]>()));
+        } else if (ram != nullptr) {
+            keepAlive.push_back(std::shared_ptr<const u8>(ram, std::default_delete<const u8[]>()));
+            ram = new u8[NUM_PAGES * PAGE_SIZE];
+        } else {
+            keepAlive.push_back(arena);
+            arena.reset();
+        }
+        mapGeneration += 1;
+    }
+    if (baseline == ZERO_BASELINE || std::find(dirtyPages, dirtyPages + NUM_PAGES, 1) != dirtyPages + NUM_PAGES) {
+        baseline = nextBaseline++;
+    }
+    memset(dirtyPages, 0, sizeof(dirtyPages));
+}
+
+void mos6502::Memory::restore(const Memory& frozen) {
+    if (baseline != frozen.baseline || baseline == ZERO_BASELINE) {
+        *this = frozen;
+        return;
+    }
+    bool remapped = false;
+    for (u32 page = 0; page < NUM_PAGES; ++page) {
+        if (dirtyPages[page]) {
+            remapped |= (readPages[page] != frozen.readPages[page] || writePages[page] != frozen.writePages[page]);
+            set_page(page, frozen.readPages[page], frozen.writePages[page], frozen.devices[page]);
+            sharedPages[page] = frozen.sharedPages[page];
+        }
+    }
+    // Frozen memory maps nothing of its own and every page taken from the arena was dirty
+    if (arena) {
+        arena->clear();
+    }
+    memset(dirtyPages, 0, sizeof(dirtyPages));
+    // Code translated for pages that were ram would write past the shared pages
+    if (remapped) {
+        mapGeneration += 1;
+    }
+}
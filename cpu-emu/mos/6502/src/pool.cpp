@@ -0,0 +1,185 @@
+/*
+Work-stealing pool running independent jobs on all cores
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "mos6502.hpp"
+#include "pool.hpp"
+
+
+// Jobs of one worker. Jobs run for thousands of cycles, so a lock per take costs nothing next to them.
+class mos6502::WorkDeque {
+ public:
+    void push(u32 job) {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobs.push_back(job);
+    }
+    // Owner end
+    bool pop(u32& job) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (jobs.empty()) { return false; }
+        job = jobs.back();
+        jobs.pop_back();
+        return true;
+    }
+    // Thief end
+    bool steal(u32& job) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (jobs.empty()) { return false; }
+        job = jobs.front();
+        jobs.pop_front();
+        return true;
+    }
+
+    // Written by the owner only, read once the workers are joined
+    u64 steals = 0;
+    u64 jobsRun = 0;
+    u64 cycles = 0;
+
+ private:
+    std::mutex mutex;
+    std::deque<u32> jobs;
+};
+
+mos6502::InstancePool::InstancePool(u32 numWorkers, Engine engine, InstanceArena* arena) :
+        engine(engine), arena(arena) {
+    if (numWorkers == 0) {
+        numWorkers = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (u32 i = 0; i < numWorkers; ++i) {
+        CPU* cpu = (arena != nullptr) ? arena->create() : nullptr;
+        cpus.push_back((cpu != nullptr) ? cpu : new CPU());
+        deques.push_back(std::make_unique<WorkDeque>());
+    }
+}
+
+mos6502::InstancePool::~InstancePool() {
+    for (CPU* cpu : cpus) {
+        if (arena != nullptr && arena->owns(cpu)) {
+            arena->destroy(cpu);
+        } else {
+            delete cpu;
+        }
+    }
+}
+
+std::vector<mos6502::JobResult> mos6502::InstancePool::run(const std::vector<Job>& jobs) {
+    u32 numWorkers = num_workers();
+    std::vector<JobResult> results(jobs.size());
+    for (u32 i = 0; i < jobs.size(); ++i) {
+        deques[(u64) i * numWorkers / jobs.size()]->push(i);
+    }
+    for (auto& deque : deques) {
+        deque->steals = 0;
+        deque->jobsRun = 0;
+        deque->cycles = 0;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (u32 worker = 1; worker < numWorkers; ++worker) {
+        threads.emplace_back(&InstancePool::work, this, worker, std::cref(jobs), std::ref(results));
+    }
+    work(0, jobs, results);
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    poolStats = PoolStats();
+    poolStats.seconds = elapsed.count();
+    for (auto& deque : deques) {
+        poolStats.jobs += deque->jobsRun;
+        poolStats.cycles += deque->cycles;
+        poolStats.steals += deque->steals;
+        poolStats.jobsByWorker.push_back(deque->jobsRun);
+    }
+    return results;
+}
+
+void mos6502::InstancePool::work(u32 worker, const std::vector<Job>& jobs, std::vector<JobResult>& results) {
+    WorkDeque& own = *deques[worker];
+    u32 job;
+    while (next_job(worker, job)) {
+        run_job(*cpus[worker], jobs[job], results[job]);
+        results[job].worker = worker;
+        own.jobsRun += 1;
+        own.cycles += std::max(results[job].cycles, 0);
+    }
+}
+
+bool mos6502::InstancePool::next_job(u32 worker, u32& job) {
+    if (deques[worker]->pop(job)) {
+        return true;
+    }
+    // No jobs are added while running, so every deque found empty stays empty
+    u32 numWorkers = num_workers();
+    for (u32 i = 1; i < numWorkers; ++i) {
+        if (deques[(worker + i) % numWorkers]->steal(job)) {
+            deques[worker]->steals += 1;
+            return true;
+        }
+    }
+    return false;
+}
+
+void mos6502::InstancePool::run_job(CPU& cpu, const Job& job, JobResult& result) {
+    // Jobs from the same state only redo the pages the previous one wrote
+    if (job.start) {
+        cpu.restore(job.start);
+    } else {
+        cpu.reset();
+        cpu.PC = job.regs.PC;
+        cpu.A = job.regs.A;
+        cpu.X = job.regs.X;
+        cpu.Y = job.regs.Y;
+        cpu.S = job.regs.S;
+        cpu.SR = job.regs.SR;
+    }
+    cpu.engine = engine;
+    u32 size = std::min(job.imageSize, MEM_MAX - job.origin);
+    if (job.image != nullptr) {
+        cpu.memory.load(job.origin, job.image, size);
+    }
+    if (job.setup) {
+        job.setup(cpu);
+    }
+
+    s32 executed = 0;
+    result.done = false;
+    while (executed < job.numCycles) {
+        s32 slice = job.numCycles - executed;
+        if (job.done && job.checkCycles > 0) {
+            slice = std::min(slice, job.checkCycles);
+        }
+        s32 ret = cpu.execute(slice);
+        if (ret < 0) {
+            executed = -1;
+            break;
+        }
+        executed += ret;
+        if (job.done && job.done(cpu)) {
+            result.done = true;
+            break;
+        }
+    }
+    result.cycles = executed;
+    result.regs = { cpu.PC, cpu.A, cpu.X, cpu.Y, cpu.S, cpu.SR };
+    if (job.keepMemory) {
+        // Pages may be shared or mapped elsewhere, device pages read as zero
+        result.ram.assign(MEM_MAX, 0);
+        for (u32 page = 0; page < NUM_PAGES; ++page) {
+            const u8* data = cpu.memory.page_memory(page);
+            if (data != nullptr) {
+                std::copy(data, data + PAGE_SIZE, result.ram.begin() + page * PAGE_SIZE);
+            }
+        }
+    } else {
+        result.ram.clear();
+    }
+}
@@ -0,0 +1,227 @@
+/*
+Save states of a CPU in files
+*/
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "savestate.hpp"
+
+#if defined(__unix__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+
+static const char MAGIC[8] = {'6', '5', '0', '2', 'S', 'A', 'V', 'E'};
+
+// PackBits: n < 128 is followed by n + 1 bytes as they are, n > 128 by one byte repeated 257 - n times
+static void pack_page(const u8* page, std::vector<u8>& out) {
+    u32 i = 0;
+    while (i < mos6502::PAGE_SIZE) {
+        u32 run = 1;
+        while (i + run < mos6502::PAGE_SIZE && run < 128 && page[i + run] == page[i]) {
+            run += 1;
+        }
+        if (run >= 3) {
+            out.push_back((u8) (257 - run));
+            out.push_back(page[i]);
+            i += run;
+            continue;
+        }
+        // Literals up to the next run worth encoding
+        u32 start = i;
+        while (i < mos6502::PAGE_SIZE && i - start < 128) {
+            if (i + 2 < mos6502::PAGE_SIZE && page[i] == page[i + 1] && page[i] == page[i + 2]) {
+                break;
+            }
+            i += 1;
+        }
+        out.push_back((u8) (i - start - 1));
+        out.insert(out.end(), page + start, page + i);
+    }
+}
+
+static bool unpack_page(FILE* in, u8* page) {
+    u32 i = 0;
+    while (i < mos6502::PAGE_SIZE) {
+        int n = fgetc(in);
+        if (n == EOF) {
+            return false;
+        }
+        if (n < 128) {
+            if (i + n + 1 > mos6502::PAGE_SIZE || fread(page + i, 1, n + 1, in) != (size_t) n + 1) {
+                return false;
+            }
+            i += n + 1;
+        } else if (n > 128) {
+            int val = fgetc(in);
+            if (val == EOF || i + 257 - n > mos6502::PAGE_SIZE) {
+                return false;
+            }
+            memset(page + i, val, 257 - n);
+            i += 257 - n;
+        }
+    }
+    return true;
+}
+
+static bool all_zero(const u8* page) {
+    return std::all_of(page, page + mos6502::PAGE_SIZE, [](u8 b) { return b == 0; });
+}
+
+bool mos6502::SaveState::save(const CPU& cpu, const char* path, SaveFormat format) {
+    SaveStateHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = SAVE_STATE_VERSION;
+    header.format = format;
+    header.dataOffset = SAVE_STATE_DATA;
+    header.pageSize = PAGE_SIZE;
+    header.nmiPending = cpu.nmiPending;
+    header.cycles = cpu.cycles;
+    header.PC = cpu.PC;
+    header.A = cpu.A;
+    header.X = cpu.X;
+    header.Y = cpu.Y;
+    header.S = cpu.S;
+    header.SR = cpu.SR;
+
+    const Memory& memory = cpu.memory;
+    std::vector<const u8*> pages;
+    for (u32 page = 0; page < NUM_PAGES; ++page) {
+        const u8* data = memory.page_memory(page);
+        if (data == nullptr) {
+            header.kinds[page] = SAVED_DEVICE;
+        } else if (memory.is_rom(page)) {
+            header.kinds[page] = SAVED_ROM;
+        } else if (all_zero(data)) {
+            header.kinds[page] = SAVED_ZERO;
+        } else {
+            header.kinds[page] = SAVED_RAM;
+        }
+        if (header.kinds[page] == SAVED_RAM || header.kinds[page] == SAVED_ROM) {
+            header.data[page] = (u32) pages.size();
+            pages.push_back(data);
+        }
+    }
+    header.numDataPages = (u32) pages.size();
+
+    FILE* out = fopen(path, "wb");
+    if (out == nullptr) {
+        return false;
+    }
+    std::vector<u8> head(SAVE_STATE_DATA, 0);
+    memcpy(head.data(), &header, sizeof(header));
+    fwrite(head.data(), 1, head.size(), out);
+    std::vector<u8> packed;
+    for (const u8* data : pages) {
+        if (format == SAVE_COMPRESSED) {
+            packed.clear();
+            pack_page(data, packed);
+            fwrite(packed.data(), 1, packed.size(), out);
+        } else {
+            fwrite(data, 1, PAGE_SIZE, out);
+        }
+    }
+    bool ok = !ferror(out);
+    return (fclose(out) == 0) && ok;
+}
+
+static bool valid(const mos6502::SaveStateHeader& header) {
+    if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != mos6502::SAVE_STATE_VERSION
+            || header.format > mos6502::SAVE_COMPRESSED || header.dataOffset != mos6502::SAVE_STATE_DATA
+            || header.pageSize != mos6502::PAGE_SIZE || header.numDataPages > mos6502::NUM_PAGES) {
+        return false;
+    }
+    for (u32 page = 0; page < mos6502::NUM_PAGES; ++page) {
+        u8 kind = header.kinds[page];
+        if (kind > mos6502::SAVED_DEVICE) {
+            return false;
+        }
+        if ((kind == mos6502::SAVED_RAM || kind == mos6502::SAVED_ROM) && header.data[page] >= header.numDataPages) {
+            return false;
+        }
+    }
+    return true;
+}
+
+mos6502::Snapshot mos6502::SaveState::load(const char* path) {
+    FILE* in = fopen(path, "rb");
+    if (in == nullptr) {
+        return nullptr;
+    }
+    SaveStateHeader header;
+    if (fread(&header, 1, sizeof(header), in) != sizeof(header) || !valid(header)) {
+        fclose(in);
+        return nullptr;
+    }
+
+    // Page data, kept alive by the memory mapping it
+    std::shared_ptr<const void> storage;
+    const u8* data = nullptr;
+    u32 dataSize = header.numDataPages * PAGE_SIZE;
+#if defined(__unix__)
+    struct stat st;
+    if (header.format == SAVE_RAW && fstat(fileno(in), &st) == 0) {
+        size_t size = st.st_size;
+        if (size < header.dataOffset + dataSize) {
+            fclose(in);
+            return nullptr;
+        }
+        if (dataSize != 0) {
+            void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fileno(in), 0);
+            if (mapped == MAP_FAILED) {
+                fclose(in);
+                return nullptr;
+            }
+            storage = std::shared_ptr<const void>(mapped, [size](const void* p) { munmap((void*) p, size); });
+            data = (const u8*) mapped + header.dataOffset;
+        }
+    }
+#endif
+    if (data == nullptr && dataSize != 0) {
+        u8* pages = new u8[dataSize];
+        storage = std::shared_ptr<const u8>(pages, std::default_delete<const u8[]>());
+        bool ok = (fseek(in, header.dataOffset, SEEK_SET) == 0);
+        for (u32 i = 0; ok && i < header.numDataPages; ++i) {
+            if (header.format == SAVE_COMPRESSED) {
+                ok = unpack_page(in, pages + i * PAGE_SIZE);
+            } else {
+                ok = (fread(pages + i * PAGE_SIZE, 1, PAGE_SIZE, in) == PAGE_SIZE);
+            }
+        }
+        if (!ok) {
+            fclose(in);
+            return nullptr;
+        }
+        data = pages;
+    }
+    fclose(in);
+
+    auto cpu = std::make_shared<CPU>(MEMORY_SPARSE);
+    Memory& memory = cpu->memory;
+    if (storage) {
+        memory.keep_alive(storage);
+    }
+    for (u32 page = 0; page < NUM_PAGES; ++page) {
+        if (header.kinds[page] == SAVED_RAM) {
+            memory.map_shared(page, 1, data + header.data[page] * PAGE_SIZE);
+        } else if (header.kinds[page] == SAVED_ROM) {
+            memory.map_rom(page, 1, data + header.data[page] * PAGE_SIZE);
+        }
+    }
+    // Pages as loaded are the baseline restore() goes back to
+    memory.freeze();
+    cpu->nmiPending = header.nmiPending != 0;
+    cpu->cycles = header.cycles;
+    cpu->PC = header.PC;
+    cpu->A = header.A;
+    cpu->X = header.X;
+    cpu->Y = header.Y;
+    cpu->S = header.S;
+    cpu->SR = header.SR;
+    return cpu;
+}
@@ -0,0 +1,38 @@
+/*
+Cycle-timestamped events
+*/
+
+#include <algorithm>
+
+#include "scheduler.hpp"
+
+
+u32 mos6502::Scheduler::schedule(u64 cycle, Callback callback) {
+    u32 id = nextId++;
+    heap.push_back({ cycle, numScheduled++, id, std::move(callback) });
+    std::push_heap(heap.begin(), heap.end());
+    return id;
+}
+
+bool mos6502::Scheduler::cancel(u32 id) {
+    auto it = std::find_if(heap.begin(), heap.end(), [id](const Event& event) { return event.id == id; });
+    if (it == heap.end()) {
+        return false;
+    }
+    *it = std::move(heap.back());
+    heap.pop_back();
+    std::make_heap(heap.begin(), heap.end());
+    return true;
+}
+
+u32 mos6502::Scheduler::run_due(u64 now) {
+    u32 numRun = 0;
+    while (!heap.empty() && heap.front().cycle <= now) {
+        std::pop_heap(heap.begin(), heap.end());
+        Event event = std::move(heap.back());
+        heap.pop_back();
+        event.callback(event.cycle);
+        numRun += 1;
+    }
+    return numRun;
+}
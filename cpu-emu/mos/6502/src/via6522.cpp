@@ -0,0 +1,361 @@
+/*
+MOS 6522 VIA
+*/
+
+#include <algorithm>
+
+#include "via6522.hpp"
+
+
+mos6502::Via6522::Via6522(CPU& cpu, u32 irqSource) : ClockedDevice(cpu), irqSource(irqSource) {
+    t1Base = t2Base = srBase = synced();
+}
+
+mos6502::Via6522::~Via6522() {
+    if (irq) {
+        cpu.set_irq(false, irqSource);
+    }
+}
+
+void mos6502::Via6522::map(u8 page) {
+    cpu.memory.map_device(page, 1, this);
+}
+
+u16 mos6502::Via6522::t1_counter(u64 cycle) const {
+    return (u16) (t1Value - (cycle - t1Base));
+}
+
+u16 mos6502::Via6522::t2_counter(u64 cycle) const {
+    return t2_counts_pulses() ? t2Value : (u16) (t2Value - (cycle - t2Base));
+}
+
+u32 mos6502::Via6522::sr_bit_cycles() const {
+    switch (sr_mode()) {
+        case 2: case 6: return 2;
+        case 1: case 4: case 5: return 2 * (t2LatchLow + 2);
+        default: return 0;      // Disabled or clocked by CB1
+    }
+}
+
+void mos6502::Via6522::start_shift(u64 cycle) {
+    ifr &= ~VIA_IRQ_SR;
+    // Free-running shift out (mode 4) never finishes
+    srBits = sr_mode() != 0 && sr_mode() != 4 ? 8 : 0;
+    srBase = cycle;
+    srOut = sr;
+}
+
+void mos6502::Via6522::shift_bits(u32 numBits) {
+    u32 bits = sr;
+    if (sr_mode() < 4) {
+        // In from CB2
+        bits = (bits << numBits) | (cb2 ? (1u << numBits) - 1 : 0);
+    } else {
+        // Out to CB2, bit 7 goes round to bit 0
+        bits = (bits << numBits) | (bits >> (8 - numBits));
+    }
+    sr = (u8) bits;
+    if (srBits == 0) {
+        return;     // Free-running
+    }
+    srBits -= numBits;
+    if (srBits == 0) {
+        ifr |= VIA_IRQ_SR;
+        if (sr_mode() >= 5 && onShiftOut) {
+            onShiftOut(srOut);
+        }
+    }
+}
+
+void mos6502::Via6522::advance(u64 cycle) {
+    // T1, underflow N + 1 cycles after loading N, reload the cycle after that
+    for (;;) {
+        u64 underflow = t1Base + t1Value + 1;
+        if (underflow > cycle) {
+            break;
+        }
+        if (!t1Underflowed) {
+            t1Underflowed = true;
+            if (t1Armed) {
+                ifr |= VIA_IRQ_T1;
+                t1Armed = t1_free_run();
+            }
+            pb7 = t1_free_run() ? !pb7 : true;
+        }
+        // One-shot keeps counting down from 0xFFFF
+        if (!t1_free_run() || underflow + 1 > cycle) {
+            break;
+        }
+        // Reloaded, then the whole periods before cycle at once
+        u64 period = t1Latch + 2;
+        t1Base = underflow + 1;
+        t1Value = t1Latch;
+        t1Underflowed = false;
+        u64 periods = (cycle - t1Base) / period;
+        if (periods > 0) {
+            if (t1Armed) {
+                ifr |= VIA_IRQ_T1;
+            }
+            pb7 = pb7 != (bool) (periods & 1);
+            t1Base += periods * period;
+        }
+    }
+
+    // T2, one-shot
+    if (t2Armed && !t2_counts_pulses() && t2Base + t2Value + 1 <= cycle) {
+        ifr |= VIA_IRQ_T2;
+        t2Armed = false;
+    }
+
+    // Shift register on a clock of its own
+    u32 bitCycles = sr_bit_cycles();
+    if (bitCycles != 0 && (srBits != 0 || sr_mode() == 4)) {
+        u64 numBits = (cycle - srBase) / bitCycles;
+        if (srBits != 0 && numBits > srBits) {
+            numBits = srBits;
+        }
+        srBase += numBits * bitCycles;
+        shift_bits(srBits != 0 ? (u32) numBits : (u32) (numBits % 8));
+    }
+}
+
+void mos6502::Via6522::control_edge(bool old, bool level, u8 flag, bool positive) {
+    if (old != level && level == positive) {
+        ifr |= flag;
+    }
+}
+
+void mos6502::Via6522::update() {
+    bool asserted = (ifr & ier & 0x7F) != 0;
+    if (asserted != irq) {
+        irq = asserted;
+        cpu.set_irq(irq, irqSource);
+    }
+
+    // Events only for flags that would raise the line, the others are set when synced
+    u64 next = NO_EVENT;
+    if ((ier & VIA_IRQ_T1) && !(ifr & VIA_IRQ_T1) && t1Armed) {
+        u64 underflow = t1Base + t1Value + 1;
+        next = !t1Underflowed ? underflow : underflow + 1 + t1Latch + 1;
+    }
+    if ((ier & VIA_IRQ_T2) && !(ifr & VIA_IRQ_T2) && t2Armed && !t2_counts_pulses()) {
+        next = std::min(next, t2Base + t2Value + 1);
+    }
+    u32 bitCycles = sr_bit_cycles();
+    if ((ier & VIA_IRQ_SR) && !(ifr & VIA_IRQ_SR) && srBits != 0 && bitCycles != 0) {
+        next = std::min(next, srBase + (u64) srBits * bitCycles);
+    }
+
+    if (next == NO_EVENT) {
+        cancel();
+    } else if (!scheduled() || next != eventCycle) {
+        schedule(next);
+    }
+    eventCycle = next;
+}
+
+void mos6502::Via6522::event(u64 cycle) {
+    (void) cycle;
+    eventCycle = NO_EVENT;
+    update();
+}
+
+u8 mos6502::Via6522::read_register(u16 addr) {
+    u64 now = synced();
+    u8 val = 0;
+    switch (addr & 0x0F) {
+        case VIA_ORB:
+            ifr &= (pcr & 0xA0) == 0x20 ? ~VIA_IRQ_CB1 : ~(VIA_IRQ_CB1 | VIA_IRQ_CB2);
+            val = (orb & ddrb) | ((acr & 0x02 ? irb : pinsB) & ~ddrb);
+            if (acr & 0x80) {
+                val = (val & 0x7F) | (pb7 ? 0x80 : 0);
+            }
+            break;
+        case VIA_ORA:
+            ifr &= (pcr & 0x0A) == 0x02 ? ~VIA_IRQ_CA1 : ~(VIA_IRQ_CA1 | VIA_IRQ_CA2);
+            // Fall through
+        case VIA_ORA_NH:
+            val = (ora & ddra) | ((acr & 0x01 ? ira : pinsA) & ~ddra);
+            break;
+        case VIA_DDRB: val = ddrb; break;
+        case VIA_DDRA: val = ddra; break;
+        case VIA_T1CL:
+            ifr &= ~VIA_IRQ_T1;
+            val = (u8) t1_counter(now);
+            break;
+        case VIA_T1CH: val = (u8) (t1_counter(now) >> 8); break;
+        case VIA_T1LL: val = (u8) t1Latch; break;
+        case VIA_T1LH: val = (u8) (t1Latch >> 8); break;
+        case VIA_T2CL:
+            ifr &= ~VIA_IRQ_T2;
+            val = (u8) t2_counter(now);
+            break;
+        case VIA_T2CH: val = (u8) (t2_counter(now) >> 8); break;
+        case VIA_SR:
+            val = sr;
+            start_shift(now);
+            break;
+        case VIA_ACR: val = acr; break;
+        case VIA_PCR: val = pcr; break;
+        case VIA_IFR: val = ifr | ((ifr & ier & 0x7F) != 0 ? VIA_IRQ_ANY : 0); break;
+        case VIA_IER: val = ier | 0x80; break;
+    }
+    update();
+    return val;
+}
+
+void mos6502::Via6522::write_register(u16 addr, u8 val) {
+    u64 now = synced();
+    switch (addr & 0x0F) {
+        case VIA_ORB:
+            ifr &= (pcr & 0xA0) == 0x20 ? ~VIA_IRQ_CB1 : ~(VIA_IRQ_CB1 | VIA_IRQ_CB2);
+            orb = val;
+            break;
+        case VIA_ORA:
+            ifr &= (pcr & 0x0A) == 0x02 ? ~VIA_IRQ_CA1 : ~(VIA_IRQ_CA1 | VIA_IRQ_CA2);
+            // Fall through
+        case VIA_ORA_NH:
+            ora = val;
+            break;
+        case VIA_DDRB: ddrb = val; break;
+        case VIA_DDRA: ddra = val; break;
+        case VIA_T1CL:
+        case VIA_T1LL:
+            t1Latch = (t1Latch & 0xFF00) | val;
+            break;
+        case VIA_T1CH:
+            t1Latch = (t1Latch & 0x00FF) | (val << 8);
+            t1Base = now;
+            t1Value = t1Latch;
+            t1Underflowed = false;
+            t1Armed = true;
+            pb7 = false;
+            ifr &= ~VIA_IRQ_T1;
+            break;
+        case VIA_T1LH:
+            t1Latch = (t1Latch & 0x00FF) | (val << 8);
+            ifr &= ~VIA_IRQ_T1;
+            break;
+        case VIA_T2CL:
+            t2LatchLow = val;
+            break;
+        case VIA_T2CH:
+            t2Base = now;
+            t2Value = t2LatchLow | (val << 8);
+            t2Armed = true;
+            ifr &= ~VIA_IRQ_T2;
+            break;
+        case VIA_SR:
+            sr = val;
+            start_shift(now);
+            break;
+        case VIA_ACR:
+            // T2 holds its count while it counts pulses
+            if ((val ^ acr) & 0x20) {
+                if (val & 0x20) {
+                    t2Value = t2_counter(now);
+                } else {
+                    t2Base = now;
+                }
+            }
+            // A shift in progress keeps its bit clock unless the shift mode changes
+            if ((val ^ acr) & 0x1C) {
+                if ((val & 0x1C) == 0) {
+                    srBits = 0;
+                }
+                srBase = now;
+            }
+            acr = val;
+            break;
+        case VIA_PCR: pcr = val; break;
+        case VIA_IFR: ifr &= ~(val & 0x7F); break;
+        case VIA_IER:
+            if (val & 0x80) {
+                ier |= val & 0x7F;
+            } else {
+                ier &= ~(val & 0x7F);
+            }
+            break;
+    }
+    update();
+}
+
+void mos6502::Via6522::set_port_a(u8 pins) {
+    sync();
+    pinsA = pins;
+}
+
+void mos6502::Via6522::set_port_b(u8 pins) {
+    sync();
+    pinsB = pins;
+}
+
+u8 mos6502::Via6522::port_a() {
+    sync();
+    return (ora & ddra) | (pinsA & ~ddra);
+}
+
+u8 mos6502::Via6522::port_b() {
+    sync();
+    u8 val = (orb & ddrb) | (pinsB & ~ddrb);
+    if (acr & 0x80) {
+        val = (val & 0x7F) | (pb7 ? 0x80 : 0);
+    }
+    return val;
+}
+
+void mos6502::Via6522::set_ca1(bool level) {
+    sync();
+    bool positive = pcr & 0x01;
+    if (ca1 != level && level == positive && (acr & 0x01)) {
+        ira = pinsA;
+    }
+    control_edge(ca1, level, VIA_IRQ_CA1, positive);
+    ca1 = level;
+    update();
+}
+
+void mos6502::Via6522::set_ca2(bool level) {
+    sync();
+    if (!(pcr & 0x08)) {
+        control_edge(ca2, level, VIA_IRQ_CA2, pcr & 0x04);
+    }
+    ca2 = level;
+    update();
+}
+
+void mos6502::Via6522::set_cb1(bool level) {
+    sync();
+    bool positive = pcr & 0x10;
+    if (cb1 != level && level == positive && (acr & 0x02)) {
+        irb = pinsB;
+    }
+    control_edge(cb1, level, VIA_IRQ_CB1, positive);
+    // External shift clock, a bit per rising edge
+    if (!cb1 && level && (sr_mode() & 0x03) == 3 && srBits != 0) {
+        shift_bits(1);
+    }
+    cb1 = level;
+    update();
+}
+
+void mos6502::Via6522::set_cb2(bool level) {
+    sync();
+    if (!(pcr & 0x80)) {
+        control_edge(cb2, level, VIA_IRQ_CB2, pcr & 0x40);
+    }
+    cb2 = level;
+    update();
+}
+
+void mos6502::Via6522::pulse_pb6() {
+    sync();
+    if (t2_counts_pulses()) {
+        t2Value -= 1;
+        if (t2Value == 0 && t2Armed) {
+            ifr |= VIA_IRQ_T2;
+            t2Armed = false;
+        }
+    }
+    update();
+}
@@ -0,0 +1,67 @@
+/*
+Writes the ROM image translated by aot-6502 for the AOT tests
+
+    aot-test-rom <image>
+*/
+
+#include <cstdio>
+#include <vector>
+
+#include "mos6502.hpp"
+
+using namespace mos6502;
+
+
+int main(int argc, char** argv) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <image>\n", argv[0]);
+        return 1;
+    }
+    std::vector<u8> image(MEM_MAX, 0);
+    u8 program[] = {
+        LDX_IMM, 0x00,          // F000
+        NOP_IMP,                // F002
+        JSR_ABS, 0x00, 0xF1,    // F003
+        LDA_ABX, 0x00, 0x10,    // F006 copy:
+        STA_ABX, 0x00, 0x20,    // F009
+        INX_IMP,                // F00C
+        CPX_IMM, 0x20,          // F00D
+        BNE_REL, (u8) -9,       // F00F
+        SED_IMP,                // F011
+        CLC_IMP,                // F012
+        LDA_IMM, 0x15,          // F013
+        ADC_IMM, 0x27,          // F015
+        CLD_IMP,                // F017
+        ASL_ABS, 0x00, 0x10,    // F018
+        JMP_ABS, 0x00, 0xF0,    // F01B
+    };
+    u8 subroutine[] = {
+        LDY_IMM, 0x10,          // F100
+        DEY_IMP,                // F102 loop:
+        BNE_REL, (u8) -1,       // F103
+        RTS_IMP,                // F105
+    };
+    for (u32 i = 0; i < sizeof(program); ++i)    { image[0xF000 + i] = program[i]; }
+    for (u32 i = 0; i < sizeof(subroutine); ++i) { image[0xF100 + i] = subroutine[i]; }
+    image[0xF200] = RTI_IMP;
+    image[0xF300] = INC_ZPG;
+    image[0xF301] = 0x30;
+    image[0xF302] = RTI_IMP;
+    for (u32 i = 0; i < 0x20; ++i) {
+        image[0x1000 + i] = (u8) (i * 37 + 11);
+    }
+    image[RESET_VEC_LOC] = 0x00;
+    image[RESET_VEC_LOC + 1] = 0xF0;
+    image[INT_VEC_LOC] = 0x00;
+    image[INT_VEC_LOC + 1] = 0xF2;
+    image[NON_MASK_INT_VEC_LOC] = 0x00;
+    image[NON_MASK_INT_VEC_LOC + 1] = 0xF3;
+
+    FILE* out = fopen(argv[1], "wb");
+    if (out == nullptr || fwrite(image.data(), 1, image.size(), out) != image.size()) {
+        fprintf(stderr, "Cannot write %s\n", argv[1]);
+        return 1;
+    }
+    fclose(out);
+    return 0;
+}
@@ -1,6 +1,30 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
 #include <gtest/gtest.h>
 
+#include "test.hpp"
+
+// Engine every fixture runs on, chosen with --engine=<name>
+Engine TEST_ENGINE = ENGINE_SWITCH;
+// Block runs before the jit engine translates, --jit-threshold=0 translates every block
+u32 TEST_JIT_THRESHOLD = 2;
+
 int main(int argc, char **argv) {
     testing::InitGoogleTest(&argc, argv);
+    for (int i = 1; i < argc; ++i) {
+        const char* prefix = "--engine=";
+        if (strncmp(argv[i], prefix, strlen(prefix)) == 0
+                && !engine_from_name(argv[i] + strlen(prefix), TEST_ENGINE)) {
+            fprintf(stderr, "Unknown engine: %s\n", argv[i] + strlen(prefix));
+            return 1;
+        }
+        const char* jitPrefix = "--jit-threshold=";
+        if (strncmp(argv[i], jitPrefix, strlen(jitPrefix)) == 0) {
+            TEST_JIT_THRESHOLD = atoi(argv[i] + strlen(jitPrefix));
+        }
+    }
+    printf("Engine: %s\n", engine_name(TEST_ENGINE));
     return RUN_ALL_TESTS();
 }
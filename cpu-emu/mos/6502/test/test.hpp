@@ -1,6 +1,8 @@
 #pragma once
 
 #include <gtest/gtest.h>
+#include <string>
+#include <unistd.h>
 
 #include "mos6502.hpp"
 #include "models.hpp"
@@ -20,6 +22,14 @@
 
 using namespace mos6502;
 
+extern Engine TEST_ENGINE;
+extern u32 TEST_JIT_THRESHOLD;
+
+// File for a test to write, per process: ctest runs the suite once per engine in parallel
+inline std::string temp_path(const char* name) {
+    return ::testing::TempDir() + "mos6502_" + std::to_string(getpid()) + "_" + name;
+}
+
 class SetupCPU_F : public ::testing::Test {
  public:
     CPU cpu;
@@ -29,6 +39,8 @@ class SetupCPU_F : public ::testing::Test {
     ~SetupCPU_F()           {}
     virtual void SetUp()    {
         cpu.reset();
+        cpu.engine = TEST_ENGINE;
+        cpu.jitThreshold = TEST_JIT_THRESHOLD;
         cpuOrig = cpu;
     }
     virtual void TearDown() {}
@@ -65,3 +77,19 @@ class BRANCH        : public SetupCPU_F {};
 class SUBROUTINE    : public SetupCPU_F {};
 class INTERRUPT     : public SetupCPU_F {};
 class OBELISK_TESTS : public SetupCPU_F {};
+class ENGINES       : public SetupCPU_F {};
+class BLOCK_CACHE   : public SetupCPU_F {};
+class AOT           : public SetupCPU_F {};
+class FUSION        : public SetupCPU_F {};
+class IDLE          : public SetupCPU_F {};
+class BATCH         : public SetupCPU_F {};
+class POOL          : public SetupCPU_F {};
+class MEMORY        : public SetupCPU_F {};
+class SNAPSHOT      : public SetupCPU_F {};
+class ARENA         : public SetupCPU_F {};
+class SAVESTATE     : public SetupCPU_F {};
+class MAPPER        : public SetupCPU_F {};
+class LOADER        : public SetupCPU_F {};
+class DEVICES       : public SetupCPU_F {};
+class VIA           : public SetupCPU_F {};
+class SERIAL        : public SetupCPU_F {};
@@ -0,0 +1,88 @@
+#include <cstdio>
+
+#include <gtest/gtest.h>
+
+#include "mos6502.hpp"
+#include "models.hpp"
+#include "test.hpp"
+
+using namespace mos6502;
+
+
+// Image and module built from test/aot_rom.cpp, paths set by the build
+static void loadImage(CPU& cpu) {
+    FILE* in = fopen(AOT_TEST_IMAGE, "rb");
+    ASSERT_TRUE(in != nullptr);
+    ASSERT_TRUE(fread(cpu.memory.ram, 1, MEM_MAX, in) == MEM_MAX);
+    fclose(in);
+    cpu.PC = B2W(cpu.memory.ram[RESET_VEC_LOC], cpu.memory.ram[RESET_VEC_LOC + 1]);
+}
+
+static void expectSameAsSwitch(const CPU& start, s32 numCycles) {
+    CPU ref = start;
+    CPU aot = start;
+    ref.engine = ENGINE_SWITCH;
+    ASSERT_TRUE(aot.execute(numCycles) == ref.execute(numCycles));
+    ASSERT_TRUE(aot.PC == ref.PC);
+    ASSERT_TRUE(aot.A == ref.A);
+    ASSERT_TRUE(aot.X == ref.X);
+    ASSERT_TRUE(aot.Y == ref.Y);
+    ASSERT_TRUE(aot.S == ref.S);
+    ASSERT_TRUE(aot.SR == ref.SR);
+    for (u32 addr = 0; addr < MEM_MAX; ++addr) {
+        ASSERT_TRUE(aot[addr] == ref[addr]) << "addr " << addr;
+    }
+}
+
+TEST_F(AOT, LoadMissingModule) {
+    AotModule module;
+    ASSERT_FALSE(module.load("/nonexistent/module.so"));
+    ASSERT_FALSE(module.error().empty());
+    ASSERT_TRUE(module.num_blocks() == 0);
+}
+TEST_F(AOT, MatchesInterpreter) {
+    AotModule module;
+    ASSERT_TRUE(module.load(AOT_TEST_MODULE)) << module.error();
+    ASSERT_TRUE(module.num_blocks() > 0);
+    loadImage(cpu);
+    cpu.engine = ENGINE_AOT;
+    cpu.aot = &module;
+    for (s32 numCycles = 1; numCycles < 400; numCycles += 7) {
+        expectSameAsSwitch(cpu, numCycles);
+    }
+    expectSameAsSwitch(cpu, 100000);
+}
+TEST_F(AOT, NmiHandlerTranslated) {
+    AotModule module;
+    ASSERT_TRUE(module.load(AOT_TEST_MODULE)) << module.error();
+    loadImage(cpu);
+    // INC $30, RTI only reachable from the NMI vector
+    Block block = {};
+    block.start = 0xF300;
+    block.next = 0xF303;
+    ASSERT_TRUE(module.find(cpu.memory, block) != nullptr);
+}
+TEST_F(AOT, ModifiedCodeInterpreted) {
+    AotModule module;
+    ASSERT_TRUE(module.load(AOT_TEST_MODULE)) << module.error();
+    loadImage(cpu);
+    cpu.engine = ENGINE_AOT;
+    cpu.aot = &module;
+    ASSERT_TRUE(cpu.execute(2) == 2);
+    ASSERT_TRUE(cpu.X == 0x00);
+
+    // LDX #$00 becomes LDX #$05 before and after the block was translated
+    CPU changed = cpu;
+    changed.reset();
+    loadImage(changed);
+    changed.engine = ENGINE_AOT;
+    changed.aot = &module;
+    changed[0xF001] = 0x05;
+    ASSERT_TRUE(changed.execute(2) == 2);
+    ASSERT_TRUE(changed.X == 0x05);
+
+    cpu.PC = 0xF000;
+    cpu[0xF001] = 0x05;
+    ASSERT_TRUE(cpu.execute(2) == 2);
+    ASSERT_TRUE(cpu.X == 0x05);
+}
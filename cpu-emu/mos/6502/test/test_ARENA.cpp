@@ -0,0 +1,99 @@
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <vector>
+
+#include "mos6502.hpp"
+#include "models.hpp"
+#include "arena.hpp"
+#include "pool.hpp"
+#include "test.hpp"
+
+using namespace mos6502;
+
+
+TEST_F(ARENA, InstancesInRegions) {
+    InstanceArena arena;
+    u32 numCpus = arena.slots_per_region() + 3;
+    std::vector<CPU*> cpus;
+    for (u32 i = 0; i < numCpus; ++i) {
+        CPU* other = arena.create();
+        ASSERT_TRUE(other != nullptr);
+        ASSERT_TRUE((std::uintptr_t) other % 64 == 0);
+        // Registers are on one cache line
+        ASSERT_TRUE((std::uintptr_t) &other->PC / 64 == (std::uintptr_t) &other->SR / 64);
+        // Flat memory is in the same region as the instance
+        ASSERT_TRUE((std::uintptr_t) other->memory.ram / InstanceArena::REGION_SIZE
+                    == (std::uintptr_t) other / InstanceArena::REGION_SIZE);
+        ASSERT_TRUE(arena.owns(other));
+        other->engine = cpu.engine;
+        other->jitThreshold = cpu.jitThreshold;
+        other->reset();
+        (*other)[RESET_START] = LDX_IMM;
+        (*other)[RESET_START + 1] = (u8) i;
+        (*other)[RESET_START + 2] = STX_ABS;
+        (*other)[RESET_START + 3] = 0x00;
+        (*other)[RESET_START + 4] = 0x20;
+        cpus.push_back(other);
+    }
+    ASSERT_TRUE(arena.num_regions() == 2);
+    ASSERT_TRUE(arena.num_instances() == numCpus);
+    ASSERT_FALSE(arena.owns(&cpu));
+    for (u32 i = 0; i < numCpus; ++i) {
+        ASSERT_TRUE(cpus[i]->execute(2 + 4) == 2 + 4);
+    }
+    for (u32 i = 0; i < numCpus; ++i) {
+        ASSERT_TRUE((*cpus[i])[0x2000] == (u8) i);
+    }
+
+    // Slots are reused before another region is mapped, and come back zeroed
+    for (u32 i = 0; i < numCpus; i += 2) {
+        arena.destroy(cpus[i]);
+    }
+    for (u32 i = 0; i < numCpus; i += 2) {
+        cpus[i] = arena.create();
+        ASSERT_TRUE((*cpus[i])[0x2000] == 0x00);
+    }
+    ASSERT_TRUE(arena.num_regions() == 2);
+    for (CPU* other : cpus) {
+        arena.destroy(other);
+    }
+    ASSERT_TRUE(arena.num_instances() == 0);
+}
+
+TEST_F(ARENA, SnapshotOutlivesSlot) {
+    InstanceArena arena;
+    CPU* other = arena.create();
+    ASSERT_TRUE(other != nullptr);
+    other->reset();
+    (*other)[0x0300] = 0x42;
+    Snapshot snapshot = other->snapshot();
+    (*other)[0x0300] = 0x43;
+    arena.destroy(other);
+
+    // The slot is reused and overwritten, the snapshot kept its own copy
+    CPU* reused = arena.create();
+    (*reused)[0x0300] = 0x44;
+    CPU branch = *snapshot;
+    ASSERT_TRUE(branch[0x0300] == 0x42);
+    arena.destroy(reused);
+}
+
+TEST_F(ARENA, PoolInArena) {
+    InstanceArena arena;
+    InstancePool pool(2, cpu.engine, &arena);
+    ASSERT_TRUE(arena.num_instances() == 2);
+
+    u8 program[] = { LDA_IMM, 0x07, STA_ZPG, 0x10, JMP_ABS, 0x04, 0x40 };
+    Job job;
+    job.image = program;
+    job.imageSize = sizeof(program);
+    job.origin = RESET_START;
+    job.numCycles = 2 + 3;
+    job.keepMemory = true;
+    std::vector<JobResult> results = pool.run(std::vector<Job>(4, job));
+    for (const JobResult& result : results) {
+        ASSERT_TRUE(result.cycles == 2 + 3);
+        ASSERT_TRUE(result.ram[0x10] == 0x07);
+    }
+}
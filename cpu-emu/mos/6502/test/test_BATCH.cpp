@@ -0,0 +1,157 @@
+#include <cstring>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "mos6502.hpp"
+#include "batch.hpp"
+#include "models.hpp"
+#include "test.hpp"
+
+using namespace mos6502;
+
+
+// Loop with data dependent branches, lanes differ in their input at 0x10 and loop count at 0x11
+static const u8 PROGRAM[] = {
+    LDY_IMM, 0x00,          // 00
+    LDA_ZPG, 0x10,          // 02 loop:
+    AND_IMM, 0x03,          // 04
+    BEQ_REL, 10,            // 06 to zero
+    CLC_IMP,                // 08
+    ADC_ABY, 0x00, 0x03,    // 09
+    JMP_ABS, 0x15, 0x40,    // 0C to join
+    NOP_IMP,                // 0F
+    SEC_IMP,                // 10 zero:
+    SBC_IMM, 0x05,          // 11
+    PHA_IMP,                // 13
+    PLA_IMP,                // 14
+    ROL_ACC,                // 15 join:
+    STA_ABY, 0x00, 0x02,    // 16
+    INC_ZPG, 0x10,          // 19
+    INY_IMP,                // 1B
+    CPY_ZPG, 0x11,          // 1C
+    BNE_REL, (u8) -28,      // 1E to loop
+    BIT_ZPG, 0x10,          // 20
+    SED_IMP,                // 22
+    ADC_IMM, 0x19,          // 23
+    CLD_IMP,                // 25
+    TAX_IMP,                // 26
+    JMP_ABS, 0x00, 0x40,    // 27
+};
+
+static std::vector<CPU> makeLanes(const CPU& start, u32 numLanes) {
+    std::vector<CPU> lanes(numLanes, start);
+    for (u32 i = 0; i < numLanes; ++i) {
+        CPU& cpu = lanes[i];
+        for (u32 j = 0; j < sizeof(PROGRAM); ++j) {
+            cpu[RESET_START + j] = PROGRAM[j];
+        }
+        cpu[0x10] = (u8) (i * 7);
+        cpu[0x11] = (u8) (1 + i % 8);
+        for (u32 j = 0; j < 8; ++j) {
+            cpu[0x0300 + j] = (u8) (i * 13 + j * 29);
+        }
+        cpu.SR = (u8) (FLAG_INIT | ((i % 3 == 0) ? FLAG_MASK_C : 0));
+    }
+    return lanes;
+}
+
+// Every lane ends where running it alone with the switch engine does
+static void expectSameAsSwitch(const std::vector<CPU>& start, s32 numCycles) {
+    std::vector<CPU> lanes = start;
+    Batch batch;
+    for (CPU& cpu : lanes) {
+        batch.add(cpu);
+    }
+    std::vector<s32> results = batch.execute(numCycles);
+    ASSERT_EQ(results.size(), lanes.size());
+    for (u32 i = 0; i < lanes.size(); ++i) {
+        CPU ref = start[i];
+        ref.engine = ENGINE_SWITCH;
+        EXPECT_EQ(results[i], ref.execute(numCycles)) << "lane " << i << " " << numCycles;
+        EXPECT_EQ(lanes[i].PC, ref.PC) << "lane " << i << " " << numCycles;
+        EXPECT_EQ(lanes[i].A, ref.A) << "lane " << i << " " << numCycles;
+        EXPECT_EQ(lanes[i].X, ref.X) << "lane " << i << " " << numCycles;
+        EXPECT_EQ(lanes[i].Y, ref.Y) << "lane " << i << " " << numCycles;
+        EXPECT_EQ(lanes[i].S, ref.S) << "lane " << i << " " << numCycles;
+        EXPECT_EQ(lanes[i].SR, ref.SR) << "lane " << i << " " << numCycles;
+        EXPECT_EQ(lanes[i].cycles, ref.cycles) << "lane " << i << " " << numCycles;
+        EXPECT_EQ(memcmp(lanes[i].memory.ram, ref.memory.ram, MEM_MAX), 0) << "lane " << i << " " << numCycles;
+    }
+}
+
+TEST_F(BATCH, MatchesSwitch) {
+    std::vector<CPU> lanes = makeLanes(cpu, 37);
+    for (s32 numCycles = 0; numCycles < 200; ++numCycles) {
+        expectSameAsSwitch(lanes, numCycles);
+    }
+    expectSameAsSwitch(lanes, 5000);
+}
+TEST_F(BATCH, DivergentCode) {
+    std::vector<CPU> lanes = makeLanes(cpu, 16);
+    lanes[3][RESET_START + 0x12] = 0x07;        // Other SBC operand
+    lanes[5][RESET_START + 0x0F] = LDA_IMM;     // Other instruction boundaries after the NOP
+    lanes[9][RESET_START + 0x1B] = 0x02;        // Invalid opcode
+    for (s32 numCycles = 0; numCycles < 200; numCycles += 3) {
+        expectSameAsSwitch(lanes, numCycles);
+    }
+    expectSameAsSwitch(lanes, 5000);
+}
+TEST_F(BATCH, LanesShareSteps) {
+    std::vector<CPU> lanes = makeLanes(cpu, 64);
+    Batch batch;
+    for (CPU& cpu : lanes) {
+        batch.add(cpu);
+    }
+    ASSERT_EQ(batch.size(), 64u);
+    batch.execute(2000);
+    ASSERT_TRUE(batch.vectorSteps > 0);
+    ASSERT_TRUE(batch.scalarSteps > 0);
+    // Most instructions run once for many lanes
+    ASSERT_TRUE(batch.vectorSteps + batch.scalarSteps < 64 * 2000 / 8);
+
+    batch.clear();
+    ASSERT_EQ(batch.size(), 0u);
+    ASSERT_TRUE(batch.execute(100).empty());
+}
+TEST_F(BATCH, EventsAndInterrupts) {
+    // Events raise the IRQ for 10 cycles, and on some lanes an NMI later, the handler counts them
+    u8 handler[] = {
+        INC_ZPG, 0x12,          // 5000
+        RTI_IMP,                // 5002
+    };
+    std::vector<CPU> lanes = makeLanes(cpu, 16);
+    std::vector<CPU> refs = lanes;
+    for (std::vector<CPU>* set : { &lanes, &refs }) {
+        for (u32 i = 0; i < set->size(); ++i) {
+            CPU& lane = (*set)[i];
+            lane.memory.load(0x5000, handler, sizeof(handler));
+            lane[INT_VEC_LOC] = 0x00;
+            lane[INT_VEC_LOC + 1] = 0x50;
+            lane[NON_MASK_INT_VEC_LOC] = 0x00;
+            lane[NON_MASK_INT_VEC_LOC + 1] = 0x50;
+            u64 at = 50 + 41 * i;
+            lane.events.schedule(at, [&lane](u64) { lane.set_irq(true); });
+            lane.events.schedule(at + 10, [&lane](u64) { lane.set_irq(false); });
+            if (i % 4 == 1) {
+                lane.events.schedule(at + 300, [&lane](u64) { lane.nmi(); });
+            }
+        }
+    }
+
+    Batch batch;
+    for (CPU& lane : lanes) {
+        batch.add(lane);
+    }
+    std::vector<s32> results = batch.execute(2000);
+    for (u32 i = 0; i < lanes.size(); ++i) {
+        refs[i].engine = ENGINE_SWITCH;
+        EXPECT_EQ(results[i], refs[i].execute(2000)) << "lane " << i;
+        EXPECT_EQ(lanes[i].PC, refs[i].PC) << "lane " << i;
+        EXPECT_EQ(lanes[i].SR, refs[i].SR) << "lane " << i;
+        EXPECT_EQ(lanes[i].cycles, refs[i].cycles) << "lane " << i;
+        EXPECT_TRUE(lanes[i].events.empty()) << "lane " << i;
+        EXPECT_EQ(lanes[i][0x12], (i % 4 == 1) ? 2 : 1) << "lane " << i;
+        EXPECT_EQ(memcmp(lanes[i].memory.ram, refs[i].memory.ram, MEM_MAX), 0) << "lane " << i;
+    }
+}
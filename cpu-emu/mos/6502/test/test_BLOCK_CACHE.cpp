@@ -0,0 +1,70 @@
+#include <gtest/gtest.h>
+
+#include "mos6502.hpp"
+#include "models.hpp"
+#include "test.hpp"
+
+using namespace mos6502;
+
+
+// Decoded blocks must follow changes to the code they came from
+TEST_F(BLOCK_CACHE, HostWriteInvalidates) {
+    cpu.engine = ENGINE_BLOCKS;
+    cpu[RESET_START] = LDA_IMM;
+    cpu[RESET_START + 1] = 0x11;
+    cpu[RESET_START + 2] = JMP_ABS;
+    cpu[RESET_START + 3] = 0x00;
+    cpu[RESET_START + 4] = 0x40;
+    ASSERT_TRUE(cpu.execute(2 + 3 + 2) == 2 + 3 + 2);
+    ASSERT_TRUE(cpu.A == 0x11);
+
+    cpu[RESET_START + 1] = 0x22;
+    ASSERT_TRUE(cpu.execute(3 + 2) == 3 + 2);
+    ASSERT_TRUE(cpu.A == 0x22);
+}
+TEST_F(BLOCK_CACHE, InvalidInstructionReplaced) {
+    cpu.engine = ENGINE_BLOCKS;
+    cpu[RESET_START] = INVALID_INSTRUCTION;
+    ASSERT_TRUE(cpu.execute(2) == -1);
+    cpu[RESET_START] = LDX_IMM;
+    cpu[RESET_START + 1] = 0x42;
+    ASSERT_TRUE(cpu.execute(2) == 2);
+    ASSERT_TRUE(cpu.X == 0x42);
+}
+TEST_F(BLOCK_CACHE, SelfModifyingStoreInBlock) {
+    // Store into the operand of the next instruction in the same block
+    u8 program[] = {
+        LDA_IMM, 0x77,
+        STA_ABS, 0x06, 0x40,
+        LDX_IMM, 0x00,          // Operand replaced with 0x77
+        INC_ABS, 0x06, 0x40,
+        JMP_ABS, 0x05, 0x40,    // Back to LDX
+    };
+    for (u32 i = 0; i < sizeof(program); ++i) {
+        cpu[RESET_START + i] = program[i];
+    }
+    for (u32 e = 0; e < NUM_ENGINES; ++e) {
+        CPU other = cpu;
+        other.engine = (Engine) e;
+        ASSERT_TRUE(other.execute(2 + 4 + 2) == 2 + 4 + 2) << engine_name(other.engine);
+        ASSERT_TRUE(other.X == 0x77) << engine_name(other.engine);
+        ASSERT_TRUE(other.execute(6 + 3 + 2) == 6 + 3 + 2) << engine_name(other.engine);
+        ASSERT_TRUE(other.X == 0x78) << engine_name(other.engine);
+        ASSERT_TRUE(other.execute(6 + 3 + 2) == 6 + 3 + 2) << engine_name(other.engine);
+        ASSERT_TRUE(other.X == 0x79) << engine_name(other.engine);
+    }
+}
+TEST_F(BLOCK_CACHE, CopyStartsEmpty) {
+    cpu.engine = ENGINE_BLOCKS;
+    cpu[RESET_START] = NOP_IMP;
+    cpu[RESET_START + 1] = JMP_ABS;
+    cpu[RESET_START + 2] = 0x00;
+    cpu[RESET_START + 3] = 0x40;
+    ASSERT_TRUE(cpu.execute(2 + 3) == 2 + 3);
+
+    // Copy memory changed without the copy's knowledge must not run stale code
+    CPU other = cpu;
+    other.memory.ram[RESET_START] = INX_IMP;
+    ASSERT_TRUE(other.execute(2) == 2);
+    ASSERT_TRUE(other.X == 1);
+}
@@ -0,0 +1,131 @@
+#include <gtest/gtest.h>
+
+#include "mos6502.hpp"
+#include "clocked_device.hpp"
+#include "via6522.hpp"
+#include "models.hpp"
+#include "test.hpp"
+
+using namespace mos6502;
+
+
+// Counts cycles, registers read the count at the cycle of the access, an event every period cycles
+class Counter : public ClockedDevice {
+ public:
+    Counter(CPU& cpu, u32 period) : ClockedDevice(cpu), period(period) { schedule(cpu.now() + period); }
+
+    u64 count = 0;
+    u32 advances = 0;
+    u32 events = 0;
+    u64 lastEvent = 0;
+
+ protected:
+    void advance(u64 cycle) override {
+        count += cycle - synced();
+        advances += 1;
+    }
+    u8 read_register(u16 addr) override { return (addr & 0xFF) == 0 ? (u8) count : (u8) (count >> 8); }
+    void write_register(u16, u8) override { cancel(); }
+    void event(u64 cycle) override {
+        events += 1;
+        lastEvent = cycle;
+        schedule(cycle + period);
+    }
+
+ private:
+    u32 period;
+};
+
+TEST_F(DEVICES, AccessSyncsToCycle) {
+    u8 program[] = {
+        NOP_IMP,                // 4000 cycle 0
+        NOP_IMP,                // 4001 cycle 2
+        LDA_ABS, 0x00, 0xD0,    // 4002 cycle 4
+        STA_ZPG, 0x10,          // 4005 cycle 8
+        LDA_ABS, 0x00, 0xD0,    // 4007 cycle 11
+        STA_ZPG, 0x11,          // 400A
+        INVALID_INSTRUCTION,    // 400C
+    };
+    Counter counter(cpu, 1000);
+    cpu.memory.map_device(0xD0, 1, &counter);
+    cpu.memory.load(RESET_START, program, sizeof(program));
+
+    ASSERT_TRUE(cpu.execute(100) == -1);
+    ASSERT_TRUE(cpu[0x0010] == 4);
+    ASSERT_TRUE(cpu[0x0011] == 11);
+    // Only the accesses advanced it
+    ASSERT_TRUE(counter.advances == 2);
+    ASSERT_TRUE(counter.synced() == 11);
+    ASSERT_TRUE(cpu.cycles == 4 + 4 + 3 + 4 + 3);
+    counter.sync();
+    ASSERT_TRUE(counter.synced() == cpu.cycles);
+    ASSERT_TRUE(counter.count == cpu.cycles);
+}
+
+TEST_F(DEVICES, EventsAdvanceWithoutAccess) {
+    cpu[RESET_START] = JMP_ABS;
+    cpu[RESET_START + 1] = 0x00;
+    cpu[RESET_START + 2] = 0x40;
+    Counter counter(cpu, 100);
+    cpu.memory.map_device(0xD0, 1, &counter);
+
+    ASSERT_TRUE(cpu.execute(1000) >= 1000);
+    // The event at 1000 runs when execution goes on
+    ASSERT_TRUE(counter.events == 9);
+    ASSERT_TRUE(counter.lastEvent == 900);
+    ASSERT_TRUE(counter.advances == 9);
+    ASSERT_TRUE(counter.synced() == 900);
+
+    // Cycles 1002 to 2004 in jumps of 3
+    ASSERT_TRUE(cpu.execute(1000) == 1002);
+    ASSERT_TRUE(counter.events == 20);
+    ASSERT_TRUE(counter.count == 2000);
+
+    // Writing stops the events
+    cpu[0xD000] = 0;
+    ASSERT_TRUE(cpu.execute(1000) >= 1000);
+    ASSERT_TRUE(counter.events == 20);
+    ASSERT_TRUE(cpu.events.empty());
+}
+
+TEST_F(DEVICES, DestroyedDeviceLeavesNoEvent) {
+    {
+        Counter counter(cpu, 100);
+        ASSERT_TRUE(cpu.events.size() == 1);
+    }
+    ASSERT_TRUE(cpu.events.empty());
+    cpu[RESET_START] = NOP_IMP;
+    ASSERT_TRUE(cpu.execute(2) == 2);
+}
+
+TEST_F(DEVICES, ForkLeavesDevicesAlone) {
+    u8 program[] = {
+        JMP_ABS, 0x00, 0x40,    // 4000
+    };
+    Via6522 via(cpu);
+    via.map(0xD0);
+    cpu.memory.load(RESET_START, program, sizeof(program));
+    cpu.set_flag_i(1);
+    // T1 interrupt 101 cycles after the load at cycle 0
+    cpu[0xD00E] = 0x80 | VIA_IRQ_T1;
+    cpu[0xD004] = 100;
+    cpu[0xD005] = 0;
+    ASSERT_TRUE(cpu.events.size() == 1);
+
+    CPU child = cpu.fork();
+    ASSERT_TRUE(child.events.empty());
+    ASSERT_TRUE(child.execute(500) >= 500);
+    ASSERT_FALSE(cpu.irq_asserted());
+    ASSERT_FALSE(child.irq_asserted());
+    ASSERT_TRUE(cpu.events.size() == 1);
+    ASSERT_TRUE(via.synced() == 0);
+
+    ASSERT_TRUE(cpu.execute(500) >= 500);
+    ASSERT_TRUE(cpu.irq_asserted());
+    // Held lines stay with the parent too
+    CPU other = cpu.fork();
+    ASSERT_FALSE(other.irq_asserted());
+    Snapshot saved = cpu.snapshot();
+    ASSERT_FALSE(saved->irq_asserted());
+    ASSERT_TRUE(saved->events.empty());
+}
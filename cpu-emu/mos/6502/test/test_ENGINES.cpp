@@ -0,0 +1,230 @@
+#include <gtest/gtest.h>
+
+#include "mos6502.hpp"
+#include "models.hpp"
+#include "test.hpp"
+
+using namespace mos6502;
+
+
+// Run the same program on every engine, all must end in the same state
+static void expectSameOnAllEngines(const CPU& start, s32 numCycles) {
+    CPU ref = start;
+    ref.engine = ENGINE_SWITCH;
+    s32 refRet = ref.execute(numCycles);
+
+    for (u32 e = 0; e < NUM_ENGINES; ++e) {
+        CPU other = start;
+        other.engine = (Engine) e;
+        EXPECT_EQ(other.execute(numCycles), refRet) << engine_name(other.engine);
+        EXPECT_EQ(other.PC, ref.PC) << engine_name(other.engine);
+        EXPECT_EQ(other.A, ref.A) << engine_name(other.engine);
+        EXPECT_EQ(other.X, ref.X) << engine_name(other.engine);
+        EXPECT_EQ(other.Y, ref.Y) << engine_name(other.engine);
+        EXPECT_EQ(other.S, ref.S) << engine_name(other.engine);
+        EXPECT_EQ(other.SR, ref.SR) << engine_name(other.engine);
+        for (u32 addr = 0; addr < MEM_MAX; ++addr) {
+            ASSERT_EQ(other[addr], ref[addr]) << engine_name(other.engine) << " addr " << addr;
+        }
+    }
+}
+
+TEST_F(ENGINES, NameLookup) {
+    for (u32 e = 0; e < NUM_ENGINES; ++e) {
+        Engine found;
+        ASSERT_TRUE(engine_from_name(engine_name((Engine) e), found));
+        ASSERT_TRUE(found == (Engine) e);
+    }
+    Engine found;
+    ASSERT_FALSE(engine_from_name("no-such-engine", found));
+}
+TEST_F(ENGINES, HandlerTableMatchesOpcodeTables) {
+    for (u32 opcode = 0; opcode < 256; ++opcode) {
+        ASSERT_EQ(HANDLERS[opcode] == nullptr, INSTR_GET_ADDR_MODE[opcode] == NUL) << "opcode " << opcode;
+        ASSERT_EQ(HANDLERS[opcode] == nullptr, NUM_CYCLES_BASE[opcode] == 0) << "opcode " << opcode;
+    }
+}
+TEST_F(ENGINES, InvalidInstruction) {
+    for (u32 e = 0; e < NUM_ENGINES; ++e) {
+        cpu.engine = (Engine) e;
+        cpu[RESET_START] = INVALID_INSTRUCTION;
+        ASSERT_TRUE(cpu.execute(10) == -1);
+    }
+}
+TEST_F(ENGINES, MemoryCopyLoop) {
+    // Copy 0x20 bytes from 0x1000 to 0x2000, then sum them with ADC
+    u8 program[] = {
+        LDX_IMM, 0x00,
+        LDA_ABX, 0x00, 0x10,    // loop:
+        STA_ABX, 0x00, 0x20,
+        INX_IMP,
+        CPX_IMM, 0x20,
+        BNE_REL, (u8) -9,
+        LDA_IMM, 0x00,
+        LDY_IMM, 0x20,
+        CLC_IMP,
+        ADC_ABY, 0xFF, 0x1F,    // sum:
+        DEY_IMP,
+        BNE_REL, (u8) -4,
+        PHA_IMP,
+        PHP_IMP,
+        NOP_IMP,
+    };
+    for (u32 i = 0; i < sizeof(program); ++i) {
+        cpu[RESET_START + i] = program[i];
+    }
+    for (u32 i = 0; i < 0x20; ++i) {
+        cpu[0x1000 + i] = (u8) (i * 37 + 11);
+    }
+    expectSameOnAllEngines(cpu, 1000);
+    expectSameOnAllEngines(cpu, 37);
+}
+TEST_F(ENGINES, SubroutineAndInterrupt) {
+    cpu[INT_VEC_LOC] = 0x00;
+    cpu[INT_VEC_LOC + 1] = 0x30;
+    u8 program[] = {
+        JSR_ABS, 0x00, 0x50,
+        BRK_IMP,
+    };
+    u8 subroutine[] = {
+        SEC_IMP,
+        LDA_IMM, 0x80,
+        ROR_ACC,
+        ASL_ZPG, 0x10,
+        EOR_ZPG, 0x10,
+        RTS_IMP,
+    };
+    u8 handler[] = {
+        INC_ZPG, 0x11,
+        BIT_ZPG, 0x11,
+        RTI_IMP,
+    };
+    for (u32 i = 0; i < sizeof(program); ++i)    { cpu[RESET_START + i] = program[i]; }
+    for (u32 i = 0; i < sizeof(subroutine); ++i) { cpu[0x5000 + i] = subroutine[i]; }
+    for (u32 i = 0; i < sizeof(handler); ++i)    { cpu[0x3000 + i] = handler[i]; }
+    cpu[0x10] = 0xC3;
+    for (s32 numCycles = 1; numCycles < 60; ++numCycles) {
+        expectSameOnAllEngines(cpu, numCycles);
+    }
+}
+TEST_F(ENGINES, FlagsVisibleBetweenCalls) {
+    // N and Z both set can only come from SR, not from a result
+    cpu.SR = FLAG_INIT | FLAG_MASK_N | FLAG_MASK_Z | FLAG_MASK_C;
+    u8 program[] = {
+        PHP_IMP,
+        LDA_IMM, 0x01,
+        ADC_IMM, 0x7F,
+        PLP_IMP,
+        PHP_IMP,
+    };
+    for (u32 i = 0; i < sizeof(program); ++i) {
+        cpu[RESET_START + i] = program[i];
+    }
+    expectSameOnAllEngines(cpu, 3 + 2 + 2 + 4 + 3);
+
+    for (u32 e = 0; e < NUM_ENGINES; ++e) {
+        CPU other = cpu;
+        other.engine = (Engine) e;
+        ASSERT_TRUE(other.execute(3 + 2 + 2) == 3 + 2 + 2);
+        ASSERT_TRUE(other.A == 0x81);
+        ASSERT_TRUE(other.get_flag_n() == F_NEG);
+        ASSERT_TRUE(other.get_flag_z() == F_NON_ZERO);
+        ASSERT_TRUE(other.get_flag_v() == F_YES_OVERFLOW);
+        ASSERT_TRUE(other.get_flag_c() == F_NO_CARRY);
+        ASSERT_TRUE(other.execute(4 + 3) == 4 + 3);
+        ASSERT_TRUE(other.SR == (FLAG_INIT | FLAG_MASK_N | FLAG_MASK_Z | FLAG_MASK_C));
+        ASSERT_TRUE(other[0x01FF] == other.SR);
+    }
+}
+TEST_F(ENGINES, JitDecimalModeBetweenCalls) {
+    // Block translated in binary mode, must fall back once D is set from outside
+    u8 program[] = {
+        ADC_IMM, 0x19,      // loop:
+        SBC_IMM, 0x08,
+        JMP_ABS, lowByte(RESET_START), highByte(RESET_START),
+    };
+    for (u32 i = 0; i < sizeof(program); ++i) {
+        cpu[RESET_START + i] = program[i];
+    }
+    CPU ref = cpu;
+    CPU jit = cpu;
+    ref.engine = ENGINE_SWITCH;
+    jit.engine = ENGINE_JIT;
+    jit.jitThreshold = 0;
+    for (u32 round = 0; round < 4; ++round) {
+        ref.set_flag_d(round % 2);
+        jit.set_flag_d(round % 2);
+        ASSERT_TRUE(jit.execute(100) == ref.execute(100));
+        ASSERT_TRUE(jit.PC == ref.PC);
+        ASSERT_TRUE(jit.A == ref.A);
+        ASSERT_TRUE(jit.SR == ref.SR);
+    }
+}
+TEST_F(ENGINES, RunUntilComposes) {
+    // Instructions of 2 to 7 cycles, page crossing and taken branches
+    u8 program[] = {
+        LDX_IMM, 0xF0,          // 4000
+        LDA_ABX, 0x20, 0x10,    // 4002 loop: crosses a page for X >= 0xE0
+        ADC_ZPG, 0x10,          // 4005
+        STA_ZPG, 0x10,          // 4007
+        INC_ABX, 0x00, 0x30,    // 4009
+        INX_IMP,                // 400C
+        BNE_REL, (u8) -11,      // 400D to loop
+        JMP_ABS, 0x00, 0x40,    // 400F
+    };
+    cpu.memory.load(RESET_START, program, sizeof(program));
+    CPU whole = cpu;
+
+    for (u64 slice = 1; slice <= 1000; ++slice) {
+        s64 overshoot = cpu.run_until(slice * 97);
+        ASSERT_TRUE(overshoot >= 0 && overshoot < 7);
+        ASSERT_TRUE(cpu.cycles == slice * 97 + overshoot);
+    }
+    // Slices end at the same instruction boundary as one call
+    ASSERT_TRUE(whole.run_until(1000 * 97) == (s64) (cpu.cycles - 1000 * 97));
+    ASSERT_TRUE(whole.cycles == cpu.cycles);
+    ASSERT_TRUE(whole.PC == cpu.PC);
+    ASSERT_TRUE(whole.A == cpu.A);
+    ASSERT_TRUE(whole.X == cpu.X);
+    ASSERT_TRUE(whole.SR == cpu.SR);
+    for (u32 addr = 0x3000; addr < 0x3100; ++addr) {
+        ASSERT_TRUE(whole[addr] == cpu[addr]);
+    }
+    // Already there
+    u64 before = cpu.cycles;
+    ASSERT_TRUE(cpu.run_until(before - 1) == 1);
+    ASSERT_TRUE(cpu.cycles == before);
+}
+TEST_F(ENGINES, CyclesCountedUpToInvalidInstruction) {
+    u8 program[] = { NOP_IMP, LDA_IMM, 0x01, INVALID_INSTRUCTION };
+    cpu.memory.load(RESET_START, program, sizeof(program));
+    ASSERT_TRUE(cpu.execute(100) == -1);
+    ASSERT_TRUE(cpu.cycles == 2 + 2);
+    cpu.PC = RESET_START;
+    ASSERT_TRUE(cpu.run_until(1000) == -1);
+    ASSERT_TRUE(cpu.cycles == 2 * (2 + 2));
+}
+TEST_F(ENGINES, ComparePaysPageCrossing) {
+    u8 program[] = {
+        LDX_IMM, 0x01,          // 4000 2
+        LDY_IMM, 0x01,          // 4002 2
+        CMP_ABX, 0xFF, 0x40,    // 4004 4 + 1
+        CMP_ABY, 0xFF, 0x40,    // 4007 4 + 1
+        CMP_IDY, 0x10,          // 400A 5 + 1
+        CMP_ABX, 0x00, 0x40,    // 400C 4
+        CPX_ABS, 0xFF, 0x40,    // 400F 4
+        CPY_ABS, 0xFF, 0x40,    // 4012 4
+        INVALID_INSTRUCTION,    // 4015
+    };
+    cpu.memory.load(RESET_START, program, sizeof(program));
+    cpu[0x0010] = 0xFF;
+    cpu[0x0011] = 0x40;
+    for (u32 e = 0; e < NUM_ENGINES; ++e) {
+        CPU other = cpu;
+        other.engine = (Engine) e;
+        other.jitThreshold = 0;
+        ASSERT_TRUE(other.execute(1000) == -1) << engine_name(other.engine);
+        ASSERT_TRUE(other.PC == 0x4015) << engine_name(other.engine);
+        ASSERT_TRUE(other.cycles == 2 + 2 + 5 + 5 + 6 + 4 + 4 + 4) << engine_name(other.engine);
+    }
+}
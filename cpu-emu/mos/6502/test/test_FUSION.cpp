@@ -0,0 +1,165 @@
+#include <gtest/gtest.h>
+
+#include "mos6502.hpp"
+#include "models.hpp"
+#include "test.hpp"
+
+using namespace mos6502;
+
+
+// Fused blocks must end every budget in the state of running one instruction at a time
+static void expectSameAsSwitch(const CPU& start, s32 numCycles) {
+    CPU ref = start;
+    CPU fused = start;
+    ref.engine = ENGINE_SWITCH;
+    fused.engine = ENGINE_BLOCKS;
+    ASSERT_TRUE(fused.execute(numCycles) == ref.execute(numCycles)) << numCycles;
+    ASSERT_TRUE(fused.PC == ref.PC) << numCycles;
+    ASSERT_TRUE(fused.A == ref.A) << numCycles;
+    ASSERT_TRUE(fused.X == ref.X) << numCycles;
+    ASSERT_TRUE(fused.Y == ref.Y) << numCycles;
+    ASSERT_TRUE(fused.SR == ref.SR) << numCycles;
+    for (u32 addr = 0; addr < MEM_MAX; ++addr) {
+        ASSERT_TRUE(fused[addr] == ref[addr]) << numCycles << " addr " << addr;
+    }
+}
+
+static void load(CPU& cpu, const u8* program, u32 size) {
+    for (u32 i = 0; i < size; ++i) {
+        cpu[RESET_START + i] = program[i];
+    }
+}
+
+TEST_F(FUSION, Lookup) {
+    DecodedInstr instrs[3] = {};
+    instrs[0].opcode = CLC_IMP;
+    instrs[1].opcode = ADC_IMM;
+    instrs[2].opcode = STA_ZPG;
+    ASSERT_TRUE(find_fusion(instrs, 3)->length == 3);
+    ASSERT_TRUE(find_fusion(instrs, 2)->length == 2);
+    ASSERT_TRUE(find_fusion(instrs, 1) == nullptr);
+    instrs[0].opcode = NOP_IMP;
+    ASSERT_TRUE(find_fusion(instrs, 3) == nullptr);
+
+    instrs[0] = { nullptr, 0x1234, LDA_ABS };
+    instrs[1] = { nullptr, 0xABCD, STA_ABS };
+    ASSERT_TRUE(pack_operands(instrs, 2) == 0xABCD1234);
+    instrs[0] = { nullptr, 0, CLC_IMP };
+    instrs[1] = { nullptr, 0x42, ADC_IMM };
+    ASSERT_TRUE(pack_operands(instrs, 2) == 0x42);
+}
+TEST_F(FUSION, LoopsAndCompares) {
+    u8 program[] = {
+        LDX_IMM, 0x05,
+        DEX_IMP,                // x loop:
+        BNE_REL, (u8) -1,
+        LDY_IMM, 0x03,
+        DEY_IMP,                // y loop:
+        BPL_REL, (u8) -1,
+        LDA_IMM, 0x10,
+        CMP_IMM, 0x10,
+        BEQ_REL, 0x03,
+        NOP_IMP,
+        CPX_IMM, 0x00,          // taken branch lands here
+        BCS_REL, 0x03,
+        NOP_IMP,
+        CPY_IMM, 0x80,
+        BCC_REL, 0x03,
+        NOP_IMP,
+        INC_ZPG, 0x20,
+        BNE_REL, (u8) -2,
+        INC_ZPG, 0x21,
+        JMP_ABS, lowByte(RESET_START), highByte(RESET_START),
+    };
+    load(cpu, program, sizeof(program));
+    cpu[0x20] = 0xF0;
+    for (s32 numCycles = 1; numCycles < 300; ++numCycles) {
+        expectSameAsSwitch(cpu, numCycles);
+    }
+    expectSameAsSwitch(cpu, 20000);
+}
+TEST_F(FUSION, ArithmeticAndCopies) {
+    u8 program[] = {
+        LDA_ZPG, 0x10,
+        CLC_IMP,
+        ADC_IMM, 0x7F,
+        STA_ZPG, 0x10,
+        LDA_ZPG, 0x11,
+        SEC_IMP,
+        SBC_IMM, 0x01,
+        STA_ZPG, 0x11,
+        CLC_IMP,
+        ADC_ABS, 0x10, 0x00,
+        SEC_IMP,
+        SBC_ZPG, 0x11,
+        SED_IMP,                // Decimal mode inside fused handlers
+        CLC_IMP,
+        ADC_IMM, 0x19,
+        CLD_IMP,
+        LDA_ABS, 0x10, 0x00,
+        STA_ABS, 0x00, 0x30,
+        LDX_IMM, 0xF8,
+        LDA_ABX, 0x00, 0x10,    // Crosses a page
+        STA_ABX, 0x00, 0x31,
+        LDY_IMM, 0x01,
+        LDA_IDY, 0x12,
+        STA_IDY, 0x14,
+        LDA_IMM, 0x99,
+        STA_ABX, 0x00, 0x32,
+        JMP_ABS, lowByte(RESET_START), highByte(RESET_START),
+    };
+    load(cpu, program, sizeof(program));
+    cpu[0x10] = 0x81;
+    cpu[0x11] = 0x00;
+    cpu[0x12] = 0x00;
+    cpu[0x13] = 0x20;
+    cpu[0x14] = 0x00;
+    cpu[0x15] = 0x21;
+    cpu[0x2001] = 0x5A;
+    cpu[0x10F8] = 0x3C;
+    for (s32 numCycles = 1; numCycles < 300; ++numCycles) {
+        expectSameAsSwitch(cpu, numCycles);
+    }
+    expectSameAsSwitch(cpu, 20000);
+}
+TEST_F(FUSION, IncrementOfOwnBranchNotFused) {
+    // Zero page code, INC changes the branch offset that follows it
+    cpu.PC = 0x0080;
+    u8 program[] = {
+        INC_ZPG, 0x83,          // 0080
+        BNE_REL, 0x00,          // 0082
+        JMP_ABS, 0x80, 0x00,    // 0084
+    };
+    for (u32 i = 0; i < sizeof(program); ++i) {
+        cpu[0x0080 + i] = program[i];
+    }
+    for (s32 numCycles = 1; numCycles < 100; ++numCycles) {
+        expectSameAsSwitch(cpu, numCycles);
+    }
+}
+TEST_F(FUSION, Profile) {
+    u8 program[] = {
+        LDX_IMM, 0x10,
+        DEX_IMP,                // loop:
+        NOP_IMP,
+        CPX_IMM, 0x00,
+        BNE_REL, (u8) -4,
+        JMP_ABS, lowByte(RESET_START), highByte(RESET_START),
+    };
+    load(cpu, program, sizeof(program));
+    FusionProfile profile;
+    cpu.engine = ENGINE_BLOCKS;
+    cpu.profile = &profile;
+    cpu.execute(1000);
+
+    std::vector<FusionProfile::Entry> top = profile.top(3);
+    ASSERT_TRUE(top.size() == 3);
+    // Loop body pairs first (same count, by opcode), the one with a fused handler marked
+    ASSERT_TRUE(top[0].length == 2);
+    ASSERT_TRUE(top[0].count == top[1].count && top[1].count == top[2].count);
+    ASSERT_TRUE(top[0].opcodes[0] == DEX_IMP && top[0].opcodes[1] == NOP_IMP);
+    ASSERT_FALSE(top[0].fused);
+    ASSERT_TRUE(top[1].opcodes[0] == CPX_IMM && top[1].opcodes[1] == BNE_REL);
+    ASSERT_TRUE(top[1].fused);
+    ASSERT_TRUE(top[2].opcodes[0] == NOP_IMP && top[2].opcodes[1] == CPX_IMM);
+}
@@ -0,0 +1,112 @@
+#include <gtest/gtest.h>
+
+#include "mos6502.hpp"
+#include "models.hpp"
+#include "test.hpp"
+
+using namespace mos6502;
+
+
+static const Engine BLOCK_ENGINES[] = { ENGINE_BLOCKS, ENGINE_JIT, ENGINE_AOT };
+
+// Fast-forwarded loops must end in the state of running every iteration, returns cycles skipped
+static u64 expectSameAsSwitch(const CPU& start, s32 numCycles) {
+    CPU ref = start;
+    ref.engine = ENGINE_SWITCH;
+    s32 refRet = ref.execute(numCycles);
+    u64 skipped = 0;
+    for (Engine engine : BLOCK_ENGINES) {
+        CPU other = start;
+        other.engine = engine;
+        other.jitThreshold = 0;
+        EXPECT_EQ(other.execute(numCycles), refRet) << engine_name(engine) << " " << numCycles;
+        EXPECT_EQ(other.PC, ref.PC) << engine_name(engine) << " " << numCycles;
+        EXPECT_EQ(other.A, ref.A) << engine_name(engine) << " " << numCycles;
+        EXPECT_EQ(other.X, ref.X) << engine_name(engine) << " " << numCycles;
+        EXPECT_EQ(other.SR, ref.SR) << engine_name(engine) << " " << numCycles;
+        skipped = other.idleCyclesSkipped;
+    }
+    return skipped;
+}
+
+TEST_F(IDLE, JmpToItself) {
+    cpu[RESET_START] = JMP_ABS;
+    cpu[RESET_START + 1] = lowByte(RESET_START);
+    cpu[RESET_START + 2] = highByte(RESET_START);
+    for (s32 numCycles = 1; numCycles < 40; ++numCycles) {
+        expectSameAsSwitch(cpu, numCycles);
+    }
+    ASSERT_TRUE(expectSameAsSwitch(cpu, 10000000) > 9000000);
+
+    cpu.engine = ENGINE_BLOCKS;
+    ASSERT_TRUE(cpu.execute(2000000000) == 2000000001);
+    ASSERT_TRUE(cpu.PC == RESET_START);
+}
+TEST_F(IDLE, PollUntilChanged) {
+    // First run loads A, every run after leaves the state alone
+    u8 program[] = {
+        LDA_ZPG, 0x10,
+        CMP_IMM, 0x01,
+        BNE_REL, (u8) -4,
+        NOP_IMP,
+    };
+    for (u32 i = 0; i < sizeof(program); ++i) {
+        cpu[RESET_START + i] = program[i];
+    }
+    cpu.A = 0x55;
+    for (s32 numCycles = 1; numCycles < 60; ++numCycles) {
+        expectSameAsSwitch(cpu, numCycles);
+    }
+    ASSERT_TRUE(expectSameAsSwitch(cpu, 1000000) > 900000);
+
+    // Host changes the polled location between runs
+    cpu.engine = ENGINE_BLOCKS;
+    ASSERT_TRUE(cpu.execute(8 * 12500) == 8 * 12500);
+    ASSERT_TRUE(cpu.PC == RESET_START);
+    cpu[0x10] = 0x01;
+    ASSERT_TRUE(cpu.execute(3 + 2 + 2) == 3 + 2 + 2);
+    ASSERT_TRUE(cpu.A == 0x01);
+    ASSERT_TRUE(cpu.PC == RESET_START + 6);
+}
+TEST_F(IDLE, BranchToItselfFlagSet) {
+    cpu[RESET_START] = BEQ_REL;
+    cpu[RESET_START + 1] = 0x00;
+    cpu.SR |= FLAG_MASK_Z;
+    ASSERT_TRUE(expectSameAsSwitch(cpu, 1000000) > 900000);
+    cpu.SR &= ~FLAG_MASK_Z;
+    ASSERT_TRUE(expectSameAsSwitch(cpu, 1000) == 0);
+}
+TEST_F(IDLE, ChangingLoopsNotSkipped) {
+    // The bench loop changes A every time around
+    u8 bench[] = {
+        ADC_IMM, 1, ADC_IMM, 1, ADC_IMM, 1, ADC_IMM, 1, ADC_IMM, 1,
+        JMP_ABS, lowByte(RESET_START), highByte(RESET_START),
+    };
+    for (u32 i = 0; i < sizeof(bench); ++i) {
+        cpu[RESET_START + i] = bench[i];
+    }
+    ASSERT_TRUE(expectSameAsSwitch(cpu, 100000) == 0);
+
+    // Counting down, then idle on the final branch
+    u8 countdown[] = {
+        DEX_IMP,
+        BNE_REL, (u8) -1,
+        JMP_ABS, lowByte(RESET_START + 3), highByte(RESET_START + 3),
+    };
+    for (u32 i = 0; i < sizeof(countdown); ++i) {
+        cpu[RESET_START + i] = countdown[i];
+    }
+    cpu.X = 0xF0;
+    for (s32 numCycles = 1; numCycles < 1300; numCycles += 13) {
+        expectSameAsSwitch(cpu, numCycles);
+    }
+    ASSERT_TRUE(expectSameAsSwitch(cpu, 1000000) > 900000);
+
+    // Stores are never idle
+    cpu[RESET_START] = STA_ZPG;
+    cpu[RESET_START + 1] = 0x10;
+    cpu[RESET_START + 2] = JMP_ABS;
+    cpu[RESET_START + 3] = lowByte(RESET_START);
+    cpu[RESET_START + 4] = highByte(RESET_START);
+    ASSERT_TRUE(expectSameAsSwitch(cpu, 100000) == 0);
+}
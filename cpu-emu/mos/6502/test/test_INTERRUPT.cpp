@@ -1,5 +1,8 @@
 #include <gtest/gtest.h>
 
+#include <utility>
+#include <vector>
+
 #include "mos6502.hpp"
 #include "models.hpp"
 #include "test.hpp"
@@ -26,3 +29,170 @@ TEST_F(INTERRUPT, BRK_and_RTI) {
     ASSERT_TRUE(cpu.execute(6) == 6);
     ASSERT_TRUE(cpu.PC == RESET_START);  // Should return to original location
 }
+
+// Writes to offset 0 release the IRQ line, to offset 1 assert it
+class IrqLine : public Device {
+ public:
+    explicit IrqLine(CPU& cpu) : cpu(cpu) {}
+    u8 read(u16) override { return 0; }
+    void write(u16 addr, u8) override { cpu.set_irq((addr & 0xFF) == 1); }
+ private:
+    CPU& cpu;
+};
+
+TEST_F(INTERRUPT, EventsRunInOrder) {
+    cpu[RESET_START] = JMP_ABS;
+    cpu[RESET_START + 1] = 0x00;
+    cpu[RESET_START + 2] = 0x40;
+    std::vector<std::pair<u64, u64>> ran;  // Cycle scheduled for, cycle run at
+    auto record = [&](u64 cycle) { ran.push_back({ cycle, cpu.cycles }); };
+    cpu.events.schedule(30, record);
+    cpu.events.schedule(10, record);
+    cpu.events.schedule(10, [&](u64 cycle) {
+        record(cycle);
+        cpu.events.schedule(cycle + 5, record);
+    });
+    u32 cancelled = cpu.events.schedule(50, record);
+    ASSERT_TRUE(cpu.events.cancel(cancelled));
+    ASSERT_FALSE(cpu.events.cancel(cancelled));
+
+    s32 executed = cpu.execute(100);
+    ASSERT_TRUE(executed >= 100 && executed < 100 + 3);
+    ASSERT_TRUE(cpu.cycles == (u64) executed);
+    std::vector<u64> order = { 10, 10, 15, 30 };
+    ASSERT_TRUE(ran.size() == order.size());
+    for (u32 i = 0; i < ran.size(); ++i) {
+        ASSERT_TRUE(ran[i].first == order[i]);
+        ASSERT_TRUE(ran[i].second >= ran[i].first && ran[i].second < ran[i].first + 3);
+    }
+    ASSERT_TRUE(cpu.events.empty());
+}
+
+TEST_F(INTERRUPT, IrqTiming) {
+    u8 program[] = {
+        CLI_IMP,                // 4000
+        JMP_ABS, 0x01, 0x40,    // 4001
+    };
+    u8 handler[] = {
+        STA_ABS, 0x00, 0xD0,    // 5000 release the line
+        RTI_IMP,                // 5003
+    };
+    IrqLine line(cpu);
+    cpu.memory.map_device(0xD0, 1, &line);
+    cpu.memory.load(RESET_START, program, sizeof(program));
+    cpu.memory.load(0x5000, handler, sizeof(handler));
+    cpu[INT_VEC_LOC] = 0x00;
+    cpu[INT_VEC_LOC + 1] = 0x50;
+    cpu.events.schedule(50, [&](u64) { cpu.set_irq(true); });
+
+    // CLI and 16 jumps reach cycle 50, the interrupt takes 7 more
+    ASSERT_TRUE(cpu.execute(57) == 57);
+    ASSERT_TRUE(cpu.cycles == 57);
+    ASSERT_TRUE(cpu.PC == 0x5000);
+    ASSERT_TRUE(cpu.get_flag_i() == 1);
+    ASSERT_TRUE(cpu.S == 0xFC);
+    ASSERT_TRUE(cpu[0x01FF] == 0x40);
+    ASSERT_TRUE(cpu[0x01FE] == 0x01);
+    ASSERT_TRUE(cpu[0x01FD] == FLAG_INIT);   // B clear, I clear as it was
+
+    ASSERT_TRUE(cpu.execute(4 + 6) == 4 + 6);
+    ASSERT_FALSE(cpu.irq_asserted());
+    ASSERT_TRUE(cpu.PC == 0x4001);
+    ASSERT_TRUE(cpu.get_flag_i() == 0);
+    ASSERT_TRUE(cpu.execute(30) == 30);
+    ASSERT_TRUE(cpu.PC == 0x4001);
+    ASSERT_TRUE(cpu.S == 0xFF);
+}
+
+TEST_F(INTERRUPT, MaskedIrqWaitsForCli) {
+    u8 program[] = {
+        SEI_IMP,                // 4000
+        LDX_IMM, 0x04,          // 4001
+        DEX_IMP,                // 4003
+        BNE_REL, (u8) -1,       // 4004
+        CLI_IMP,                // 4006
+        JMP_ABS, 0x07, 0x40,    // 4007
+    };
+    cpu.memory.load(RESET_START, program, sizeof(program));
+    cpu[0x5000] = JMP_ABS;
+    cpu[0x5001] = 0x00;
+    cpu[0x5002] = 0x50;
+    cpu[INT_VEC_LOC] = 0x00;
+    cpu[INT_VEC_LOC + 1] = 0x50;
+    cpu.events.schedule(5, [&](u64) { cpu.set_irq(true); });
+
+    ASSERT_TRUE(cpu.execute(200) >= 200);
+    ASSERT_TRUE(cpu.PC == 0x5000);
+    ASSERT_TRUE(cpu.S == 0xFC);
+    // Taken right after CLI
+    ASSERT_TRUE(cpu[0x01FF] == 0x40);
+    ASSERT_TRUE(cpu[0x01FE] == 0x07);
+    ASSERT_TRUE((cpu[0x01FD] & FLAG_MASK_I) == 0);
+    ASSERT_TRUE(cpu.X == 0);
+}
+
+TEST_F(INTERRUPT, IrqRaisedByWrite) {
+    u8 program[] = {
+        CLI_IMP,                // 4000
+        LDA_IMM, 0x01,          // 4001
+        STA_ABS, 0x01, 0xD0,    // 4003 assert the line
+        JMP_ABS, 0x09, 0x40,    // 4006
+        JMP_ABS, 0x09, 0x40,    // 4009
+    };
+    IrqLine line(cpu);
+    cpu.memory.map_device(0xD0, 1, &line);
+    cpu.memory.load(RESET_START, program, sizeof(program));
+    cpu[0x5000] = JMP_ABS;
+    cpu[0x5001] = 0x00;
+    cpu[0x5002] = 0x50;
+    cpu[INT_VEC_LOC] = 0x00;
+    cpu[INT_VEC_LOC + 1] = 0x50;
+
+    ASSERT_TRUE(cpu.execute(1000) >= 1000);
+    ASSERT_TRUE(cpu.PC == 0x5000);
+    // At the next instruction, or after the block for the block engines
+    u16 pushed = B2W(cpu[0x01FE], cpu[0x01FF]);
+    ASSERT_TRUE(pushed == 0x4006 || pushed == 0x4009);
+}
+
+TEST_F(INTERRUPT, NmiIgnoresI) {
+    u8 program[] = {
+        SEI_IMP,                // 4000
+        JMP_ABS, 0x01, 0x40,    // 4001
+    };
+    cpu.memory.load(RESET_START, program, sizeof(program));
+    cpu[0x6000] = JMP_ABS;
+    cpu[0x6001] = 0x00;
+    cpu[0x6002] = 0x60;
+    cpu[NON_MASK_INT_VEC_LOC] = 0x00;
+    cpu[NON_MASK_INT_VEC_LOC + 1] = 0x60;
+    cpu.events.schedule(20, [&](u64) { cpu.nmi(); });
+
+    ASSERT_TRUE(cpu.execute(100) >= 100);
+    ASSERT_TRUE(cpu.PC == 0x6000);
+    ASSERT_TRUE(cpu[0x01FF] == 0x40);
+    ASSERT_TRUE(cpu[0x01FE] == 0x01);
+    ASSERT_TRUE((cpu[0x01FD] & FLAG_MASK_I) != 0);
+    // Taken once
+    ASSERT_TRUE(cpu.execute(100) >= 100);
+    ASSERT_TRUE(cpu.S == 0xFC);
+
+    // Pending before execute, taken first
+    cpu.nmi();
+    ASSERT_TRUE(cpu.execute(7) == 7);
+    ASSERT_TRUE(cpu.S == 0xF9);
+}
+
+TEST_F(INTERRUPT, IdleSkipStopsAtEvents) {
+    cpu[RESET_START] = JMP_ABS;
+    cpu[RESET_START + 1] = 0x00;
+    cpu[RESET_START + 2] = 0x40;
+    u64 ranAt = 0;
+    cpu.events.schedule(1000003, [&](u64) { ranAt = cpu.cycles; });
+
+    ASSERT_TRUE(cpu.execute(10000000) >= 10000000);
+    ASSERT_TRUE(ranAt >= 1000003 && ranAt < 1000003 + 3);
+    if (cpu.engine >= ENGINE_BLOCKS) {
+        ASSERT_TRUE(cpu.idleCyclesSkipped > 0);
+    }
+}
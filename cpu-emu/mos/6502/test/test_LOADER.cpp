@@ -0,0 +1,213 @@
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "mos6502.hpp"
+#include "loader.hpp"
+#include "models.hpp"
+#include "test.hpp"
+
+using namespace mos6502;
+
+
+static void write_file(const std::string& path, const std::vector<u8>& data) {
+    FILE* f = fopen(path.c_str(), "wb");
+    ASSERT_TRUE(f != nullptr);
+    fwrite(data.data(), 1, data.size(), f);
+    fclose(f);
+}
+
+// One Intel HEX record with its checksum
+static std::string hex_record(u8 type, u16 addr, const std::vector<u8>& data) {
+    std::vector<u8> bytes = { (u8) data.size(), (u8) (addr >> 8), (u8) (addr & 0xFF), type };
+    bytes.insert(bytes.end(), data.begin(), data.end());
+    u8 sum = 0;
+    for (u8 b : bytes) {
+        sum += b;
+    }
+    bytes.push_back((u8) -sum);
+    std::string line = ":";
+    char digits[3];
+    for (u8 b : bytes) {
+        snprintf(digits, sizeof(digits), "%02X", b);
+        line += digits;
+    }
+    return line + "\r\n";
+}
+
+TEST_F(LOADER, RawRomIsMapped) {
+    // 16 KiB ROM ending at 0xFFFF, its reset vector points at its start
+    std::vector<u8> rom(0x4000, NOP_IMP);
+    u8 program[] = { LDA_IMM, 0x42, STA_ZPG, 0x10, 0x02 };
+    std::copy(program, program + sizeof(program), rom.begin());
+    rom[0x3FFC] = 0x00;
+    rom[0x3FFD] = 0xC0;
+    std::string path = temp_path("rom.bin");
+    write_file(path, rom);
+
+    ImageLoader loader;
+    loader.rom = true;
+    ASSERT_TRUE(loader.load(cpu, path.c_str()));
+    ASSERT_TRUE(loader.start() == 0xC000);
+    ASSERT_TRUE(loader.size() == 0x4000);
+    ASSERT_TRUE(loader.entry() == 0xC000);
+    ASSERT_TRUE(cpu.PC == 0xC000);
+#if defined(__unix__)
+    ASSERT_TRUE(loader.mapped());
+    // Pages come from one mapping of the file
+    for (u32 page = 0xC1; page <= 0xFF; ++page) {
+        ASSERT_TRUE(cpu.memory.page_memory(page) == cpu.memory.page_memory(0xC0) + (page - 0xC0) * PAGE_SIZE);
+    }
+#endif
+    ASSERT_TRUE(cpu.memory.is_rom(0xC0));
+    cpu[0xC001] = 0x99;
+    ASSERT_TRUE(cpu[0xC001] == 0x42);
+    ASSERT_TRUE(cpu.execute(100) == -1);
+    ASSERT_TRUE(cpu[0x0010] == 0x42);
+
+    // Copies keep the mapping alive
+    CPU copy = cpu;
+    ASSERT_TRUE(copy[0xFFFD] == 0xC0);
+
+    // A partial last page is padded like make_rom()
+    rom.resize(0x0110);
+    write_file(path, rom);
+    loader.address = 0x8000;
+    ASSERT_TRUE(loader.load(cpu, path.c_str()));
+    ASSERT_TRUE(cpu[0x8001] == 0x42);
+    ASSERT_TRUE(cpu[0x810F] == NOP_IMP);
+    ASSERT_TRUE(cpu[0x8110] == 0xFF);
+    ASSERT_TRUE(cpu.memory.is_rom(0x81));
+
+    loader.address = 0x8010;
+    ASSERT_FALSE(loader.load(cpu, path.c_str()));
+    ASSERT_FALSE(loader.error().empty());
+    remove(path.c_str());
+}
+
+TEST_F(LOADER, RawRamAtAddress) {
+    std::vector<u8> program = { LDA_IMM, 0x37, STA_ZPG, 0x20, 0x02 };
+    std::string path = temp_path("ram.bin");
+    write_file(path, program);
+
+    ImageLoader loader;
+    loader.address = 0x0600;
+    ASSERT_TRUE(loader.load(cpu, path.c_str()));
+    ASSERT_FALSE(loader.mapped());
+    ASSERT_TRUE(loader.entry() == 0x0600);
+    ASSERT_TRUE(cpu[RESET_VEC_LOC] == 0x00);
+    ASSERT_TRUE(cpu[RESET_VEC_LOC + 1] == 0x06);
+    ASSERT_TRUE(cpu.PC == 0x0600);
+    // RAM, writable
+    cpu[0x0601] = 0x38;
+    ASSERT_TRUE(cpu.execute(100) == -1);
+    ASSERT_TRUE(cpu[0x0020] == 0x38);
+
+    loader.address = 0xFFFE;
+    ASSERT_FALSE(loader.load(cpu, path.c_str()));
+    ASSERT_FALSE(loader.load(cpu, temp_path("missing.bin").c_str()));
+    remove(path.c_str());
+}
+
+TEST_F(LOADER, Prg) {
+    std::vector<u8> prg = { 0x01, 0x08, LDX_IMM, 0x07, STX_ZPG, 0x30, 0x02 };
+    std::string path = temp_path("program.prg");
+    write_file(path, prg);
+
+    ImageLoader loader;
+    ASSERT_TRUE(loader.load(cpu, path.c_str()));
+    ASSERT_TRUE(loader.start() == 0x0801);
+    ASSERT_TRUE(loader.size() == 5);
+    ASSERT_TRUE(cpu.PC == 0x0801);
+    ASSERT_TRUE(B2W(cpu[RESET_VEC_LOC], cpu[RESET_VEC_LOC + 1]) == 0x0801);
+    ASSERT_TRUE(cpu.execute(100) == -1);
+    ASSERT_TRUE(cpu[0x0030] == 0x07);
+
+    // Same bytes read as raw
+    loader.format = IMAGE_RAW;
+    loader.address = 0x2000;
+    ASSERT_TRUE(loader.load(cpu, path.c_str()));
+    ASSERT_TRUE(cpu[0x2000] == 0x01);
+
+    write_file(path, { 0x00, 0x10 });
+    loader.format = IMAGE_PRG;
+    ASSERT_FALSE(loader.load(cpu, path.c_str()));
+    remove(path.c_str());
+}
+
+TEST_F(LOADER, IntelHex) {
+    std::string text;
+    text += hex_record(0x04, 0x0000, { 0x00, 0x00 });
+    text += hex_record(0x00, 0x0300, { LDY_IMM, 0x0B, STY_ZPG });
+    text += hex_record(0x00, 0x0303, { 0x40, 0x02 });
+    text += hex_record(0x00, 0x1000, { 0xEE });
+    text += hex_record(0x05, 0x0000, { 0x00, 0x00, 0x03, 0x00 });
+    text += hex_record(0x01, 0x0000, {});
+    // Past the end of file record, ignored
+    text += hex_record(0x00, 0x0400, { 0x55 });
+    std::string path = temp_path("program.hex");
+    write_file(path, std::vector<u8>(text.begin(), text.end()));
+
+    ImageLoader loader;
+    ASSERT_TRUE(loader.load(cpu, path.c_str()));
+    ASSERT_TRUE(loader.start() == 0x0300);
+    ASSERT_TRUE(loader.size() == 0x1001 - 0x0300);
+    ASSERT_TRUE(loader.entry() == 0x0300);
+    ASSERT_TRUE(cpu[0x1000] == 0xEE);
+    ASSERT_TRUE(cpu[0x0400] == 0x00);
+    ASSERT_TRUE(cpu.execute(100) == -1);
+    ASSERT_TRUE(cpu[0x0040] == 0x0B);
+
+    // A vector in the image wins over the start address record
+    std::string withVector = hex_record(0x00, 0xFFFC, { 0x03, 0x03 }) + text;
+    write_file(path, std::vector<u8>(withVector.begin(), withVector.end()));
+    ASSERT_TRUE(loader.load(cpu, path.c_str()));
+    ASSERT_TRUE(loader.entry() == 0x0303);
+
+    std::string bad = text;
+    char& checksum = bad[bad.find("\r\n") - 1];
+    checksum = (checksum == '0') ? '1' : '0';
+    write_file(path, std::vector<u8>(bad.begin(), bad.end()));
+    ASSERT_FALSE(loader.load(cpu, path.c_str()));
+    ASSERT_TRUE(loader.error().find("checksum") != std::string::npos);
+
+    std::string past = hex_record(0x04, 0x0000, { 0x00, 0x01 }) + hex_record(0x00, 0x0000, { 0x00 });
+    write_file(path, std::vector<u8>(past.begin(), past.end()));
+    ASSERT_FALSE(loader.load(cpu, path.c_str()));
+    remove(path.c_str());
+}
+
+TEST_F(LOADER, IntelHexGapsAndErrors) {
+    // Around the reset vector but not on it, the start address record gives the entry
+    std::string text;
+    text += hex_record(0x00, 0xFFF0, { 0xEA, 0xEA });
+    text += hex_record(0x00, 0xFFFE, { 0x00, 0x50 });
+    text += hex_record(0x05, 0x0000, { 0x00, 0x00, 0xFF, 0xF0 });
+    text += hex_record(0x01, 0x0000, {});
+    std::string path = temp_path("gaps.hex");
+    write_file(path, std::vector<u8>(text.begin(), text.end()));
+    cpu[0xFFF5] = 0x77;
+
+    ImageLoader loader;
+    ASSERT_TRUE(loader.load(cpu, path.c_str()));
+    ASSERT_TRUE(loader.start() == 0xFFF0);
+    ASSERT_TRUE(loader.entry() == 0xFFF0);
+    ASSERT_TRUE(cpu[RESET_VEC_LOC] == 0xF0);
+    ASSERT_TRUE(cpu[RESET_VEC_LOC + 1] == 0xFF);
+    ASSERT_TRUE(cpu[0xFFFE] == 0x00 && cpu[0xFFFF] == 0x50);
+    // Gaps keep what was there
+    ASSERT_TRUE(cpu[0xFFF5] == 0x77);
+
+    // A bad record after good ones loads nothing
+    std::string bad = hex_record(0x00, 0x0600, { 0x11, 0x22 }) + hex_record(0x00, 0x0700, { 0x33 });
+    bad[bad.rfind("\r\n") - 1] ^= 1;
+    write_file(path, std::vector<u8>(bad.begin(), bad.end()));
+    u16 pc = cpu.PC;
+    ASSERT_FALSE(loader.load(cpu, path.c_str()));
+    ASSERT_TRUE(cpu[0x0600] == 0x00);
+    ASSERT_TRUE(cpu[0x0601] == 0x00);
+    ASSERT_TRUE(cpu.PC == pc);
+    remove(path.c_str());
+}
@@ -0,0 +1,143 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "mos6502.hpp"
+#include "mapper.hpp"
+#include "models.hpp"
+#include "test.hpp"
+
+using namespace mos6502;
+
+
+// Bank k starts with LDA #(0x10 + k); RTS
+static void fill_banks(Mapper& mapper) {
+    for (u32 k = 0; k < mapper.num_banks(); ++k) {
+        u8* bank = mapper.bank(k);
+        bank[0] = LDA_IMM;
+        bank[1] = (u8) (0x10 + k);
+        bank[2] = RTS_IMP;
+    }
+}
+
+TEST_F(MAPPER, SelectRemapsPages) {
+    Mapper mapper(cpu.memory, 0x2000, 8, false);
+    fill_banks(mapper);
+    u32 window = mapper.add_window(0x80);
+    mapper.map_registers(0xD0);
+    ASSERT_TRUE(cpu[0x8001] == 0x10);
+
+    cpu[0xD000] = 5;
+    ASSERT_TRUE(mapper.selected(window) == 5);
+    ASSERT_TRUE(cpu[0xD000] == 5);
+    ASSERT_TRUE(cpu[0x8001] == 0x15);
+    // The window points into the bank, nothing was copied
+    for (u32 page = 0; page < 0x20; ++page) {
+        ASSERT_TRUE(cpu.memory.page_memory(0x80 + page) == mapper.bank(5) + page * PAGE_SIZE);
+    }
+    // Read-only window
+    cpu[0x8001] = 0x99;
+    ASSERT_TRUE(cpu[0x8001] == 0x15);
+    ASSERT_TRUE(mapper.bank(5)[1] == 0x15);
+
+    // Writable window maps its bank as RAM
+    Mapper ram(cpu.memory, 0x1000, 4, true);
+    u32 ramWindow = ram.add_window(0x60, 2);
+    cpu[0x6010] = 0x42;
+    ASSERT_TRUE(ram.bank(2)[0x10] == 0x42);
+    ram.select(ramWindow, 3);
+    ASSERT_TRUE(cpu[0x6010] == 0x00);
+    ram.select(ramWindow, 2);
+    ASSERT_TRUE(cpu[0x6010] == 0x42);
+}
+
+TEST_F(MAPPER, CodeFollowsBanks) {
+    // Calls into every bank, the block at 0x8000 must be redecoded after each switch
+    u8 program[] = {
+        LDX_IMM, 0x00,          // 4000
+        STX_ABS, 0x00, 0xD0,    // 4002 loop:
+        JSR_ABS, 0x00, 0x80,    // 4005
+        STA_ABX, 0x00, 0x03,    // 4008
+        INX_IMP,                // 400B
+        CPX_IMM, 0x08,          // 400C
+        BNE_REL, (u8) -12,      // 400E to loop
+        0x02,                   // 4010 invalid
+    };
+    Mapper mapper(cpu.memory, 0x2000, 8, false);
+    fill_banks(mapper);
+    mapper.add_window(0x80);
+    mapper.map_registers(0xD0);
+    cpu.memory.load(RESET_START, program, sizeof(program));
+
+    for (u32 round = 0; round < 3; ++round) {
+        cpu.PC = RESET_START;
+        ASSERT_TRUE(cpu.execute(100000) == -1);
+        for (u32 k = 0; k < 8; ++k) {
+            ASSERT_TRUE(cpu[0x0300 + k] == 0x10 + k);
+        }
+        cpu.memory.load(0x0300, std::vector<u8>(8, 0).data(), 8);
+    }
+}
+
+TEST_F(MAPPER, SwitchInsideBlock) {
+    // Bank 0 switches its own window to bank 1 and runs on into it
+    Mapper mapper(cpu.memory, 0x1000, 2, false);
+    u8 bank0[] = {
+        LDA_IMM, 0x01,          // 8000
+        STA_ABS, 0x00, 0xD0,    // 8002
+        LDA_IMM, 0xAA,          // 8005
+        STA_ZPG, 0x10,          // 8007
+        0x02,                   // 8009 invalid
+    };
+    u8 bank1[] = {
+        NOP_IMP, NOP_IMP, NOP_IMP, NOP_IMP, NOP_IMP,
+        LDA_IMM, 0xBB,          // 8005
+        STA_ZPG, 0x10,          // 8007
+        0x02,                   // 8009 invalid
+    };
+    std::copy(bank0, bank0 + sizeof(bank0), mapper.bank(0));
+    std::copy(bank1, bank1 + sizeof(bank1), mapper.bank(1));
+    u32 window = mapper.add_window(0x80);
+    mapper.map_registers(0xD0);
+
+    for (u32 round = 0; round < 3; ++round) {
+        mapper.select(window, 0);
+        cpu[0x0010] = 0x00;
+        cpu.PC = 0x8000;
+        ASSERT_TRUE(cpu.execute(1000) == -1);
+        ASSERT_TRUE(cpu[0x0010] == 0xBB);
+        ASSERT_TRUE(cpu.PC == 0x8009);
+    }
+}
+
+TEST_F(MAPPER, CopiesOwnWritableBanks) {
+    u8 program[] = {
+        LDA_IMM, 0x77,          // 4000
+        STA_ABS, 0x20, 0x60,    // 4002
+        0x02,                   // 4005 invalid
+    };
+    Mapper ram(cpu.memory, 0x1000, 4, true);
+    ram.add_window(0x60, 2);
+    cpu.memory.load(RESET_START, program, sizeof(program));
+    cpu[0x6010] = 0x42;
+
+    // Neither sees the other's writes, the copy's do not reach the bank
+    CPU other = cpu.fork();
+    ASSERT_TRUE(other[0x6010] == 0x42);
+    other[0x6010] = 0x43;
+    cpu[0x6011] = 0x11;
+    ASSERT_TRUE(cpu[0x6010] == 0x42);
+    ASSERT_TRUE(other[0x6011] == 0x00);
+    ASSERT_TRUE(other.execute(100) == -1);
+    ASSERT_TRUE(other[0x6020] == 0x77);
+    ASSERT_TRUE(ram.bank(2)[0x10] == 0x42);
+    ASSERT_TRUE(ram.bank(2)[0x11] == 0x11);
+    ASSERT_TRUE(ram.bank(2)[0x20] == 0x00);
+
+    Snapshot saved = cpu.snapshot();
+    cpu[0x6010] = 0x50;
+    ASSERT_TRUE((*saved)[0x6010] == 0x42);
+    cpu.restore(saved);
+    ASSERT_TRUE(cpu[0x6010] == 0x42);
+}
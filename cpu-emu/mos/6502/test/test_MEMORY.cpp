@@ -0,0 +1,200 @@
+#include <gtest/gtest.h>
+
+#include "mos6502.hpp"
+#include "models.hpp"
+#include "test.hpp"
+
+using namespace mos6502;
+
+
+// Status register that reads 0 until polled often enough, remembers the last write
+class PollDevice : public Device {
+ public:
+    u8 read(u16 addr) override {
+        reads += 1;
+        lastAddr = addr;
+        return (reads >= readyAfter) ? 0x80 : 0x00;
+    }
+    void write(u16 addr, u8 val) override {
+        lastAddr = addr;
+        written = val;
+    }
+
+    u32 reads = 0;
+    u32 readyAfter = 5;
+    u16 lastAddr = 0;
+    u8 written = 0;
+};
+
+TEST_F(MEMORY, RomWritesDropped) {
+    static u8 rom[PAGE_SIZE] = { 0x12 };
+    cpu.memory.map_rom(0x80, 1, rom);
+    u8 program[] = {
+        LDA_IMM, 0x34,
+        STA_ABS, 0x00, 0x80,
+        LDX_ABS, 0x00, 0x80,
+        JMP_ABS, 0x08, 0x40,
+    };
+    for (u32 i = 0; i < sizeof(program); ++i) {
+        cpu[RESET_START + i] = program[i];
+    }
+    for (u32 e = 0; e < NUM_ENGINES; ++e) {
+        CPU other = cpu;
+        other.engine = (Engine) e;
+        ASSERT_TRUE(other.execute(2 + 4 + 4) == 2 + 4 + 4) << engine_name(other.engine);
+        ASSERT_TRUE(other.X == 0x12) << engine_name(other.engine);
+        ASSERT_TRUE(other[0x8000] == 0x12) << engine_name(other.engine);
+    }
+    ASSERT_TRUE(rom[0] == 0x12);
+    ASSERT_TRUE(cpu.memory.ram[0x8000] == 0x00);
+}
+TEST_F(MEMORY, DeviceSeesAccesses) {
+    // Poll until bit 7 is set, then acknowledge
+    u8 program[] = {
+        LDA_ABS, 0x00, 0xD0,
+        BPL_REL, (u8) -3,
+        STA_ABS, 0x01, 0xD0,
+        JMP_ABS, 0x08, 0x40,
+    };
+    for (u32 i = 0; i < sizeof(program); ++i) {
+        cpu[RESET_START + i] = program[i];
+    }
+    for (u32 e = 0; e < NUM_ENGINES; ++e) {
+        PollDevice device;
+        CPU other = cpu;
+        other.memory.map_device(0xD0, 1, &device);
+        other.engine = (Engine) e;
+        ASSERT_TRUE(other.execute(1000) > 0) << engine_name(other.engine);
+        ASSERT_TRUE(device.reads == device.readyAfter) << engine_name(other.engine);
+        ASSERT_TRUE(device.written == 0x80) << engine_name(other.engine);
+        ASSERT_TRUE(device.lastAddr == 0xD001) << engine_name(other.engine);
+        ASSERT_TRUE(other.idleCyclesSkipped == 0) << engine_name(other.engine);
+    }
+}
+TEST_F(MEMORY, ExternalRam) {
+    u8 external[2 * PAGE_SIZE] = {};
+    cpu.memory.map_ram(0x20, 2, external);
+    cpu[0x2110] = 0x55;
+    ASSERT_TRUE(external[0x110] == 0x55);
+    ASSERT_TRUE(cpu.memory.ram[0x2110] == 0x00);
+
+    // Copies keep sharing mapped memory but get their own ram
+    CPU other = cpu;
+    other[0x2111] = 0x66;
+    other[0x0300] = 0x77;
+    ASSERT_TRUE(external[0x111] == 0x66);
+    ASSERT_TRUE(cpu[0x0300] == 0x00);
+    ASSERT_TRUE(other[0x0300] == 0x77);
+
+    cpu.memory.unmap(0x20, 2);
+    ASSERT_TRUE(cpu[0x2110] == 0x00);
+    ASSERT_TRUE(cpu.memory.is_ram(0x20));
+}
+TEST_F(MEMORY, MappingDropsCode) {
+    static u8 rom[PAGE_SIZE] = { LDX_IMM, 0x22, JMP_ABS, 0x00, 0x40 };
+    cpu[RESET_START] = LDX_IMM;
+    cpu[RESET_START + 1] = 0x11;
+    cpu[RESET_START + 2] = JMP_ABS;
+    cpu[RESET_START + 3] = 0x00;
+    cpu[RESET_START + 4] = 0x40;
+    for (u32 e = 0; e < NUM_ENGINES; ++e) {
+        CPU other = cpu;
+        other.engine = (Engine) e;
+        other.jitThreshold = 0;
+        ASSERT_TRUE(other.execute(2 + 3 + 2) == 2 + 3 + 2) << engine_name(other.engine);
+        ASSERT_TRUE(other.X == 0x11) << engine_name(other.engine);
+        other.memory.map_rom(0x40, 1, rom);
+        ASSERT_TRUE(other.execute(3 + 2) == 3 + 2) << engine_name(other.engine);
+        ASSERT_TRUE(other.X == 0x22) << engine_name(other.engine);
+    }
+}
+TEST_F(MEMORY, SharedRom) {
+    u8 code[] = { LDX_IMM, 0x33, JMP_ABS, 0x00, 0xE0 };
+    RomImage image = make_rom(code, sizeof(code));
+    ASSERT_TRUE(image->size() == PAGE_SIZE);
+    ASSERT_TRUE((*image)[sizeof(code)] == 0xFF);
+
+    std::vector<CPU> cpus(4);
+    for (CPU& other : cpus) {
+        other.memory.map_rom(0xE0, image);
+        other.memory.map_rom(0xE0, image);
+        other.PC = 0xE000;
+    }
+    cpus.push_back(cpus[0]);
+    image.reset();
+    for (CPU& other : cpus) {
+        ASSERT_TRUE(other.memory.page_memory(0xE0) == cpus[0].memory.page_memory(0xE0));
+        ASSERT_TRUE(other.execute(2 + 3) == 2 + 3);
+        ASSERT_TRUE(other.X == 0x33);
+    }
+
+    // Guest memory is not part of the CPU, so instances are cheap to keep around
+    ASSERT_TRUE(sizeof(CPU) < MEM_MAX / 4);
+}
+TEST_F(MEMORY, SparsePagesOnWrite) {
+    u8 program[] = {
+        LDA_IMM, 0x5A,
+        STA_ABS, 0x00, 0x20,
+        PHA_IMP,
+        LDX_ABS, 0x00, 0x30,
+        JMP_ABS, 0x09, 0x40,
+    };
+    CPU sparse(MEMORY_SPARSE);
+    sparse.engine = cpu.engine;
+    sparse.jitThreshold = cpu.jitThreshold;
+    sparse.reset();
+    ASSERT_TRUE(sparse.memory.backend() == MEMORY_SPARSE);
+    ASSERT_TRUE(sparse.memory.ram == nullptr);
+    sparse.memory.load(RESET_START, program, sizeof(program));
+    sparse[0x3000] = 0x66;
+
+    for (u32 i = 0; i < 2; ++i) {
+        CPU other = sparse;
+        ASSERT_TRUE(other.execute(2 + 4 + 3 + 4) == 2 + 4 + 3 + 4);
+        ASSERT_TRUE(other[0x2000] == 0x5A);
+        ASSERT_TRUE(other[0x01FF] == 0x5A);
+        ASSERT_TRUE(other.X == 0x66);
+        ASSERT_FALSE(other.memory.is_shared(0x20));
+        // Untouched pages all read the same zero page
+        ASSERT_TRUE(other.memory.is_shared(0x50));
+        ASSERT_TRUE(other.memory.page_memory(0x50) == sparse.memory.page_memory(0x51));
+        ASSERT_TRUE(sparse[0x2000] == 0x00);
+    }
+
+    sparse.reset();
+    ASSERT_TRUE(sparse[0x3000] == 0x00);
+    ASSERT_TRUE(sparse[RESET_START] == 0x00);
+    ASSERT_TRUE(sparse.memory.is_shared(0x30));
+    ASSERT_TRUE(sparse.PC == RESET_START);
+}
+TEST_F(MEMORY, SparseSnapshot) {
+    CPU sparse(MEMORY_SPARSE);
+    sparse.reset();
+    sparse[0x0400] = 0x12;
+    Snapshot snapshot = sparse.snapshot();
+    CPU child = sparse.fork();
+    child[0x0400] = 0x34;
+    sparse[0x0401] = 0x56;
+    ASSERT_TRUE(child.memory.backend() == MEMORY_SPARSE);
+    ASSERT_TRUE(sparse[0x0400] == 0x12);
+    ASSERT_TRUE(child[0x0401] == 0x00);
+
+    for (u32 i = 0; i < 2; ++i) {
+        child.restore(snapshot);
+        ASSERT_TRUE(child[0x0400] == 0x12);
+        child[0x0400] = 0x78;
+        child[0x0500] = 0x9A;
+    }
+    sparse.restore(snapshot);
+    ASSERT_TRUE(sparse[0x0401] == 0x00);
+    ASSERT_TRUE((*snapshot)[0x0400] == 0x12);
+
+    // Flat and sparse copy into each other
+    cpu = child;
+    ASSERT_TRUE(cpu.memory.backend() == MEMORY_FLAT);
+    ASSERT_TRUE(cpu[0x0400] == 0x78);
+    ASSERT_TRUE(cpu[0x0500] == 0x9A);
+    cpu.reset();
+    child = cpu;
+    ASSERT_TRUE(child[0x0400] == 0x00);
+}
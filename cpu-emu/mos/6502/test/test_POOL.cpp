@@ -0,0 +1,229 @@
+#include <cstring>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "mos6502.hpp"
+#include "pool.hpp"
+#include "models.hpp"
+#include "test.hpp"
+
+using namespace mos6502;
+
+
+// Sums the bytes from 0x0200 into 0x10 (low) 0x11 (high), X bytes, then stops on an invalid opcode
+static const u8 SUM[] = {
+    LDY_IMM, 0x00,          // 4000
+    LDA_IMM, 0x00,          // 4002
+    STA_ZPG, 0x10,          // 4004
+    STA_ZPG, 0x11,          // 4006
+    CLC_IMP,                // 4008 loop:
+    LDA_ZPG, 0x10,          // 4009
+    ADC_ABY, 0x00, 0x02,    // 400B
+    STA_ZPG, 0x10,          // 400E
+    BCC_REL, 4,             // 4010 to skip
+    INC_ZPG, 0x11,          // 4012
+    INY_IMP,                // 4014 skip:
+    DEX_IMP,                // 4015
+    BNE_REL, (u8) -14,      // 4016 to loop
+    0x02,                   // 4018 invalid
+};
+
+static std::vector<Job> makeJobs(const std::vector<std::vector<u8>>& images, s32 numCycles) {
+    std::vector<Job> jobs(images.size());
+    for (u32 i = 0; i < images.size(); ++i) {
+        jobs[i].image = images[i].data();
+        jobs[i].imageSize = (u32) images[i].size();
+        jobs[i].regs.X = (u8) (1 + i % 200);
+        jobs[i].numCycles = numCycles;
+    }
+    return jobs;
+}
+
+static std::vector<std::vector<u8>> makeImages(u32 numJobs) {
+    std::vector<std::vector<u8>> images(numJobs, std::vector<u8>(MEM_MAX, 0));
+    for (u32 i = 0; i < numJobs; ++i) {
+        memcpy(&images[i][RESET_START], SUM, sizeof(SUM));
+        for (u32 j = 0; j < 0x100; ++j) {
+            images[i][0x0200 + j] = (u8) (i * 31 + j * 7);
+        }
+    }
+    return images;
+}
+
+TEST_F(POOL, MatchesSingleCPU) {
+    std::vector<std::vector<u8>> images = makeImages(150);
+    std::vector<Job> jobs = makeJobs(images, 100000);
+    jobs[7].keepMemory = true;
+    InstancePool pool(4, TEST_ENGINE);
+    ASSERT_EQ(pool.num_workers(), 4u);
+    std::vector<JobResult> results = pool.run(jobs);
+    ASSERT_EQ(results.size(), jobs.size());
+
+    for (u32 i = 0; i < jobs.size(); ++i) {
+        cpu.reset();
+        memcpy(cpu.memory.ram, images[i].data(), MEM_MAX);
+        cpu.X = jobs[i].regs.X;
+        s32 ret = cpu.execute(jobs[i].numCycles);
+        ASSERT_EQ(ret, -1);
+        ASSERT_EQ(results[i].cycles, -1);
+        ASSERT_EQ(results[i].regs.PC, cpu.PC);
+        ASSERT_EQ(results[i].regs.A, cpu.A);
+        ASSERT_EQ(results[i].regs.Y, cpu.Y);
+        ASSERT_EQ(results[i].regs.SR, cpu.SR);
+        ASSERT_FALSE(results[i].done);
+        u32 sum = 0;
+        for (u32 j = 0; j < jobs[i].regs.X; ++j) {
+            sum += images[i][0x0200 + j];
+        }
+        ASSERT_EQ(cpu[0x10] + 256 * cpu[0x11], sum);
+        ASSERT_EQ(results[i].ram.empty(), i != 7);
+        if (i == 7) {
+            ASSERT_EQ(memcmp(results[i].ram.data(), cpu.memory.ram, MEM_MAX), 0);
+        }
+    }
+
+    const PoolStats& stats = pool.stats();
+    ASSERT_EQ(stats.jobs, jobs.size());
+    ASSERT_EQ(stats.jobsByWorker.size(), 4u);
+    u64 byWorker = 0;
+    for (u64 count : stats.jobsByWorker) {
+        byWorker += count;
+    }
+    ASSERT_EQ(byWorker, jobs.size());
+    ASSERT_EQ(stats.cycles, 0u);    // Every job ended on the invalid opcode
+}
+TEST_F(POOL, CompletionPredicate) {
+    // Counts 0x10 up forever
+    u8 program[] = { INC_ZPG, 0x10, JMP_ABS, 0x00, 0x40 };
+    std::vector<Job> jobs(40);
+    for (u32 i = 0; i < jobs.size(); ++i) {
+        jobs[i].image = program;
+        jobs[i].imageSize = sizeof(program);
+        jobs[i].origin = RESET_START;
+        jobs[i].numCycles = 1000000;
+        u8 target = (u8) (10 + i);
+        jobs[i].done = [target](const CPU& cpu) { return cpu[0x10] >= target; };
+        jobs[i].checkCycles = 8;    // One loop
+    }
+    jobs[0].done = nullptr;
+    InstancePool pool(3, TEST_ENGINE);
+    std::vector<JobResult> results = pool.run(jobs);
+
+    ASSERT_FALSE(results[0].done);
+    ASSERT_TRUE(results[0].cycles >= 1000000);
+    for (u32 i = 1; i < jobs.size(); ++i) {
+        ASSERT_TRUE(results[i].done);
+        ASSERT_EQ(results[i].cycles, 8 * (s32) (10 + i));
+        ASSERT_EQ(results[i].regs.PC, RESET_START);
+    }
+    ASSERT_EQ(pool.stats().jobs, jobs.size());
+    ASSERT_TRUE(pool.stats().cycles >= 1000000);
+
+    // Workers and their CPUs are reused
+    results = pool.run(jobs);
+    ASSERT_EQ(results[5].cycles, 8 * 15);
+    ASSERT_EQ(pool.stats().jobs, jobs.size());
+    ASSERT_TRUE(pool.run({}).empty());
+}
+TEST_F(POOL, WorkIsStolen) {
+    // First worker's chunk has one long job, the other worker finishes its own and takes the rest.
+    // The loop writes memory so the block engines do not skip it as idle.
+    u8 program[] = { INC_ZPG, 0x10, JMP_ABS, 0x00, 0x40 };
+    std::vector<Job> jobs(8);
+    for (Job& job : jobs) {
+        job.image = program;
+        job.imageSize = sizeof(program);
+        job.origin = RESET_START;
+        job.numCycles = 304;
+    }
+    jobs[3].numCycles = 10000000;
+    InstancePool pool(2, TEST_ENGINE);
+    std::vector<JobResult> results = pool.run(jobs);
+    for (u32 i = 0; i < jobs.size(); ++i) {
+        ASSERT_EQ(results[i].cycles, jobs[i].numCycles);
+    }
+    ASSERT_TRUE(pool.stats().steals > 0);
+}
+TEST_F(POOL, StartFromBootedState) {
+    // Builds a table, then looks up the entry given by the job
+    u8 program[] = {
+        LDX_IMM, 0x00,          // 4000
+        TXA_IMP,                // 4002 loop:
+        STA_ABX, 0x00, 0x03,    // 4003
+        INX_IMP,                // 4006
+        BNE_REL, (u8) -5,       // 4007 to loop
+        LDX_ABS, 0x00, 0x02,    // 4009 ready:
+        LDA_ABX, 0x00, 0x03,    // 400C
+        STA_ZPG, 0x10,          // 400F
+        0x02,                   // 4011 invalid
+    };
+    cpu.memory.load(RESET_START, program, sizeof(program));
+    ASSERT_EQ(cpu.run_to(0x5000, 100), 100);
+    ASSERT_EQ(cpu.run_to(0x4009, 1000000), 2 + 256 * (2 + 5 + 2 + 3) - 1 - 100);
+    ASSERT_EQ(cpu.PC, 0x4009);
+    ASSERT_EQ(cpu.X, 0x00);
+    Snapshot booted = cpu.snapshot();
+
+    std::vector<u8> entries(60);
+    std::vector<Job> jobs(entries.size());
+    for (u32 i = 0; i < jobs.size(); ++i) {
+        entries[i] = (u8) (i * 37);
+        jobs[i].start = booted;
+        jobs[i].image = &entries[i];
+        jobs[i].imageSize = 1;
+        jobs[i].origin = 0x0200;
+        jobs[i].numCycles = 1000;
+    }
+    jobs[5].keepMemory = true;
+    InstancePool pool(2, TEST_ENGINE);
+    for (u32 round = 0; round < 2; ++round) {
+        std::vector<JobResult> results = pool.run(jobs);
+        for (u32 i = 0; i < jobs.size(); ++i) {
+            ASSERT_EQ(results[i].cycles, -1);
+            ASSERT_EQ(results[i].regs.PC, 0x4011);
+            ASSERT_EQ(results[i].regs.A, entries[i]);
+        }
+        ASSERT_EQ(results[5].ram[0x10], entries[5]);
+        ASSERT_EQ(results[5].ram[0x0200], entries[5]);
+        ASSERT_EQ(results[5].ram[0x03FF], 0xFF);
+    }
+    ASSERT_EQ((*booted)[0x0200], 0x00);
+}
+
+TEST_F(POOL, NothingCarriesToTheNextJob) {
+    // The interrupt handler is an invalid opcode, so a job that takes the IRQ fails
+    std::vector<u8> image(MEM_MAX, 0);
+    image[RESET_START] = JMP_ABS;
+    image[RESET_START + 1] = (u8) RESET_START;
+    image[RESET_START + 2] = (u8) (RESET_START >> 8);
+    image[INT_VEC_LOC] = 0x00;
+    image[INT_VEC_LOC + 1] = 0x50;
+    image[0x5000] = 0x02;
+    cpu.memory.load(0, image.data(), MEM_MAX);
+    Snapshot loaded = cpu.snapshot();
+
+    u32 fired = 0;
+    InstancePool pool(1, TEST_ENGINE);
+    for (u32 fromSnapshot = 0; fromSnapshot < 2; ++fromSnapshot) {
+        // The first job leaves an event past its budget and the IRQ line held, with I set
+        std::vector<Job> jobs(2);
+        for (Job& job : jobs) {
+            job.start = fromSnapshot ? loaded : nullptr;
+            job.image = fromSnapshot ? nullptr : image.data();
+            job.imageSize = MEM_MAX;
+        }
+        jobs[0].numCycles = 1000;
+        jobs[0].setup = [&](CPU& worker) {
+            worker.set_flag_i(1);
+            worker.set_irq(true, 2);
+            worker.events.schedule(5000, [&](u64) { fired += 1; });
+        };
+        jobs[1].numCycles = 10000;
+        std::vector<JobResult> results = pool.run(jobs);
+        ASSERT_GE(results[0].cycles, 1000);
+        ASSERT_GE(results[1].cycles, 10000);
+        ASSERT_EQ(results[1].regs.PC, RESET_START);
+        ASSERT_EQ(fired, 0u);
+    }
+}
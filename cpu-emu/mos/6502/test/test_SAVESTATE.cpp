@@ -0,0 +1,153 @@
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "mos6502.hpp"
+#include "models.hpp"
+#include "savestate.hpp"
+#include "test.hpp"
+
+using namespace mos6502;
+
+
+static long file_size(const std::string& path) {
+    FILE* f = fopen(path.c_str(), "rb");
+    if (f == nullptr) {
+        return -1;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fclose(f);
+    return size;
+}
+
+TEST_F(SAVESTATE, RoundTrip) {
+    u8 program[] = {
+        LDX_IMM, 0x05,
+        INC_ABS, 0x00, 0x20,
+        DEX_IMP,
+        BNE_REL, (u8) -4,
+        STX_ZPG, 0x10,
+        JMP_ABS, 0x0A, 0x40,
+    };
+    cpu.memory.load(RESET_START, program, sizeof(program));
+    ASSERT_TRUE(cpu.execute(2 + 6) == 2 + 6);
+    std::string path = temp_path("roundtrip.state");
+    ASSERT_TRUE(SaveState::save(cpu, path.c_str()));
+    // Header, then the reset vector, code and counter pages
+    ASSERT_TRUE(file_size(path) == SAVE_STATE_DATA + 3 * PAGE_SIZE);
+
+    Snapshot state = SaveState::load(path.c_str());
+    ASSERT_TRUE(state != nullptr);
+    ASSERT_TRUE(state->PC == cpu.PC);
+    ASSERT_TRUE(state->X == 0x05);
+    ASSERT_TRUE(state->SR == cpu.SR);
+    ASSERT_TRUE(state->cycles == 2 + 6);
+    ASSERT_TRUE((*state)[0x2000] == 0x01);
+    ASSERT_TRUE(state->memory.backend() == MEMORY_SPARSE);
+    ASSERT_TRUE(state->memory.is_shared(0x20));
+    ASSERT_TRUE(state->memory.is_shared(0x30));
+    remove(path.c_str());
+
+    // The file stays mapped by the state, instances branched off it copy only what they write
+    for (u32 i = 0; i < 2; ++i) {
+        CPU loaded;
+        loaded.engine = cpu.engine;
+        loaded.jitThreshold = cpu.jitThreshold;
+        loaded.restore(state);
+        ASSERT_TRUE(loaded.memory.backend() == MEMORY_FLAT);
+        ASSERT_TRUE(loaded.execute(6 * 4 + 2 * 5 + 3 * 4 + 2 + 3 + 3) == 6 * 4 + 2 * 5 + 3 * 4 + 2 + 3 + 3);
+        ASSERT_TRUE(loaded[0x2000] == 0x05);
+        ASSERT_TRUE(loaded.X == 0x00);
+        ASSERT_TRUE(loaded.PC == 0x400A);
+        ASSERT_TRUE(loaded.cycles == 2 + 6 + 6 * 4 + 2 * 5 + 3 * 4 + 2 + 3 + 3);
+    }
+    ASSERT_TRUE((*state)[0x2000] == 0x01);
+    ASSERT_TRUE(cpu.execute(6 * 4 + 2 * 5 + 3 * 4 + 2 + 3 + 3) == 6 * 4 + 2 * 5 + 3 * 4 + 2 + 3 + 3);
+    ASSERT_TRUE(cpu[0x2000] == 0x05);
+}
+
+TEST_F(SAVESTATE, RomAndDevicePages) {
+    class Port : public Device {
+     public:
+        u8 read(u16) override { return 0xEE; }
+        void write(u16, u8) override {}
+    } port;
+    u8 rom[PAGE_SIZE * 2];
+    for (u32 i = 0; i < sizeof(rom); ++i) {
+        rom[i] = (u8) i;
+    }
+    cpu.memory.map_rom(0xC0, make_rom(rom, sizeof(rom)));
+    cpu.memory.map_device(0xD0, 1, &port);
+    cpu[0x0300] = 0x42;
+    std::string path = temp_path("rom.state");
+    ASSERT_TRUE(SaveState::save(cpu, path.c_str()));
+    Snapshot state = SaveState::load(path.c_str());
+    remove(path.c_str());
+    ASSERT_TRUE(state != nullptr);
+
+    CPU loaded = *state;
+    ASSERT_TRUE(loaded.memory.is_rom(0xC0));
+    ASSERT_TRUE(loaded.memory.is_rom(0xC1));
+    ASSERT_TRUE(loaded[0xC1FF] == 0xFF);
+    loaded[0xC000] = 0x99;
+    ASSERT_TRUE(loaded[0xC000] == 0x00);
+    // Devices are not saved
+    ASSERT_FALSE(loaded.memory.is_device(0xD0));
+    ASSERT_TRUE(loaded[0xD000] == 0x00);
+    ASSERT_TRUE(loaded[0x0300] == 0x42);
+}
+
+TEST_F(SAVESTATE, Compressed) {
+    for (u32 i = 0; i < 0x1000; ++i) {
+        cpu[0x8000 + i] = (u8) ((i / 64) * 3);
+    }
+    cpu[0x9000] = 0x01;
+    cpu[0x9001] = 0x02;
+    cpu.A = 0x77;
+    std::string raw = temp_path("raw.state");
+    std::string packed = temp_path("packed.state");
+    ASSERT_TRUE(SaveState::save(cpu, raw.c_str()));
+    ASSERT_TRUE(SaveState::save(cpu, packed.c_str(), SAVE_COMPRESSED));
+    ASSERT_TRUE(file_size(packed) < file_size(raw) - 16 * PAGE_SIZE);
+
+    Snapshot state = SaveState::load(packed.c_str());
+    remove(raw.c_str());
+    remove(packed.c_str());
+    ASSERT_TRUE(state != nullptr);
+    ASSERT_TRUE(state->A == 0x77);
+    for (u32 i = 0; i < 0x1000; ++i) {
+        ASSERT_TRUE((*state)[0x8000 + i] == cpu[0x8000 + i]);
+    }
+    ASSERT_TRUE((*state)[0x9000] == 0x01);
+    ASSERT_TRUE((*state)[0x9001] == 0x02);
+    ASSERT_TRUE((*state)[RESET_VEC_LOC + 1] == highByte(RESET_START));
+}
+
+TEST_F(SAVESTATE, RejectsBadFiles) {
+    std::string path = temp_path("bad.state");
+    ASSERT_TRUE(SaveState::load(path.c_str()) == nullptr);
+
+    cpu[0x0200] = 0x01;
+    ASSERT_TRUE(SaveState::save(cpu, path.c_str()));
+    std::vector<u8> bytes(file_size(path));
+    FILE* f = fopen(path.c_str(), "rb");
+    ASSERT_TRUE(fread(bytes.data(), 1, bytes.size(), f) == bytes.size());
+    fclose(f);
+
+    // Truncated data
+    f = fopen(path.c_str(), "wb");
+    fwrite(bytes.data(), 1, bytes.size() - 1, f);
+    fclose(f);
+    ASSERT_TRUE(SaveState::load(path.c_str()) == nullptr);
+
+    // Other version
+    ((SaveStateHeader*) bytes.data())->version += 1;
+    f = fopen(path.c_str(), "wb");
+    fwrite(bytes.data(), 1, bytes.size(), f);
+    fclose(f);
+    ASSERT_TRUE(SaveState::load(path.c_str()) == nullptr);
+    remove(path.c_str());
+}
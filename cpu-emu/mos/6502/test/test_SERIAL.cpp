@@ -0,0 +1,237 @@
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+#include "mos6502.hpp"
+#include "acia6551.hpp"
+#include "ring.hpp"
+#include "models.hpp"
+#include "test.hpp"
+
+using namespace mos6502;
+
+
+static std::string read_file(const char* path) {
+    std::string contents;
+    FILE* f = fopen(path, "rb");
+    if (f == nullptr) {
+        return contents;
+    }
+    char buffer[256];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0) {
+        contents.append(buffer, n);
+    }
+    fclose(f);
+    return contents;
+}
+
+TEST_F(SERIAL, RingWrapsAround) {
+    ByteRing ring(6);
+    ASSERT_TRUE(ring.capacity() == 8);
+    u8 in[] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+    u8 out[16] = {};
+    ASSERT_TRUE(ring.push(in, 5) == 5);
+    ASSERT_TRUE(ring.pop(out, 3) == 3);
+    ASSERT_TRUE(out[0] == 1 && out[2] == 3);
+    // Room for 6, across the end of the buffer
+    ASSERT_TRUE(ring.push(in + 5, 6) == 6);
+    ASSERT_TRUE(ring.full());
+    ASSERT_FALSE(ring.push(12));
+    ASSERT_TRUE(ring.pop(out, 16) == 8);
+    for (u32 i = 0; i < 8; i++) {
+        ASSERT_TRUE(out[i] == 4 + i);
+    }
+    ASSERT_TRUE(ring.empty());
+    ASSERT_TRUE(ring.push(12));
+    ASSERT_TRUE(ring.pop(out, 16) == 1);
+    ASSERT_TRUE(out[0] == 12);
+}
+
+TEST_F(SERIAL, RingAcrossThreads) {
+    ByteRing ring(4096);
+    const u32 total = 1 << 18;
+    std::thread producer([&] {
+        for (u32 i = 0; i < total; i++) {
+            while (!ring.push((u8) i)) {
+                std::this_thread::yield();
+            }
+        }
+    });
+    u32 received = 0;
+    bool inOrder = true;
+    u8 out[100];
+    while (received < total) {
+        u32 n = ring.pop(out, sizeof(out));
+        if (n == 0) {
+            std::this_thread::yield();
+        }
+        for (u32 i = 0; i < n; i++) {
+            inOrder = inOrder && out[i] == (u8) (received + i);
+        }
+        received += n;
+    }
+    producer.join();
+    ASSERT_TRUE(inOrder);
+    ASSERT_TRUE(ring.empty());
+}
+
+TEST_F(SERIAL, Registers) {
+    Acia6551 acia(cpu, 1, 16);
+    acia.map(0xD0);
+    ASSERT_TRUE(cpu[0xD001] == ACIA_TDRE);
+    u8 input[] = { 'h', 'i' };
+    ASSERT_TRUE(acia.give_input(input, 2) == 2);
+    ASSERT_TRUE(cpu[0xD001] == (ACIA_TDRE | ACIA_RDRF));
+    ASSERT_TRUE(cpu[0xD000] == 'h');
+    ASSERT_TRUE(cpu[0xD000] == 'i');
+    ASSERT_TRUE(cpu[0xD001] == ACIA_TDRE);
+
+    // Registers repeat through the page, the programmed reset clears command bits 0-4
+    cpu[0xD0F6] = 0xFF;
+    cpu[0xD0F7] = 0x1E;
+    ASSERT_TRUE(cpu[0xD002] == 0xFF);
+    ASSERT_TRUE(cpu[0xD003] == 0x1E);
+    cpu[0xD001] = 0;
+    ASSERT_TRUE(cpu[0xD002] == 0xE0);
+
+    // Nothing drains TX, what does not fit is dropped
+    for (u32 i = 0; i < 20; i++) {
+        cpu[0xD000] = (u8) i;
+    }
+    ASSERT_TRUE(acia.dropped == 4);
+    ASSERT_TRUE(cpu[0xD001] == 0x00);
+    u8 out[32];
+    ASSERT_TRUE(acia.take_output(out, sizeof(out)) == 16);
+    ASSERT_TRUE(out[0] == 0 && out[15] == 15);
+}
+
+TEST_F(SERIAL, GuestOutputToFile) {
+    u8 program[] = {
+        LDX_IMM, 0x00,          // 4000
+        LDA_ABX, 0x00, 0x50,    // 4002
+        BEQ_REL, 0x09,          // 4005
+        STA_ABS, 0x00, 0xD0,    // 4007
+        INX_IMP,                // 400A
+        JMP_ABS, 0x02, 0x40,    // 400B
+        INVALID_INSTRUCTION,    // 400E
+    };
+    const char message[] = "Hello, 6551!\n";
+    char path[] = "/tmp/acia-out-XXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_TRUE(fd >= 0);
+
+    Acia6551 acia(cpu);
+    acia.map(0xD0);
+    ASSERT_TRUE(acia.attach(-1, fd));
+    ASSERT_FALSE(acia.attach(-1, fd));
+    cpu.memory.load(RESET_START, program, sizeof(program));
+    cpu.memory.load(0x5000, (const u8*) message, sizeof(message));
+    ASSERT_TRUE(cpu.execute(100000) == -1);
+    acia.flush();
+    ASSERT_TRUE(read_file(path) == message);
+    acia.detach();
+    ASSERT_FALSE(acia.attached());
+    close(fd);
+    unlink(path);
+}
+
+TEST_F(SERIAL, EchoFiles) {
+    u8 program[] = {
+        LDA_ABS, 0x01, 0xD0,    // 4000 wait for RDRF
+        AND_IMM, ACIA_RDRF,     // 4003
+        BEQ_REL, 0xFB,          // 4005
+        LDA_ABS, 0x00, 0xD0,    // 4007
+        STA_ABS, 0x00, 0xD0,    // 400A
+        CMP_IMM, '.',           // 400D
+        BNE_REL, 0xF1,          // 400F
+        INVALID_INSTRUCTION,    // 4011
+    };
+    std::string text;
+    for (u32 i = 0; i < 2000; i++) {
+        text += "line " + std::to_string(i) + "\n";
+    }
+    text += ".";
+    char inPath[] = "/tmp/acia-in-XXXXXX";
+    char outPath[] = "/tmp/acia-out-XXXXXX";
+    int inFd = mkstemp(inPath);
+    int outFd = mkstemp(outPath);
+    ASSERT_TRUE(inFd >= 0 && outFd >= 0);
+    ASSERT_TRUE(write(inFd, text.data(), text.size()) == (ssize_t) text.size());
+    close(inFd);
+    close(outFd);
+
+    // Smaller than the input, so the reader waits for the guest
+    Acia6551 acia(cpu, 1, 4096);
+    acia.map(0xD0);
+    ASSERT_TRUE(acia.open(inPath, outPath));
+    cpu.memory.load(RESET_START, program, sizeof(program));
+    s32 ret = 0;
+    for (u32 i = 0; i < 100000 && ret >= 0; i++) {
+        ret = cpu.execute(100000);
+    }
+    ASSERT_TRUE(ret == -1);
+    acia.detach();
+    ASSERT_TRUE(read_file(outPath) == text);
+    unlink(inPath);
+    unlink(outPath);
+}
+
+TEST_F(SERIAL, ReceiveInterrupt) {
+    u8 program[] = {
+        LDA_IMM, 0x01,          // 4000 DTR, receive interrupt
+        STA_ABS, 0x02, 0xD0,    // 4002 cycle 2
+        CLI_IMP,                // 4005
+        JMP_ABS, 0x06, 0x40,    // 4006
+    };
+    u8 handler[] = {
+        LDA_ABS, 0x00, 0xD0,    // 5000
+        STA_ZPG, 0x10,          // 5003
+        INC_ZPG, 0x11,          // 5005
+        RTI_IMP,                // 5007
+    };
+    Acia6551 acia(cpu);
+    acia.map(0xD0);
+    cpu.memory.load(RESET_START, program, sizeof(program));
+    cpu.memory.load(0x5000, handler, sizeof(handler));
+    cpu[INT_VEC_LOC] = 0x00;
+    cpu[INT_VEC_LOC + 1] = 0x50;
+
+    ASSERT_TRUE(cpu.execute(5000) >= 5000);
+    ASSERT_TRUE(cpu[0x0011] == 0);
+    u8 input = 'x';
+    acia.give_input(&input, 1);
+    // Polled every 1000 cycles from 2, taken within a jump
+    ASSERT_TRUE(cpu.run_until(6002 + 2 + 7 + 4 + 3 + 5) >= 0);
+    ASSERT_TRUE(cpu[0x0010] == 'x');
+    ASSERT_TRUE(cpu[0x0011] == 1);
+    ASSERT_FALSE(cpu.irq_asserted());
+    ASSERT_TRUE(cpu.execute(5000) >= 5000);
+    ASSERT_TRUE(cpu[0x0011] == 1);
+}
+
+TEST_F(SERIAL, TransmitInterruptAfterDrain) {
+    u8 program[] = {
+        SEI_IMP,                // 4000
+        JMP_ABS, 0x01, 0x40,    // 4001
+    };
+    Acia6551 acia(cpu, 1, 16);
+    acia.map(0xD0);
+    cpu.memory.load(RESET_START, program, sizeof(program));
+    // DTR, transmit interrupt only
+    cpu[0xD002] = 0x07;
+    ASSERT_TRUE(cpu.irq_asserted());
+    for (u32 i = 0; i < 16; i++) {
+        cpu[0xD000] = (u8) i;
+    }
+    ASSERT_FALSE(cpu.irq_asserted());
+    u8 out[16];
+    ASSERT_TRUE(acia.take_output(out, sizeof(out)) == 16);
+    // Drained behind the guest's back, seen at the next poll
+    ASSERT_TRUE(cpu.execute(2000) >= 2000);
+    ASSERT_TRUE(cpu.irq_asserted());
+}
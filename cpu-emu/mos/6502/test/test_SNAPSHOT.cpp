@@ -0,0 +1,207 @@
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include "mos6502.hpp"
+#include "via6522.hpp"
+#include "models.hpp"
+#include "test.hpp"
+
+using namespace mos6502;
+
+
+TEST_F(SNAPSHOT, ForkCopiesWrittenPages) {
+    // Every kind of guest write, each to its own page
+    u8 program[] = {
+        LDA_IMM, 0x11,
+        STA_ABS, 0x00, 0x20,
+        INC_ZPG, 0x10,
+        ASL_ABS, 0x00, 0x30,
+        PHA_IMP,
+        JMP_ABS, 0x0B, 0x40,
+    };
+    for (u32 i = 0; i < sizeof(program); ++i) {
+        cpu[RESET_START + i] = program[i];
+    }
+    cpu[0x0010] = 0x05;
+    cpu[0x3000] = 0x40;
+
+    for (u32 i = 0; i < 3; ++i) {
+        CPU child = cpu.fork();
+        ASSERT_TRUE(child.execute(2 + 4 + 5 + 6 + 3) == 2 + 4 + 5 + 6 + 3);
+        ASSERT_TRUE(child[0x2000] == 0x11);
+        ASSERT_TRUE(child[0x0010] == 0x06);
+        ASSERT_TRUE(child[0x3000] == 0x80);
+        ASSERT_TRUE(child[0x01FF] == 0x11);
+        for (u8 page : { 0x00, 0x01, 0x20, 0x30 }) {
+            ASSERT_FALSE(child.memory.is_shared(page));
+        }
+        ASSERT_TRUE(child.memory.is_shared(0x40));
+        ASSERT_TRUE(child.memory.page_memory(0x50) == cpu.memory.page_memory(0x50));
+
+        ASSERT_TRUE(cpu[0x2000] == 0x00);
+        ASSERT_TRUE(cpu[0x0010] == 0x05);
+        ASSERT_TRUE(cpu[0x3000] == 0x40);
+        ASSERT_TRUE(cpu[0x01FF] == 0x00);
+    }
+
+    // The parent runs on its own shared pages the same way
+    ASSERT_TRUE(cpu.execute(2 + 4) == 2 + 4);
+    ASSERT_TRUE(cpu[0x2000] == 0x11);
+    ASSERT_FALSE(cpu.memory.is_shared(0x20));
+}
+
+TEST_F(SNAPSHOT, BranchesFromSnapshot) {
+    cpu[0x0300] = 0xAA;
+    cpu.X = 0x42;
+    Snapshot snapshot = cpu.snapshot();
+
+    // Host writes after the snapshot are private too
+    cpu[0x0300] = 0xBB;
+    std::vector<CPU> branches;
+    for (u32 i = 0; i < 8; ++i) {
+        branches.push_back(*snapshot);
+        branches.back()[0x0301] = (u8) i;
+    }
+    for (u32 i = 0; i < branches.size(); ++i) {
+        ASSERT_TRUE(branches[i].X == 0x42);
+        ASSERT_TRUE(branches[i][0x0300] == 0xAA);
+        ASSERT_TRUE(branches[i][0x0301] == i);
+    }
+    ASSERT_TRUE((*snapshot)[0x0300] == 0xAA);
+    ASSERT_TRUE((*snapshot)[0x0301] == 0x00);
+    ASSERT_TRUE(cpu[0x0300] == 0xBB);
+
+    // Reset leaves the snapshot alone
+    branches[0].reset();
+    ASSERT_TRUE(branches[0][0x0300] == 0x00);
+    ASSERT_FALSE(branches[0].memory.is_shared(0x03));
+    ASSERT_TRUE((*snapshot)[0x0300] == 0xAA);
+}
+
+TEST_F(SNAPSHOT, ResetClearsDirtyPages) {
+    u8 program[] = {
+        LDA_IMM, 0x11,
+        STA_ABS, 0x00, 0x20,
+        STA_ZPX, 0x10,
+        JMP_ABS, 0x07, 0x40,
+    };
+    cpu.memory.load(RESET_START, program, sizeof(program));
+    cpu.reset();
+    cpu.memory.load(RESET_START, program, sizeof(program));
+    ASSERT_TRUE(cpu.execute(2 + 4 + 4) == 2 + 4 + 4);
+    ASSERT_TRUE(cpu.memory.dirty_pages()[0x00]);
+    ASSERT_TRUE(cpu.memory.dirty_pages()[0x20]);
+    ASSERT_TRUE(cpu.memory.dirty_pages()[0x40]);
+    ASSERT_FALSE(cpu.memory.dirty_pages()[0x30]);
+
+    cpu.reset();
+    ASSERT_TRUE(cpu[0x2000] == 0x00);
+    ASSERT_TRUE(cpu[0x0010] == 0x00);
+    ASSERT_TRUE(cpu[RESET_START] == 0x00);
+    ASSERT_FALSE(cpu.memory.dirty_pages()[0x20]);
+    ASSERT_TRUE(cpu.PC == RESET_START);
+}
+
+TEST_F(SNAPSHOT, RestoreRedoesDirtyPages) {
+    u8 program[] = {
+        INC_ABS, 0x00, 0x20,
+        LDX_ABS, 0x00, 0x20,
+        TXA_IMP,
+        PHA_IMP,
+        JMP_ABS, 0x08, 0x40,
+    };
+    cpu.memory.load(RESET_START, program, sizeof(program));
+    cpu[0x2000] = 0x41;
+    Snapshot snapshot = cpu.snapshot();
+
+    // The second round starts from a memory derived from the snapshot, so only dirty pages are redone
+    for (u32 round = 0; round < 3; ++round) {
+        ASSERT_TRUE(cpu.execute(6 + 4 + 2 + 3) == 6 + 4 + 2 + 3);
+        ASSERT_TRUE(cpu.X == 0x42);
+        ASSERT_TRUE(cpu[0x01FF] == 0x42);
+        ASSERT_FALSE(cpu.memory.is_shared(0x20));
+
+        cpu.restore(snapshot);
+        ASSERT_TRUE(cpu.PC == RESET_START);
+        ASSERT_TRUE(cpu.X == 0x00);
+        ASSERT_TRUE(cpu[0x2000] == 0x41);
+        ASSERT_TRUE(cpu[0x01FF] == 0x00);
+        ASSERT_TRUE(cpu.memory.is_shared(0x20));
+        ASSERT_TRUE(cpu.memory.is_shared(0x01));
+    }
+
+    // Restoring into an unrelated CPU takes the whole map
+    CPU other;
+    other.engine = cpu.engine;
+    other.jitThreshold = cpu.jitThreshold;
+    other.reset();
+    other[0x3000] = 0x99;
+    other.restore(snapshot);
+    ASSERT_TRUE(other[0x3000] == 0x00);
+    ASSERT_TRUE(other.execute(6 + 4) == 6 + 4);
+    ASSERT_TRUE(other.X == 0x42);
+}
+
+TEST_F(SNAPSHOT, RestoreStartsTheTimelineOver) {
+    u8 program[] = {
+        LDA_IMM, 0x11,          // 4000
+        STA_ZPG, 0x10,          // 4002
+        JMP_ABS, 0x04, 0x40,    // 4004
+    };
+    Via6522 via(cpu);
+    via.map(0xD0);
+    cpu[0xD00E] = 0x80 | VIA_IRQ_T1;
+    cpu.memory.load(RESET_START, program, sizeof(program));
+    cpu.set_flag_i(1);
+    Snapshot saved = cpu.snapshot();
+
+    // Leaves an event, a held IRQ line, a device synced ahead and other code behind
+    u32 fired = 0;
+    cpu.events.schedule(300, [&](u64) { fired += 1; });
+    cpu.set_irq(true, 2);
+    cpu[RESET_START + 1] = 0x22;
+    ASSERT_TRUE(cpu.execute(200) >= 200);
+    ASSERT_TRUE(cpu[0x0010] == 0x22);
+    cpu[0xD004] = 0xFF;
+    ASSERT_TRUE(via.synced() >= 200);
+
+    cpu.restore(saved);
+    ASSERT_TRUE(cpu.cycles == 0);
+    ASSERT_TRUE(cpu.events.empty());
+    ASSERT_FALSE(cpu.irq_asserted());
+    // T1 underflows 101 cycles after this load, the VIA follows the clock back
+    cpu[0xD004] = 100;
+    cpu[0xD005] = 0;
+    ASSERT_TRUE(cpu.execute(150) >= 150);
+    ASSERT_TRUE(cpu.irq_asserted());
+    ASSERT_TRUE(fired == 0);
+    ASSERT_TRUE(cpu[0x0010] == 0x11);
+}
+
+TEST_F(SNAPSHOT, ResetToBaseline) {
+    u8 program[] = {
+        LDA_IMM, 0x77,
+        STA_ABS, 0x00, 0x20,
+        JMP_ABS, 0x05, 0x60,
+    };
+    cpu.memory.load(0x6000, program, sizeof(program));
+    cpu[RESET_VEC_LOC] = 0x00;
+    cpu[RESET_VEC_LOC + 1] = 0x60;
+    cpu[0x2000] = 0x33;
+    cpu.baseline = cpu.snapshot();
+
+    for (u32 round = 0; round < 3; ++round) {
+        cpu.reset();
+        ASSERT_TRUE(cpu.PC == 0x6000);
+        ASSERT_TRUE(cpu[0x2000] == 0x33);
+        ASSERT_TRUE(cpu.execute(2 + 4) == 2 + 4);
+        ASSERT_TRUE(cpu[0x2000] == 0x77);
+    }
+
+    cpu.baseline.reset();
+    cpu.reset();
+    ASSERT_TRUE(cpu.PC == RESET_START);
+    ASSERT_TRUE(cpu[0x6000] == 0x00);
+    ASSERT_TRUE(cpu[0x2000] == 0x00);
+}
@@ -0,0 +1,232 @@
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include "mos6502.hpp"
+#include "via6522.hpp"
+#include "models.hpp"
+#include "test.hpp"
+
+using namespace mos6502;
+
+
+TEST_F(VIA, OneShotT1IrqTiming) {
+    u8 program[] = {
+        LDA_IMM, 0xC0,          // 4000 cycle 0
+        STA_ABS, 0x0E, 0xD0,    // 4002 cycle 2, IER T1
+        LDA_IMM, 100,           // 4005 cycle 6
+        STA_ABS, 0x04, 0xD0,    // 4007 cycle 8
+        LDA_IMM, 0x00,          // 400A cycle 12
+        STA_ABS, 0x05, 0xD0,    // 400C cycle 14, T1 = 100, underflows at 14 + 101
+        CLI_IMP,                // 400F cycle 18
+        JMP_ABS, 0x10, 0x40,    // 4010 cycle 20 + 3k
+    };
+    u8 handler[] = {
+        LDA_ABS, 0x04, 0xD0,    // 5000 clears the flag
+        STA_ZPG, 0x10,          // 5003
+        LDA_ABS, 0x05, 0xD0,    // 5005
+        STA_ZPG, 0x11,          // 5008
+        INC_ZPG, 0x12,          // 500A
+        RTI_IMP,                // 500C
+    };
+    Via6522 via(cpu);
+    via.map(0xD0);
+    cpu.memory.load(RESET_START, program, sizeof(program));
+    cpu.memory.load(0x5000, handler, sizeof(handler));
+    cpu[INT_VEC_LOC] = 0x00;
+    cpu[INT_VEC_LOC + 1] = 0x50;
+
+    // The budget is far past the underflow, the write of T1C-H cut the slice
+    ASSERT_TRUE(cpu.execute(1000) >= 1000);
+    ASSERT_TRUE(cpu[0x0012] == 1);
+    // Taken at the jump at 116, handler from 123: T1C-L read at 123 and T1C-H at 130
+    ASSERT_TRUE(cpu[0x0010] == (u8) (100 - (123 - 14)));
+    ASSERT_TRUE(cpu[0x0011] == 0xFF);
+    ASSERT_FALSE(cpu.irq_asserted());
+    ASSERT_TRUE(cpu.S == 0xFF);
+    // One-shot, no further interrupt
+    ASSERT_TRUE(cpu.execute(200000) >= 200000);
+    ASSERT_TRUE(cpu[0x0012] == 1);
+}
+
+TEST_F(VIA, FreeRunningT1) {
+    u8 program[] = {
+        LDA_IMM, 0xC0,          // 4000 cycle 0
+        STA_ABS, 0x0B, 0x9F,    // 4002 cycle 2, ACR free-running, PB7 out
+        STA_ABS, 0x0E, 0x9F,    // 4005 cycle 6, IER T1
+        LDA_IMM, 0xE6,          // 4008 cycle 10
+        STA_ABS, 0x04, 0x9F,    // 400A cycle 12
+        LDA_IMM, 0x03,          // 400D cycle 16
+        STA_ABS, 0x05, 0x9F,    // 400F cycle 18, T1 = 998, underflows at 18 + 999 + 1000k
+        CLI_IMP,                // 4012 cycle 22
+        JMP_ABS, 0x13, 0x40,    // 4013
+    };
+    u8 handler[] = {
+        INC_ZPG, 0x20,          // 5000
+        LDA_ABS, 0x04, 0x9F,    // 5002
+        RTI_IMP,                // 5005
+    };
+    Via6522 via(cpu);
+    via.map(0x9F);
+    cpu.memory.load(RESET_START, program, sizeof(program));
+    cpu.memory.load(0x5000, handler, sizeof(handler));
+    cpu[INT_VEC_LOC] = 0x00;
+    cpu[INT_VEC_LOC + 1] = 0x50;
+
+    for (u32 k = 0; k < 10; k++) {
+        u64 underflow = 18 + 999 + 1000 * k;
+        ASSERT_TRUE(cpu.run_until(underflow - 1) >= 0);
+        ASSERT_TRUE(cpu[0x0020] == k);
+        // Taken within a jump, then 7 cycles to the handler and 5 for its INC
+        ASSERT_TRUE(cpu.run_until(underflow + 2 + 7 + 5) >= 0);
+        ASSERT_TRUE(cpu[0x0020] == k + 1);
+        ASSERT_TRUE(((via.port_b() & 0x80) != 0) == (k % 2 == 0));
+    }
+}
+
+// T2 loaded with n at cycle 8, IFR read at 12 and 19, on a CPU of its own
+static std::vector<u8> t2_flags(u8 n) {
+    u8 program[] = {
+        LDA_IMM, n,             // 4000 cycle 0
+        STA_ABS, 0x08, 0xD0,    // 4002 cycle 2
+        LDA_IMM, 0x00,          // 4005 cycle 6
+        STA_ABS, 0x09, 0xD0,    // 4007 cycle 8
+        LDA_ABS, 0x0D, 0xD0,    // 400A cycle 12
+        STA_ZPG, 0x10,          // 400D cycle 16
+        LDA_ABS, 0x0D, 0xD0,    // 400F cycle 19
+        STA_ZPG, 0x11,          // 4012 cycle 23
+        LDA_ABS, 0x08, 0xD0,    // 4014 cycle 26, clears the flag
+        STA_ZPG, 0x12,          // 4017 cycle 30
+        LDA_ABS, 0x0D, 0xD0,    // 4019 cycle 33
+        STA_ZPG, 0x13,          // 401C
+        INVALID_INSTRUCTION,    // 401E
+    };
+    CPU cpu;
+    cpu.reset();
+    cpu.engine = TEST_ENGINE;
+    cpu.jitThreshold = TEST_JIT_THRESHOLD;
+    Via6522 via(cpu);
+    via.map(0xD0);
+    cpu.memory.load(RESET_START, program, sizeof(program));
+    cpu.execute(1000);
+    // Not enabled, so no IRQ bit and no interrupt
+    EXPECT_FALSE(cpu.irq_asserted());
+    return { cpu[0x0010], cpu[0x0011], cpu[0x0012], cpu[0x0013] };
+}
+
+TEST_F(VIA, T2FlagTiming) {
+    // Set n + 1 cycles after the write
+    std::vector<u8> flags = t2_flags(10);
+    ASSERT_TRUE(flags[0] == 0x00);
+    ASSERT_TRUE(flags[1] == VIA_IRQ_T2);
+    ASSERT_TRUE(flags[2] == (u8) (10 - (26 - 8)));
+    ASSERT_TRUE(flags[3] == 0x00);
+
+    flags = t2_flags(11);
+    ASSERT_TRUE(flags[1] == 0x00);
+}
+
+TEST_F(VIA, InterruptRegisters) {
+    Via6522 via(cpu);
+    via.map(0xD0);
+    ASSERT_TRUE(cpu[0xD00E] == 0x80);
+    cpu[0xD00E] = 0x80 | VIA_IRQ_CA1 | VIA_IRQ_T2;
+    ASSERT_TRUE(cpu[0xD00E] == (0x80 | VIA_IRQ_CA1 | VIA_IRQ_T2));
+    cpu[0xD00E] = VIA_IRQ_T2;
+    ASSERT_TRUE(cpu[0xD00E] == (0x80 | VIA_IRQ_CA1));
+
+    // CA1 on its negative edge by default
+    via.set_ca1(false);
+    ASSERT_TRUE(cpu[0xD00D] == (VIA_IRQ_ANY | VIA_IRQ_CA1));
+    ASSERT_TRUE(cpu.irq_asserted());
+    // No handshake register keeps it
+    ASSERT_TRUE(cpu[0xD00F] == 0xFF);
+    ASSERT_TRUE(cpu.irq_asserted());
+    (void) (u8) cpu[0xD001];
+    ASSERT_FALSE(cpu.irq_asserted());
+
+    // Flags of disabled sources are set but do not interrupt, writing 1 clears them
+    cpu[0xD00C] = 0x01;
+    via.set_ca1(true);
+    cpu[0xD00E] = 0x7F;
+    ASSERT_TRUE(cpu[0xD00D] == VIA_IRQ_CA1);
+    ASSERT_FALSE(cpu.irq_asserted());
+    cpu[0xD00D] = VIA_IRQ_CA1;
+    ASSERT_TRUE(cpu[0xD00D] == 0x00);
+}
+
+TEST_F(VIA, Ports) {
+    Via6522 via(cpu);
+    via.map(0xD0);
+    via.set_port_b(0x30);
+    cpu[0xD002] = 0x0F;
+    cpu[0xD000] = 0xA5;
+    ASSERT_TRUE(cpu[0xD000] == 0x35);
+    ASSERT_TRUE(via.port_b() == 0x35);
+
+    // Port A latched on CA1
+    cpu[0xD00B] = 0x01;
+    via.set_port_a(0x12);
+    via.set_ca1(false);
+    via.set_port_a(0x34);
+    ASSERT_TRUE(cpu[0xD00F] == 0x12);
+    cpu[0xD00B] = 0x00;
+    ASSERT_TRUE(cpu[0xD00F] == 0x34);
+}
+
+TEST_F(VIA, ShiftOutUnderPhi2) {
+    u8 program[] = {
+        LDA_IMM, 0x18,          // 4000 cycle 0, shift out under phi2
+        STA_ABS, 0x0B, 0xD0,    // 4002 cycle 2
+        LDA_IMM, 0x84,          // 4005 cycle 6
+        STA_ABS, 0x0E, 0xD0,    // 4007 cycle 8, IER SR
+        LDA_IMM, 0x81,          // 400A cycle 12
+        STA_ABS, 0x0A, 0xD0,    // 400C cycle 14, 8 bits in 16 cycles
+        LDA_ABS, 0x0D, 0xD0,    // 400F cycle 18
+        STA_ZPG, 0x10,          // 4012 cycle 22
+        JMP_ABS, 0x14, 0x40,    // 4014 cycle 25 + 3k
+    };
+    Via6522 via(cpu);
+    via.map(0xD0);
+    std::vector<u8> sent;
+    via.onShiftOut = [&](u8 byte) { sent.push_back(byte); };
+    cpu.memory.load(RESET_START, program, sizeof(program));
+    cpu.set_flag_i(1);
+
+    ASSERT_TRUE(cpu.run_until(29) >= 0);
+    ASSERT_TRUE(cpu[0x0010] == 0x00);
+    ASSERT_TRUE(sent.empty());
+    ASSERT_FALSE(cpu.irq_asserted());
+    // Done at 30, the event runs after the jump at 31
+    ASSERT_TRUE(cpu.run_until(32) >= 0);
+    ASSERT_TRUE(sent.size() == 1);
+    ASSERT_TRUE(sent[0] == 0x81);
+    ASSERT_TRUE(cpu.irq_asserted());
+    // Shifted out round to where it started
+    ASSERT_TRUE(cpu[0xD00A] == 0x81);
+    ASSERT_FALSE(cpu.irq_asserted());
+}
+
+TEST_F(VIA, ShiftKeepsClockAcrossAcrWrites) {
+    u8 program[] = {
+        LDA_IMM, 0x08,          // 4000 cycle 0
+        STA_ABS, 0x08, 0xD0,    // 4002 cycle 2, T2 latch: a bit every 20 cycles
+        LDA_IMM, 0x14,          // 4005 cycle 6, shift out under T2
+        STA_ABS, 0x0B, 0xD0,    // 4007 cycle 8
+        LDA_IMM, 0x81,          // 400A cycle 12
+        STA_ABS, 0x0A, 0xD0,    // 400C cycle 14, 8 bits in 160 cycles
+        LDA_IMM, 0x15,          // 400F cycle 18
+        STA_ABS, 0x0B, 0xD0,    // 4011 cycle 20, PA latching only, mid bit
+        JMP_ABS, 0x14, 0x40,    // 4014 cycle 24 + 3k
+    };
+    Via6522 via(cpu);
+    via.map(0xD0);
+    cpu.memory.load(RESET_START, program, sizeof(program));
+    cpu.set_flag_i(1);
+
+    ASSERT_TRUE(cpu.run_until(170) >= 0);
+    ASSERT_FALSE(cpu[0xD00D] & VIA_IRQ_SR);
+    // Done at 174 as if ACR had not been written
+    ASSERT_TRUE(cpu.run_until(176) >= 0);
+    ASSERT_TRUE(cpu[0xD00D] & VIA_IRQ_SR);
+}
@@ -0,0 +1,189 @@
+/*
+Ahead-of-time translator of a 6502 ROM image to C++
+
+    aot-6502 <image> <output.cpp> [entry ...]
+
+The image is placed so it ends at 0xFFFF (a full 64 KiB image covers all memory). Code is found
+statically from the reset, IRQ and NMI vectors and the extra entry points, following branches,
+JMP absolute and JSR. Blocks have the boundaries CPU::decode_block gives them, each becomes a
+function calling the decoded handlers with constant operands. Compile the output into a shared
+object with this library's headers and load it with AotModule.
+*/
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <vector>
+
+#include "mos6502.hpp"
+#include "aot.hpp"
+
+using namespace mos6502;
+
+
+struct StaticBlock {
+    u16 start;
+    u16 next;
+    std::vector<u8> opcodes;
+    std::vector<u16> operands;
+};
+
+// Same boundaries as CPU::decode_block, false for blocks that can not be translated
+static bool decode(const u8* image, u16 pc, StaticBlock& block) {
+    block.start = pc;
+    while (block.opcodes.size() < BlockCache::MAX_INSTRS) {
+        u8 opcode = image[pc];
+        if (DECODED_HANDLERS[opcode] == nullptr) {
+            break;
+        }
+        u8 numBytes = operand_bytes(INSTR_GET_ADDR_MODE[opcode]);
+        u16 operand = 0;
+        if (numBytes >= 1) { operand = image[(u16) (pc + 1)]; }
+        if (numBytes == 2) { operand = B2W((u8) operand, image[(u16) (pc + 2)]); }
+        block.opcodes.push_back(opcode);
+        block.operands.push_back(operand);
+        if ((u32) pc + 1 + numBytes > 0xFFFF) {
+            return false;   // Wraps around memory
+        }
+        pc += 1 + numBytes;
+        if (INSTR_BYTES[opcode] == 0) {
+            break;
+        }
+    }
+    block.next = pc;
+    return !block.opcodes.empty();
+}
+
+// Blocks the CPU can continue with after this one
+static std::vector<u16> successors(const StaticBlock& block) {
+    u8 opcode = block.opcodes.back();
+    u16 operand = block.operands.back();
+    u16 pc = block.next - 1 - operand_bytes(INSTR_GET_ADDR_MODE[opcode]);
+    if (INSTR_BYTES[opcode] != 0) {
+        return { block.next };  // Ended at the instruction limit
+    }
+    switch (instr_operation(opcode)) {
+        case OP_BCC: case OP_BCS: case OP_BEQ: case OP_BMI: case OP_BNE: case OP_BPL: case OP_BVC: case OP_BVS:
+            return { (u16) (pc + (s8) operand), (u16) (pc + 2) };
+        case OP_JMP:
+            if (INSTR_GET_ADDR_MODE[opcode] == ABS) { return { operand }; }
+            return {};  // Indirect, pointer may be in RAM
+        case OP_JSR: {
+            // Where RTS lands with the return address JSR pushes
+            u16 addrOnStack = pc + 2;
+            return { operand, (u16) (B2W(lowByte(addrOnStack), highByte(addrOnStack)) + 1) };
+        }
+        default:
+            return {};  // BRK goes to the interrupt vector (an entry), RTS / RTI are not known statically
+    }
+}
+
+static bool writes_memory(u8 opcode) {
+    switch (instr_operation(opcode)) {
+        case OP_STA: case OP_STX: case OP_STY: case OP_INC: case OP_DEC: case OP_PHA: case OP_PHP:
+        case OP_JSR: case OP_BRK:
+            return true;
+        case OP_ASL: case OP_LSR: case OP_ROL: case OP_ROR:
+            return INSTR_GET_ADDR_MODE[opcode] != ACC;
+        default:
+            return false;
+    }
+}
+
+static void emit_block(FILE* out, const StaticBlock& block) {
+    bool checks = false;
+    for (u32 i = 0; i + 1 < block.opcodes.size(); ++i) {
+        checks |= writes_memory(block.opcodes[i]);
+    }
+    fprintf(out, "u32 block_%04X(CPU* cpu, const Block*%s) {\n", block.start, checks ? " block" : "");
+    for (u32 i = 0; i < block.opcodes.size(); ++i) {
+        fprintf(out, "    CPU::decoded_handler<0x%02X>(*cpu, 0x%04X);\n", block.opcodes[i], block.operands[i]);
+        // Stop like the interpreter when the block wrote to itself
+        if (i + 1 < block.opcodes.size() && writes_memory(block.opcodes[i])) {
+            fprintf(out, "    if (!block->valid) { return 0; }\n");
+        }
+    }
+    fprintf(out, "    return 0;\n}\n\n");
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s <image> <output.cpp> [entry ...]\n", argv[0]);
+        return 1;
+    }
+    FILE* in = fopen(argv[1], "rb");
+    if (in == nullptr) {
+        fprintf(stderr, "Cannot open %s\n", argv[1]);
+        return 1;
+    }
+    std::vector<u8> file(MEM_MAX + 1);
+    size_t size = fread(file.data(), 1, file.size(), in);
+    fclose(in);
+    if (size == 0 || size > MEM_MAX) {
+        fprintf(stderr, "%s: image must be 1 to %u bytes\n", argv[1], MEM_MAX);
+        return 1;
+    }
+    std::vector<u8> image(MEM_MAX, 0);
+    std::copy(file.begin(), file.begin() + size, image.begin() + (MEM_MAX - size));
+
+    std::vector<u16> work = {
+        B2W(image[RESET_VEC_LOC], image[RESET_VEC_LOC + 1]),
+        B2W(image[INT_VEC_LOC], image[INT_VEC_LOC + 1]),
+        B2W(image[NON_MASK_INT_VEC_LOC], image[NON_MASK_INT_VEC_LOC + 1]),
+    };
+    for (int i = 3; i < argc; ++i) {
+        work.push_back((u16) strtoul(argv[i], nullptr, 0));
+    }
+    std::map<u16, StaticBlock> blocks;
+    std::vector<u16> untranslated;
+    while (!work.empty()) {
+        u16 pc = work.back();
+        work.pop_back();
+        if (blocks.count(pc) != 0) {
+            continue;
+        }
+        StaticBlock block;
+        if (!decode(image.data(), pc, block)) {
+            untranslated.push_back(pc);
+            blocks[pc].opcodes.clear();    // Visited, dropped below
+            continue;
+        }
+        for (u16 next : successors(block)) {
+            work.push_back(next);
+        }
+        blocks[pc] = block;
+    }
+
+    FILE* out = fopen(argv[2], "w");
+    if (out == nullptr) {
+        fprintf(stderr, "Cannot open %s\n", argv[2]);
+        return 1;
+    }
+    fprintf(out, "// Generated by aot-6502 from %s, do not edit\n\n", argv[1]);
+    fprintf(out, "#include \"mos6502.hpp\"\n#include \"aot.hpp\"\n\nusing namespace mos6502;\n\nnamespace {\n\n");
+    u32 numBlocks = 0;
+    for (const auto& entry : blocks) {
+        if (!entry.second.opcodes.empty()) {
+            emit_block(out, entry.second);
+            numBlocks += 1;
+        }
+    }
+    fprintf(out, "const AotBlock BLOCKS[%u] = {\n", std::max(numBlocks, 1u));
+    for (const auto& entry : blocks) {
+        if (!entry.second.opcodes.empty()) {
+            fprintf(out, "    { 0x%04X, 0x%04X, block_%04X },\n", entry.second.start, entry.second.next, entry.first);
+        }
+    }
+    fprintf(out, "};\n\nconst u8 IMAGE[MEM_MAX] = {");
+    for (u32 addr = 0; addr < MEM_MAX; ++addr) {
+        fprintf(out, "%s0x%02X,", (addr % 16 == 0) ? "\n    " : " ", image[addr]);
+    }
+    fprintf(out, "\n};\n\n}\n\n");
+    fprintf(out, "extern \"C\" const AotModuleInfo mos6502_aot_module = { AOT_VERSION, sizeof(CPU), %u, BLOCKS, IMAGE };\n",
+            numBlocks);
+    fclose(out);
+
+    printf("%u blocks translated, %zu entry points left to the interpreter\n", numBlocks, untranslated.size());
+    return 0;
+}
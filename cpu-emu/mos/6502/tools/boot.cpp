@@ -0,0 +1,99 @@
+/*
+Runs a 6502 image through its initialization and saves the state it reaches
+
+    boot-6502 <image> <output.state> [--pc addr] [--cycles n] [--engine name] [--compressed]
+
+The image is loaded with ImageLoader: Intel HEX (.hex), PRG (.prg) or raw placed so it ends at
+0xFFFF like for aot-6502. It runs from its reset vector until PC is addr (checked before every
+instruction) or n cycles ran, whichever comes first. At least one of them must be given.
+Without --pc the program runs on the engine given (switch by default), with it one instruction
+at a time. The state is saved with SaveState, jobs start from it with SaveState::load and
+Job::start or CPU::restore instead of reset().
+*/
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "mos6502.hpp"
+#include "loader.hpp"
+#include "savestate.hpp"
+
+using namespace mos6502;
+
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s <image> <output.state> [--pc addr] [--cycles n] [--engine name] [--compressed]\n",
+                argv[0]);
+        return 1;
+    }
+    bool stopAtPC = false;
+    u16 stopPC = 0;
+    s64 maxCycles = -1;
+    Engine engine = ENGINE_SWITCH;
+    SaveFormat format = SAVE_RAW;
+    for (int i = 3; i < argc; ++i) {
+        if (strcmp(argv[i], "--pc") == 0 && i + 1 < argc) {
+            stopAtPC = true;
+            stopPC = (u16) strtoul(argv[++i], nullptr, 0);
+        } else if (strcmp(argv[i], "--cycles") == 0 && i + 1 < argc) {
+            maxCycles = strtoll(argv[++i], nullptr, 0);
+        } else if (strcmp(argv[i], "--engine") == 0 && i + 1 < argc) {
+            if (!engine_from_name(argv[++i], engine)) {
+                fprintf(stderr, "Unknown engine %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--compressed") == 0) {
+            format = SAVE_COMPRESSED;
+        } else {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (!stopAtPC && maxCycles < 0) {
+        fprintf(stderr, "Give --pc, --cycles or both\n");
+        return 1;
+    }
+    if (maxCycles < 0) {
+        maxCycles = INT64_MAX;
+    }
+
+    CPU cpu;
+    cpu.engine = engine;
+    cpu.reset();
+    ImageLoader loader;
+    if (!loader.load(cpu, argv[1])) {
+        fprintf(stderr, "%s\n", loader.error().c_str());
+        return 1;
+    }
+
+    s64 executed = 0;
+    if (stopAtPC) {
+        executed = cpu.run_to(stopPC, maxCycles);
+    } else {
+        while (executed < maxCycles) {
+            s32 ret = cpu.execute((s32) std::min<s64>(maxCycles - executed, 1 << 30));
+            if (ret < 0) {
+                executed = -1;
+                break;
+            }
+            executed += ret;
+        }
+    }
+    if (executed < 0) {
+        fprintf(stderr, "Illegal instruction at PC $%04X\n", cpu.PC);
+        return 1;
+    }
+    if (stopAtPC && cpu.PC != stopPC) {
+        fprintf(stderr, "PC $%04X not reached in %lld cycles\n", stopPC, (long long) executed);
+        return 1;
+    }
+    if (!SaveState::save(cpu, argv[2], format)) {
+        fprintf(stderr, "Cannot write %s\n", argv[2]);
+        return 1;
+    }
+    printf("Saved state at PC $%04X after %lld cycles\n", cpu.PC, (long long) executed);
+    return 0;
+}